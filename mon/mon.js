@@ -95,11 +95,26 @@ const etcd_tree = {
             client_queue_depth: 128, // unused
             recovery_queue_depth: 4,
             recovery_sync_batch: 16,
+            // QoS token buckets, 0 = unlimited. recovery = degraded objects, rebalance = misplaced objects
+            qos_client_iops: 0,
+            qos_client_mbs: 0,
+            qos_recovery_iops: 0,
+            qos_recovery_mbs: 0,
+            qos_rebalance_iops: 0,
+            qos_rebalance_mbs: 0,
+            peering_list_chunk: 65536, // max clean objects per listing request during peering, 0 = unlimited
             readonly: false,
             no_recovery: false,
             no_rebalance: false,
             print_stats_interval: 3,
             slow_log_interval: 10,
+            fixed_buffer_count: 0, // block_size buffers for received write data registered in io_uring, 0 = off
+            // io_uring submission: kernel SQ polling thread (Linux 5.11+) with idle time in ms
+            // and CPU affinity, and one submit per event loop iteration. command line only
+            io_sqpoll: false,
+            io_sqpoll_idle: 1000,
+            io_sqpoll_cpu: null,
+            io_batch_submit: false,
             // blockstore - fixed in superblock
             block_size,
             disk_alignment,
@@ -122,8 +137,14 @@ const etcd_tree = {
             max_write_iodepth,
             min_flusher_count: 1,
             max_flusher_count: 256,
+            flusher_sort_window: 0, // flush objects in data location order among this many queued ones (for HDD)
+            flusher_adaptive: false, // tune flusher count from journal fill and disk latency, and throttle small writes to the measured disk capacity (up to throttle_target_*)
             inmemory_metadata,
+            register_buffers: false, // register journal and metadata buffers in io_uring (needs RLIMIT_MEMLOCK)
+            meta_init_iodepth: 4, // parallel metadata reads of meta_buf_size bytes during OSD startup
+            lazy_meta_load: false, // replay the journal and serve reads of journaled objects before loading metadata
             inmemory_journal,
+            journal_init_iodepth: 4, // parallel journal reads of 4 MB during OSD startup
             journal_sector_buffer_count,
             journal_no_same_sector_overwrites,
         }, */
@@ -137,10 +158,11 @@ const etcd_tree = {
             <id>: {
                 name: 'testpool',
                 // jerasure uses Reed-Solomon-Vandermonde codes
-                scheme: 'replicated' | 'xor' | 'jerasure',
+                // ec uses built-in SIMD Reed-Solomon-Vandermonde codes (incompatible with jerasure)
+                scheme: 'replicated' | 'xor' | 'jerasure' | 'ec',
                 pg_size: 3,
                 pg_minsize: 2,
-                // number of parity chunks, required for jerasure
+                // number of parity chunks, required for jerasure and ec
                 parity_chunks?: 1,
                 pg_count: 100,
                 failure_domain: 'host',
@@ -177,6 +199,14 @@ const etcd_tree = {
                     parent_pool?: <pool_id>,
                     parent_id?: <inode_t>,
                     readonly?: boolean,
+                    qos?: {
+                        read_iops?: uint64_t,
+                        write_iops?: uint64_t,
+                        read_mbs?: uint64_t,
+                        write_mbs?: uint64_t,
+                        burst_iops?: uint64_t,
+                        burst_mbs?: uint64_t,
+                    },
                 }
             }
         }, */
@@ -967,14 +997,15 @@ class Mon
                 console.log('Pool ID '+pool_id+' is invalid');
             return false;
         }
-        if (pool_cfg.scheme !== 'xor' && pool_cfg.scheme !== 'replicated' && pool_cfg.scheme !== 'jerasure')
+        if (pool_cfg.scheme !== 'xor' && pool_cfg.scheme !== 'replicated' &&
+            pool_cfg.scheme !== 'jerasure' && pool_cfg.scheme !== 'ec')
         {
             if (warn)
-                console.log('Pool '+pool_id+' has invalid coding scheme (one of "xor", "replicated" and "jerasure" required)');
+                console.log('Pool '+pool_id+' has invalid coding scheme (one of "xor", "replicated", "jerasure" and "ec" required)');
             return false;
         }
         if (!pool_cfg.pg_size || pool_cfg.pg_size < 1 || pool_cfg.pg_size > 256 ||
-            (pool_cfg.scheme === 'xor' || pool_cfg.scheme == 'jerasure') && pool_cfg.pg_size < 3)
+            (pool_cfg.scheme === 'xor' || pool_cfg.scheme == 'jerasure' || pool_cfg.scheme == 'ec') && pool_cfg.pg_size < 3)
         {
             if (warn)
                 console.log('Pool '+pool_id+' has invalid pg_size');
@@ -993,7 +1024,7 @@ class Mon
                 console.log('Pool '+pool_id+' has invalid parity_chunks (must be 1)');
             return false;
         }
-        if (pool_cfg.scheme === 'jerasure' && (pool_cfg.parity_chunks < 1 || pool_cfg.parity_chunks > pool_cfg.pg_size-2))
+        if ((pool_cfg.scheme === 'jerasure' || pool_cfg.scheme === 'ec') && (pool_cfg.parity_chunks < 1 || pool_cfg.parity_chunks > pool_cfg.pg_size-2))
         {
             if (warn)
                 console.log('Pool '+pool_id+' has invalid parity_chunks (must be between 1 and pg_size-2)');
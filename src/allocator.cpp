@@ -9,27 +9,42 @@
 
 allocator::allocator(uint64_t blocks)
 {
-    if (blocks >= 0x80000000 || blocks <= 1)
+    if (blocks <= 1)
     {
         throw std::invalid_argument("blocks");
     }
-    uint64_t p2 = 1;
+    // Calculate level sizes from the bottom and place the root level first
+    uint64_t words[ALLOCATOR_MAX_LEVELS];
+    levels = 0;
+    words[levels++] = (blocks+63) / 64;
+    while (words[levels-1] > 1)
+    {
+        words[levels] = (words[levels-1]+63) / 64;
+        levels++;
+    }
     total = 0;
-    while (p2 * 64 < blocks)
+    for (int i = 0; i < levels; i++)
     {
-        total += p2;
-        p2 = p2 * 64;
+        level_words[i] = words[levels-1-i];
+        level_offset[i] = total;
+        total += level_words[i];
     }
-    total += (blocks+63) / 64;
     mask = new uint64_t[total];
     size = free = blocks;
-    last_one_mask = (blocks % 64) == 0
-        ? UINT64_MAX
-        : ((1l << (blocks % 64)) - 1);
     for (uint64_t i = 0; i < total; i++)
     {
         mask[i] = 0;
     }
+    // Mark the tail of each level as used so it's never allocated
+    uint64_t items = blocks;
+    for (int i = levels-1; i >= 0; i--)
+    {
+        if (items % 64)
+        {
+            mask[level_offset[i] + level_words[i] - 1] = ~((1ul << (items % 64)) - 1);
+        }
+        items = level_words[i];
+    }
 }
 
 allocator::~allocator()
@@ -43,13 +58,7 @@ bool allocator::get(uint64_t addr)
     {
         return false;
     }
-    uint64_t p2 = 1, offset = 0;
-    while (p2 * 64 < size)
-    {
-        offset += p2;
-        p2 = p2 * 64;
-    }
-    return ((mask[offset + addr/64] >> (addr % 64)) & 1);
+    return ((mask[level_offset[levels-1] + addr/64] >> (addr % 64)) & 1);
 }
 
 void allocator::set(uint64_t addr, bool value)
@@ -58,84 +67,135 @@ void allocator::set(uint64_t addr, bool value)
     {
         return;
     }
-    uint64_t p2 = 1, offset = 0;
-    while (p2 * 64 < size)
+    uint64_t *leaf = &mask[level_offset[levels-1] + addr/64];
+    if (((*leaf >> (addr % 64)) & 1) == (value ? 1 : 0))
     {
-        offset += p2;
-        p2 = p2 * 64;
+        return;
     }
+    free += value ? -1 : 1;
     uint64_t cur_addr = addr;
-    bool is_last = true;
-    uint64_t value64 = value ? 1 : 0;
-    while (1)
+    for (int i = levels-1; i >= 0; i--)
     {
-        uint64_t last = offset + cur_addr/64;
-        uint64_t bit = cur_addr % 64;
-        if (((mask[last] >> bit) & 1) != value64)
+        uint64_t *word = &mask[level_offset[i] + cur_addr/64];
+        bool was_full = *word == UINT64_MAX;
+        if (value)
         {
-            if (is_last)
-            {
-                free += value ? -1 : 1;
-            }
-            if (value)
-            {
-                mask[last] = mask[last] | (1l << bit);
-                if (mask[last] != (!is_last || cur_addr/64 < size/64
-                    ? UINT64_MAX : last_one_mask))
-                {
-                    break;
-                }
-            }
-            else
-            {
-                mask[last] = mask[last] & ~(1l << bit);
-            }
-            is_last = false;
-            if (p2 > 1)
-            {
-                p2 = p2 / 64;
-                offset -= p2;
-                cur_addr /= 64;
-            }
-            else
+            *word = *word | (1ul << (cur_addr % 64));
+            if (*word != UINT64_MAX)
             {
                 break;
             }
         }
         else
         {
-            break;
+            *word = *word & ~(1ul << (cur_addr % 64));
+            if (!was_full)
+            {
+                break;
+            }
         }
+        cur_addr /= 64;
     }
 }
 
+// Descend from the non-full item <pos> of level <level> to the first free block
+inline uint64_t allocator::descend(int level, uint64_t pos)
+{
+    for (int i = level+1; i < levels; i++)
+    {
+        pos = pos*64 + __builtin_ctzll(~mask[level_offset[i] + pos]);
+    }
+    return pos;
+}
+
 uint64_t allocator::find_free()
 {
-    uint64_t p2 = 1, offset = 0, addr = 0, f, i;
-    while (p2 < size)
+    if (mask[0] == UINT64_MAX)
+    {
+        // No space
+        return UINT64_MAX;
+    }
+    return descend(0, __builtin_ctzll(~mask[0]));
+}
+
+// Find the first free block >= pos without wrapping around
+uint64_t allocator::find_next_free(uint64_t pos)
+{
+    for (int i = levels-1; i >= 0; i--)
     {
-        if (offset+addr >= total)
+        if (pos/64 >= level_words[i])
         {
             return UINT64_MAX;
         }
-        uint64_t m = mask[offset + addr];
-        for (i = 0, f = 1; i < 64; i++, f <<= 1)
+        uint64_t m = mask[level_offset[i] + pos/64] | ((1ul << (pos % 64)) - 1);
+        if (m != UINT64_MAX)
+        {
+            return descend(i, (pos & ~63ul) | __builtin_ctzll(~m));
+        }
+        // The rest of this word is full, continue with the next item of the upper level
+        pos = pos/64 + 1;
+    }
+    return UINT64_MAX;
+}
+
+// Find the first used block in [pos, limit), return limit if there is none
+uint64_t allocator::find_next_used(uint64_t pos, uint64_t limit)
+{
+    const uint64_t *leaves = mask + level_offset[levels-1];
+    while (pos < limit)
+    {
+        uint64_t m = leaves[pos/64] & ~((1ul << (pos % 64)) - 1);
+        if (m)
+        {
+            pos = (pos & ~63ul) | __builtin_ctzll(m);
+            return pos < limit ? pos : limit;
+        }
+        pos = (pos & ~63ul) + 64;
+    }
+    return limit;
+}
+
+uint64_t allocator::find_free(uint64_t hint)
+{
+    uint64_t pos = hint < size ? find_next_free(hint) : UINT64_MAX;
+    return pos != UINT64_MAX ? pos : find_free();
+}
+
+uint64_t allocator::find_free_n(uint64_t count, uint64_t hint)
+{
+    if (count <= 1)
+    {
+        return find_free(hint);
+    }
+    if (hint >= size)
+    {
+        hint = 0;
+    }
+    // First search in [hint, size), then in [0, hint+count-1)
+    for (int pass = 0; pass < 2; pass++)
+    {
+        uint64_t pos = pass == 0 ? hint : 0;
+        uint64_t to = pass == 0 || hint+count-1 > size ? size : hint+count-1;
+        while (pos < to)
         {
-            if (!(m & f))
+            pos = find_next_free(pos);
+            if (pos == UINT64_MAX || pos+count > to)
             {
                 break;
             }
+            uint64_t used = find_next_used(pos, pos+count);
+            if (used >= pos+count)
+            {
+                return pos;
+            }
+            pos = used+1;
         }
-        if (i == 64)
+        if (hint == 0)
         {
-            // No space
-            return UINT64_MAX;
+            break;
         }
-        addr = (addr * 64) | i;
-        offset += p2;
-        p2 = p2 * 64;
     }
-    return addr;
+    return UINT64_MAX;
 }
 
 uint64_t allocator::get_free_count()
@@ -5,20 +5,33 @@
 
 #include <stdint.h>
 
+#define ALLOCATOR_MAX_LEVELS 11
+
 // Hierarchical bitmap allocator
+// Each bit of an upper level is set when the corresponding 64-bit word of the lower level is full
 class allocator
 {
     uint64_t total;
     uint64_t size;
     uint64_t free;
-    uint64_t last_one_mask;
+    int levels;
+    uint64_t level_offset[ALLOCATOR_MAX_LEVELS];
+    uint64_t level_words[ALLOCATOR_MAX_LEVELS];
     uint64_t *mask;
+    uint64_t descend(int level, uint64_t pos);
+    uint64_t find_next_free(uint64_t pos);
+    uint64_t find_next_used(uint64_t pos, uint64_t limit);
 public:
     allocator(uint64_t blocks);
     ~allocator();
     bool get(uint64_t addr);
     void set(uint64_t addr, bool value);
+    // Find the first free block
     uint64_t find_free();
+    // Find the first free block starting with <hint>, wrapping around to the beginning if there is none
+    uint64_t find_free(uint64_t hint);
+    // Find <count> contiguous free blocks starting with <hint> (wrapping around), return the first of them
+    uint64_t find_free_n(uint64_t count, uint64_t hint = 0);
     uint64_t get_free_count();
 };
 
@@ -17,6 +17,7 @@
 #include "object_id.h"
 #include "ringloop.h"
 #include "timerfd_manager.h"
+#include "object_pool.h"
 
 // Memory alignment for direct I/O (usually 512 bytes)
 // All other alignments must be a multiple of this one
@@ -119,11 +120,14 @@ Output:
 Get a list of all objects in this Blockstore.
 
 Input:
-- oid.stripe = PG alignment
-- len = PG count or 0 to list all objects
-- offset = PG number
-- oid.inode = min inode number or 0 to list all inodes
-- version = max inode number or 0 to list all inodes
+- pg_alignment = PG alignment
+- pg_count = PG count or 0 to list all objects
+- pg_number = PG number
+- min_oid = min inode/stripe or 0:0 to list all objects. Listing starts from this key
+- max_oid = max inode/stripe or 0:0 to list all objects
+- list_stable_limit = max number of clean objects in the reply or 0 for no limit.
+  Objects that are only present in the journal are always listed up to the cut-off key,
+  so the reply may contain more entries. This is fine because the journal is small.
 
 Output:
 - retval = total obj_ver_id count
@@ -131,6 +135,7 @@ Output:
 - buf = obj_ver_id array allocated by the blockstore. Stable versions come first.
   You must free it yourself after usage with free().
   Output includes all objects for which (((inode + stripe / <PG alignment>) % <PG count>) == <PG number>).
+- min_oid = the key to continue listing from, or 0:0 if there are no more objects
 
 */
 
@@ -140,15 +145,34 @@ struct blockstore_op_t
     uint64_t opcode;
     // finish callback
     std::function<void (blockstore_op_t*)> callback;
-    object_id oid;
-    uint64_t version;
-    uint32_t offset;
-    uint32_t len;
+    union
+    {
+        // R/W
+        struct
+        {
+            object_id oid;
+            uint64_t version;
+            uint32_t offset;
+            uint32_t len;
+        };
+        // List
+        struct
+        {
+            object_id min_oid;
+            object_id max_oid;
+            uint64_t pg_alignment;
+            uint32_t pg_count;
+            uint32_t pg_number;
+            uint32_t list_stable_limit;
+        };
+    };
     void *buf;
     void *bitmap;
     int retval;
 
     uint8_t private_data[BS_OP_PRIVATE_DATA_SIZE];
+
+    OBJECT_POOL_OPERATORS(blockstore_op_t)
 };
 
 typedef std::unordered_map<std::string, std::string> blockstore_config_t;
@@ -167,6 +191,8 @@ public:
 
     // Returns true when blockstore is ready to process operations
     // (Although you're free to enqueue them before that)
+    // With lazy_meta_load, only reads of objects present in the journal are processed
+    // until metadata is loaded, other operations wait
     bool is_started();
 
     // Returns true when blockstore is stalled
@@ -181,6 +207,7 @@ public:
     void enqueue_op(blockstore_op_t *op);
 
     // Simplified synchronous operation: get object bitmap & current version
+    // Objects without journal entries are reported as missing until metadata is loaded
     int read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version = NULL);
 
     // Get per-inode space usage statistics
@@ -0,0 +1,223 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+// Compact clean_db for RAM-constrained OSDs, enabled with -DBLOCKSTORE_COMPACT_CLEAN_DB
+// (cmake -DWITH_COMPACT_CLEAN_DB=true).
+//
+// Objects are grouped by inode, so every entry only holds the stripe and a 32-bit data block
+// number: 12 bytes instead of 32 (object_id => clean_entry). Versions aren't kept in memory
+// at all, they're read from the in-memory copy of the metadata area instead. So the compact
+// mode requires inmemory_metadata and less than 2^32 blocks on the data device.
+//
+// The interface mimics the subset of btree_map<object_id, clean_entry> used by the blockstore.
+// Iterators return entries by value, so they can't be used to modify entries in place.
+
+#include "cpp-btree/btree_set.h"
+
+// Where to take object versions from
+struct clean_db_meta_t
+{
+    uint8_t *buffer = NULL;
+    uint64_t meta_block_size = 0, clean_entry_size = 0;
+    uint32_t block_order = 0;
+};
+
+struct __attribute__((__packed__)) compact_clean_entry
+{
+    uint64_t stripe;
+    // not a part of the key
+    mutable uint32_t block;
+};
+
+struct compact_clean_entry_less
+{
+    inline bool operator()(const compact_clean_entry & a, const compact_clean_entry & b) const
+    {
+        return a.stripe < b.stripe;
+    }
+};
+
+class blockstore_clean_db_t
+{
+public:
+    typedef btree::btree_set<compact_clean_entry, compact_clean_entry_less> stripe_set_t;
+    typedef std::map<inode_t, stripe_set_t> inode_map_t;
+    typedef std::pair<object_id, clean_entry> value_type;
+
+    class iterator
+    {
+        friend class blockstore_clean_db_t;
+        blockstore_clean_db_t *db = NULL;
+        inode_map_t::iterator inode_it;
+        stripe_set_t::iterator stripe_it;
+        value_type cur;
+
+        iterator(blockstore_clean_db_t *db, inode_map_t::iterator inode_it, stripe_set_t::iterator stripe_it):
+            db(db), inode_it(inode_it), stripe_it(stripe_it)
+        {
+            // Move to the next inode if stripe_it points to the end of the current one
+            if (inode_it != db->inodes.end() && stripe_it == inode_it->second.end())
+            {
+                this->inode_it++;
+                if (this->inode_it != db->inodes.end())
+                    this->stripe_it = this->inode_it->second.begin();
+            }
+            load();
+        }
+
+        iterator(blockstore_clean_db_t *db): db(db), inode_it(db->inodes.end())
+        {
+        }
+
+        void load()
+        {
+            if (inode_it != db->inodes.end())
+            {
+                cur.first = { .inode = inode_it->first, .stripe = stripe_it->stripe };
+                cur.second = {
+                    .version = db->get_version(stripe_it->block),
+                    .location = (uint64_t)stripe_it->block << db->meta->block_order,
+                };
+            }
+        }
+    public:
+        iterator() {}
+        value_type & operator*() { return cur; }
+        value_type* operator->() { return &cur; }
+        const value_type & operator*() const { return cur; }
+        const value_type* operator->() const { return &cur; }
+        iterator & operator++()
+        {
+            stripe_it++;
+            if (stripe_it == inode_it->second.end())
+            {
+                inode_it++;
+                if (inode_it != db->inodes.end())
+                    stripe_it = inode_it->second.begin();
+            }
+            load();
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+        bool operator==(const iterator & other) const
+        {
+            return inode_it == other.inode_it && (inode_it == db->inodes.end() || stripe_it == other.stripe_it);
+        }
+        bool operator!=(const iterator & other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    // Assigning a clean_entry to it updates the location, the version must already be in the metadata
+    class entry_ref
+    {
+        friend class blockstore_clean_db_t;
+        blockstore_clean_db_t *db;
+        object_id oid;
+        entry_ref(blockstore_clean_db_t *db, object_id oid): db(db), oid(oid) {}
+    public:
+        entry_ref & operator=(const clean_entry & e)
+        {
+            db->set(oid, e.location >> db->meta->block_order);
+            return *this;
+        }
+    };
+
+    const clean_db_meta_t *meta = NULL;
+
+    iterator begin()
+    {
+        auto inode_it = inodes.begin();
+        return inode_it == inodes.end() ? end() : iterator(this, inode_it, inode_it->second.begin());
+    }
+
+    iterator end()
+    {
+        return iterator(this);
+    }
+
+    iterator find(const object_id & oid)
+    {
+        auto inode_it = inodes.find(oid.inode);
+        if (inode_it == inodes.end())
+            return end();
+        auto stripe_it = inode_it->second.find((compact_clean_entry){ .stripe = oid.stripe });
+        if (stripe_it == inode_it->second.end())
+            return end();
+        return iterator(this, inode_it, stripe_it);
+    }
+
+    iterator lower_bound(const object_id & oid)
+    {
+        auto inode_it = inodes.lower_bound(oid.inode);
+        if (inode_it == inodes.end())
+            return end();
+        return iterator(this, inode_it, inode_it->first == oid.inode
+            ? inode_it->second.lower_bound((compact_clean_entry){ .stripe = oid.stripe })
+            : inode_it->second.begin());
+    }
+
+    iterator upper_bound(const object_id & oid)
+    {
+        auto inode_it = inodes.lower_bound(oid.inode);
+        if (inode_it == inodes.end())
+            return end();
+        return iterator(this, inode_it, inode_it->first == oid.inode
+            ? inode_it->second.upper_bound((compact_clean_entry){ .stripe = oid.stripe })
+            : inode_it->second.begin());
+    }
+
+    void erase(iterator it)
+    {
+        it.inode_it->second.erase(it.stripe_it);
+        if (!it.inode_it->second.size())
+            inodes.erase(it.inode_it);
+        count--;
+    }
+
+    entry_ref operator[](const object_id & oid)
+    {
+        return entry_ref(this, oid);
+    }
+
+    uint64_t size()
+    {
+        return count;
+    }
+
+    void swap(blockstore_clean_db_t & other)
+    {
+        inodes.swap(other.inodes);
+        std::swap(count, other.count);
+        std::swap(meta, other.meta);
+    }
+
+protected:
+    inode_map_t inodes;
+    uint64_t count = 0;
+
+    inline uint64_t get_version(uint64_t block)
+    {
+        uint64_t entries_per_block = meta->meta_block_size / meta->clean_entry_size;
+        return ((clean_disk_entry*)(meta->buffer + (block / entries_per_block)*meta->meta_block_size +
+            (block % entries_per_block)*meta->clean_entry_size))->version;
+    }
+
+    void set(const object_id & oid, uint32_t block)
+    {
+        auto & stripes = inodes[oid.inode];
+        auto ins = stripes.insert((compact_clean_entry){ .stripe = oid.stripe, .block = block });
+        if (ins.second)
+            count++;
+        else
+            ins.first->block = block;
+    }
+};
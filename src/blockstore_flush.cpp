@@ -1,6 +1,9 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+#define _XOPEN_SOURCE
+#include <limits.h>
+
 #include "blockstore_impl.h"
 
 journal_flusher_t::journal_flusher_t(blockstore_impl_t *bs)
@@ -8,6 +11,7 @@ journal_flusher_t::journal_flusher_t(blockstore_impl_t *bs)
     this->bs = bs;
     this->max_flusher_count = bs->max_flusher_count;
     this->min_flusher_count = bs->min_flusher_count;
+    this->sort_window = bs->flusher_sort_window;
     this->cur_flusher_count = bs->min_flusher_count;
     this->target_flusher_count = bs->min_flusher_count;
     dequeuing = false;
@@ -55,6 +59,23 @@ journal_flusher_co::journal_flusher_co()
         }
         wait_count--;
     };
+    data_callback_w = [this](ring_data_t* data)
+    {
+        simple_callback_w(data);
+        if (bs->flusher_adaptive)
+        {
+            // Device write latency and parallelism for the adaptive flusher. fsyncs are batched
+            // and waited for separately, so they don't affect it
+            timespec tv_end;
+            clock_gettime(CLOCK_REALTIME, &tv_end);
+            uint64_t lat_us = (tv_end.tv_sec - copy_start.tv_sec)*1000000 +
+                (tv_end.tv_nsec - copy_start.tv_nsec)/1000;
+            uint64_t par_x100 = flusher->data_writes_in_flight*100;
+            flusher->data_lat_us = flusher->data_lat_us ? (flusher->data_lat_us*7 + lat_us)/8 : lat_us;
+            flusher->data_par_x100 = flusher->data_par_x100 ? (flusher->data_par_x100*7 + par_x100)/8 : par_x100;
+            flusher->data_writes_in_flight--;
+        }
+    };
 }
 
 journal_flusher_t::~journal_flusher_t()
@@ -71,11 +92,18 @@ bool journal_flusher_t::is_active()
 
 void journal_flusher_t::loop()
 {
-    target_flusher_count = bs->write_iodepth*2;
-    if (target_flusher_count < min_flusher_count)
-        target_flusher_count = min_flusher_count;
-    else if (target_flusher_count > max_flusher_count)
-        target_flusher_count = max_flusher_count;
+    if (bs->flusher_adaptive)
+    {
+        adapt();
+    }
+    else
+    {
+        target_flusher_count = bs->write_iodepth*2;
+        if (target_flusher_count < min_flusher_count)
+            target_flusher_count = min_flusher_count;
+        else if (target_flusher_count > max_flusher_count)
+            target_flusher_count = max_flusher_count;
+    }
     if (target_flusher_count > cur_flusher_count)
         cur_flusher_count = target_flusher_count;
     else if (target_flusher_count < cur_flusher_count)
@@ -91,6 +119,64 @@ void journal_flusher_t::loop()
         co[i].loop();
 }
 
+#define FLUSHER_ADAPT_INTERVAL_US 100000
+
+// Feedback controller for flusher_adaptive, runs every FLUSHER_ADAPT_INTERVAL_US:
+// - the journal is full (someone waits for a trim) or more than half full => add 50% flushers
+// - the journal is less than 1/4 full or the data device latency is more than 2x of its
+//   baseline (the device is saturated and more flushers only queue up) => remove one flusher
+// - small write throttling uses the data device capacity measured from write latency and
+//   parallelism, limited by the configured throttle_target_iops and throttle_target_parallelism
+void journal_flusher_t::adapt()
+{
+    timespec tv_now;
+    clock_gettime(CLOCK_REALTIME, &tv_now);
+    uint64_t now_us = tv_now.tv_sec*1000000 + tv_now.tv_nsec/1000;
+    if (now_us < adapt_time_us + FLUSHER_ADAPT_INTERVAL_US)
+    {
+        return;
+    }
+    adapt_time_us = now_us;
+    uint64_t used_start = bs->journal.get_trim_pos();
+    uint64_t journal_free_space = bs->journal.next_free < used_start
+        ? (used_start - bs->journal.next_free)
+        : (bs->journal.len - bs->journal.next_free + used_start - bs->journal.block_size);
+    journal_fill_pct = 100 - journal_free_space*100/bs->journal.len;
+    // Let the baseline latency slowly follow the real one
+    if (!data_lat_min_us || data_lat_us < data_lat_min_us)
+        data_lat_min_us = data_lat_us;
+    else
+        data_lat_min_us += (data_lat_us - data_lat_min_us) / 64;
+    int target = target_flusher_count;
+    if (trim_wanted > 0 || journal_fill_pct >= 50)
+    {
+        target += target/2 > 0 ? target/2 : 1;
+    }
+    else if (journal_fill_pct < 25 || data_lat_min_us && data_lat_us > 2*data_lat_min_us)
+    {
+        target--;
+    }
+    if (target < min_flusher_count)
+        target = min_flusher_count;
+    else if (target > max_flusher_count)
+        target = max_flusher_count;
+    if (target > target_flusher_count)
+        stat_target_up++;
+    else if (target < target_flusher_count)
+        stat_target_down++;
+    target_flusher_count = target;
+    if (bs->throttle_small_writes && data_lat_us)
+    {
+        // One write takes data_lat_us with data_par_x100/100 writes in parallel.
+        // It doesn't depend on how many writes are actually submitted, unlike the write rate
+        int iops = 1000000 / data_lat_us;
+        int parallelism = (data_par_x100 + 50) / 100;
+        bs->throttle_adapted_iops = iops < 1 ? 1 : (iops > bs->throttle_target_iops ? bs->throttle_target_iops : iops);
+        bs->throttle_adapted_parallelism = parallelism < 1 ? 1
+            : (parallelism > bs->throttle_target_parallelism ? bs->throttle_target_parallelism : parallelism);
+    }
+}
+
 void journal_flusher_t::enqueue_flush(obj_ver_id ov)
 {
 #ifdef BLOCKSTORE_DEBUG
@@ -160,6 +246,13 @@ void journal_flusher_t::remove_flush(object_id oid)
     }
 }
 
+// Forget all queued objects, used when the journal is replayed again
+void journal_flusher_t::clear_queue()
+{
+    flush_queue.clear();
+    flush_versions.clear();
+}
+
 void journal_flusher_t::request_trim()
 {
     dequeuing = true;
@@ -190,8 +283,8 @@ void journal_flusher_t::dump_diagnostics()
     for (object_id cur_oid: flush_queue)
     {
         obj_ver_id cur = { .oid = cur_oid, .version = flush_versions[cur_oid] };
-        auto dirty_end = bs->dirty_db.find(cur);
-        if (dirty_end == bs->dirty_db.end())
+        auto dirty_end = bs->dirty_db_shard(cur.oid).find(cur);
+        if (dirty_end == bs->dirty_db_shard(cur.oid).end())
         {
             // Already flushed
             continue;
@@ -222,17 +315,65 @@ void journal_flusher_t::dump_diagnostics()
         break;
     }
     printf(
-        "Flusher: queued=%ld first=%s%lx:%lx trim_wanted=%d dequeuing=%d trimming=%d cur=%d target=%d active=%d syncing=%d\n",
+        "Flusher: queued=%ld first=%s%lx:%lx trim_wanted=%d dequeuing=%d trimming=%d cur=%d target=%d active=%d syncing=%d"
+        " flushed=%lu meta_writes=%lu (%.2f per object) data_writes=%lu (avg %lu bytes)\n",
         flush_queue.size(), unflushable_type, unflushable.oid.inode, unflushable.oid.stripe,
         trim_wanted, dequeuing, trimming, cur_flusher_count, target_flusher_count,
-        active_flushers, syncing_flushers
+        active_flushers, syncing_flushers, stat_flushed_objects, stat_meta_writes,
+        stat_flushed_objects ? (double)stat_meta_writes/stat_flushed_objects : 0.0,
+        stat_data_writes, stat_data_writes ? stat_data_write_bytes/stat_data_writes : 0
     );
+    if (bs->flusher_adaptive)
+    {
+        printf(
+            "Adaptive flusher: journal_fill=%d%% data_latency=%luus (baseline %luus) data_parallelism=%.2f"
+            " target_up=%lu target_down=%lu throttle_iops=%d throttle_parallelism=%d\n",
+            journal_fill_pct, data_lat_us, data_lat_min_us, data_par_x100/100.0, stat_target_up, stat_target_down,
+            bs->throttle_adapted_iops, bs->throttle_adapted_parallelism
+        );
+    }
+}
+
+void journal_flusher_t::pick_nearest()
+{
+    // Elevator: move the object located nearest after the last flushed data to the head of the queue,
+    // or the lowest located one when there's nothing after it. Objects without a clean location
+    // are treated as located at 0, so they're flushed at the beginning of every pass
+    unsigned window = flush_queue.size() < sort_window ? flush_queue.size() : sort_window;
+    int next_i = -1, first_i = -1;
+    uint64_t next_loc = UINT64_MAX, first_loc = UINT64_MAX;
+    for (unsigned i = 0; i < window; i++)
+    {
+        auto & clean_db = bs->clean_db_shard(flush_queue[i]);
+        auto clean_it = clean_db.find(flush_queue[i]);
+        uint64_t loc = clean_it != clean_db.end() ? clean_it->second.location : 0;
+        if (loc >= last_flush_loc && (next_i < 0 || loc < next_loc))
+        {
+            next_i = i;
+            next_loc = loc;
+        }
+        if (first_i < 0 || loc < first_loc)
+        {
+            first_i = i;
+            first_loc = loc;
+        }
+    }
+    if (next_i < 0)
+    {
+        next_i = first_i;
+    }
+    if (next_i > 0)
+    {
+        object_id oid = flush_queue[next_i];
+        flush_queue.erase(flush_queue.begin()+next_i);
+        flush_queue.push_front(oid);
+    }
 }
 
-bool journal_flusher_t::try_find_older(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur)
+bool journal_flusher_t::try_find_older(blockstore_dirty_db_t::iterator & dirty_end, obj_ver_id & cur)
 {
     bool found = false;
-    while (dirty_end != bs->dirty_db.begin())
+    while (dirty_end != bs->dirty_db_shard(cur.oid).begin())
     {
         dirty_end--;
         if (dirty_end->first.oid != cur.oid)
@@ -276,10 +417,6 @@ bool journal_flusher_co::loop()
         goto resume_4;
     else if (wait_state == 5)
         goto resume_5;
-    else if (wait_state == 6)
-        goto resume_6;
-    else if (wait_state == 7)
-        goto resume_7;
     else if (wait_state == 8)
         goto resume_8;
     else if (wait_state == 9)
@@ -292,8 +429,6 @@ bool journal_flusher_co::loop()
         goto resume_13;
     else if (wait_state == 14)
         goto resume_14;
-    else if (wait_state == 15)
-        goto resume_15;
     else if (wait_state == 16)
         goto resume_16;
     else if (wait_state == 17)
@@ -306,6 +441,12 @@ bool journal_flusher_co::loop()
         goto resume_20;
     else if (wait_state == 21)
         goto resume_21;
+    else if (wait_state == 22)
+        goto resume_22;
+    else if (wait_state == 23)
+        goto resume_23;
+    else if (wait_state == 24)
+        goto resume_24;
 resume_0:
     if (flusher->flush_queue.size() < flusher->min_flusher_count && !flusher->trim_wanted ||
         !flusher->flush_queue.size() || !flusher->dequeuing)
@@ -321,12 +462,16 @@ stop_flusher:
         wait_state = 0;
         return true;
     }
+    if (flusher->sort_window > 1)
+    {
+        flusher->pick_nearest();
+    }
     cur.oid = flusher->flush_queue.front();
     cur.version = flusher->flush_versions[cur.oid];
     flusher->flush_queue.pop_front();
     flusher->flush_versions.erase(cur.oid);
-    dirty_end = bs->dirty_db.find(cur);
-    if (dirty_end != bs->dirty_db.end())
+    dirty_end = bs->dirty_db_shard(cur.oid).find(cur);
+    if (dirty_end != bs->dirty_db_shard(cur.oid).end())
     {
         repeat_it = flusher->sync_to_repeat.find(cur.oid);
         if (repeat_it != flusher->sync_to_repeat.end())
@@ -371,8 +516,8 @@ stop_flusher:
                     cur.version = flusher->flush_versions[cur.oid];
                     flusher->flush_queue.pop_front();
                     flusher->flush_versions.erase(cur.oid);
-                    dirty_end = bs->dirty_db.find(cur);
-                    if (dirty_end != bs->dirty_db.end())
+                    dirty_end = bs->dirty_db_shard(cur.oid).find(cur);
+                    if (dirty_end != bs->dirty_db_shard(cur.oid).end())
                     {
                         if (dirty_end->second.journal_sector >= bs->journal.dirty_start &&
                             (bs->journal.dirty_start >= bs->journal.used_start ||
@@ -415,8 +560,11 @@ stop_flusher:
         flusher->active_flushers++;
 resume_1:
         // Find it in clean_db
-        clean_it = bs->clean_db.find(cur.oid);
-        old_clean_loc = (clean_it != bs->clean_db.end() ? clean_it->second.location : UINT64_MAX);
+        {
+            auto & clean_db = bs->clean_db_shard(cur.oid);
+            auto clean_it = clean_db.find(cur.oid);
+            old_clean_loc = (clean_it != clean_db.end() ? clean_it->second.location : UINT64_MAX);
+        }
         // Scan dirty versions of the object
         if (!scan_dirty(1))
         {
@@ -428,6 +576,7 @@ resume_1:
         if (!has_writes && !has_delete || has_delete && old_clean_loc == UINT64_MAX)
         {
             // Nothing to flush
+            find_dirty_range();
             bs->erase_dirty(dirty_start, std::next(dirty_end), clean_loc);
             goto release_oid;
         }
@@ -494,19 +643,40 @@ resume_1:
                 bitmap_set(new_clean_bitmap, clean_bitmap_offset, clean_bitmap_len, bs->bitmap_granularity);
             }
         }
+        copy_iov.clear();
         for (it = v.begin(); it != v.end(); it++)
         {
             if (new_clean_bitmap)
             {
                 bitmap_set(new_clean_bitmap, it->offset, it->len, bs->bitmap_granularity);
             }
+            copy_iov.push_back((struct iovec){ it->buf, (size_t)it->len });
+        }
+        if (bs->flusher_adaptive && v.size())
+        {
+            clock_gettime(CLOCK_REALTIME, &copy_start);
+        }
+        // Buffers are sorted by offset, so adjacent ones are written with a single writev
+        for (copy_pos = 0; copy_pos < v.size(); copy_pos = copy_end)
+        {
+            for (copy_end = copy_pos+1; copy_end < v.size() && copy_end-copy_pos < IOV_MAX &&
+                v[copy_end].offset == v[copy_end-1].offset+v[copy_end-1].len; copy_end++) {}
             await_sqe(4);
-            data->iov = (struct iovec){ it->buf, (size_t)it->len };
-            data->callback = simple_callback_w;
-            my_uring_prep_writev(
-                sqe, bs->data_fd, &data->iov, 1, bs->data_offset + clean_loc + it->offset
+            // only iov_len is checked in the callback
+            data->iov = (struct iovec){ v[copy_pos].buf, (size_t)(v[copy_end-1].offset+v[copy_end-1].len-v[copy_pos].offset) };
+            data->callback = data_callback_w;
+            bs->ringloop->prep_writev(
+                sqe, bs->data_fd, copy_iov.data()+copy_pos, copy_end-copy_pos, bs->data_offset + clean_loc + v[copy_pos].offset
             );
             wait_count++;
+            if (bs->flusher_adaptive)
+                flusher->data_writes_in_flight++;
+            flusher->stat_data_writes++;
+            flusher->stat_data_write_bytes += data->iov.iov_len;
+        }
+        if (v.size())
+        {
+            flusher->last_flush_loc = clean_loc + v.back().offset + v.back().len;
         }
         // Sync data before writing metadata
     resume_16:
@@ -534,13 +704,6 @@ resume_1:
             }
             // zero out old metadata entry
             memset(meta_old.buf + meta_old.pos*bs->clean_entry_size, 0, bs->clean_entry_size);
-            await_sqe(15);
-            data->iov = (struct iovec){ meta_old.buf, bs->meta_block_size };
-            data->callback = simple_callback_w;
-            my_uring_prep_writev(
-                sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + meta_old.sector
-            );
-            wait_count++;
         }
         if (has_delete)
         {
@@ -574,21 +737,23 @@ resume_1:
             // copy latest external bitmap/attributes
             if (bs->clean_entry_bitmap_size)
             {
+                dirty_end = bs->dirty_db_shard(cur.oid).find(cur);
                 void *bmp_ptr = bs->clean_entry_bitmap_size > sizeof(void*) ? dirty_end->second.bitmap : &dirty_end->second.bitmap;
                 memcpy((void*)(new_entry+1) + bs->clean_entry_bitmap_size, bmp_ptr, bs->clean_entry_bitmap_size);
             }
         }
-        await_sqe(6);
-        data->iov = (struct iovec){ meta_new.buf, bs->meta_block_size };
-        data->callback = simple_callback_w;
-        my_uring_prep_writev(
-            sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + meta_new.sector
-        );
-        wait_count++;
-    resume_7:
-        if (wait_count > 0)
+#ifdef BLOCKSTORE_COMPACT_CLEAN_DB
+        // Compact clean_db takes versions from the metadata buffer which is already modified,
+        // so the entry must point to the new location before the next suspension point
+        update_clean_entry();
+#endif
+        // Write modified metadata sectors, coalescing them with other flushers
+    resume_22:
+    resume_23:
+    resume_24:
+        if (!write_meta_batch(22))
         {
-            wait_state = 7;
+            wait_state += 22;
             return false;
         }
         // Done, free all buffers
@@ -615,6 +780,7 @@ resume_1:
             free(it->buf);
         }
         v.clear();
+        copy_iov.clear();
         // And sync metadata (in batches - not per each operation!)
     resume_8:
     resume_9:
@@ -626,6 +792,7 @@ resume_1:
         }
         // Update clean_db and dirty_db, free old data locations
         update_clean_db();
+        flusher->stat_flushed_objects++;
 #ifdef BLOCKSTORE_DEBUG
         printf("Flushed %lx:%lx v%lu (%d copies, wr:%d, del:%d), %ld left\n", cur.oid.inode, cur.oid.stripe, cur.version,
             copy_count, has_writes, has_delete, flusher->flush_queue.size());
@@ -714,6 +881,8 @@ bool journal_flusher_co::scan_dirty(int wait_base)
 {
     if (wait_state == wait_base)
     {
+        // dirty_db may be modified while we wait for an SQE
+        dirty_it = bs->dirty_db_shard(cur.oid).find((obj_ver_id){ .oid = cur.oid, .version = scan_version });
         goto resume_0;
     }
     dirty_it = dirty_start = dirty_end;
@@ -727,6 +896,7 @@ bool journal_flusher_co::scan_dirty(int wait_base)
     clean_init_bitmap = false;
     while (1)
     {
+        scan_version = dirty_it->first.version;
         if (!IS_STABLE(dirty_it->second.state))
         {
             char err[1024];
@@ -799,7 +969,7 @@ bool journal_flusher_co::scan_dirty(int wait_base)
             skip_copy = true;
         }
         dirty_start = dirty_it;
-        if (dirty_it == bs->dirty_db.begin())
+        if (dirty_it == bs->dirty_db_shard(cur.oid).begin())
         {
             break;
         }
@@ -812,6 +982,14 @@ bool journal_flusher_co::scan_dirty(int wait_base)
     return true;
 }
 
+// Scanned versions of the object always start with its first dirty entry, and it's
+// flushed up to <cur>, so the range is easily found again after any suspension point
+void journal_flusher_co::find_dirty_range()
+{
+    dirty_start = bs->dirty_db_shard(cur.oid).lower_bound((obj_ver_id){ .oid = cur.oid, .version = 0 });
+    dirty_end = bs->dirty_db_shard(cur.oid).find(cur);
+}
+
 bool journal_flusher_co::modify_meta_read(uint64_t meta_loc, flusher_meta_write_t &wr, int wait_base)
 {
     if (wait_state == wait_base)
@@ -870,10 +1048,11 @@ void journal_flusher_co::update_clean_db()
 #endif
         bs->data_alloc->set(old_clean_loc >> bs->block_order, false);
     }
+#ifndef BLOCKSTORE_COMPACT_CLEAN_DB
+    update_clean_entry();
+#endif
     if (has_delete)
     {
-        auto clean_it = bs->clean_db.find(cur.oid);
-        bs->clean_db.erase(clean_it);
 #ifdef BLOCKSTORE_DEBUG
         printf("Free block %lu from %lx:%lx v%lu (delete)\n",
             clean_loc >> bs->block_order,
@@ -882,14 +1061,102 @@ void journal_flusher_co::update_clean_db()
         bs->data_alloc->set(clean_loc >> bs->block_order, false);
         clean_loc = UINT64_MAX;
     }
+    find_dirty_range();
+    bs->erase_dirty(dirty_start, std::next(dirty_end), clean_loc);
+}
+
+void journal_flusher_co::update_clean_entry()
+{
+    if (has_delete)
+    {
+        auto & clean_db = bs->clean_db_shard(cur.oid);
+        auto clean_it = clean_db.find(cur.oid);
+        if (clean_it != clean_db.end())
+        {
+            clean_db.erase(clean_it);
+        }
+    }
     else
     {
-        bs->clean_db[cur.oid] = {
+        auto & clean_db = bs->modify_clean_db_shard(cur.oid);
+        clean_db[cur.oid] = {
             .version = cur.version,
             .location = clean_loc,
         };
     }
-    bs->erase_dirty(dirty_start, std::next(dirty_end), clean_loc);
+}
+
+bool journal_flusher_co::write_meta_batch(int wait_base)
+{
+    if (wait_state == wait_base)
+        goto resume_0;
+    else if (wait_state == wait_base+1)
+        goto resume_1;
+    else if (wait_state == wait_base+2)
+        goto resume_2;
+    // Join the batch which is still being collected or start a new one. Sectors modified
+    // by several flushers (neighbouring objects) are only written once per batch
+    cur_meta_batch = flusher->meta_batches.end();
+    while (cur_meta_batch != flusher->meta_batches.begin())
+    {
+        cur_meta_batch--;
+        if (cur_meta_batch->state == 0)
+        {
+            goto batch_found;
+        }
+    }
+    cur_meta_batch = flusher->meta_batches.emplace(flusher->meta_batches.end(), (flusher_meta_batch_t){
+        .ready_count = 0,
+        .state = 0,
+    });
+batch_found:
+    cur_meta_batch->sectors[meta_new.sector] = meta_new.buf;
+    if (old_clean_loc != UINT64_MAX && old_clean_loc != clean_loc)
+    {
+        cur_meta_batch->sectors[meta_old.sector] = meta_old.buf;
+    }
+    cur_meta_batch->ready_count++;
+    flusher->syncing_flushers++;
+resume_0:
+    if (cur_meta_batch->state == 0 && flusher_meta_batch_ready(bs->disable_meta_fsync,
+        flusher->syncing_flushers, flusher->active_flushers, flusher->flush_queue.size()))
+    {
+        // Batch is ready, everyone else is also waiting for something. Write it.
+        cur_meta_batch->state = 1;
+        for (meta_batch_it = cur_meta_batch->sectors.begin(); meta_batch_it != cur_meta_batch->sectors.end(); meta_batch_it++)
+        {
+            await_sqe(1);
+            data->iov = (struct iovec){ meta_batch_it->second, bs->meta_block_size };
+            data->callback = simple_callback_w;
+            bs->ringloop->prep_writev(
+                sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + meta_batch_it->first
+            );
+            wait_count++;
+            flusher->stat_meta_writes++;
+        }
+    resume_2:
+        if (wait_count > 0)
+        {
+            wait_state = 2;
+            return false;
+        }
+        // Writes completed. All coroutines of this batch must be resumed
+        cur_meta_batch->state = 2;
+        bs->ringloop->wakeup();
+    }
+    else if (cur_meta_batch->state != 2)
+    {
+        // Wait until someone else writes the batch
+        wait_state = 0;
+        return false;
+    }
+    flusher->syncing_flushers--;
+    cur_meta_batch->ready_count--;
+    if (cur_meta_batch->ready_count == 0)
+    {
+        flusher->meta_batches.erase(cur_meta_batch);
+    }
+    return true;
 }
 
 bool journal_flusher_co::fsync_batch(bool fsync_meta, int wait_base)
@@ -22,6 +22,14 @@ struct flusher_sync_t
     int state;
 };
 
+struct flusher_meta_batch_t
+{
+    // sector offset => buffer
+    std::map<uint64_t, void*> sectors;
+    int ready_count;
+    int state;
+};
+
 struct flusher_meta_write_t
 {
     uint64_t sector, pos;
@@ -32,6 +40,15 @@ struct flusher_meta_write_t
 
 class journal_flusher_t;
 
+// Metadata write batch may be written when no other flusher can join it: when all active
+// flushers wait for some batch or fsync, or when there's nothing more to flush. Idle flushers
+// are not counted, they may be unable to pick anything from the queue and would never join.
+// Without metadata fsyncs there's no fsync to align writes with, so batches are written at once
+inline bool flusher_meta_batch_ready(bool disable_meta_fsync, int syncing_flushers, int active_flushers, size_t queue_size)
+{
+    return disable_meta_fsync || syncing_flushers >= active_flushers || !queue_size;
+}
+
 // Journal flusher coroutine
 class journal_flusher_co
 {
@@ -42,18 +59,22 @@ class journal_flusher_co
     struct ring_data_t *data;
 
     std::list<flusher_sync_t>::iterator cur_sync;
+    std::list<flusher_meta_batch_t>::iterator cur_meta_batch;
+    std::map<uint64_t, void*>::iterator meta_batch_it;
 
     obj_ver_id cur;
-    std::map<obj_ver_id, dirty_entry>::iterator dirty_it, dirty_start, dirty_end;
+    blockstore_dirty_db_t::iterator dirty_it, dirty_start, dirty_end;
     std::map<object_id, uint64_t>::iterator repeat_it;
-    std::function<void(ring_data_t*)> simple_callback_r, simple_callback_w;
+    std::function<void(ring_data_t*)> simple_callback_r, simple_callback_w, data_callback_w;
 
     bool skip_copy, has_delete, has_writes;
-    blockstore_clean_db_t::iterator clean_it;
     std::vector<copy_buffer_t> v;
     std::vector<copy_buffer_t>::iterator it;
     int copy_count;
     uint64_t clean_loc, old_clean_loc;
+    std::vector<iovec> copy_iov;
+    int copy_pos, copy_end;
+    timespec copy_start;
     flusher_meta_write_t meta_old, meta_new;
     bool clean_init_bitmap;
     uint64_t clean_bitmap_offset, clean_bitmap_len;
@@ -62,12 +83,15 @@ class journal_flusher_co
     uint64_t new_trim_pos;
 
     // local: scan_dirty()
-    uint64_t offset, end_offset, submit_offset, submit_len;
+    uint64_t offset, end_offset, submit_offset, submit_len, scan_version;
 
     friend class journal_flusher_t;
     bool scan_dirty(int wait_base);
+    void find_dirty_range();
     bool modify_meta_read(uint64_t meta_loc, flusher_meta_write_t &wr, int wait_base);
     void update_clean_db();
+    void update_clean_entry();
+    bool write_meta_batch(int wait_base);
     bool fsync_batch(bool fsync_meta, int wait_base);
 public:
     journal_flusher_co();
@@ -81,6 +105,8 @@ class journal_flusher_t
     bool dequeuing;
     int min_flusher_count, max_flusher_count, cur_flusher_count, target_flusher_count;
     int flusher_start_threshold;
+    unsigned sort_window;
+    uint64_t last_flush_loc = 0;
     journal_flusher_co *co;
     blockstore_impl_t *bs;
     friend class journal_flusher_co;
@@ -95,10 +121,23 @@ class journal_flusher_t
     std::map<object_id, uint64_t> sync_to_repeat;
 
     std::map<uint64_t, meta_sector_t> meta_sectors;
+    std::list<flusher_meta_batch_t> meta_batches;
+    uint64_t stat_flushed_objects = 0, stat_meta_writes = 0;
+    uint64_t stat_data_writes = 0, stat_data_write_bytes = 0;
+
+    // flusher_adaptive state
+    uint64_t adapt_time_us = 0;
+    // data write latency without fsyncs and the number of data writes in flight (x100)
+    uint64_t data_lat_us = 0, data_lat_min_us = 0, data_par_x100 = 0;
+    int data_writes_in_flight = 0;
+    int journal_fill_pct = 0;
+    uint64_t stat_target_up = 0, stat_target_down = 0;
     std::deque<object_id> flush_queue;
     std::map<object_id, uint64_t> flush_versions;
 
-    bool try_find_older(std::map<obj_ver_id, dirty_entry>::iterator & dirty_end, obj_ver_id & cur);
+    bool try_find_older(blockstore_dirty_db_t::iterator & dirty_end, obj_ver_id & cur);
+    void pick_nearest();
+    void adapt();
 
 public:
     journal_flusher_t(blockstore_impl_t *bs);
@@ -111,5 +150,6 @@ public:
     void enqueue_flush(obj_ver_id oid);
     void unshift_flush(obj_ver_id oid, bool force);
     void remove_flush(object_id oid);
+    void clear_queue();
     void dump_diagnostics();
 };
@@ -1,6 +1,8 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+#include <algorithm>
+
 #include "blockstore_impl.h"
 
 blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *ringloop, timerfd_manager_t *tfd)
@@ -13,6 +15,7 @@ blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *
     initialized = 0;
     data_fd = meta_fd = journal.fd = -1;
     parse_config(config);
+    lazy_meta_state = lazy_meta_load ? 1 : 0;
     zero_object = (uint8_t*)memalign_or_die(MEM_ALIGNMENT, block_size);
     try
     {
@@ -33,12 +36,29 @@ blockstore_impl_t::blockstore_impl_t(blockstore_config_t & config, ring_loop_t *
         throw;
     }
     flusher = new journal_flusher_t(this);
+    if (register_buffers)
+    {
+        ringloop->register_buffer(zero_object, block_size);
+        if (journal.inmemory)
+            ringloop->register_buffer(journal.buffer, journal.len);
+        else
+            ringloop->register_buffer(journal.sector_buf, journal.sector_count * journal_block_size);
+        if (inmemory_meta)
+            ringloop->register_buffer(metadata_buffer, meta_len);
+    }
 }
 
 blockstore_impl_t::~blockstore_impl_t()
 {
     delete data_alloc;
     delete flusher;
+    if (register_buffers)
+    {
+        ringloop->unregister_buffer(zero_object);
+        ringloop->unregister_buffer(journal.inmemory ? journal.buffer : journal.sector_buf);
+        if (inmemory_meta)
+            ringloop->unregister_buffer(metadata_buffer);
+    }
     free(zero_object);
     ringloop->unregister_consumer(&ring_consumer);
     if (data_fd >= 0)
@@ -78,7 +98,13 @@ void blockstore_impl_t::loop()
         if (initialized == 1)
         {
             int res = metadata_init_reader->loop();
-            if (!res)
+            if (res == 2)
+            {
+                // Lazy loading: the superblock is checked, replay the journal before reading entries
+                journal_init_reader = new blockstore_init_journal(this);
+                initialized = 2;
+            }
+            else if (!res)
             {
                 delete metadata_init_reader;
                 metadata_init_reader = NULL;
@@ -93,7 +119,16 @@ void blockstore_impl_t::loop()
             {
                 delete journal_init_reader;
                 journal_init_reader = NULL;
-                if (journal.flush_journal)
+                if (lazy_meta_state)
+                {
+                    // Allocations and space statistics are rebuilt from metadata and the second replay
+                    delete data_alloc;
+                    data_alloc = new allocator(block_count);
+                    inode_space_stats.clear();
+                    printf("Serving reads of journaled objects, loading metadata in background\n");
+                    initialized = 10;
+                }
+                else if (journal.flush_journal)
                     initialized = 3;
                 else
                     initialized = 10;
@@ -113,12 +148,22 @@ void blockstore_impl_t::loop()
     }
     else
     {
+        if (lazy_meta_state)
+        {
+            continue_lazy_load();
+        }
+        if (clean_db_old_shards.size() || dirty_db_old_shards.size())
+        {
+            continue_reshard();
+        }
         // try to submit ops
         unsigned initial_ring_space = ringloop->space_left();
         // has_writes == 0 - no writes before the current queue item
         // has_writes == 1 - some writes in progress
         // has_writes == 2 - tried to submit some writes, but failed
         int has_writes = 0, op_idx = 0, new_idx = 0;
+        // LIST may be heavy, so only one of them is processed per loop iteration
+        bool has_list = false, delayed_list = false;
         for (; op_idx < submit_queue.size(); op_idx++, new_idx++)
         {
             auto op = submit_queue[op_idx];
@@ -200,7 +245,17 @@ void blockstore_impl_t::loop()
             else if (op->opcode == BS_OP_LIST)
             {
                 // LIST doesn't need to be blocked by previous modifications
-                process_list(op);
+                if (has_list)
+                {
+                    delayed_list = true;
+                    continue;
+                }
+                has_list = true;
+                if (!process_list(op))
+                {
+                    delayed_list = true;
+                    continue;
+                }
                 wr_st = 2;
             }
             if (wr_st == 2)
@@ -226,7 +281,12 @@ void blockstore_impl_t::loop()
             }
             submit_queue.resize(new_idx);
         }
-        if (!readonly)
+        if (delayed_list)
+        {
+            // Let other consumers run before listing the next chunk
+            ringloop->wakeup();
+        }
+        if (!readonly && !lazy_meta_state)
         {
             flusher->loop();
         }
@@ -250,11 +310,66 @@ void blockstore_impl_t::loop()
     }
 }
 
+void blockstore_impl_t::continue_lazy_load()
+{
+    if (lazy_meta_state == 1)
+    {
+        if (metadata_init_reader->loop())
+        {
+            return;
+        }
+        delete metadata_init_reader;
+        metadata_init_reader = NULL;
+        // The first replay didn't know clean versions of objects, so it kept entries that are
+        // already flushed and didn't count space. Now replay the journal again from scratch
+        forget_journal_replay();
+        journal_init_reader = new blockstore_init_journal(this);
+        lazy_meta_state = 2;
+    }
+    if (lazy_meta_state == 2)
+    {
+        if (journal_init_reader->loop())
+        {
+            return;
+        }
+        delete journal_init_reader;
+        journal_init_reader = NULL;
+        lazy_meta_state = 0;
+        std::vector<blockstore_op_t*> ops;
+        ops.swap(lazy_meta_ops);
+        for (auto op: ops)
+        {
+            enqueue_op(op);
+        }
+        ringloop->wakeup();
+    }
+}
+
+// Drop the state built by the journal replay. Only reads are processed before the second replay,
+// so the state doesn't contain anything else
+void blockstore_impl_t::forget_journal_replay()
+{
+    for (auto & sh: dirty_db_shards)
+    {
+        if (clean_entry_bitmap_size > sizeof(void*))
+        {
+            for (auto & dirty: sh.second)
+            {
+                free(dirty.second.bitmap);
+            }
+        }
+    }
+    dirty_db_shards.clear();
+    unstable_writes.clear();
+    journal.used_sectors.clear();
+    flusher->clear_queue();
+}
+
 bool blockstore_impl_t::is_safe_to_stop()
 {
     // It's safe to stop blockstore when there are no in-flight operations,
     // no in-progress syncs and flusher isn't doing anything
-    if (submit_queue.size() > 0 || !readonly && flusher->is_active())
+    if (submit_queue.size() > 0 || lazy_meta_state || !readonly && flusher->is_active())
     {
         return false;
     }
@@ -351,6 +466,12 @@ void blockstore_impl_t::enqueue_op(blockstore_op_t *op)
         std::function<void (blockstore_op_t*)>(op->callback)(op);
         return;
     }
+    if (lazy_meta_state && op->opcode != BS_OP_READ)
+    {
+        // Versions and object lists aren't known until metadata is loaded
+        lazy_meta_ops.push_back(op);
+        return;
+    }
     if (op->opcode == BS_OP_SYNC_STAB_ALL)
     {
         std::function<void(blockstore_op_t*)> *old_callback = new std::function<void(blockstore_op_t*)>(op->callback);
@@ -425,89 +546,426 @@ static bool replace_stable(object_id oid, uint64_t version, int search_start, in
     return false;
 }
 
-void blockstore_impl_t::process_list(blockstore_op_t *op)
+static inline pool_pg_id_t layout_shard_id(object_id oid, uint32_t pg_count, uint64_t pg_stripe_size)
+{
+    uint64_t pool_id = (oid.inode >> (64-POOL_ID_BITS));
+    if (!pg_count)
+    {
+        return (pool_id << (64-POOL_ID_BITS));
+    }
+    // like map_to_pg()
+    uint64_t pg_num = (oid.stripe / pg_stripe_size) % pg_count + 1;
+    return (pool_id << (64-POOL_ID_BITS)) | pg_num;
+}
+
+pool_pg_id_t blockstore_impl_t::clean_db_shard_id(object_id oid)
+{
+    uint64_t pool_id = (oid.inode >> (64-POOL_ID_BITS));
+    auto sh_it = clean_db_settings.find(pool_id);
+    if (sh_it != clean_db_settings.end())
+    {
+        return layout_shard_id(oid, sh_it->second.pg_count, sh_it->second.pg_stripe_size);
+    }
+    return (pool_id << (64-POOL_ID_BITS));
+}
+
+// Shard of the object in the previous layout, only if its pool is being resharded
+bool blockstore_impl_t::old_shard_id(object_id oid, pool_pg_id_t *shard_id)
+{
+    auto sh_it = clean_db_settings.find(oid.inode >> (64-POOL_ID_BITS));
+    if (sh_it == clean_db_settings.end() || !sh_it->second.resharding)
+    {
+        return false;
+    }
+    *shard_id = layout_shard_id(oid, sh_it->second.old_pg_count, sh_it->second.old_pg_stripe_size);
+    return true;
+}
+
+// Shard of the object for lookups. Missing shards aren't created, an empty one is returned instead
+blockstore_clean_db_t& blockstore_impl_t::clean_db_shard(object_id oid)
+{
+    auto sh_it = clean_db_shards.find(clean_db_shard_id(oid));
+    pool_pg_id_t old_id;
+    if (clean_db_old_shards.size() && old_shard_id(oid, &old_id) &&
+        (sh_it == clean_db_shards.end() || sh_it->second.find(oid) == sh_it->second.end()))
+    {
+        // Not moved to the new shard yet
+        auto old_it = clean_db_old_shards.find(old_id);
+        if (old_it != clean_db_old_shards.end())
+            return old_it->second;
+    }
+    return sh_it != clean_db_shards.end() ? sh_it->second : empty_clean_db;
+}
+
+// Shard for modifications of the object, created if it doesn't exist yet. If the pool
+// is being resharded, the object's entry is moved to its new shard first
+blockstore_clean_db_t& blockstore_impl_t::modify_clean_db_shard(object_id oid)
+{
+    auto & shard = get_clean_db_shard(clean_db_shards, clean_db_shard_id(oid));
+    pool_pg_id_t old_id;
+    if (clean_db_old_shards.size() && old_shard_id(oid, &old_id))
+    {
+        auto old_it = clean_db_old_shards.find(old_id);
+        if (old_it != clean_db_old_shards.end())
+        {
+            auto clean_it = old_it->second.find(oid);
+            if (clean_it != old_it->second.end())
+            {
+                shard[oid] = clean_it->second;
+                old_it->second.erase(clean_it);
+            }
+        }
+    }
+    return shard;
+}
+
+blockstore_clean_db_t& blockstore_impl_t::get_clean_db_shard(std::map<pool_pg_id_t, blockstore_clean_db_t> & shards, pool_pg_id_t shard_id)
+{
+    auto sh_it = shards.find(shard_id);
+    if (sh_it == shards.end())
+    {
+        sh_it = shards.emplace(shard_id, blockstore_clean_db_t()).first;
+#ifdef BLOCKSTORE_COMPACT_CLEAN_DB
+        // Compact shards read object versions from the metadata area
+        sh_it->second.meta = &clean_db_meta;
+#endif
+    }
+    return sh_it->second;
+}
+
+// Shard with all versions of the object, created if it doesn't exist yet. Versions of one
+// object are never split between shards: during resharding they're moved all at once
+blockstore_dirty_db_t& blockstore_impl_t::dirty_db_shard(object_id oid)
 {
-    uint32_t list_pg = op->offset;
-    uint32_t pg_count = op->len;
-    uint64_t pg_stripe_size = op->oid.stripe;
-    uint64_t min_inode = op->oid.inode;
-    uint64_t max_inode = op->version;
+    pool_pg_id_t old_id;
+    if (dirty_db_old_shards.size() && old_shard_id(oid, &old_id))
+    {
+        auto old_it = dirty_db_old_shards.find(old_id);
+        if (old_it != dirty_db_old_shards.end())
+        {
+            auto dirty_it = old_it->second.lower_bound((obj_ver_id){ .oid = oid, .version = 0 });
+            if (dirty_it != old_it->second.end() && dirty_it->first.oid == oid)
+                return old_it->second;
+        }
+    }
+    pool_pg_id_t shard_id = clean_db_shard_id(oid);
+    auto sh_it = dirty_db_shards.find(shard_id);
+    if (sh_it == dirty_db_shards.end())
+    {
+        sh_it = dirty_db_shards.emplace(shard_id, blockstore_dirty_db_t()).first;
+    }
+    return sh_it->second;
+}
+
+// Switch the pool to a new layout. Existing shards are put aside and their entries are
+// moved to new shards by continue_reshard() in batches, between other operations
+void blockstore_impl_t::start_reshard(pool_id_t pool, uint32_t pg_count, uint64_t pg_stripe_size)
+{
+    uint64_t pool_id = (uint64_t)pool;
+    auto & settings = clean_db_settings[pool_id];
+    assert(!settings.resharding);
+    settings.old_pg_count = settings.pg_count;
+    settings.old_pg_stripe_size = settings.pg_stripe_size;
+    settings.pg_count = pg_count;
+    settings.pg_stripe_size = pg_stripe_size;
+    settings.next_pg_count = 0;
+    settings.next_pg_stripe_size = 0;
+    auto sh_it = clean_db_shards.lower_bound((pool_id << (64-POOL_ID_BITS)));
+    while (sh_it != clean_db_shards.end() && (sh_it->first >> (64-POOL_ID_BITS)) == pool_id)
+    {
+        if (sh_it->second.size())
+        {
+            get_clean_db_shard(clean_db_old_shards, sh_it->first).swap(sh_it->second);
+            settings.resharding = true;
+        }
+        clean_db_shards.erase(sh_it++);
+    }
+    auto dirty_sh_it = dirty_db_shards.lower_bound((pool_id << (64-POOL_ID_BITS)));
+    while (dirty_sh_it != dirty_db_shards.end() && (dirty_sh_it->first >> (64-POOL_ID_BITS)) == pool_id)
+    {
+        if (dirty_sh_it->second.size())
+        {
+            dirty_db_old_shards[dirty_sh_it->first].swap(dirty_sh_it->second);
+            settings.resharding = true;
+        }
+        dirty_db_shards.erase(dirty_sh_it++);
+    }
+    if (settings.resharding)
+    {
+        ringloop->wakeup();
+    }
+}
+
+void blockstore_impl_t::continue_reshard()
+{
+    int left = RESHARD_BATCH_SIZE;
+    std::set<uint64_t> pools;
+    while (left > 0 && clean_db_old_shards.size())
+    {
+        auto old_it = clean_db_old_shards.begin();
+        auto & old_shard = old_it->second;
+        while (left > 0 && old_shard.size())
+        {
+            auto clean_it = old_shard.begin();
+            get_clean_db_shard(clean_db_shards, clean_db_shard_id(clean_it->first))[clean_it->first] = clean_it->second;
+            old_shard.erase(clean_it);
+            left--;
+        }
+        if (!old_shard.size())
+        {
+            pools.insert(old_it->first >> (64-POOL_ID_BITS));
+            clean_db_old_shards.erase(old_it);
+        }
+    }
+    while (left > 0 && dirty_db_old_shards.size())
+    {
+        auto old_it = dirty_db_old_shards.begin();
+        auto & old_shard = old_it->second;
+        while (left > 0 && old_shard.size())
+        {
+            // Move all versions of the object at once
+            auto dirty_start = old_shard.begin();
+            auto dirty_end = dirty_start;
+            auto & to = dirty_db_shards[clean_db_shard_id(dirty_start->first.oid)];
+            while (dirty_end != old_shard.end() && dirty_end->first.oid == dirty_start->first.oid)
+            {
+                to.emplace(dirty_end->first, dirty_end->second);
+                dirty_end++;
+                left--;
+            }
+            old_shard.erase(dirty_start, dirty_end);
+        }
+        if (!old_shard.size())
+        {
+            pools.insert(old_it->first >> (64-POOL_ID_BITS));
+            dirty_db_old_shards.erase(old_it);
+        }
+    }
+    for (uint64_t pool_id: pools)
+    {
+        // Check if all old shards of the pool are moved
+        uint64_t pool_start = (pool_id << (64-POOL_ID_BITS));
+        auto clean_it = clean_db_old_shards.lower_bound(pool_start);
+        auto dirty_it = dirty_db_old_shards.lower_bound(pool_start);
+        if ((clean_it == clean_db_old_shards.end() || (clean_it->first >> (64-POOL_ID_BITS)) != pool_id) &&
+            (dirty_it == dirty_db_old_shards.end() || (dirty_it->first >> (64-POOL_ID_BITS)) != pool_id))
+        {
+            clean_db_settings[pool_id].resharding = false;
+        }
+    }
+    if (clean_db_old_shards.size() || dirty_db_old_shards.size())
+    {
+        // Let other consumers run before moving the next batch
+        ringloop->wakeup();
+    }
+}
+
+// Merges ranges of several shards in key order. Keys of different shards never repeat
+template<class It> class shard_merge_t
+{
+    typedef std::pair<It, It> range_t;
+    // The heap front is the range with the smallest current key
+    std::vector<range_t> heap;
+
+    static bool greater(const range_t & a, const range_t & b)
+    {
+        return b.first->first < a.first->first;
+    }
+public:
+    void add(It begin, It end)
+    {
+        if (begin != end)
+            heap.push_back({ begin, end });
+    }
+
+    void start()
+    {
+        std::make_heap(heap.begin(), heap.end(), greater);
+    }
+
+    bool done()
+    {
+        return !heap.size();
+    }
+
+    It & cur()
+    {
+        return heap.front().first;
+    }
+
+    void next()
+    {
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        heap.back().first++;
+        if (heap.back().first == heap.back().second)
+            heap.pop_back();
+        else
+            std::push_heap(heap.begin(), heap.end(), greater);
+    }
+};
+
+bool blockstore_impl_t::process_list(blockstore_op_t *op)
+{
+    uint32_t list_pg = op->pg_number;
+    uint32_t pg_count = op->pg_count;
+    uint64_t pg_stripe_size = op->pg_alignment;
+    uint32_t stable_limit = op->list_stable_limit;
+    object_id min_oid = op->min_oid;
+    object_id max_oid = op->max_oid;
+    if (!max_oid.inode && !max_oid.stripe)
+    {
+        max_oid = { .inode = UINT64_MAX, .stripe = UINT64_MAX };
+    }
     // Check PG
     if (pg_count != 0 && (pg_stripe_size < MIN_BLOCK_SIZE || list_pg >= pg_count))
     {
         op->retval = -EINVAL;
         FINISH_OP(op);
-        return;
+        return true;
     }
-    // Copy clean_db entries (sorted)
-    int stable_count = 0, stable_alloc = clean_db.size() / (pg_count ? pg_count : 1);
-    obj_ver_id *stable = (obj_ver_id*)malloc(sizeof(obj_ver_id) * stable_alloc);
-    if (!stable)
+    if (max_oid < min_oid)
     {
-        op->retval = -ENOMEM;
+        // Empty range
+        op->version = 0;
+        op->retval = 0;
+        op->buf = NULL;
+        op->min_oid = { 0 };
         FINISH_OP(op);
-        return;
+        return true;
+    }
+    // Select clean_db and dirty_db shards to scan
+    std::vector<blockstore_clean_db_t*> shards;
+    std::vector<blockstore_dirty_db_t*> dirty_shards;
+    bool filter_pg = pg_count != 0;
+    if (pg_count != 0 && INODE_POOL(min_oid.inode) == INODE_POOL(max_oid.inode))
+    {
+        // Listing of a single PG of a single pool - the common case, used by the OSD during peering
+        uint64_t pool_id = INODE_POOL(min_oid.inode);
+        auto set_it = clean_db_settings.find(pool_id);
+        if (set_it == clean_db_settings.end() || !set_it->second.resharding &&
+            set_it->second.next_pg_count == pg_count && set_it->second.next_pg_stripe_size == pg_stripe_size)
+        {
+            start_reshard(pool_id, pg_count, pg_stripe_size);
+            set_it = clean_db_settings.find(pool_id);
+        }
+        if (set_it->second.pg_count == pg_count && set_it->second.pg_stripe_size == pg_stripe_size)
+        {
+            if (set_it->second.resharding)
+            {
+                // Wait until the pool is resharded, it takes several event loop iterations
+                return false;
+            }
+            auto sh_it = clean_db_shards.find((pool_id << (64-POOL_ID_BITS)) | (list_pg+1));
+            if (sh_it != clean_db_shards.end())
+            {
+                shards.push_back(&sh_it->second);
+            }
+            auto dirty_sh_it = dirty_db_shards.find((pool_id << (64-POOL_ID_BITS)) | (list_pg+1));
+            if (dirty_sh_it != dirty_db_shards.end())
+            {
+                dirty_shards.push_back(&dirty_sh_it->second);
+            }
+            filter_pg = false;
+        }
+        else
+        {
+            // Another layout is requested for the first time. Filter all objects of the pool
+            // and reshard it if the same layout is requested again
+            set_it->second.next_pg_count = pg_count;
+            set_it->second.next_pg_stripe_size = pg_stripe_size;
+        }
     }
+    if (filter_pg || !pg_count)
     {
-        auto clean_it = clean_db.begin(), clean_end = clean_db.end();
-        if ((min_inode != 0 || max_inode != 0) && min_inode <= max_inode)
+        // Shards of all pools in the range, including ones not resharded yet
+        pool_pg_id_t first_id = (uint64_t)INODE_POOL(min_oid.inode) << (64-POOL_ID_BITS);
+        pool_pg_id_t last_id = (((uint64_t)INODE_POOL(max_oid.inode)) << (64-POOL_ID_BITS)) |
+            (((uint64_t)1 << (64-POOL_ID_BITS)) - 1);
+        for (auto shard_map: { &clean_db_shards, &clean_db_old_shards })
         {
-            clean_it = clean_db.lower_bound({
-                .inode = min_inode,
-                .stripe = 0,
-            });
-            clean_end = clean_db.upper_bound({
-                .inode = max_inode,
-                .stripe = UINT64_MAX,
-            });
+            for (auto sh_it = shard_map->lower_bound(first_id); sh_it != shard_map->end() && sh_it->first <= last_id; sh_it++)
+            {
+                shards.push_back(&sh_it->second);
+            }
         }
-        for (; clean_it != clean_end; clean_it++)
+        for (auto shard_map: { &dirty_db_shards, &dirty_db_old_shards })
         {
-            if (!pg_count || ((clean_it->first.stripe / pg_stripe_size) % pg_count) == list_pg) // like map_to_pg()
+            for (auto sh_it = shard_map->lower_bound(first_id); sh_it != shard_map->end() && sh_it->first <= last_id; sh_it++)
             {
-                if (stable_count >= stable_alloc)
+                dirty_shards.push_back(&sh_it->second);
+            }
+        }
+    }
+    // Copy clean_db entries. Shards are merged by a heap of their iterators, so with a limit
+    // only <limit>+1 entries are taken: the extra entry gives the key to continue listing from
+    int stable_count = 0, stable_alloc = 0;
+    for (auto shard: shards)
+    {
+        stable_alloc += filter_pg ? shard->size()/pg_count : shard->size();
+    }
+    if (stable_limit && stable_alloc > stable_limit+1)
+    {
+        stable_alloc = stable_limit+1;
+    }
+    obj_ver_id *stable = (obj_ver_id*)malloc(sizeof(obj_ver_id) * (stable_alloc ? stable_alloc : 1));
+    if (!stable)
+    {
+        op->retval = -ENOMEM;
+        FINISH_OP(op);
+        return true;
+    }
+    shard_merge_t<blockstore_clean_db_t::iterator> clean_merge;
+    for (auto shard: shards)
+    {
+        clean_merge.add(shard->lower_bound(min_oid), shard->upper_bound(max_oid));
+    }
+    clean_merge.start();
+    for (; !clean_merge.done() && (!stable_limit || stable_count <= stable_limit); clean_merge.next())
+    {
+        auto & clean_it = clean_merge.cur();
+        if (!filter_pg || ((clean_it->first.stripe / pg_stripe_size) % pg_count) == list_pg) // like map_to_pg()
+        {
+            if (stable_count >= stable_alloc)
+            {
+                stable_alloc += 32768;
+                stable = (obj_ver_id*)realloc(stable, sizeof(obj_ver_id) * stable_alloc);
+                if (!stable)
                 {
-                    stable_alloc += 32768;
-                    stable = (obj_ver_id*)realloc(stable, sizeof(obj_ver_id) * stable_alloc);
-                    if (!stable)
-                    {
-                        op->retval = -ENOMEM;
-                        FINISH_OP(op);
-                        return;
-                    }
+                    op->retval = -ENOMEM;
+                    FINISH_OP(op);
+                    return true;
                 }
-                stable[stable_count++] = {
-                    .oid = clean_it->first,
-                    .version = clean_it->second.version,
-                };
             }
+            stable[stable_count++] = {
+                .oid = clean_it->first,
+                .version = clean_it->second.version,
+            };
         }
     }
+    // Cut the listing at the first clean object over the limit
+    object_id next_oid = { 0 };
+    if (stable_limit && stable_count > stable_limit)
+    {
+        next_oid = stable[stable_limit].oid;
+        stable_count = stable_limit;
+    }
     int clean_stable_count = stable_count;
     // Copy dirty_db entries (sorted, too)
     int unstable_count = 0, unstable_alloc = 0;
     obj_ver_id *unstable = NULL;
     {
-        auto dirty_it = dirty_db.begin(), dirty_end = dirty_db.end();
-        if ((min_inode != 0 || max_inode != 0) && min_inode <= max_inode)
-        {
-            dirty_it = dirty_db.lower_bound({
-                .oid = {
-                    .inode = min_inode,
-                    .stripe = 0,
-                },
-                .version = 0,
-            });
-            dirty_end = dirty_db.upper_bound({
-                .oid = {
-                    .inode = max_inode,
-                    .stripe = UINT64_MAX,
-                },
-                .version = UINT64_MAX,
-            });
-        }
-        for (; dirty_it != dirty_end; dirty_it++)
+        obj_ver_id dirty_min = { .oid = min_oid, .version = 0 };
+        shard_merge_t<blockstore_dirty_db_t::iterator> dirty_merge;
+        for (auto shard: dirty_shards)
+        {
+            dirty_merge.add(shard->lower_bound(dirty_min), next_oid.inode || next_oid.stripe
+                ? shard->lower_bound((obj_ver_id){ .oid = next_oid, .version = 0 })
+                : shard->upper_bound((obj_ver_id){ .oid = max_oid, .version = UINT64_MAX }));
+        }
+        dirty_merge.start();
+        for (; !dirty_merge.done(); dirty_merge.next())
         {
+            auto & dirty_it = dirty_merge.cur();
             if (!pg_count || ((dirty_it->first.oid.stripe / pg_stripe_size) % pg_count) == list_pg) // like map_to_pg()
             {
                 if (IS_DELETE(dirty_it->second.state))
@@ -540,7 +998,7 @@ void blockstore_impl_t::process_list(blockstore_op_t *op)
                                         free(unstable);
                                     op->retval = -ENOMEM;
                                     FINISH_OP(op);
-                                    return;
+                                    return true;
                                 }
                             }
                             stable[stable_count++] = dirty_it->first;
@@ -559,7 +1017,7 @@ void blockstore_impl_t::process_list(blockstore_op_t *op)
                                 free(stable);
                             op->retval = -ENOMEM;
                             FINISH_OP(op);
-                            return;
+                            return true;
                         }
                     }
                     unstable[unstable_count++] = dirty_it->first;
@@ -587,7 +1045,7 @@ void blockstore_impl_t::process_list(blockstore_op_t *op)
                 free(unstable);
             op->retval = -ENOMEM;
             FINISH_OP(op);
-            return;
+            return true;
         }
     }
     // Copy unstable entries
@@ -599,7 +1057,9 @@ void blockstore_impl_t::process_list(blockstore_op_t *op)
     op->version = stable_count;
     op->retval = stable_count+unstable_count;
     op->buf = stable;
+    op->min_oid = next_oid;
     FINISH_OP(op);
+    return true;
 }
 
 void blockstore_impl_t::dump_diagnostics()
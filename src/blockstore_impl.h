@@ -22,6 +22,7 @@
 
 #include "malloc_or_die.h"
 #include "allocator.h"
+#include "osd_id.h"
 
 //#define BLOCKSTORE_DEBUG
 
@@ -90,6 +91,8 @@
 #define BLOCKSTORE_META_MAGIC 0x726F747341544956l
 #define BLOCKSTORE_META_VERSION 1
 
+#define MAX_INODE_ALLOC_HINTS 65536
+
 // metadata header (superblock)
 // FIXME: After adding the OSD superblock, add a key to metadata
 // and journal headers to check if they belong to the same OSD
@@ -194,8 +197,38 @@ struct blockstore_op_private_t
 // https://github.com/algorithm-ninja/cpp-btree
 // https://github.com/greg7mdp/sparsepp/ was used previously, but it was TERRIBLY slow after resizing
 // with sparsepp, random reads dropped to ~700 iops very fast with just as much as ~32k objects in the DB
+#ifdef BLOCKSTORE_COMPACT_CLEAN_DB
+#include "blockstore_clean_db.h"
+#else
 typedef btree::btree_map<object_id, clean_entry> blockstore_clean_db_t;
-typedef std::map<obj_ver_id, dirty_entry> blockstore_dirty_db_t;
+#endif
+// dirty_db is also a btree: with a large journal it holds millions of entries and std::map
+// node-per-entry layout was dominating cache misses. Beware that btree iterators are invalidated
+// by any insert or erase, so they must never be kept across suspension points.
+typedef btree::btree_map<obj_ver_id, dirty_entry> blockstore_dirty_db_t;
+
+// clean_db and dirty_db are split into separate btrees ("shards") for every pool and PG so that
+// listing one PG doesn't scan all objects. Blockstore doesn't know about PGs itself, so pools are
+// resharded when a listing request comes with a different PG count or stripe size.
+// Shard ID is (pool_id << (64-POOL_ID_BITS)) | pg_num, pg_num = 0 is used for unsharded pools
+typedef uint64_t pool_pg_id_t;
+
+// Maximum number of clean_db or dirty_db entries moved to new shards in one event loop iteration
+#define RESHARD_BATCH_SIZE 16384
+
+struct pool_shard_settings_t
+{
+    uint32_t pg_count = 0;
+    uint64_t pg_stripe_size = 0;
+    // The pool is being resharded: entries not moved yet are in *_old_shards, sharded by the old layout
+    bool resharding = false;
+    uint32_t old_pg_count = 0;
+    uint64_t old_pg_stripe_size = 0;
+    // Different layout requested by the last listing. The pool is only resharded when it's
+    // requested again, so listings alternating between layouts don't reshard it every time
+    uint32_t next_pg_count = 0;
+    uint64_t next_pg_stripe_size = 0;
+};
 
 #include "blockstore_init.h"
 
@@ -226,8 +259,18 @@ class blockstore_impl_t
     // Suitable only for server SSDs with capacitors, requires disabled data and journal fsyncs
     int immediate_commit = IMMEDIATE_NONE;
     bool inmemory_meta = false;
+    // Replay the journal and start serving reads before loading metadata, load it in background
+    bool lazy_meta_load = false;
+    // Register journal and in-memory metadata buffers in io_uring to use READ_FIXED/WRITE_FIXED
+    bool register_buffers = false;
     // Maximum and minimum flusher count
     unsigned max_flusher_count, min_flusher_count;
+    // Pick the nearest object by data location among the first N queued ones when flushing
+    // (elevator order, for HDDs). 0 or 1 means flushing in the queue order
+    unsigned flusher_sort_window = 0;
+    // Adjust flusher count and small write throttling (target iops) from the journal fill level
+    // and the measured data device latency instead of using the static settings
+    bool flusher_adaptive = false;
     // Maximum queue depth
     unsigned max_write_iodepth = 128;
     // Enable small (journaled) write throttling, useful for the SSD+HDD case
@@ -240,15 +283,26 @@ class blockstore_impl_t
     int throttle_threshold_us = 50;
     /******* END OF OPTIONS *******/
 
+    // Throttling parameters measured by the adaptive flusher, not above the configured ones. 0 = not measured
+    int throttle_adapted_iops = 0, throttle_adapted_parallelism = 0;
+
     struct ring_consumer_t ring_consumer;
 
-    blockstore_clean_db_t clean_db;
+    std::map<pool_id_t, pool_shard_settings_t> clean_db_settings;
+    std::map<pool_pg_id_t, blockstore_clean_db_t> clean_db_shards, clean_db_old_shards;
+    // Returned by clean_db_shard() for objects without a shard, always empty
+    blockstore_clean_db_t empty_clean_db;
+#ifdef BLOCKSTORE_COMPACT_CLEAN_DB
+    clean_db_meta_t clean_db_meta;
+#endif
     uint8_t *clean_bitmap = NULL;
-    blockstore_dirty_db_t dirty_db;
+    std::map<pool_pg_id_t, blockstore_dirty_db_t> dirty_db_shards, dirty_db_old_shards;
     std::vector<blockstore_op_t*> submit_queue;
     std::vector<obj_ver_id> unsynced_big_writes, unsynced_small_writes;
     int unsynced_big_write_count = 0;
     allocator *data_alloc = NULL;
+    // Last allocated data block of each inode, big writes are placed after it when possible
+    std::map<inode_t, uint64_t> inode_alloc_hints;
     uint8_t *zero_object;
 
     uint32_t block_order;
@@ -298,8 +352,17 @@ class blockstore_impl_t
     // Asynchronous init
     int initialized;
     int metadata_buf_size;
+    // Parallel metadata and journal reads during startup
+    int meta_init_iodepth, journal_init_iodepth;
     blockstore_init_meta* metadata_init_reader;
     blockstore_init_journal* journal_init_reader;
+    // Lazy metadata loading: 1 = the journal is replayed without metadata and metadata is loaded
+    // in background, only reads covered by journal entries are served, 2 = the journal is replayed
+    // again with metadata, 0 = finished. Other operations wait in lazy_meta_ops until then
+    int lazy_meta_state = 0;
+    std::vector<blockstore_op_t*> lazy_meta_ops;
+    void continue_lazy_load();
+    void forget_journal_replay();
 
     void check_wait(blockstore_op_t *op);
 
@@ -337,7 +400,17 @@ class blockstore_impl_t
     void erase_dirty(blockstore_dirty_db_t::iterator dirty_start, blockstore_dirty_db_t::iterator dirty_end, uint64_t clean_loc);
 
     // List
-    void process_list(blockstore_op_t *op);
+    bool process_list(blockstore_op_t *op);
+
+    // clean_db and dirty_db sharding
+    pool_pg_id_t clean_db_shard_id(object_id oid);
+    bool old_shard_id(object_id oid, pool_pg_id_t *shard_id);
+    blockstore_clean_db_t& clean_db_shard(object_id oid);
+    blockstore_clean_db_t& modify_clean_db_shard(object_id oid);
+    blockstore_clean_db_t& get_clean_db_shard(std::map<pool_pg_id_t, blockstore_clean_db_t> & shards, pool_pg_id_t shard_id);
+    blockstore_dirty_db_t& dirty_db_shard(object_id oid);
+    void start_reshard(pool_id_t pool_id, uint32_t pg_count, uint64_t pg_stripe_size);
+    void continue_reshard();
 
 public:
 
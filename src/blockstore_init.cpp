@@ -22,20 +22,20 @@ blockstore_init_meta::blockstore_init_meta(blockstore_impl_t *bs)
     this->bs = bs;
 }
 
-void blockstore_init_meta::handle_event(ring_data_t *data)
+void blockstore_init_meta::handle_event(ring_data_t *data, int read_idx)
 {
-    if (data->res < 0)
+    if (data->res < 0 || read_idx >= 0 && data->res != reads[read_idx].len)
     {
         throw std::runtime_error(
-            std::string("read metadata failed at offset ") + std::to_string(metadata_read) +
-            std::string(": ") + strerror(-data->res)
+            std::string("read metadata failed at offset ") + std::to_string(read_idx >= 0 ? reads[read_idx].pos : 0) +
+            std::string(": ") + (data->res < 0 ? strerror(-data->res) : "short read")
         );
     }
-    prev_done = data->res > 0 ? submitted : 0;
-    done_len = data->res;
-    done_pos = metadata_read;
-    metadata_read += data->res;
-    submitted = 0;
+    if (read_idx >= 0)
+    {
+        reads[read_idx].state = 2;
+    }
+    submitted--;
 }
 
 int blockstore_init_meta::loop()
@@ -48,17 +48,19 @@ int blockstore_init_meta::loop()
         goto resume_3;
     else if (wait_state == 4)
         goto resume_4;
+    else if (wait_state == 5)
+        goto resume_5;
     printf("Reading blockstore metadata\n");
     if (bs->inmemory_meta)
         metadata_buffer = bs->metadata_buffer;
     else
-        metadata_buffer = memalign(MEM_ALIGNMENT, 2*bs->metadata_buf_size);
+        metadata_buffer = memalign(MEM_ALIGNMENT, bs->meta_init_iodepth*bs->metadata_buf_size);
     if (!metadata_buffer)
         throw std::runtime_error("Failed to allocate metadata read buffer");
     // Read superblock
     GET_SQE();
     data->iov = { metadata_buffer, bs->meta_block_size };
-    data->callback = [this](ring_data_t *data) { handle_event(data); };
+    data->callback = [this](ring_data_t *data) { handle_event(data, -1); };
     my_uring_prep_readv(sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset);
     bs->ringloop->submit();
     submitted = 1;
@@ -88,7 +90,7 @@ resume_1:
             printf("Initializing metadata area\n");
             GET_SQE();
             data->iov = (struct iovec){ metadata_buffer, bs->meta_block_size };
-            data->callback = [this](ring_data_t *data) { handle_event(data); };
+            data->callback = [this](ring_data_t *data) { handle_event(data, -1); };
             my_uring_prep_writev(sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset);
             bs->ringloop->submit();
             submitted = 1;
@@ -131,60 +133,76 @@ resume_1:
     }
     // Skip superblock
     bs->meta_offset += bs->meta_block_size;
-    prev_done = 0;
-    done_len = 0;
-    done_pos = 0;
+    if (bs->lazy_meta_state)
+    {
+        // The journal is replayed first, entries are then loaded between other operations
+        wait_state = 5;
+        return 2;
+    }
+resume_5:
     metadata_read = 0;
-    // Read the rest of the metadata
+    // Read the rest of the metadata with <meta_init_iodepth> parallel requests to keep the device busy
+    // while entries are being handled. Entries may be handled in any order because duplicate entries
+    // of the same object are resolved by comparing their versions.
+    reads.resize(bs->meta_init_iodepth);
+    for (int i = 0; i < reads.size(); i++)
+    {
+        reads[i].state = 0;
+    }
     while (1)
     {
     resume_2:
-        if (submitted)
-        {
-            wait_state = 2;
-            return 1;
-        }
-        if (metadata_read < bs->meta_len)
+        for (int i = 0; i < reads.size(); i++)
         {
-            GET_SQE();
-            data->iov = {
-                metadata_buffer + (bs->inmemory_meta
-                    ? metadata_read
-                    : (prev == 1 ? bs->metadata_buf_size : 0)),
-                bs->meta_len - metadata_read > bs->metadata_buf_size ? bs->metadata_buf_size : bs->meta_len - metadata_read,
-            };
-            data->callback = [this](ring_data_t *data) { handle_event(data); };
-            if (!zero_on_init)
-                my_uring_prep_readv(sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + metadata_read);
-            else
+            if (reads[i].state == 2)
             {
-                // Fill metadata with zeroes
-                memset(data->iov.iov_base, 0, data->iov.iov_len);
-                my_uring_prep_writev(sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + metadata_read);
+                // handle <count> entries in each block
+                unsigned count = bs->meta_block_size / bs->clean_entry_size;
+                void *done_buf = bs->inmemory_meta ? (metadata_buffer + reads[i].pos) : reads[i].buf;
+                done_cnt = reads[i].pos / bs->meta_block_size * count;
+                for (uint64_t sector = 0; sector < reads[i].len; sector += bs->meta_block_size)
+                {
+                    handle_entries(done_buf + sector, count, bs->block_order);
+                    done_cnt += count;
+                }
+                reads[i].state = 0;
             }
-            bs->ringloop->submit();
-            submitted = (prev == 1 ? 2 : 1);
-            prev = submitted;
-        }
-        if (prev_done)
-        {
-            void *done_buf = bs->inmemory_meta
-                ? (metadata_buffer + done_pos)
-                : (metadata_buffer + (prev_done == 2 ? bs->metadata_buf_size : 0));
-            unsigned count = bs->meta_block_size / bs->clean_entry_size;
-            for (int sector = 0; sector < done_len; sector += bs->meta_block_size)
+            if (reads[i].state == 0 && metadata_read < bs->meta_len)
             {
-                // handle <count> entries
-                handle_entries(done_buf + sector, count, bs->block_order);
-                done_cnt += count;
+                sqe = bs->get_sqe();
+                if (!sqe)
+                {
+                    // The ring is full of other operations, retry after some of them complete
+                    break;
+                }
+                data = ((ring_data_t*)sqe->user_data);
+                reads[i].pos = metadata_read;
+                reads[i].len = bs->meta_len - metadata_read > bs->metadata_buf_size ? bs->metadata_buf_size : bs->meta_len - metadata_read;
+                reads[i].buf = bs->inmemory_meta
+                    ? metadata_buffer + metadata_read
+                    : metadata_buffer + i*bs->metadata_buf_size;
+                reads[i].state = 1;
+                metadata_read += reads[i].len;
+                data->iov = { reads[i].buf, reads[i].len };
+                data->callback = [this, i](ring_data_t *data) { handle_event(data, i); };
+                if (!zero_on_init)
+                    my_uring_prep_readv(sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + reads[i].pos);
+                else
+                {
+                    // Fill metadata with zeroes
+                    memset(data->iov.iov_base, 0, data->iov.iov_len);
+                    my_uring_prep_writev(sqe, bs->meta_fd, &data->iov, 1, bs->meta_offset + reads[i].pos);
+                }
+                bs->ringloop->submit();
+                submitted++;
             }
-            prev_done = 0;
-            done_len = 0;
         }
-        if (!submitted)
+        if (!submitted && metadata_read >= bs->meta_len)
         {
             break;
         }
+        wait_state = 2;
+        return 1;
     }
     // metadata read finished
     printf("Metadata entries loaded: %lu, free blocks: %lu / %lu\n", entries_loaded, bs->data_alloc->get_free_count(), bs->block_count);
@@ -198,7 +216,7 @@ resume_1:
         GET_SQE();
         my_uring_prep_fsync(sqe, bs->meta_fd, IORING_FSYNC_DATASYNC);
         data->iov = { 0 };
-        data->callback = [this](ring_data_t *data) { handle_event(data); };
+        data->callback = [this](ring_data_t *data) { handle_event(data, -1); };
         submitted = 1;
         bs->ringloop->submit();
     resume_4:
@@ -222,10 +240,11 @@ void blockstore_init_meta::handle_entries(void* entries, unsigned count, int blo
         }
         if (entry->oid.inode > 0)
         {
-            auto clean_it = bs->clean_db.find(entry->oid);
-            if (clean_it == bs->clean_db.end() || clean_it->second.version < entry->version)
+            auto & clean_db = bs->modify_clean_db_shard(entry->oid);
+            auto clean_it = clean_db.find(entry->oid);
+            if (clean_it == clean_db.end() || clean_it->second.version < entry->version)
             {
-                if (clean_it != bs->clean_db.end())
+                if (clean_it != clean_db.end())
                 {
                     // free the previous block
 #ifdef BLOCKSTORE_DEBUG
@@ -245,7 +264,7 @@ void blockstore_init_meta::handle_entries(void* entries, unsigned count, int blo
                 printf("Allocate block (clean entry) %lu: %lx:%lx v%lu\n", done_cnt+i, entry->oid.inode, entry->oid.stripe, entry->version);
 #endif
                 bs->data_alloc->set(done_cnt+i, true);
-                bs->clean_db[entry->oid] = (struct clean_entry){
+                clean_db[entry->oid] = (struct clean_entry){
                     .version = entry->version,
                     .location = (done_cnt+i) << block_order,
                 };
@@ -274,28 +293,24 @@ blockstore_init_journal::blockstore_init_journal(blockstore_impl_t *bs)
     };
 }
 
-void blockstore_init_journal::handle_event(ring_data_t *data1)
+void blockstore_init_journal::handle_event(ring_data_t *data1, void *buf)
 {
-    if (data1->res <= 0)
-    {
-        throw std::runtime_error(
-            std::string("read journal failed at offset ") + std::to_string(journal_pos) +
-            std::string(": ") + strerror(-data1->res)
-        );
-    }
-    done.push_back({
-        .buf = submitted_buf,
-        .pos = journal_pos,
-        .len = (uint64_t)data1->res,
-    });
-    journal_pos += data1->res;
-    if (journal_pos >= bs->journal.len)
+    for (auto & e: done)
     {
-        // Continue from the beginning
-        journal_pos = bs->journal.block_size;
-        wrapped = true;
+        if (e.buf == buf)
+        {
+            if (data1->res != e.len)
+            {
+                throw std::runtime_error(
+                    std::string("read journal failed at offset ") + std::to_string(e.pos) +
+                    std::string(": ") + (data1->res < 0 ? strerror(-data1->res) : "short read")
+                );
+            }
+            e.ready = true;
+            break;
+        }
     }
-    submitted_buf = NULL;
+    submitted_count--;
 }
 
 int blockstore_init_journal::loop()
@@ -422,34 +437,41 @@ resume_1:
             free(submitted_buf);
         submitted_buf = NULL;
         crc32_last = 0;
-        // Read journal
+        // Read journal with <journal_init_iodepth> parallel requests,
+        // entries of already read buffers are checked and replayed while the next reads are in flight
         while (1)
         {
         resume_2:
-            if (submitted_buf)
-            {
-                wait_state = 2;
-                return 1;
-            }
-            if (!wrapped || journal_pos < bs->journal.used_start)
+            while (submitted_count < bs->journal_init_iodepth && (!wrapped || journal_pos < bs->journal.used_start))
             {
                 GET_SQE();
                 uint64_t end = bs->journal.len;
                 if (journal_pos < bs->journal.used_start)
                     end = bs->journal.used_start;
-                if (!bs->journal.inmemory)
-                    submitted_buf = memalign_or_die(MEM_ALIGNMENT, JOURNAL_BUFFER_SIZE);
-                else
-                    submitted_buf = bs->journal.buffer + journal_pos;
-                data->iov = {
-                    submitted_buf,
-                    end - journal_pos < JOURNAL_BUFFER_SIZE ? end - journal_pos : JOURNAL_BUFFER_SIZE,
-                };
-                data->callback = [this](ring_data_t *data1) { handle_event(data1); };
+                void *buf = bs->journal.inmemory
+                    ? bs->journal.buffer + journal_pos
+                    : memalign_or_die(MEM_ALIGNMENT, JOURNAL_BUFFER_SIZE);
+                uint64_t len = end - journal_pos < JOURNAL_BUFFER_SIZE ? end - journal_pos : JOURNAL_BUFFER_SIZE;
+                done.push_back({
+                    .buf = buf,
+                    .pos = journal_pos,
+                    .len = len,
+                    .ready = false,
+                });
+                data->iov = { buf, len };
+                data->callback = [this, buf](ring_data_t *data1) { handle_event(data1, buf); };
                 my_uring_prep_readv(sqe, bs->journal.fd, &data->iov, 1, bs->journal.offset + journal_pos);
                 bs->ringloop->submit();
+                submitted_count++;
+                journal_pos += len;
+                if (journal_pos >= bs->journal.len)
+                {
+                    // Continue from the beginning
+                    journal_pos = bs->journal.block_size;
+                    wrapped = true;
+                }
             }
-            while (done.size() > 0)
+            while (done.size() > 0 && done[0].ready)
             {
                 handle_res = handle_journal_part(done[0].buf, done[0].pos, done[0].len);
                 if (handle_res == 0)
@@ -486,9 +508,9 @@ resume_1:
                             return 1;
                         }
                     }
-                    // wait for the next read to complete, then stop
+                    // wait for the remaining reads to complete, then stop
                 resume_3:
-                    if (submitted_buf)
+                    if (submitted_count > 0)
                     {
                         wait_state = 3;
                         return 1;
@@ -515,16 +537,19 @@ resume_1:
                     break;
                 }
             }
-            if (!submitted_buf)
+            if (!submitted_count)
             {
                 break;
             }
+            wait_state = 2;
+            return 1;
         }
     }
     for (auto ov: double_allocs)
     {
-        auto dirty_it = bs->dirty_db.find(ov);
-        if (dirty_it != bs->dirty_db.end() &&
+        auto & dirty_db = bs->dirty_db_shard(ov.oid);
+        auto dirty_it = dirty_db.find(ov);
+        if (dirty_it != dirty_db.end() &&
             IS_BIG_WRITE(dirty_it->second.state) &&
             dirty_it->second.location == UINT64_MAX)
         {
@@ -625,7 +650,7 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                 {
                     // this case is even more interesting because we must carry data crc32 check to next buffer(s)
                     uint64_t covered = 0;
-                    for (int i = 0; i < done.size(); i++)
+                    for (int i = 0; i < done.size() && done[i].ready; i++)
                     {
                         if (location+je->small_write.len > done[i].pos &&
                             location < done[i].pos+done[i].len)
@@ -656,8 +681,9 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                     init_write_sector = proc_pos;
                     return 0;
                 }
-                auto clean_it = bs->clean_db.find(je->small_write.oid);
-                if (clean_it == bs->clean_db.end() ||
+                auto & clean_db = bs->clean_db_shard(je->small_write.oid);
+                auto clean_it = clean_db.find(je->small_write.oid);
+                if (clean_it == clean_db.end() ||
                     clean_it->second.version < je->small_write.version)
                 {
                     obj_ver_id ov = {
@@ -673,13 +699,12 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                     else
                     {
                         // FIXME Using large blockstore objects will result in a lot of small
-                        // allocations for entry bitmaps. This can only be fixed by using
-                        // a patched map with dynamic entry size, but not the btree_map,
-                        // because it doesn't keep iterators valid all the time.
+                        // allocations for entry bitmaps. dirty_db is a btree_map now, so it
+                        // could store bitmaps inline if it supported a dynamic entry size.
                         bmp = malloc_or_die(bs->clean_entry_bitmap_size);
                         memcpy(bmp, bmp_from, bs->clean_entry_bitmap_size);
                     }
-                    bs->dirty_db.emplace(ov, (dirty_entry){
+                    bs->dirty_db_shard(ov.oid).emplace(ov, (dirty_entry){
                         .state = (BS_ST_SMALL_WRITE | BS_ST_SYNCED),
                         .flags = 0,
                         .location = location,
@@ -712,11 +737,12 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                     je->big_write.oid.inode, je->big_write.oid.stripe, je->big_write.version, je->big_write.location >> bs->block_order
                 );
 #endif
-                auto dirty_it = bs->dirty_db.upper_bound((obj_ver_id){
+                auto & dirty_db = bs->dirty_db_shard(je->big_write.oid);
+                auto dirty_it = dirty_db.upper_bound((obj_ver_id){
                     .oid = je->big_write.oid,
                     .version = UINT64_MAX,
                 });
-                if (dirty_it != bs->dirty_db.begin() && bs->dirty_db.size() > 0)
+                if (dirty_it != dirty_db.begin() && dirty_db.size() > 0)
                 {
                     dirty_it--;
                     if (dirty_it->first.oid == je->big_write.oid &&
@@ -735,8 +761,9 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         erase_dirty_object(dirty_it);
                     }
                 }
-                auto clean_it = bs->clean_db.find(je->big_write.oid);
-                if (clean_it == bs->clean_db.end() ||
+                auto & clean_db = bs->clean_db_shard(je->big_write.oid);
+                auto clean_it = clean_db.find(je->big_write.oid);
+                if (clean_it == clean_db.end() ||
                     clean_it->second.version < je->big_write.version)
                 {
                     // oid, version, block
@@ -753,13 +780,12 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                     else
                     {
                         // FIXME Using large blockstore objects will result in a lot of small
-                        // allocations for entry bitmaps. This can only be fixed by using
-                        // a patched map with dynamic entry size, but not the btree_map,
-                        // because it doesn't keep iterators valid all the time.
+                        // allocations for entry bitmaps. dirty_db is a btree_map now, so it
+                        // could store bitmaps inline if it supported a dynamic entry size.
                         bmp = malloc_or_die(bs->clean_entry_bitmap_size);
                         memcpy(bmp, bmp_from, bs->clean_entry_bitmap_size);
                     }
-                    auto dirty_it = bs->dirty_db.emplace(ov, (dirty_entry){
+                    auto dirty_it = dirty_db.emplace(ov, (dirty_entry){
                         .state = (BS_ST_BIG_WRITE | BS_ST_SYNCED),
                         .flags = 0,
                         .location = je->big_write.location,
@@ -768,7 +794,8 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         .journal_sector = proc_pos,
                         .bitmap = bmp,
                     }).first;
-                    if (bs->data_alloc->get(je->big_write.location >> bs->block_order))
+                    // Allocations can't be checked when the journal is replayed before loading metadata
+                    if (bs->lazy_meta_state != 1 && bs->data_alloc->get(je->big_write.location >> bs->block_order))
                     {
                         // This is probably a big_write that's already flushed and freed, but it may
                         // also indicate a bug. So we remember such entries and recheck them afterwards.
@@ -832,17 +859,19 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                 printf("je_delete oid=%lx:%lx ver=%lu\n", je->del.oid.inode, je->del.oid.stripe, je->del.version);
 #endif
                 bool dirty_exists = false;
-                auto dirty_it = bs->dirty_db.upper_bound((obj_ver_id){
+                auto & dirty_db = bs->dirty_db_shard(je->del.oid);
+                auto dirty_it = dirty_db.upper_bound((obj_ver_id){
                     .oid = je->del.oid,
                     .version = UINT64_MAX,
                 });
-                if (dirty_it != bs->dirty_db.begin())
+                if (dirty_it != dirty_db.begin())
                 {
                     dirty_it--;
                     dirty_exists = dirty_it->first.oid == je->del.oid;
                 }
-                auto clean_it = bs->clean_db.find(je->del.oid);
-                bool clean_exists = (clean_it != bs->clean_db.end() &&
+                auto & clean_db = bs->clean_db_shard(je->del.oid);
+                auto clean_it = clean_db.find(je->del.oid);
+                bool clean_exists = (clean_it != clean_db.end() &&
                     clean_it->second.version < je->del.version);
                 if (!clean_exists && dirty_exists)
                 {
@@ -857,7 +886,7 @@ int blockstore_init_journal::handle_journal_part(void *buf, uint64_t done_pos, u
                         .oid = je->del.oid,
                         .version = je->del.version,
                     };
-                    bs->dirty_db.emplace(ov, (dirty_entry){
+                    dirty_db.emplace(ov, (dirty_entry){
                         .state = (BS_ST_DELETE | BS_ST_SYNCED),
                         .flags = 0,
                         .location = 0,
@@ -886,11 +915,12 @@ void blockstore_init_journal::erase_dirty_object(blockstore_dirty_db_t::iterator
 {
     auto oid = dirty_it->first.oid;
     bool exists = !IS_DELETE(dirty_it->second.state);
+    auto & dirty_db = bs->dirty_db_shard(oid);
     auto dirty_end = dirty_it;
     dirty_end++;
     while (1)
     {
-        if (dirty_it == bs->dirty_db.begin())
+        if (dirty_it == dirty_db.begin())
         {
             break;
         }
@@ -901,8 +931,9 @@ void blockstore_init_journal::erase_dirty_object(blockstore_dirty_db_t::iterator
             break;
         }
     }
-    auto clean_it = bs->clean_db.find(oid);
-    uint64_t clean_loc = clean_it != bs->clean_db.end()
+    auto & clean_db = bs->clean_db_shard(oid);
+    auto clean_it = clean_db.find(oid);
+    uint64_t clean_loc = clean_it != clean_db.end()
         ? clean_it->second.location : UINT64_MAX;
     if (exists && clean_loc == UINT64_MAX)
     {
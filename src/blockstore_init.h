@@ -3,6 +3,14 @@
 
 #pragma once
 
+struct bs_init_meta_read
+{
+    void *buf;
+    uint64_t pos, len;
+    // 0 = free, 1 = submitted, 2 = done
+    int state;
+};
+
 class blockstore_init_meta
 {
     blockstore_impl_t *bs;
@@ -10,13 +18,14 @@ class blockstore_init_meta
     bool zero_on_init = false;
     void *metadata_buffer = NULL;
     uint64_t metadata_read = 0;
-    int prev = 0, prev_done = 0, done_len = 0, submitted = 0;
-    uint64_t done_cnt = 0, done_pos = 0;
+    int submitted = 0;
+    std::vector<bs_init_meta_read> reads;
+    uint64_t done_cnt = 0;
     uint64_t entries_loaded = 0;
     struct io_uring_sqe *sqe;
     struct ring_data_t *data;
     void handle_entries(void *entries, unsigned count, int block_order);
-    void handle_event(ring_data_t *data);
+    void handle_event(ring_data_t *data, int read_idx);
 public:
     blockstore_init_meta(blockstore_impl_t *bs);
     int loop();
@@ -26,12 +35,13 @@ struct bs_init_journal_done
 {
     void *buf;
     uint64_t pos, len;
+    bool ready;
 };
 
 class blockstore_init_journal
 {
     blockstore_impl_t *bs;
-    int wait_state = 0, wait_count = 0, handle_res = 0;
+    int wait_state = 0, wait_count = 0, handle_res = 0, submitted_count = 0;
     uint64_t entries_loaded = 0;
     uint32_t crc32_last = 0;
     bool started = false;
@@ -49,7 +59,7 @@ class blockstore_init_journal
     journal_entry_start *je_start;
     std::function<void(ring_data_t*)> simple_callback;
     int handle_journal_part(void *buf, uint64_t done_pos, uint64_t len);
-    void handle_event(ring_data_t *data);
+    void handle_event(ring_data_t *data, void *buf);
     void erase_dirty_object(blockstore_dirty_db_t::iterator dirty_it);
 public:
     blockstore_init_journal(blockstore_impl_t* bs);
@@ -56,6 +56,8 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config)
         immediate_commit = IMMEDIATE_SMALL;
     }
     metadata_buf_size = strtoull(config["meta_buf_size"].c_str(), NULL, 10);
+    meta_init_iodepth = strtoull(config["meta_init_iodepth"].c_str(), NULL, 10);
+    journal_init_iodepth = strtoull(config["journal_init_iodepth"].c_str(), NULL, 10);
     cfg_journal_size = strtoull(config["journal_size"].c_str(), NULL, 10);
     data_device = config["data_device"];
     data_offset = strtoull(config["data_offset"].c_str(), NULL, 10);
@@ -64,6 +66,7 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config)
     meta_offset = strtoull(config["meta_offset"].c_str(), NULL, 10);
     block_size = strtoull(config["block_size"].c_str(), NULL, 10);
     inmemory_meta = config["inmemory_metadata"] != "false";
+    lazy_meta_load = config["lazy_meta_load"] == "true" || config["lazy_meta_load"] == "1" || config["lazy_meta_load"] == "yes";
     journal_device = config["journal_device"];
     journal.offset = strtoull(config["journal_offset"].c_str(), NULL, 10);
     journal.sector_count = strtoull(config["journal_sector_buffer_count"].c_str(), NULL, 10);
@@ -78,6 +81,9 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config)
     if (!max_flusher_count)
         max_flusher_count = strtoull(config["flusher_count"].c_str(), NULL, 10);
     min_flusher_count = strtoull(config["min_flusher_count"].c_str(), NULL, 10);
+    flusher_sort_window = strtoull(config["flusher_sort_window"].c_str(), NULL, 10);
+    register_buffers = config["register_buffers"] == "true" || config["register_buffers"] == "1" || config["register_buffers"] == "yes";
+    flusher_adaptive = config["flusher_adaptive"] == "true" || config["flusher_adaptive"] == "1" || config["flusher_adaptive"] == "yes";
     max_write_iodepth = strtoull(config["max_write_iodepth"].c_str(), NULL, 10);
     throttle_small_writes = config["throttle_small_writes"] == "true" || config["throttle_small_writes"] == "1" || config["throttle_small_writes"] == "yes";
     throttle_target_iops = strtoull(config["throttle_target_iops"].c_str(), NULL, 10);
@@ -101,6 +107,11 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config)
     {
         min_flusher_count = 1;
     }
+    if (journal.flush_journal)
+    {
+        // Nothing to serve while flushing the journal
+        lazy_meta_load = false;
+    }
     if (!max_write_iodepth)
     {
         max_write_iodepth = 128;
@@ -169,6 +180,14 @@ void blockstore_impl_t::parse_config(blockstore_config_t & config)
     {
         metadata_buf_size = 4*1024*1024;
     }
+    if (!meta_init_iodepth)
+    {
+        meta_init_iodepth = 4;
+    }
+    if (!journal_init_iodepth)
+    {
+        journal_init_iodepth = 4;
+    }
     if (meta_device == "")
     {
         disable_meta_fsync = disable_data_fsync;
@@ -274,6 +293,22 @@ void blockstore_impl_t::calc_lengths()
         if (!clean_bitmap)
             throw std::runtime_error("Failed to allocate memory for the metadata sparse write bitmap");
     }
+#ifdef BLOCKSTORE_COMPACT_CLEAN_DB
+    if (!inmemory_meta)
+    {
+        throw std::runtime_error("Compact clean_db requires inmemory_metadata");
+    }
+    if (block_count > UINT32_MAX)
+    {
+        throw std::runtime_error("Compact clean_db supports at most 2^32 data blocks, use larger block_size");
+    }
+    clean_db_meta = (clean_db_meta_t){
+        .buffer = (uint8_t*)metadata_buffer,
+        .meta_block_size = meta_block_size,
+        .clean_entry_size = clean_entry_size,
+        .block_order = block_order,
+    };
+#endif
     // requested journal size
     if (cfg_journal_size > journal.len)
     {
@@ -30,7 +30,7 @@ int blockstore_impl_t::fulfill_read_push(blockstore_op_t *op, void *buf, uint64_
     BS_SUBMIT_GET_SQE(sqe, data);
     data->iov = (struct iovec){ buf, len };
     PRIV(op)->pending_ops++;
-    my_uring_prep_readv(
+    ringloop->prep_readv(
         sqe,
         IS_JOURNAL(item_state) ? journal.fd : data_fd,
         &data->iov, 1,
@@ -111,7 +111,14 @@ uint8_t* blockstore_impl_t::get_clean_entry_bitmap(uint64_t block_loc, int offse
 
 int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
 {
+    if (lazy_meta_state == 2)
+    {
+        // The journal is being replayed again
+        return 0;
+    }
+    auto & clean_db = clean_db_shard(read_op->oid);
     auto clean_it = clean_db.find(read_op->oid);
+    auto & dirty_db = dirty_db_shard(read_op->oid);
     auto dirty_it = dirty_db.upper_bound((obj_ver_id){
         .oid = read_op->oid,
         .version = UINT64_MAX,
@@ -120,6 +127,11 @@ int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
         dirty_it--;
     bool clean_found = clean_it != clean_db.end();
     bool dirty_found = (dirty_it != dirty_db.end() && dirty_it->first.oid == read_op->oid);
+    if (lazy_meta_state && !dirty_found)
+    {
+        // Metadata isn't loaded yet
+        return 0;
+    }
     if (!clean_found && !dirty_found)
     {
         // region is not allocated - return zeroes
@@ -170,6 +182,14 @@ int blockstore_impl_t::dequeue_read(blockstore_op_t *read_op)
             dirty_it--;
         }
     }
+    if (lazy_meta_state && fulfilled < read_op->len)
+    {
+        // The first journal replay keeps entries of objects that are already flushed, but their newest
+        // versions are always present, so reads covered by journal entries are correct. Other reads
+        // need metadata, wait for it
+        PRIV(read_op)->read_vec.clear();
+        return 0;
+    }
     if (clean_it != clean_db.end())
     {
         if (!result_version)
@@ -271,6 +291,7 @@ void blockstore_impl_t::handle_read_event(ring_data_t *data, blockstore_op_t *op
 
 int blockstore_impl_t::read_bitmap(object_id oid, uint64_t target_version, void *bitmap, uint64_t *result_version)
 {
+    auto & dirty_db = dirty_db_shard(oid);
     auto dirty_it = dirty_db.upper_bound((obj_ver_id){
         .oid = oid,
         .version = UINT64_MAX,
@@ -297,6 +318,7 @@ int blockstore_impl_t::read_bitmap(object_id oid, uint64_t target_version, void
             dirty_it--;
         }
     }
+    auto & clean_db = clean_db_shard(oid);
     auto clean_it = clean_db.find(oid);
     if (clean_it != clean_db.end())
     {
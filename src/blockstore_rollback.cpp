@@ -19,6 +19,7 @@ int blockstore_impl_t::dequeue_rollback(blockstore_op_t *op)
         }
         // Check that there are some versions greater than v->version (which may be zero),
         // check that they're unstable, synced, and not currently written to
+        auto & dirty_db = dirty_db_shard(v->oid);
         auto dirty_it = dirty_db.lower_bound((obj_ver_id){
             .oid = v->oid,
             .version = UINT64_MAX,
@@ -136,6 +137,7 @@ resume_4:
 
 void blockstore_impl_t::mark_rolled_back(const obj_ver_id & ov)
 {
+    auto & dirty_db = dirty_db_shard(ov.oid);
     auto it = dirty_db.lower_bound((obj_ver_id){
         .oid = ov.oid,
         .version = UINT64_MAX,
@@ -185,6 +187,7 @@ void blockstore_impl_t::erase_dirty(blockstore_dirty_db_t::iterator dirty_start,
     {
         return;
     }
+    auto & dirty_db = dirty_db_shard(dirty_start->first.oid);
     auto dirty_it = dirty_end;
     dirty_it--;
     if (IS_DELETE(dirty_it->second.state))
@@ -51,9 +51,11 @@ int blockstore_impl_t::dequeue_stable(blockstore_op_t *op)
     int i, todo = 0;
     for (i = 0, v = (obj_ver_id*)op->buf; i < op->len; i++, v++)
     {
+        auto & dirty_db = dirty_db_shard(v->oid);
         auto dirty_it = dirty_db.find(*v);
         if (dirty_it == dirty_db.end())
         {
+            auto & clean_db = clean_db_shard(v->oid);
             auto clean_it = clean_db.find(v->oid);
             if (clean_it == clean_db.end() || clean_it->second.version < v->version)
             {
@@ -164,6 +166,7 @@ resume_4:
 
 void blockstore_impl_t::mark_stable(const obj_ver_id & v, bool forget_dirty)
 {
+    auto & dirty_db = dirty_db_shard(v.oid);
     auto dirty_it = dirty_db.find(v);
     if (dirty_it != dirty_db.end())
     {
@@ -188,6 +191,7 @@ void blockstore_impl_t::mark_stable(const obj_ver_id & v, bool forget_dirty)
                     }
                     if (exists == -1)
                     {
+                        auto & clean_db = clean_db_shard(v.oid);
                         auto clean_it = clean_db.find(v.oid);
                         exists = clean_it != clean_db.end() ? 1 : 0;
                     }
@@ -215,6 +219,7 @@ void blockstore_impl_t::mark_stable(const obj_ver_id & v, bool forget_dirty)
                         break;
                     }
                 }
+                auto & clean_db = clean_db_shard(v.oid);
                 auto clean_it = clean_db.find(v.oid);
                 uint64_t clean_loc = clean_it != clean_db.end()
                     ? clean_it->second.location : UINT64_MAX;
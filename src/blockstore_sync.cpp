@@ -96,7 +96,10 @@ int blockstore_impl_t::continue_sync(blockstore_op_t *op, bool queue_has_in_prog
                 prepare_journal_sector_write(journal.cur_sector, op);
                 s++;
             }
-            auto & dirty_entry = dirty_db.at(*it);
+            auto & dirty_db = dirty_db_shard(it->oid);
+            auto dirty_it = dirty_db.find(*it);
+            assert(dirty_it != dirty_db.end());
+            auto & dirty_entry = dirty_it->second;
             journal_entry_big_write *je = (journal_entry_big_write*)prefill_single_journal_entry(
                 journal, (dirty_entry.state & BS_ST_INSTANT) ? JE_BIG_WRITE_INSTANT : JE_BIG_WRITE,
                 sizeof(journal_entry_big_write) + clean_entry_bitmap_size
@@ -163,6 +166,7 @@ void blockstore_impl_t::ack_sync(blockstore_op_t *op)
 #endif
         auto & unstab = unstable_writes[it->oid];
         unstab = unstab < it->version ? it->version : unstab;
+        auto & dirty_db = dirty_db_shard(it->oid);
         auto dirty_it = dirty_db.find(*it);
         dirty_it->second.state = ((dirty_it->second.state & ~BS_ST_WORKFLOW_MASK) | BS_ST_SYNCED);
         if (dirty_it->second.state & BS_ST_INSTANT)
@@ -186,6 +190,7 @@ void blockstore_impl_t::ack_sync(blockstore_op_t *op)
 #endif
         auto & unstab = unstable_writes[it->oid];
         unstab = unstab < it->version ? it->version : unstab;
+        auto & dirty_db = dirty_db_shard(it->oid);
         if (dirty_db[*it].state == (BS_ST_DELETE | BS_ST_WRITTEN))
         {
             dirty_db[*it].state = (BS_ST_DELETE | BS_ST_SYNCED);
@@ -14,6 +14,7 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
     {
         bmp = calloc_or_die(1, clean_entry_bitmap_size);
     }
+    auto & dirty_db = dirty_db_shard(op->oid);
     if (dirty_db.size() > 0)
     {
         auto dirty_it = dirty_db.upper_bound((obj_ver_id){
@@ -41,6 +42,7 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
     }
     if (!found)
     {
+        auto & clean_db = clean_db_shard(op->oid);
         auto clean_it = clean_db.find(op->oid);
         if (clean_it != clean_db.end())
         {
@@ -172,11 +174,12 @@ bool blockstore_impl_t::enqueue_write(blockstore_op_t *op)
 
 void blockstore_impl_t::cancel_all_writes(blockstore_op_t *op, blockstore_dirty_db_t::iterator dirty_it, int retval)
 {
+    auto & dirty_db = dirty_db_shard(op->oid);
     while (dirty_it != dirty_db.end() && dirty_it->first.oid == op->oid)
     {
         if (clean_entry_bitmap_size > sizeof(void*))
             free(dirty_it->second.bitmap);
-        dirty_db.erase(dirty_it++);
+        dirty_it = dirty_db.erase(dirty_it);
     }
     bool found = false;
     for (auto other_op: submit_queue)
@@ -202,6 +205,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
     {
         return continue_write(op);
     }
+    auto & dirty_db = dirty_db_shard(op->oid);
     auto dirty_it = dirty_db.find((obj_ver_id){
         .oid = op->oid,
         .version = op->version,
@@ -255,7 +259,9 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
             return 0;
         }
         // Big (redirect) write
-        uint64_t loc = data_alloc->find_free();
+        auto hint_it = inode_alloc_hints.find(op->oid.inode);
+        uint64_t loc = hint_it != inode_alloc_hints.end()
+            ? data_alloc->find_free(hint_it->second+1) : data_alloc->find_free();
         if (loc == UINT64_MAX)
         {
             // no space
@@ -279,6 +285,18 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         );
 #endif
         data_alloc->set(loc, true);
+        if (hint_it != inode_alloc_hints.end())
+        {
+            hint_it->second = loc;
+        }
+        else
+        {
+            if (inode_alloc_hints.size() >= MAX_INODE_ALLOC_HINTS)
+            {
+                inode_alloc_hints.clear();
+            }
+            inode_alloc_hints[op->oid.inode] = loc;
+        }
         uint64_t stripe_offset = (op->offset % bitmap_granularity);
         uint64_t stripe_end = (op->offset + op->len) % bitmap_granularity;
         // Zero fill up to bitmap_granularity
@@ -295,7 +313,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
         }
         data->iov.iov_len = op->len + stripe_offset + stripe_end; // to check it in the callback
         data->callback = [this, op](ring_data_t *data) { handle_write_event(data, op); };
-        my_uring_prep_writev(
+        ringloop->prep_writev(
             sqe, data_fd, PRIV(op)->iov_zerofill, vcnt, data_offset + (loc << block_order) + op->offset - stripe_offset
         );
         PRIV(op)->pending_ops = 1;
@@ -385,7 +403,7 @@ int blockstore_impl_t::dequeue_write(blockstore_op_t *op)
             BS_SUBMIT_GET_SQE(sqe2, data2);
             data2->iov = (struct iovec){ op->buf, op->len };
             data2->callback = cb;
-            my_uring_prep_writev(
+            ringloop->prep_writev(
                 sqe2, journal.fd, &data2->iov, 1, journal.offset + journal.next_free
             );
             PRIV(op)->pending_ops++;
@@ -432,6 +450,7 @@ resume_2:
     // Only for the immediate_commit mode: prepare and submit big_write journal entry
     {
         BS_SUBMIT_CHECK_SQES(1);
+        auto & dirty_db = dirty_db_shard(op->oid);
         auto dirty_it = dirty_db.find((obj_ver_id){
             .oid = op->oid,
             .version = op->version,
@@ -465,6 +484,7 @@ resume_2:
 resume_4:
     // Switch object state
     {
+        auto & dirty_db = dirty_db_shard(op->oid);
         auto dirty_it = dirty_db.find((obj_ver_id){
             .oid = op->oid,
             .version = op->version,
@@ -535,9 +555,11 @@ resume_4:
             uint64_t journal_free_space = journal.next_free < used_start
                 ? (used_start - journal.next_free)
                 : (journal.len - journal.next_free + used_start - journal.block_size);
+            int target_iops = throttle_adapted_iops ? throttle_adapted_iops : throttle_target_iops;
+            int target_parallelism = throttle_adapted_parallelism ? throttle_adapted_parallelism : throttle_target_parallelism;
             uint64_t ref_us =
-                (write_iodepth <= throttle_target_parallelism ? 100 : 100*write_iodepth/throttle_target_parallelism)
-                * (1000000/throttle_target_iops + op->len*1000000/throttle_target_mbs/1024/1024)
+                (write_iodepth <= target_parallelism ? 100 : 100*write_iodepth/target_parallelism)
+                * (1000000/target_iops + op->len*1000000/throttle_target_mbs/1024/1024)
                 / 100;
             ref_us -= ref_us * journal_free_space / journal.len;
             if (ref_us > exec_us + throttle_threshold_us)
@@ -619,6 +641,7 @@ int blockstore_impl_t::dequeue_del(blockstore_op_t *op)
     {
         return continue_write(op);
     }
+    auto & dirty_db = dirty_db_shard(op->oid);
     auto dirty_it = dirty_db.find((obj_ver_id){
         .oid = op->oid,
         .version = op->version,
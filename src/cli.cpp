@@ -108,10 +108,13 @@ void cli_tool_t::help()
         "  Create a snapshot of image <name>. May be used live if only a single writer is active.\n"
         "\n"
         "%s modify <name> [--rename <new-name>] [--resize <size>] [--readonly | --readwrite] [-f|--force]\n"
+        "    [--read-iops N] [--write-iops N] [--read-mbs N] [--write-mbs N] [--burst-iops N] [--burst-mbs N]\n"
         "  Rename, resize image or change its readonly status. Images with children can't be made read-write.\n"
         "  If the new size is smaller than the old size, extra data will be purged.\n"
         "  You should resize file system in the image, if present, before shrinking it.\n"
         "  -f|--force  Proceed with shrinking or setting readwrite flag even if the image has children.\n"
+        "  --read-iops, --write-iops, --read-mbs, --write-mbs  Set image QoS limits, 0 removes the limit.\n"
+        "  --burst-iops, --burst-mbs  Set token bucket capacity (default is 1/10 second worth of the limit).\n"
         "\n"
         "%s rm <from> [<to>] [--writers-stopped]\n"
         "  Remove <from> or all layers between <from> and <to> (<to> must be a child of <from>),\n"
@@ -129,10 +132,13 @@ void cli_tool_t::help()
         "                Requires more memory, but allows to show correct removal progress.\n"
         "  --min-offset  Purge only data starting with specified offset.\n"
         "\n"
-        "%s merge-data <from> <to> [--target <target>]\n"
+        "%s merge-data <from> <to> [--target <target>] [--server-copy 1|0]\n"
         "  Merge layer data without changing metadata. Merge <from>..<to> to <target>.\n"
         "  <to> must be a child of <from> and <target> may be one of the layers between\n"
         "  <from> and <to>, including <from> and <to>.\n"
+        "  --server-copy 0  Copy data through the client instead of asking OSDs to copy it\n"
+        "                   (OSDs copy data by default when <target> is <to> and all layers\n"
+        "                   down to <from> are in the same pool).\n"
         "\n"
         "%s alloc-osd\n"
         "  Allocate a new OSD number and reserve it by creating empty /osd/stats/<n> key.\n"
@@ -65,6 +65,11 @@ struct image_lister_t
                 { "inode_num", INODE_NO_POOL(ic.second.num) },
                 { "inode_id", ic.second.num },
             };
+            auto qos = etcd_state_client_t::serialize_inode_qos(&ic.second.qos);
+            if (qos.size())
+            {
+                item["qos"] = qos;
+            }
             if (ic.second.parent_id)
             {
                 auto p_it = parent->cli->st_cli.inode_config.find(ic.second.parent_id);
@@ -36,9 +36,14 @@ struct snap_merger_t
     bool check_delete_source = false;
     // interval between fsyncs
     int fsync_interval = 128;
+    // let OSDs copy data with OSD_OP_COPY instead of reading and writing it through the client
+    // (only possible when merging into <to> and disabled automatically if layers are in different pools)
+    bool server_copy = true;
 
     // -- STATE --
     inode_t target;
+    // lowest merged layer, OSDs don't copy data from layers below it
+    inode_t copy_from = 0;
     int target_rank;
     bool inside_continue = false;
     int state = 0;
@@ -152,6 +157,20 @@ struct snap_merger_t
             use_cas = 0;
         }
         sources.erase(target);
+        // OSDs copy data of parents into the object itself, so they can only merge into <to>,
+        // and only if all layers down to <from> are in the same pool
+        server_copy = server_copy && target == to_cfg->num;
+        copy_from = from_cfg->num;
+        for (inode_config_t *cur = target_cfg; server_copy && cur->num != copy_from; )
+        {
+            auto it = parent->cli->st_cli.inode_config.find(cur->parent_id);
+            if (it == parent->cli->st_cli.inode_config.end() || INODE_POOL(cur->parent_id) != INODE_POOL(target))
+            {
+                server_copy = false;
+                break;
+            }
+            cur = &it->second;
+        }
         printf(
             "Merging %ld layer(s) into target %s%s (inode %lu in pool %u)\n",
             sources.size(), target_cfg->name.c_str(),
@@ -379,11 +398,59 @@ struct snap_merger_t
         // Initialize counter to 1 to later allow write_subop() to return immediately
         // (even though it shouldn't really do that)
         rwo->todo = 1;
-        rwo->buf = malloc(target_block_size);
         rwo->offset = offset;
+        if (server_copy)
+        {
+            rwo_copy(rwo);
+            return;
+        }
+        rwo->buf = malloc(target_block_size);
         rwo_read(rwo);
     }
 
+    // Ask the primary OSD to copy data of lower layers into <target> at <offset>
+    void rwo_copy(snap_rw_op_t *rwo)
+    {
+        cluster_op_t *op = new cluster_op_t;
+        op->opcode = OSD_OP_COPY;
+        op->inode = target;
+        op->offset = rwo->offset;
+        op->len = target_block_size;
+        op->flags = OSD_OP_IGNORE_READONLY;
+        op->copy_from = copy_from;
+        op->callback = [this, rwo](cluster_op_t *op)
+        {
+            int retval = op->retval, len = op->len;
+            delete op;
+            if (retval == -EINTR)
+            {
+                // Target was modified during copying, repeat
+                rwo_copy(rwo);
+                return;
+            }
+            if (retval == -EXDEV || retval == -EINVAL)
+            {
+                // OSDs can't copy it (parents from other pools or an old OSD version)
+                if (server_copy)
+                {
+                    fprintf(stderr, "OSDs can't copy data, copying it through the client\n");
+                    server_copy = false;
+                }
+                rwo->buf = malloc(target_block_size);
+                rwo_read(rwo);
+                return;
+            }
+            if (retval != len)
+            {
+                fprintf(stderr, "error copying data to target at offset %lx: %s\n", rwo->offset, strerror(-retval));
+                exit(1);
+            }
+            rwo->todo--;
+            autofree_op(rwo);
+        };
+        parent->cli->execute(op);
+    }
+
     void rwo_read(snap_rw_op_t *rwo)
     {
         cluster_op_t *op = &rwo->op;
@@ -510,9 +577,9 @@ struct snap_merger_t
     {
         if (!rwo->todo)
         {
-            if (last_written_offset < rwo->op.offset+target_block_size)
+            if (last_written_offset < rwo->offset+target_block_size)
             {
-                last_written_offset = rwo->op.offset+target_block_size;
+                last_written_offset = rwo->offset+target_block_size;
             }
             if (delete_source)
             {
@@ -570,6 +637,8 @@ std::function<bool(void)> cli_tool_t::start_merge(json11::Json cfg)
         merger->fsync_interval = 128;
     if (!cfg["cas"].is_null())
         merger->use_cas = cfg["cas"].uint64_value() ? 2 : 0;
+    if (!cfg["server-copy"].is_null())
+        merger->server_copy = cfg["server-copy"].uint64_value() != 0;
     return [merger]()
     {
         merger->continue_merge_reent();
@@ -5,7 +5,7 @@
 #include "cluster_client.h"
 #include "base64.h"
 
-// Rename, resize image (and purge extra data on shrink) or change its readonly status
+// Rename, resize image (and purge extra data on shrink), change its readonly status or QoS limits
 struct image_changer_t
 {
     cli_tool_t *parent;
@@ -14,6 +14,8 @@ struct image_changer_t
     std::string new_name;
     uint64_t new_size = 0;
     bool set_readonly = false, set_readwrite = false, force = false;
+    // QoS limits to change, in the same format as in etcd
+    json11::Json::object set_qos;
     // interval between fsyncs
     int fsync_interval = 128;
 
@@ -66,7 +68,8 @@ struct image_changer_t
         if ((!set_readwrite || !cfg.readonly) &&
             (!set_readonly || cfg.readonly) &&
             (!new_size || cfg.size == new_size) &&
-            (new_name == "" || new_name == image_name))
+            (new_name == "" || new_name == image_name) &&
+            !set_qos.size())
         {
             printf("No change\n");
             state = 100;
@@ -117,6 +120,15 @@ resume_1:
         {
             cfg.name = new_name;
         }
+        if (set_qos.size())
+        {
+            json11::Json::object qos = etcd_state_client_t::serialize_inode_qos(&cfg.qos);
+            for (auto & kv: set_qos)
+            {
+                qos[kv.first] = kv.second;
+            }
+            cfg.qos = etcd_state_client_t::parse_inode_qos(qos);
+        }
         {
             std::string cur_cfg_key = base64_encode(parent->cli->st_cli.etcd_prefix+
                 "/config/inode/"+std::to_string(INODE_POOL(inode_num))+
@@ -219,6 +231,15 @@ std::function<bool(void)> cli_tool_t::start_modify(json11::Json cfg)
     changer->force = cfg["force"].bool_value();
     changer->set_readonly = cfg["readonly"].bool_value();
     changer->set_readwrite = cfg["readwrite"].bool_value();
+    for (auto key: { "read_iops", "write_iops", "read_mbs", "write_mbs", "burst_iops", "burst_mbs" })
+    {
+        std::string opt = key;
+        opt[opt.find('_')] = '-';
+        if (!cfg[opt].is_null())
+        {
+            changer->set_qos[key] = cfg[opt].uint64_value();
+        }
+    }
     changer->fsync_interval = cfg["fsync-interval"].uint64_value();
     if (!changer->fsync_interval)
         changer->fsync_interval = 128;
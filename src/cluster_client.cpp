@@ -86,11 +86,53 @@ cluster_client_t::cluster_client_t(ring_loop_t *ringloop, timerfd_manager_t *tfd
 
 cluster_client_t::~cluster_client_t()
 {
+    // Callbacks of failed operations must not restart the write-back cache
+    wb_continuing = 1;
+    // Fail operations waiting for the write-back cache
+    std::vector<cluster_op_t*> wb_waiting(wb_queue.begin(), wb_queue.end());
+    wb_queue.clear();
+    for (auto & sp: wb_syncs)
+    {
+        wb_waiting.push_back(sp.second);
+    }
+    wb_syncs.clear();
+    for (auto op: wb_waiting)
+    {
+        op->retval = -EPIPE;
+        std::function<void(cluster_op_t*)>(op->callback)(op);
+    }
+    // Fail operations waiting in QoS queues
+    std::vector<cluster_op_t*> qos_waiting;
+    for (auto & qp: inode_qos)
+    {
+        if (qp.second.timer_id >= 0)
+            tfd->clear_timer(qp.second.timer_id);
+        qos_waiting.insert(qos_waiting.end(), qp.second.queue.begin(), qp.second.queue.end());
+    }
+    inode_qos.clear();
+    qos_waiting.insert(qos_waiting.end(), qos_sync_queue.begin(), qos_sync_queue.end());
+    qos_sync_queue.clear();
+    qos_queued = 0;
+    for (auto op: qos_waiting)
+    {
+        op->retval = -EPIPE;
+        std::function<void(cluster_op_t*)>(op->callback)(op);
+    }
     for (auto bp: dirty_buffers)
     {
         free(bp.second.buf);
     }
     dirty_buffers.clear();
+    for (auto bp: wb_buffers)
+    {
+        free(bp.second.buf);
+    }
+    wb_buffers.clear();
+    for (auto bp: wb_flushing)
+    {
+        free(bp.second.buf);
+    }
+    wb_flushing.clear();
     if (ringloop)
     {
         ringloop->unregister_consumer(&consumer);
@@ -315,6 +357,24 @@ void cluster_client_t::on_load_config_hook(json11::Json::object & config)
     {
         client_max_dirty_ops = DEFAULT_CLIENT_MAX_DIRTY_OPS;
     }
+    // Write-back cache settings may be overridden in the local configuration
+    for (auto key: { "client_enable_writeback", "client_max_buffered_bytes", "client_max_buffered_ops" })
+    {
+        if (!this->config[key].is_null())
+            config[key] = this->config[key];
+    }
+    enable_writeback = config["client_enable_writeback"] == "true" || config["client_enable_writeback"] == "1" ||
+        config["client_enable_writeback"] == "yes" || config["client_enable_writeback"] == true;
+    client_max_buffered_bytes = config["client_max_buffered_bytes"].uint64_value();
+    if (!client_max_buffered_bytes)
+    {
+        client_max_buffered_bytes = DEFAULT_CLIENT_MAX_BUFFERED_BYTES;
+    }
+    client_max_buffered_ops = config["client_max_buffered_ops"].uint64_value();
+    if (!client_max_buffered_ops)
+    {
+        client_max_buffered_ops = DEFAULT_CLIENT_MAX_BUFFERED_OPS;
+    }
     up_wait_retry_interval = config["up_wait_retry_interval"].uint64_value();
     if (!up_wait_retry_interval)
     {
@@ -420,7 +480,7 @@ void cluster_client_t::on_ready(std::function<void(void)> fn)
 void cluster_client_t::execute(cluster_op_t *op)
 {
     if (op->opcode != OSD_OP_SYNC && op->opcode != OSD_OP_READ &&
-        op->opcode != OSD_OP_READ_BITMAP && op->opcode != OSD_OP_WRITE)
+        op->opcode != OSD_OP_READ_BITMAP && op->opcode != OSD_OP_WRITE && op->opcode != OSD_OP_COPY)
     {
         op->retval = -EINVAL;
         std::function<void(cluster_op_t*)>(op->callback)(op);
@@ -428,6 +488,20 @@ void cluster_client_t::execute(cluster_op_t *op)
     }
     op->cur_inode = op->inode;
     op->retval = 0;
+    if (enable_writeback || wb_ops || wb_flush_ops || wb_writes_inflight || wb_queue.size() || wb_syncs.size())
+    {
+        wb_execute(op);
+        return;
+    }
+    if (qos_delay(op))
+    {
+        return;
+    }
+    execute_internal(op);
+}
+
+void cluster_client_t::execute_internal(cluster_op_t *op)
+{
     if (op->opcode == OSD_OP_WRITE && !immediate_commit)
     {
         if (dirty_bytes >= client_max_dirty_bytes || dirty_ops >= client_max_dirty_ops)
@@ -478,6 +552,100 @@ void cluster_client_t::execute(cluster_op_t *op)
     }
 }
 
+// Per-inode QoS: returns true if the operation is delayed and will be executed later
+bool cluster_client_t::qos_delay(cluster_op_t *op)
+{
+    if (op->opcode == OSD_OP_SYNC)
+    {
+        if (!qos_queued)
+            return false;
+        qos_sync_queue.push_back(op);
+        return true;
+    }
+    if (op->opcode != OSD_OP_READ && op->opcode != OSD_OP_WRITE && op->opcode != OSD_OP_COPY)
+    {
+        return false;
+    }
+    auto cfg_it = st_cli.inode_config.find(op->inode);
+    bool limited = cfg_it != st_cli.inode_config.end() && cfg_it->second.qos.is_limited();
+    auto qos_it = inode_qos.find(op->inode);
+    if (qos_it == inode_qos.end())
+    {
+        if (!limited)
+            return false;
+        qos_it = inode_qos.emplace(op->inode, cluster_inode_qos_t()).first;
+    }
+    else if (!limited && !qos_it->second.queue.size())
+    {
+        inode_qos.erase(qos_it);
+        return false;
+    }
+    auto & qos = qos_it->second;
+    (limited ? cfg_it->second.qos : inode_qos_config_t()).apply(qos.read, qos.write);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (qos.queue.size() > 0 || !(op->opcode == OSD_OP_READ ? qos.read : qos.write).take(now, op->len))
+    {
+        qos.queue.push_back(op);
+        qos_queued++;
+        if (qos.timer_id < 0)
+        {
+            inode_t inode = op->inode;
+            qos.timer_id = tfd->set_timer_us((op->opcode == OSD_OP_READ ? qos.read : qos.write).wait_us(), false, [this, inode](int timer_id)
+            {
+                inode_qos[inode].timer_id = -1;
+                run_inode_qos(inode);
+            });
+        }
+        return true;
+    }
+    return false;
+}
+
+void cluster_client_t::run_inode_qos(inode_t inode)
+{
+    auto qos_it = inode_qos.find(inode);
+    if (qos_it == inode_qos.end())
+    {
+        return;
+    }
+    auto & qos = qos_it->second;
+    // Pick up limit changes made while operations were waiting
+    auto cfg_it = st_cli.inode_config.find(inode);
+    (cfg_it != st_cli.inode_config.end() ? cfg_it->second.qos : inode_qos_config_t()).apply(qos.read, qos.write);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    while (qos.queue.size() > 0)
+    {
+        cluster_op_t *op = qos.queue.front();
+        if (!(op->opcode == OSD_OP_READ ? qos.read : qos.write).take(now, op->len))
+        {
+            qos.timer_id = tfd->set_timer_us((op->opcode == OSD_OP_READ ? qos.read : qos.write).wait_us(), false, [this, inode](int timer_id)
+            {
+                inode_qos[inode].timer_id = -1;
+                run_inode_qos(inode);
+            });
+            break;
+        }
+        qos.queue.pop_front();
+        qos_queued--;
+        execute_internal(op);
+    }
+    if (!qos.queue.size() && !qos.read.is_limited() && !qos.write.is_limited())
+    {
+        inode_qos.erase(qos_it);
+    }
+    if (!qos_queued && qos_sync_queue.size() > 0)
+    {
+        std::vector<cluster_op_t*> syncs;
+        syncs.swap(qos_sync_queue);
+        for (auto sync_op: syncs)
+        {
+            execute_internal(sync_op);
+        }
+    }
+}
+
 void cluster_client_t::copy_write(cluster_op_t *op, std::map<object_id, cluster_buffer_t> & dirty_buffers)
 {
     // Save operation for replay when one of PGs goes out of sync
@@ -597,7 +765,7 @@ int cluster_client_t::continue_rw(cluster_op_t *op)
     else if (op->state == 3)
         goto resume_3;
 resume_0:
-    if ((op->opcode == OSD_OP_READ || op->opcode == OSD_OP_WRITE) && !op->len ||
+    if ((op->opcode == OSD_OP_READ || op->opcode == OSD_OP_WRITE || op->opcode == OSD_OP_COPY) && !op->len ||
         op->offset % bs_bitmap_granularity || op->len % bs_bitmap_granularity)
     {
         op->retval = -EINVAL;
@@ -619,7 +787,7 @@ resume_0:
             return 0;
         }
     }
-    if (op->opcode == OSD_OP_WRITE || op->opcode == OSD_OP_DELETE)
+    if (op->opcode == OSD_OP_WRITE || op->opcode == OSD_OP_DELETE || op->opcode == OSD_OP_COPY)
     {
         if (!(op->flags & OSD_OP_IGNORE_READONLY))
         {
@@ -870,7 +1038,7 @@ void cluster_client_t::slice_rw(cluster_op_t *op)
             if (end == begin)
                 op->done_count++;
         }
-        else if (op->opcode != OSD_OP_READ_BITMAP && op->opcode != OSD_OP_DELETE)
+        else if (op->opcode != OSD_OP_READ_BITMAP && op->opcode != OSD_OP_DELETE && op->opcode != OSD_OP_COPY)
         {
             add_iov(end-begin, false, op, iov_idx, iov_pos, op->parts[i].iov, NULL, 0);
         }
@@ -943,6 +1111,7 @@ bool cluster_client_t::try_send(cluster_op_t *op, int i)
                     .len = part->len,
                     .meta_revision = meta_rev,
                     .version = op->opcode == OSD_OP_WRITE || op->opcode == OSD_OP_DELETE ? op->version : 0,
+                    .copy_from = op->opcode == OSD_OP_COPY ? op->copy_from : 0,
                 } },
                 .bitmap = (op->opcode == OSD_OP_READ || op->opcode == OSD_OP_READ_BITMAP ? op->part_bitmaps + pg_bitmap_size*i : NULL),
                 .bitmap_len = (unsigned)(op->opcode == OSD_OP_READ || op->opcode == OSD_OP_READ_BITMAP ? pg_bitmap_size : 0),
@@ -1111,7 +1280,10 @@ void cluster_client_t::handle_op_part(cluster_op_part_t *part)
             // Don't overwrite other errors with -EPIPE
             op->retval = part->op.reply.hdr.retval;
         }
-        if (op->retval != -EINTR && op->retval != -EIO)
+        // OSDs without OSD_OP_COPY support reject it with -EINVAL, the caller then falls back
+        // to copying data itself, so the connection is fine
+        if (op->retval != -EINTR && op->retval != -EIO && op->retval != -EXDEV &&
+            (op->retval != -EINVAL || op->opcode != OSD_OP_COPY))
         {
             fprintf(
                 stderr, "%s operation failed on OSD %lu: retval=%ld (expected %d), dropping connection\n",
@@ -10,6 +10,8 @@
 #define MAX_BLOCK_SIZE 128*1024*1024
 #define DEFAULT_CLIENT_MAX_DIRTY_BYTES 32*1024*1024
 #define DEFAULT_CLIENT_MAX_DIRTY_OPS 1024
+#define DEFAULT_CLIENT_MAX_BUFFERED_BYTES 32*1024*1024
+#define DEFAULT_CLIENT_MAX_BUFFERED_OPS 1024
 #define INODE_LIST_DONE 1
 #define INODE_LIST_HAS_UNSTABLE 2
 #define OSD_OP_READ_BITMAP OSD_OP_SEC_READ_BMP
@@ -32,7 +34,7 @@ struct cluster_op_part_t
 
 struct cluster_op_t
 {
-    uint64_t opcode; // OSD_OP_READ, OSD_OP_WRITE, OSD_OP_SYNC, OSD_OP_DELETE, OSD_OP_READ_BITMAP
+    uint64_t opcode; // OSD_OP_READ, OSD_OP_WRITE, OSD_OP_SYNC, OSD_OP_DELETE, OSD_OP_READ_BITMAP, OSD_OP_COPY
     uint64_t inode;
     uint64_t offset;
     uint64_t len;
@@ -41,6 +43,8 @@ struct cluster_op_t
     uint64_t version = 0;
     // now only OSD_OP_IGNORE_READONLY is supported
     uint64_t flags = 0;
+    // for OSD_OP_COPY: the lowest parent layer to copy data from, 0 = all parents from the same pool
+    inode_t copy_from = 0;
     int retval;
     osd_op_buf_list_t iov;
     // READ and READ_BITMAP return the bitmap here
@@ -70,6 +74,14 @@ struct cluster_buffer_t
     int state;
 };
 
+// Per-inode QoS state: operations over the limit wait in the queue in submission order
+struct cluster_inode_qos_t
+{
+    osd_qos_bucket_t read, write;
+    std::deque<cluster_op_t*> queue;
+    int timer_id = -1;
+};
+
 struct inode_list_t;
 struct inode_list_osd_t;
 
@@ -97,6 +109,27 @@ class cluster_client_t
     std::map<object_id, cluster_buffer_t> dirty_buffers;
     std::set<osd_num_t> dirty_osds;
     uint64_t dirty_bytes = 0, dirty_ops = 0;
+    // Write-back cache: writes complete after being copied into wb_buffers, reads are served
+    // from it, syncs and writes which can't be cached wait until it's flushed. Only one flush
+    // round is in progress at a time, so flushes of overlapping writes are never reordered
+    bool enable_writeback = false;
+    uint64_t client_max_buffered_bytes = 0;
+    uint64_t client_max_buffered_ops = 0;
+    std::map<object_id, cluster_buffer_t> wb_buffers, wb_flushing;
+    uint64_t wb_bytes = 0, wb_ops = 0;
+    uint64_t wb_started_rounds = 0, wb_done_rounds = 0;
+    // Data of failed flushes is put back into wb_buffers, and the next flush is only started
+    // after wb_error is reported to a SYNC
+    int wb_flush_ops = 0, wb_writes_inflight = 0, wb_error = 0;
+    // Operations waiting for the cache to make room or to be flushed, in submission order
+    std::deque<cluster_op_t*> wb_queue;
+    // SYNCs waiting for the flush round with the given number
+    std::deque<std::pair<uint64_t, cluster_op_t*>> wb_syncs;
+    int wb_continuing = 0;
+    std::map<inode_t, cluster_inode_qos_t> inode_qos;
+    // SYNCs wait until all operations submitted before them leave QoS queues
+    std::vector<cluster_op_t*> qos_sync_queue;
+    uint64_t qos_queued = 0;
 
     void *scrap_buffer = NULL;
     unsigned scrap_buffer_size = 0;
@@ -129,6 +162,18 @@ public:
     uint64_t next_op_id();
 
 protected:
+    void execute_internal(cluster_op_t *op);
+    void wb_execute(cluster_op_t *op);
+    bool wb_can_cache(cluster_op_t *op);
+    void wb_cache_write(cluster_op_t *op);
+    void wb_execute_write(cluster_op_t *op);
+    bool wb_read(cluster_op_t *op);
+    void wb_set_bitmap(cluster_op_t *op, uint64_t offset, uint64_t len);
+    void wb_continue();
+    void wb_flush();
+    void wb_flush_done();
+    bool qos_delay(cluster_op_t *op);
+    void run_inode_qos(inode_t inode);
     bool affects_osd(uint64_t inode, uint64_t offset, uint64_t len, osd_num_t osd);
     void flush_buffer(const object_id & oid, cluster_buffer_t *wr);
     void on_load_config_hook(json11::Json::object & config);
@@ -0,0 +1,396 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+// Client-side write-back cache (client_enable_writeback)
+
+#include <algorithm>
+#include <assert.h>
+#include "cluster_client.h"
+
+// State of wb_flushing buffers which failed to be written
+#define WB_FLUSH_FAILED -1
+
+struct wb_piece_t
+{
+    uint64_t offset, len;
+    void *buf;
+};
+
+// Copy <len> bytes to the position <pos> of the operation buffer
+static void iov_copy_to(osd_op_buf_list_t & iov, uint64_t pos, const void *src, uint64_t len)
+{
+    for (int i = 0; i < iov.count && len > 0; i++)
+    {
+        if (pos >= iov.buf[i].iov_len)
+        {
+            pos -= iov.buf[i].iov_len;
+            continue;
+        }
+        uint64_t cur = iov.buf[i].iov_len - pos;
+        if (cur > len)
+            cur = len;
+        memcpy(iov.buf[i].iov_base + pos, src, cur);
+        src += cur;
+        len -= cur;
+        pos = 0;
+    }
+}
+
+// Find cached parts of the range. Buffers in one map never overlap
+static void wb_find(std::map<object_id, cluster_buffer_t> & buffers, inode_t inode,
+    uint64_t offset, uint64_t len, std::vector<wb_piece_t> & pieces)
+{
+    auto it = buffers.lower_bound((object_id){ .inode = inode, .stripe = offset });
+    if (it != buffers.begin())
+    {
+        auto prev_it = std::prev(it);
+        if (prev_it->first.inode == inode && prev_it->first.stripe + prev_it->second.len > offset)
+            it = prev_it;
+    }
+    for (; it != buffers.end() && it->first.inode == inode && it->first.stripe < offset+len; it++)
+    {
+        uint64_t begin = std::max(it->first.stripe, offset);
+        uint64_t end = std::min(it->first.stripe + it->second.len, offset+len);
+        pieces.push_back((wb_piece_t){
+            .offset = begin,
+            .len = end-begin,
+            .buf = it->second.buf + begin - it->first.stripe,
+        });
+    }
+}
+
+// Put parts of a failed buffer not overwritten by newer writes back into the cache.
+// Takes ownership of the buffer and returns the number of bytes put back
+static uint64_t wb_restore(std::map<object_id, cluster_buffer_t> & buffers, const object_id & oid, cluster_buffer_t & failed)
+{
+    std::vector<wb_piece_t> pieces;
+    wb_find(buffers, oid.inode, oid.stripe, failed.len, pieces);
+    if (!pieces.size())
+    {
+        buffers[oid] = (cluster_buffer_t){ .buf = failed.buf, .len = failed.len, .state = 0 };
+        return failed.len;
+    }
+    pieces.push_back((wb_piece_t){ .offset = oid.stripe + failed.len });
+    uint64_t pos = oid.stripe, restored = 0;
+    for (auto & p: pieces)
+    {
+        if (p.offset > pos)
+        {
+            void *buf = malloc_or_die(p.offset-pos);
+            memcpy(buf, failed.buf + pos - oid.stripe, p.offset-pos);
+            buffers[(object_id){ .inode = oid.inode, .stripe = pos }] = (cluster_buffer_t){
+                .buf = buf,
+                .len = p.offset-pos,
+                .state = 0,
+            };
+            restored += p.offset-pos;
+        }
+        pos = p.offset + p.len;
+    }
+    free(failed.buf);
+    return restored;
+}
+
+// Mark the cached range as present in the read bitmap, allocating it if the read isn't sent to OSDs
+void cluster_client_t::wb_set_bitmap(cluster_op_t *op, uint64_t offset, uint64_t len)
+{
+    if (!op->bitmap_buf)
+    {
+        // Same layout as in slice_rw()
+        unsigned object_bitmap_size = ((op->len / bs_bitmap_granularity + 7) / 8);
+        object_bitmap_size = (object_bitmap_size < 8 ? 8 : object_bitmap_size);
+        op->bitmap_buf = calloc_or_die(1, object_bitmap_size);
+        op->part_bitmaps = op->bitmap_buf + object_bitmap_size;
+        op->bitmap_buf_size = object_bitmap_size;
+    }
+    for (uint64_t bit = (offset-op->offset)/bs_bitmap_granularity; bit < (offset+len-op->offset)/bs_bitmap_granularity; bit++)
+    {
+        ((uint8_t*)op->bitmap_buf)[bit >> 3] |= (1 << (bit & 7));
+    }
+}
+
+void cluster_client_t::wb_execute(cluster_op_t *op)
+{
+    if (op->opcode == OSD_OP_READ)
+    {
+        // Reads never wait for the cache
+        if (!wb_read(op) && !qos_delay(op))
+            execute_internal(op);
+        return;
+    }
+    if (op->opcode == OSD_OP_SYNC)
+    {
+        // SYNC only has to wait for the writes already completed, i.e. buffered or being flushed
+        wb_syncs.push_back({ wb_started_rounds + (wb_ops ? 1 : 0), op });
+    }
+    else
+    {
+        wb_queue.push_back(op);
+    }
+    wb_continue();
+}
+
+bool cluster_client_t::wb_can_cache(cluster_op_t *op)
+{
+    if (!enable_writeback || op->opcode != OSD_OP_WRITE || op->version || op->flags ||
+        !bs_bitmap_granularity || !op->len || (op->offset % bs_bitmap_granularity) ||
+        (op->len % bs_bitmap_granularity) || !INODE_POOL(op->inode))
+    {
+        // Let the usual code path handle CAS writes and return errors
+        return false;
+    }
+    auto ino_it = st_cli.inode_config.find(op->inode);
+    return ino_it == st_cli.inode_config.end() || !ino_it->second.readonly;
+}
+
+void cluster_client_t::wb_cache_write(cluster_op_t *op)
+{
+    // Only count bytes not buffered yet
+    std::vector<wb_piece_t> pieces;
+    wb_find(wb_buffers, op->inode, op->offset, op->len, pieces);
+    uint64_t new_bytes = op->len;
+    for (auto & p: pieces)
+    {
+        new_bytes -= p.len;
+    }
+    copy_write(op, wb_buffers);
+    wb_bytes += new_bytes;
+    wb_ops++;
+    op->retval = op->len;
+    std::function<void(cluster_op_t*)>(op->callback)(op);
+}
+
+void cluster_client_t::wb_execute_write(cluster_op_t *op)
+{
+    if (op->opcode == OSD_OP_WRITE)
+    {
+        // Don't start flushing newer buffered writes until this one completes
+        wb_writes_inflight++;
+        auto cb = op->callback;
+        op->callback = [this, cb](cluster_op_t *op)
+        {
+            wb_writes_inflight--;
+            cb(op);
+            wb_continue();
+        };
+    }
+    if (!qos_delay(op))
+        execute_internal(op);
+}
+
+bool cluster_client_t::wb_read(cluster_op_t *op)
+{
+    if (!op->len || op->offset % bs_bitmap_granularity || op->len % bs_bitmap_granularity)
+    {
+        // Let the usual code path return an error
+        return false;
+    }
+    std::vector<wb_piece_t> pieces;
+    // Buffers being flushed are older than buffered ones
+    wb_find(wb_flushing, op->inode, op->offset, op->len, pieces);
+    wb_find(wb_buffers, op->inode, op->offset, op->len, pieces);
+    if (!pieces.size())
+    {
+        return false;
+    }
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    for (auto & p: pieces)
+    {
+        ranges.push_back({ p.offset, p.offset+p.len });
+    }
+    std::sort(ranges.begin(), ranges.end());
+    uint64_t covered = op->offset;
+    for (auto & r: ranges)
+    {
+        if (r.first > covered)
+            break;
+        if (r.second > covered)
+            covered = r.second;
+    }
+    if (covered >= op->offset+op->len)
+    {
+        // Fully cached, read from memory
+        for (auto & p: pieces)
+        {
+            iov_copy_to(op->iov, p.offset-op->offset, p.buf, p.len);
+            wb_set_bitmap(op, p.offset, p.len);
+        }
+        op->version = 0;
+        op->retval = op->len;
+        std::function<void(cluster_op_t*)>(op->callback)(op);
+        return true;
+    }
+    // Partially cached. Cached buffers may be flushed and freed before the read completes,
+    // so copy their current contents and put them over the data read from OSDs
+    uint64_t total = 0;
+    for (auto & p: pieces)
+    {
+        total += p.len;
+    }
+    void *snap = malloc_or_die(total);
+    total = 0;
+    for (auto & p: pieces)
+    {
+        memcpy(snap + total, p.buf, p.len);
+        p.buf = snap + total;
+        total += p.len;
+    }
+    auto cb = op->callback;
+    op->callback = [this, pieces, snap, cb](cluster_op_t *op)
+    {
+        if (op->retval == op->len)
+        {
+            for (auto & p: pieces)
+            {
+                iov_copy_to(op->iov, p.offset-op->offset, p.buf, p.len);
+                wb_set_bitmap(op, p.offset, p.len);
+            }
+        }
+        free(snap);
+        cb(op);
+    };
+    return false;
+}
+
+void cluster_client_t::wb_continue()
+{
+    if (wb_continuing)
+    {
+        // Attempt to reenter the function
+        wb_continuing = 2;
+        return;
+    }
+restart:
+    wb_continuing = 1;
+    // Failed data isn't flushed again until the error is reported, so report it to the next
+    // SYNC even if it was submitted after the failed round
+    while (wb_syncs.size() && (wb_syncs.front().first <= wb_done_rounds || (wb_error && !wb_flush_ops)))
+    {
+        cluster_op_t *op = wb_syncs.front().second;
+        wb_syncs.pop_front();
+        if (wb_error)
+        {
+            // Report flush errors to the next SYNC
+            op->retval = wb_error;
+            wb_error = 0;
+            std::function<void(cluster_op_t*)>(op->callback)(op);
+        }
+        else if (!qos_delay(op))
+            execute_internal(op);
+    }
+    while (wb_queue.size())
+    {
+        cluster_op_t *op = wb_queue.front();
+        if (wb_can_cache(op))
+        {
+            if (wb_bytes >= client_max_buffered_bytes || wb_ops >= client_max_buffered_ops)
+                break;
+            wb_queue.pop_front();
+            wb_cache_write(op);
+        }
+        else
+        {
+            // Other operations must see all previous writes
+            if (wb_ops || wb_flush_ops)
+                break;
+            wb_queue.pop_front();
+            wb_execute_write(op);
+        }
+    }
+    if (wb_ops && !wb_flush_ops && !wb_writes_inflight && !wb_error &&
+        (wb_syncs.size() && wb_syncs.back().first > wb_done_rounds || wb_queue.size() ||
+        wb_bytes >= client_max_buffered_bytes || wb_ops >= client_max_buffered_ops))
+    {
+        wb_flush();
+        // The flush made room in the cache, writes waiting for it may be buffered now
+        wb_continuing = 2;
+    }
+    if (wb_continuing == 2)
+    {
+        goto restart;
+    }
+    wb_continuing = 0;
+}
+
+void cluster_client_t::wb_flush()
+{
+    assert(!wb_flush_ops && !wb_flushing.size());
+    wb_flushing.swap(wb_buffers);
+    wb_bytes = 0;
+    wb_ops = 0;
+    wb_started_rounds++;
+    // Extra reference so the round doesn't finish while writes are still being submitted
+    wb_flush_ops++;
+    auto it = wb_flushing.begin();
+    while (it != wb_flushing.end())
+    {
+        uint64_t pg_block_size = bs_block_size;
+        auto pool_it = st_cli.pool_config.find(INODE_POOL(it->first.inode));
+        if (pool_it != st_cli.pool_config.end() && pool_it->second.scheme != POOL_SCHEME_REPLICATED)
+            pg_block_size *= pool_it->second.pg_size - pool_it->second.parity_chunks;
+        // Coalesce adjacent buffers of the same stripe into one write
+        cluster_op_t *op = new cluster_op_t;
+        op->opcode = OSD_OP_WRITE;
+        op->cur_inode = op->inode = it->first.inode;
+        op->offset = it->first.stripe;
+        op->len = 0;
+        op->retval = 0;
+        do
+        {
+            op->iov.push_back(it->second.buf, it->second.len);
+            op->len += it->second.len;
+            it++;
+        } while (it != wb_flushing.end() && it->first.inode == op->inode &&
+            it->first.stripe == op->offset+op->len && (it->first.stripe % pg_block_size) != 0);
+        op->callback = [this](cluster_op_t *op)
+        {
+            if (op->retval != op->len)
+            {
+                fprintf(
+                    stderr, "Failed to flush buffered write %lx+%lx of inode %lx: retval=%d\n",
+                    op->offset, op->len, op->inode, op->retval
+                );
+                if (!wb_error)
+                    wb_error = op->retval < 0 ? op->retval : -EIO;
+                // Keep the data to retry the write in the next round
+                auto fail_it = wb_flushing.lower_bound((object_id){ .inode = op->inode, .stripe = op->offset });
+                for (; fail_it != wb_flushing.end() && fail_it->first.inode == op->inode &&
+                    fail_it->first.stripe < op->offset+op->len; fail_it++)
+                {
+                    fail_it->second.state = WB_FLUSH_FAILED;
+                }
+            }
+            delete op;
+            wb_flush_ops--;
+            if (!wb_flush_ops)
+                wb_flush_done();
+        };
+        wb_flush_ops++;
+        if (!qos_delay(op))
+            execute_internal(op);
+    }
+    wb_flush_ops--;
+    if (!wb_flush_ops)
+        wb_flush_done();
+}
+
+void cluster_client_t::wb_flush_done()
+{
+    for (auto & bp: wb_flushing)
+    {
+        if (bp.second.state == WB_FLUSH_FAILED)
+        {
+            uint64_t restored = wb_restore(wb_buffers, bp.first, bp.second);
+            if (restored)
+            {
+                wb_bytes += restored;
+                wb_ops++;
+            }
+        }
+        else
+            free(bp.second.buf);
+    }
+    wb_flushing.clear();
+    wb_done_rounds = wb_started_rounds;
+    wb_continue();
+}
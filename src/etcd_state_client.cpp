@@ -553,16 +553,18 @@ void etcd_state_client_t::parse_state(const etcd_kv_t & kv)
                 pc.scheme = POOL_SCHEME_XOR;
             else if (pool_item.second["scheme"] == "jerasure")
                 pc.scheme = POOL_SCHEME_JERASURE;
+            else if (pool_item.second["scheme"] == "ec")
+                pc.scheme = POOL_SCHEME_EC;
             else
             {
-                fprintf(stderr, "Pool %u has invalid coding scheme (one of \"xor\", \"replicated\" or \"jerasure\" required), skipping pool\n", pool_id);
+                fprintf(stderr, "Pool %u has invalid coding scheme (one of \"xor\", \"replicated\", \"jerasure\" or \"ec\" required), skipping pool\n", pool_id);
                 continue;
             }
             // PG Size
             pc.pg_size = pool_item.second["pg_size"].uint64_value();
             if (pc.pg_size < 1 ||
                 pool_item.second["pg_size"].uint64_value() < 3 &&
-                (pc.scheme == POOL_SCHEME_XOR || pc.scheme == POOL_SCHEME_JERASURE) ||
+                (pc.scheme == POOL_SCHEME_XOR || pc.scheme == POOL_SCHEME_JERASURE || pc.scheme == POOL_SCHEME_EC) ||
                 pool_item.second["pg_size"].uint64_value() > 256)
             {
                 fprintf(stderr, "Pool %u has invalid pg_size, skipping pool\n", pool_id);
@@ -579,7 +581,7 @@ void etcd_state_client_t::parse_state(const etcd_kv_t & kv)
                 }
                 pc.parity_chunks = 1;
             }
-            if (pc.scheme == POOL_SCHEME_JERASURE &&
+            if ((pc.scheme == POOL_SCHEME_JERASURE || pc.scheme == POOL_SCHEME_EC) &&
                 (pc.parity_chunks < 1 || pc.parity_chunks > pc.pg_size-2))
             {
                 fprintf(stderr, "Pool %u has invalid parity_chunks (must be between 1 and pg_size-2), skipping pool\n", pool_id);
@@ -588,7 +590,7 @@ void etcd_state_client_t::parse_state(const etcd_kv_t & kv)
             // PG MinSize
             pc.pg_minsize = pool_item.second["pg_minsize"].uint64_value();
             if (pc.pg_minsize < 1 || pc.pg_minsize > pc.pg_size ||
-                (pc.scheme == POOL_SCHEME_XOR || pc.scheme == POOL_SCHEME_JERASURE) &&
+                (pc.scheme == POOL_SCHEME_XOR || pc.scheme == POOL_SCHEME_JERASURE || pc.scheme == POOL_SCHEME_EC) &&
                 pc.pg_minsize < (pc.pg_size-pc.parity_chunks))
             {
                 fprintf(stderr, "Pool %u has invalid pg_minsize, skipping pool\n", pool_id);
@@ -869,6 +871,7 @@ void etcd_state_client_t::parse_state(const etcd_kv_t & kv)
                     .parent_id = parent_inode_num,
                     .readonly = value["readonly"].bool_value(),
                     .mod_revision = kv.mod_revision,
+                    .qos = parse_inode_qos(value["qos"]),
                 };
                 this->inode_config[inode_num] = cfg;
                 if (cfg.name != "")
@@ -929,9 +932,43 @@ json11::Json::object etcd_state_client_t::serialize_inode_cfg(inode_config_t *cf
     {
         new_cfg["readonly"] = true;
     }
+    if (cfg->qos.is_limited())
+    {
+        new_cfg["qos"] = serialize_inode_qos(&cfg->qos);
+    }
     return new_cfg;
 }
 
+inode_qos_config_t etcd_state_client_t::parse_inode_qos(json11::Json value)
+{
+    inode_qos_config_t qos;
+    qos.read_iops = value["read_iops"].uint64_value();
+    qos.write_iops = value["write_iops"].uint64_value();
+    qos.read_bw = value["read_mbs"].uint64_value()*1024*1024;
+    qos.write_bw = value["write_mbs"].uint64_value()*1024*1024;
+    qos.burst_iops = value["burst_iops"].uint64_value();
+    qos.burst_bw = value["burst_mbs"].uint64_value()*1024*1024;
+    return qos;
+}
+
+json11::Json::object etcd_state_client_t::serialize_inode_qos(inode_qos_config_t *qos)
+{
+    json11::Json::object res;
+    if (qos->read_iops)
+        res["read_iops"] = qos->read_iops;
+    if (qos->write_iops)
+        res["write_iops"] = qos->write_iops;
+    if (qos->read_bw)
+        res["read_mbs"] = qos->read_bw/1024/1024;
+    if (qos->write_bw)
+        res["write_mbs"] = qos->write_bw/1024/1024;
+    if (qos->burst_iops)
+        res["burst_iops"] = qos->burst_iops;
+    if (qos->burst_bw)
+        res["burst_mbs"] = qos->burst_bw/1024/1024;
+    return res;
+}
+
 int etcd_state_client_t::address_count()
 {
     return etcd_addresses.size() + etcd_local.size();
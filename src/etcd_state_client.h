@@ -6,6 +6,7 @@
 #include "json11/json11.hpp"
 #include "osd_id.h"
 #include "timerfd_manager.h"
+#include "osd_qos.h"
 
 #define ETCD_CONFIG_WATCH_ID 1
 #define ETCD_PG_STATE_WATCH_ID 2
@@ -63,6 +64,7 @@ struct inode_config_t
     bool readonly;
     // Change revision of the metadata in etcd
     uint64_t mod_revision;
+    inode_qos_config_t qos;
 };
 
 struct inode_watch_t
@@ -110,6 +112,8 @@ public:
     std::function<void()> on_reload_hook;
 
     json11::Json::object serialize_inode_cfg(inode_config_t *cfg);
+    static inode_qos_config_t parse_inode_qos(json11::Json value);
+    static json11::Json::object serialize_inode_qos(inode_qos_config_t *qos);
     etcd_kv_t parse_etcd_kv(const json11::Json & kv_json);
     void etcd_call(std::string api, json11::Json payload, int timeout, std::function<void(std::string, json11::Json)> callback);
     void etcd_txn(json11::Json txn, int timeout, std::function<void(std::string, json11::Json)> callback);
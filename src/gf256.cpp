@@ -0,0 +1,186 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <string.h>
+
+#include "gf256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF256_X86
+#endif
+
+// Scalar multiplication is only used to build matrices and tables, so it doesn't need log tables
+uint8_t gf256_mul(uint8_t a, uint8_t b)
+{
+    uint8_t r = 0;
+    while (b)
+    {
+        if (b & 1)
+            r ^= a;
+        a = (a << 1) ^ (a & 0x80 ? 0x1d : 0);
+        b >>= 1;
+    }
+    return r;
+}
+
+uint8_t gf256_inv(uint8_t a)
+{
+    // a^254 = a^-1
+    uint8_t r = 1;
+    for (int i = 0; i < 7; i++)
+    {
+        a = gf256_mul(a, a);
+        r = gf256_mul(r, a);
+    }
+    return r;
+}
+
+bool gf256_invert_matrix(uint8_t *matrix, int n)
+{
+    uint8_t inv[n*n];
+    memset(inv, 0, n*n);
+    for (int i = 0; i < n; i++)
+        inv[i*n+i] = 1;
+    // Gauss-Jordan elimination
+    for (int col = 0; col < n; col++)
+    {
+        int pivot = col;
+        while (pivot < n && !matrix[pivot*n+col])
+            pivot++;
+        if (pivot >= n)
+            return false;
+        if (pivot != col)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                uint8_t t = matrix[pivot*n+j];
+                matrix[pivot*n+j] = matrix[col*n+j];
+                matrix[col*n+j] = t;
+                t = inv[pivot*n+j];
+                inv[pivot*n+j] = inv[col*n+j];
+                inv[col*n+j] = t;
+            }
+        }
+        uint8_t c = gf256_inv(matrix[col*n+col]);
+        for (int j = 0; j < n; j++)
+        {
+            matrix[col*n+j] = gf256_mul(matrix[col*n+j], c);
+            inv[col*n+j] = gf256_mul(inv[col*n+j], c);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            c = matrix[i*n+col];
+            if (i != col && c)
+            {
+                for (int j = 0; j < n; j++)
+                {
+                    matrix[i*n+j] ^= gf256_mul(matrix[col*n+j], c);
+                    inv[i*n+j] ^= gf256_mul(inv[col*n+j], c);
+                }
+            }
+        }
+    }
+    memcpy(matrix, inv, n*n);
+    return true;
+}
+
+// Table for each coefficient c is { c*0, c*1, ..., c*15, c*0x00, c*0x10, ..., c*0xf0 },
+// so c*x = table[x & 15] ^ table[16 + (x >> 4)]
+void gf256_init_tables(const uint8_t *coefs, int n, uint8_t *tables)
+{
+    for (int i = 0; i < n; i++)
+    {
+        for (int x = 0; x < 16; x++)
+        {
+            tables[i*GF256_TABLE_SIZE + x] = gf256_mul(coefs[i], x);
+            tables[i*GF256_TABLE_SIZE + 16 + x] = gf256_mul(coefs[i], x << 4);
+        }
+    }
+}
+
+static inline void gf256_dotprod_tail(const uint8_t *tables, const void **srcs, int n, void *dest, unsigned int pos, unsigned int len)
+{
+    for (; pos < len; pos++)
+    {
+        uint8_t v = 0;
+        for (int j = 0; j < n; j++)
+        {
+            uint8_t x = ((const uint8_t*)srcs[j])[pos];
+            v ^= tables[j*GF256_TABLE_SIZE + (x & 15)] ^ tables[j*GF256_TABLE_SIZE + 16 + (x >> 4)];
+        }
+        ((uint8_t*)dest)[pos] = v;
+    }
+}
+
+static void gf256_dotprod_generic(const uint8_t *tables, const void **srcs, int n, void *dest, unsigned int len)
+{
+    gf256_dotprod_tail(tables, srcs, n, dest, 0, len);
+}
+
+#ifdef GF256_X86
+
+// Process 2 vectors at a time, reading each source only once.
+// PSHUFB works inside 128-bit lanes, so tables are broadcasted to all lanes
+#define GF256_DOTPROD_VECTOR(name, target_spec, vec_t, load, load_table, store, vxor, vand, vsrl, vshuf, vset1, vzero)\
+__attribute__((target(target_spec))) static void name(const uint8_t *tables, const void **srcs, int n, void *dest, unsigned int len)\
+{\
+    const unsigned int sz = sizeof(vec_t);\
+    const vec_t mask = vset1(0x0f);\
+    unsigned int pos = 0;\
+    for (; pos+2*sz <= len; pos += 2*sz)\
+    {\
+        vec_t v0 = vzero(), v1 = vzero();\
+        for (int j = 0; j < n; j++)\
+        {\
+            const uint8_t *s = (const uint8_t*)srcs[j] + pos;\
+            const vec_t tlo = load_table(tables + j*GF256_TABLE_SIZE);\
+            const vec_t thi = load_table(tables + j*GF256_TABLE_SIZE + 16);\
+            vec_t x0 = load(s), x1 = load(s+sz);\
+            v0 = vxor(v0, vxor(vshuf(tlo, vand(x0, mask)), vshuf(thi, vand(vsrl(x0, 4), mask))));\
+            v1 = vxor(v1, vxor(vshuf(tlo, vand(x1, mask)), vshuf(thi, vand(vsrl(x1, 4), mask))));\
+        }\
+        uint8_t *d = (uint8_t*)dest + pos;\
+        store(d, v0);\
+        store(d+sz, v1);\
+    }\
+    gf256_dotprod_tail(tables, srcs, n, dest, pos, len);\
+}
+
+#define SSSE3_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define SSSE3_STORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define SSSE3_SET1(c) _mm_set1_epi8(c)
+#define AVX2_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define AVX2_LOAD_TABLE(p) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(p)))
+#define AVX2_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define AVX2_SET1(c) _mm256_set1_epi8(c)
+
+GF256_DOTPROD_VECTOR(gf256_dotprod_ssse3, "ssse3", __m128i, SSSE3_LOAD, SSSE3_LOAD, SSSE3_STORE,
+    _mm_xor_si128, _mm_and_si128, _mm_srli_epi64, _mm_shuffle_epi8, SSSE3_SET1, _mm_setzero_si128)
+GF256_DOTPROD_VECTOR(gf256_dotprod_avx2, "avx2", __m256i, AVX2_LOAD, AVX2_LOAD_TABLE, AVX2_STORE,
+    _mm256_xor_si256, _mm256_and_si256, _mm256_srli_epi64, _mm256_shuffle_epi8, AVX2_SET1, _mm256_setzero_si256)
+
+#endif
+
+std::vector<gf256_kernel_t> gf256_get_kernels()
+{
+    std::vector<gf256_kernel_t> kernels;
+#ifdef GF256_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back({ .name = "avx2", .fn = gf256_dotprod_avx2 });
+    if (__builtin_cpu_supports("ssse3"))
+        kernels.push_back({ .name = "ssse3", .fn = gf256_dotprod_ssse3 });
+#endif
+    kernels.push_back({ .name = "generic", .fn = gf256_dotprod_generic });
+    return kernels;
+}
+
+// Select the best kernel on the first call, same as memxor_n
+static void gf256_dotprod_select(const uint8_t *tables, const void **srcs, int n, void *dest, unsigned int len)
+{
+    gf256_dotprod = gf256_get_kernels()[0].fn;
+    gf256_dotprod(tables, srcs, n, dest, len);
+}
+
+gf256_dotprod_t gf256_dotprod = gf256_dotprod_select;
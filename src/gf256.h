@@ -0,0 +1,39 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+// GF(2^8) arithmetic for the built-in Reed-Solomon coder (pool scheme "ec")
+// Uses the 0x11D polynomial. Region operations use split 4-bit multiplication
+// tables and PSHUFB, the implementation is selected at runtime (AVX2, SSSE3 or generic)
+
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+
+// Size of the multiplication table for one coefficient
+#define GF256_TABLE_SIZE 32
+
+uint8_t gf256_mul(uint8_t a, uint8_t b);
+
+uint8_t gf256_inv(uint8_t a);
+
+// Invert a n*n matrix in place. Returns false if the matrix is singular
+bool gf256_invert_matrix(uint8_t *matrix, int n);
+
+// Expand <n> coefficients into <n>*GF256_TABLE_SIZE bytes of tables for gf256_dotprod
+void gf256_init_tables(const uint8_t *coefs, int n, uint8_t *tables);
+
+// dest = coef[0]*srcs[0] + coef[1]*srcs[1] + ... + coef[n-1]*srcs[n-1], in one pass
+typedef void (*gf256_dotprod_t)(const uint8_t *tables, const void **srcs, int n, void *dest, unsigned int len);
+
+extern gf256_dotprod_t gf256_dotprod;
+
+struct gf256_kernel_t
+{
+    const char *name;
+    gf256_dotprod_t fn;
+};
+
+// All kernels supported by the current CPU, the best one comes first
+std::vector<gf256_kernel_t> gf256_get_kernels();
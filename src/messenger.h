@@ -106,11 +106,15 @@ struct osd_wanted_peer_t
     int cur_port;
 };
 
+// Operation latency histogram buckets: [2^(i-1), 2^i) microseconds
+#define OSD_LAT_BUCKETS 32
+
 struct osd_op_stats_t
 {
     uint64_t op_stat_sum[OSD_OP_MAX+1] = { 0 };
     uint64_t op_stat_count[OSD_OP_MAX+1] = { 0 };
     uint64_t op_stat_bytes[OSD_OP_MAX+1] = { 0 };
+    uint64_t op_stat_lat_hist[OSD_OP_MAX+1][OSD_LAT_BUCKETS] = { 0 };
     uint64_t subop_stat_sum[OSD_OP_MAX+1] = { 0 };
     uint64_t subop_stat_count[OSD_OP_MAX+1] = { 0 };
 };
@@ -4,6 +4,7 @@
 #pragma once
 
 #include <functional>
+#include "malloc_or_die.h"
 
 struct ring_consumer_t
 {
@@ -22,4 +23,12 @@ public:
     void submit()
     {
     }
+    void* alloc_buffer(size_t len)
+    {
+        return malloc_or_die(len);
+    }
+    void free_buffer(void *buf)
+    {
+        free(buf);
+    }
 };
@@ -3,8 +3,26 @@
 
 #include <assert.h>
 
+#include "malloc_or_die.h"
+#include <ringloop.h>
 #include "msgr_op.h"
 
+void osd_op_t::alloc_buf(ring_loop_t *pool, size_t len)
+{
+    buf_pool = pool;
+    buf = pool ? pool->alloc_buffer(len) : memalign_or_die(MEM_ALIGNMENT, len);
+}
+
+void osd_op_t::free_buf()
+{
+    if (buf_pool)
+        buf_pool->free_buffer(buf);
+    else
+        free(buf);
+    buf = NULL;
+    buf_pool = NULL;
+}
+
 osd_op_t::~osd_op_t()
 {
     assert(!bs_op);
@@ -17,6 +35,6 @@ osd_op_t::~osd_op_t()
     {
         // Note: reusing osd_op_t WILL currently lead to memory leaks
         // So we don't reuse it, but free it every time
-        free(buf);
+        free_buf();
     }
 }
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 
 #include "osd_ops.h"
+#include "object_pool.h"
 
 #define OSD_OP_IN 0
 #define OSD_OP_OUT 1
@@ -152,6 +153,8 @@ struct blockstore_op_t;
 
 struct osd_primary_op_data_t;
 
+class ring_loop_t;
+
 struct osd_op_t
 {
     timespec tv_begin = { 0 }, tv_end = { 0 };
@@ -161,6 +164,8 @@ struct osd_op_t
     osd_any_reply_t reply;
     blockstore_op_t *bs_op = NULL;
     void *buf = NULL;
+    // buf is taken from the registered buffer pool of this ring_loop_t
+    ring_loop_t *buf_pool = NULL;
     // bitmap, bitmap_len, bmp_data are only meaningful for reads
     void *bitmap = NULL;
     unsigned bitmap_len = 0;
@@ -171,5 +176,10 @@ struct osd_op_t
 
     osd_op_buf_list_t iov;
 
+    void alloc_buf(ring_loop_t *pool, size_t len);
+    // Free buf allocated with alloc_buf() or malloc() and reset it to NULL
+    void free_buf();
     ~osd_op_t();
+
+    OBJECT_POOL_OPERATORS(osd_op_t)
 };
@@ -224,7 +224,7 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
         }
         if (cur_op->req.sec_rw.len > 0)
         {
-            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.sec_rw.len);
+            cur_op->alloc_buf(ringloop, cur_op->req.sec_rw.len);
             cl->recv_list.push_back(cur_op->buf, cur_op->req.sec_rw.len);
         }
         cl->read_remaining = cur_op->req.sec_rw.len + cur_op->req.sec_rw.attr_len;
@@ -256,7 +256,7 @@ void osd_messenger_t::handle_op_hdr(osd_client_t *cl)
     {
         if (cur_op->req.rw.len > 0)
         {
-            cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.rw.len);
+            cur_op->alloc_buf(ringloop, cur_op->req.rw.len);
             cl->recv_list.push_back(cur_op->buf, cur_op->req.rw.len);
         }
         cl->read_remaining = cur_op->req.rw.len;
@@ -349,7 +349,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
         cl->read_op = op;
         cl->read_state = CL_READ_REPLY_DATA;
         cl->read_remaining = op->reply.hdr.retval;
-        free(op->buf);
+        op->free_buf();
         op->buf = memalign_or_die(MEM_ALIGNMENT, cl->read_remaining);
         cl->recv_list.push_back(op->buf, cl->read_remaining);
     }
@@ -359,7 +359,7 @@ bool osd_messenger_t::handle_reply_hdr(osd_client_t *cl)
         cl->read_op = op;
         cl->read_state = CL_READ_REPLY_DATA;
         cl->read_remaining = op->reply.hdr.retval;
-        free(op->buf);
+        op->free_buf();
         op->buf = malloc_or_die(op->reply.hdr.retval);
         cl->recv_list.push_back(op->buf, op->reply.hdr.retval);
     }
@@ -144,10 +144,13 @@ void osd_messenger_t::measure_exec(osd_op_t *cur_op)
         stats.op_stat_sum[cur_op->req.hdr.opcode] = 0;
         stats.op_stat_bytes[cur_op->req.hdr.opcode] = 0;
     }
-    stats.op_stat_sum[cur_op->req.hdr.opcode] += (
+    uint64_t lat_us = (
         (cur_op->tv_end.tv_sec - cur_op->tv_begin.tv_sec)*1000000 +
         (cur_op->tv_end.tv_nsec - cur_op->tv_begin.tv_nsec)/1000
     );
+    stats.op_stat_sum[cur_op->req.hdr.opcode] += lat_us;
+    int lat_bucket = lat_us ? 64 - __builtin_clzll(lat_us) : 0;
+    stats.op_stat_lat_hist[cur_op->req.hdr.opcode][lat_bucket < OSD_LAT_BUCKETS ? lat_bucket : OSD_LAT_BUCKETS-1]++;
     if (cur_op->req.hdr.opcode == OSD_OP_READ ||
         cur_op->req.hdr.opcode == OSD_OP_WRITE)
     {
@@ -22,8 +22,88 @@
 #define MSG_ZEROCOPY 0
 #endif
 
+#ifndef NBD_FLAG_CAN_MULTI_CONN
+#define NBD_FLAG_CAN_MULTI_CONN (1 << 8)
+#endif
+
+// Request buffers are grouped by data size rounded up to a power of two: 4 KB .. 32 MB
+#define NBD_POOL_MIN_ORDER 12
+#define NBD_POOL_MAX_ORDER 25
+// Maximum total size of free buffers of one size kept for reuse
+#define NBD_POOL_MAX_FREE_BYTES (32*1024*1024)
+
 const char *exe_name = NULL;
 
+// Recycled buffers for request and reply payloads, each one is prefixed with an nbd_reply
+class nbd_buffer_pool_t
+{
+    std::vector<void*> free_bufs[NBD_POOL_MAX_ORDER-NBD_POOL_MIN_ORDER+1];
+
+    static int get_order(uint64_t len)
+    {
+        int order = NBD_POOL_MIN_ORDER;
+        while ((1ul << order) < len)
+            order++;
+        return order;
+    }
+
+public:
+    ~nbd_buffer_pool_t()
+    {
+        for (auto & list: free_bufs)
+            for (void *buf: list)
+                free(buf);
+    }
+
+    void* alloc_buffer(uint64_t len)
+    {
+        if (len > (1ul << NBD_POOL_MAX_ORDER))
+            return malloc_or_die(sizeof(nbd_reply) + len);
+        int order = get_order(len);
+        auto & list = free_bufs[order-NBD_POOL_MIN_ORDER];
+        if (list.size() > 0)
+        {
+            void *buf = list.back();
+            list.pop_back();
+            return buf;
+        }
+        return malloc_or_die(sizeof(nbd_reply) + (1ul << order));
+    }
+
+    void free_buffer(void *buf, uint64_t len)
+    {
+        if (len > (1ul << NBD_POOL_MAX_ORDER))
+        {
+            free(buf);
+            return;
+        }
+        int order = get_order(len);
+        auto & list = free_bufs[order-NBD_POOL_MIN_ORDER];
+        if (((list.size()+1) << order) <= NBD_POOL_MAX_FREE_BYTES)
+            list.push_back(buf);
+        else
+            free(buf);
+    }
+};
+
+// One NBD socket. The kernel maps every connection to its own hardware queue
+struct nbd_conn_t
+{
+    int nbd_fd = -1;
+    std::vector<iovec> send_list, next_send_list;
+    // buffer and data length for each send_list and next_send_list entry
+    std::vector<std::pair<void*, uint64_t>> to_free;
+    void *recv_buf = NULL;
+    nbd_request cur_req;
+    cluster_op_t *cur_op = NULL;
+    void *cur_buf = NULL;
+    int cur_left = 0;
+    int read_state = 0;
+    int read_ready = 0;
+    msghdr read_msg = { 0 }, send_msg = { 0 };
+    iovec read_iov = { 0 };
+};
+
 class nbd_proxy
 {
 protected:
@@ -37,19 +117,9 @@ protected:
     cluster_client_t *cli = NULL;
     ring_consumer_t consumer;
 
-    std::vector<iovec> send_list, next_send_list;
-    std::vector<void*> to_free;
-    int nbd_fd = -1;
-    void *recv_buf = NULL;
+    std::vector<nbd_conn_t*> conns;
+    nbd_buffer_pool_t buffer_pool;
     int receive_buffer_size = 9000;
-    nbd_request cur_req;
-    cluster_op_t *cur_op = NULL;
-    void *cur_buf = NULL;
-    int cur_left = 0;
-    int read_state = 0;
-    int read_ready = 0;
-    msghdr read_msg = { 0 }, send_msg = { 0 };
-    iovec read_iov = { 0 };
 
 public:
     static json11::Json::object parse_args(int narg, const char *args[])
@@ -117,9 +187,11 @@ public:
             "Vitastor NBD proxy\n"
             "(c) Vitaliy Filippov, 2020-2021 (VNPL-1.1)\n\n"
             "USAGE:\n"
-            "  %s map [--etcd_address <etcd_address>] (--image <image> | --pool <pool> --inode <inode> --size <size in bytes>)\n"
+            "  %s map [--etcd_address <etcd_address>] (--image <image> | --pool <pool> --inode <inode> --size <size in bytes>) [--nbd_conns N]\n"
             "  %s unmap /dev/nbd0\n"
-            "  %s ls [--json]\n",
+            "  %s ls [--json]\n"
+            "\n"
+            "  --nbd_conns N  Use N NBD connections (kernel queues) for the device (default 1)\n",
             exe_name, exe_name, exe_name
         );
         exit(0);
@@ -192,19 +264,31 @@ public:
             device_size = watch->cfg.size;
         }
         // Initialize NBD
-        int sockfd[2];
-        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfd) < 0)
+        int conn_count = cfg["nbd_conns"].uint64_value();
+        if (conn_count < 1)
+            conn_count = 1;
+        // sockfd[2*i] is our end of connection i, sockfd[2*i+1] is the kernel's end
+        std::vector<int> sockfd(conn_count*2);
+        for (int i = 0; i < conn_count; i++)
         {
-            perror("socketpair");
-            exit(1);
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockfd.data() + 2*i) < 0)
+            {
+                perror("socketpair");
+                exit(1);
+            }
+            fcntl(sockfd[2*i], F_SETFL, fcntl(sockfd[2*i], F_GETFL, 0) | O_NONBLOCK);
+            nbd_conn_t *conn = new nbd_conn_t;
+            conn->nbd_fd = sockfd[2*i];
+            conns.push_back(conn);
         }
-        fcntl(sockfd[0], F_SETFL, fcntl(sockfd[0], F_GETFL, 0) | O_NONBLOCK);
-        nbd_fd = sockfd[0];
         load_module();
         bool bg = cfg["foreground"].is_null();
+        // All connections share one cluster client, so a flush on any of them
+        // also syncs writes completed on all others, as NBD_FLAG_CAN_MULTI_CONN requires
+        uint64_t flags = NBD_FLAG_SEND_FLUSH | NBD_FLAG_CAN_MULTI_CONN;
         if (!cfg["dev_num"].is_null())
         {
-            if (run_nbd(sockfd, cfg["dev_num"].int64_value(), device_size, NBD_FLAG_SEND_FLUSH, 30, bg) < 0)
+            if (run_nbd(sockfd, cfg["dev_num"].int64_value(), device_size, flags, 30, bg) < 0)
             {
                 perror("run_nbd");
                 exit(1);
@@ -216,7 +300,7 @@ public:
             int i = 0;
             while (true)
             {
-                int r = run_nbd(sockfd, i, device_size, NBD_FLAG_SEND_FLUSH, 30, bg);
+                int r = run_nbd(sockfd, i, device_size, flags, 30, bg);
                 if (r == 0)
                 {
                     printf("/dev/nbd%d\n", i);
@@ -244,38 +328,55 @@ public:
             daemonize();
         }
         // Initialize read state
-        read_state = CL_READ_HDR;
-        recv_buf = malloc_or_die(receive_buffer_size);
-        cur_buf = &cur_req;
-        cur_left = sizeof(nbd_request);
+        for (auto conn: conns)
+        {
+            conn->read_state = CL_READ_HDR;
+            conn->recv_buf = malloc_or_die(receive_buffer_size);
+            conn->cur_buf = &conn->cur_req;
+            conn->cur_left = sizeof(nbd_request);
+        }
         consumer.loop = [this]()
         {
-            submit_read();
-            submit_send();
+            for (auto conn: conns)
+            {
+                submit_read(conn);
+                submit_send(conn);
+            }
             ringloop->submit();
         };
         ringloop->register_consumer(&consumer);
-        // Add FD to epoll
-        bool stop = false;
-        epmgr->tfd->set_fd_handler(sockfd[0], false, [this, &stop](int peer_fd, int epoll_events)
+        // Add FDs to epoll
+        int open_conns = conns.size();
+        for (auto conn: conns)
         {
-            if (epoll_events & EPOLLRDHUP)
-            {
-                close(peer_fd);
-                stop = true;
-            }
-            else
+            epmgr->tfd->set_fd_handler(conn->nbd_fd, false, [this, conn, &open_conns](int peer_fd, int epoll_events)
             {
-                read_ready++;
-                submit_read();
-            }
-        });
-        while (!stop)
+                if (epoll_events & EPOLLRDHUP)
+                {
+                    close(peer_fd);
+                    conn->nbd_fd = -1;
+                    open_conns--;
+                    if (conn->cur_op)
+                    {
+                        // Drop the partially received write
+                        conn->cur_op->retval = -EPIPE;
+                        std::function<void(cluster_op_t*)>(conn->cur_op->callback)(conn->cur_op);
+                        conn->cur_op = NULL;
+                    }
+                }
+                else
+                {
+                    conn->read_ready++;
+                    submit_read(conn);
+                }
+            });
+        }
+        while (open_conns > 0)
         {
             ringloop->loop();
             ringloop->wait();
         }
-        stop = false;
+        bool stop = false;
         cluster_op_t *close_sync = new cluster_op_t;
         close_sync->opcode = OSD_OP_SYNC;
         close_sync->callback = [this, &stop](cluster_op_t *op)
@@ -290,6 +391,13 @@ public:
             ringloop->wait();
         }
         delete cli;
+        for (auto conn: conns)
+        {
+            free_send_buffers(conn);
+            free(conn->recv_buf);
+            delete conn;
+        }
+        conns.clear();
         delete epmgr;
         delete ringloop;
     }
@@ -438,10 +546,10 @@ public:
     }
 
 protected:
-    int run_nbd(int sockfd[2], int dev_num, uint64_t size, uint64_t flags, unsigned timeout, bool bg)
+    int run_nbd(std::vector<int> & sockfd, int dev_num, uint64_t size, uint64_t flags, unsigned timeout, bool bg)
     {
         // Check handle size
-        assert(sizeof(cur_req.handle) == 8);
+        assert(sizeof(nbd_request::handle) == 8);
         char path[64] = { 0 };
         sprintf(path, "/dev/nbd%d", dev_num);
         int r, nbd = open(path, O_RDWR), qd_fd;
@@ -454,6 +562,15 @@ protected:
         {
             goto end_close;
         }
+        // Additional connections require Linux 4.10+
+        for (int i = 3; i < sockfd.size(); i += 2)
+        {
+            r = ioctl(nbd, NBD_SET_SOCK, sockfd[i]);
+            if (r < 0)
+            {
+                goto end_unmap;
+            }
+        }
         r = ioctl(nbd, NBD_SET_BLKSIZE, 4096);
         if (r < 0)
         {
@@ -485,7 +602,10 @@ protected:
         if (!fork())
         {
             // Run in child
-            close(sockfd[0]);
+            for (int i = 0; i < sockfd.size(); i += 2)
+            {
+                close(sockfd[i]);
+            }
             if (bg)
             {
                 daemonize();
@@ -495,12 +615,18 @@ protected:
             {
                 fprintf(stderr, "NBD device terminated with error: %s\n", strerror(errno));
             }
-            close(sockfd[1]);
+            for (int i = 1; i < sockfd.size(); i += 2)
+            {
+                close(sockfd[i]);
+            }
             ioctl(nbd, NBD_CLEAR_QUE);
             ioctl(nbd, NBD_CLEAR_SOCK);
             exit(0);
         }
-        close(sockfd[1]);
+        for (int i = 1; i < sockfd.size(); i += 2)
+        {
+            close(sockfd[i]);
+        }
         close(nbd);
         return 0;
     end_close:
@@ -516,9 +642,9 @@ protected:
         return -3;
     }
 
-    void submit_send()
+    void submit_send(nbd_conn_t *conn)
     {
-        if (!send_list.size() || send_msg.msg_iovlen > 0)
+        if (conn->nbd_fd < 0 || !conn->send_list.size() || conn->send_msg.msg_iovlen > 0)
         {
             return;
         }
@@ -528,26 +654,32 @@ protected:
             return;
         }
         ring_data_t* data = ((ring_data_t*)sqe->user_data);
-        data->callback = [this](ring_data_t *data) { handle_send(data->res); };
-        send_msg.msg_iov = send_list.data();
-        send_msg.msg_iovlen = send_list.size();
-        my_uring_prep_sendmsg(sqe, nbd_fd, &send_msg, MSG_ZEROCOPY);
+        data->callback = [this, conn](ring_data_t *data) { handle_send(conn, data->res); };
+        conn->send_msg.msg_iov = conn->send_list.data();
+        conn->send_msg.msg_iovlen = conn->send_list.size();
+        my_uring_prep_sendmsg(sqe, conn->nbd_fd, &conn->send_msg, MSG_ZEROCOPY);
     }
 
-    void handle_send(int result)
+    void handle_send(nbd_conn_t *conn, int result)
     {
-        send_msg.msg_iovlen = 0;
+        conn->send_msg.msg_iovlen = 0;
+        if (conn->nbd_fd < 0)
+        {
+            // Connection is already closed
+            return;
+        }
         if (result < 0 && result != -EAGAIN)
         {
             fprintf(stderr, "Socket disconnected: %s\n", strerror(-result));
             exit(1);
         }
+        auto & send_list = conn->send_list;
         int to_eat = 0;
         while (result > 0 && to_eat < send_list.size())
         {
             if (result >= send_list[to_eat].iov_len)
             {
-                free(to_free[to_eat]);
+                buffer_pool.free_buffer(conn->to_free[to_eat].first, conn->to_free[to_eat].second);
                 result -= send_list[to_eat].iov_len;
                 to_eat++;
             }
@@ -561,22 +693,33 @@ protected:
         if (to_eat > 0)
         {
             send_list.erase(send_list.begin(), send_list.begin() + to_eat);
-            to_free.erase(to_free.begin(), to_free.begin() + to_eat);
+            conn->to_free.erase(conn->to_free.begin(), conn->to_free.begin() + to_eat);
         }
-        for (int i = 0; i < next_send_list.size(); i++)
+        for (int i = 0; i < conn->next_send_list.size(); i++)
         {
-            send_list.push_back(next_send_list[i]);
+            send_list.push_back(conn->next_send_list[i]);
         }
-        next_send_list.clear();
+        conn->next_send_list.clear();
         if (send_list.size() > 0)
         {
             ringloop->wakeup();
         }
     }
 
-    void submit_read()
+    void free_send_buffers(nbd_conn_t *conn)
+    {
+        for (auto & buf: conn->to_free)
+        {
+            buffer_pool.free_buffer(buf.first, buf.second);
+        }
+        conn->to_free.clear();
+        conn->send_list.clear();
+        conn->next_send_list.clear();
+    }
+
+    void submit_read(nbd_conn_t *conn)
     {
-        if (!read_ready || read_msg.msg_iovlen > 0)
+        if (conn->nbd_fd < 0 || !conn->read_ready || conn->read_msg.msg_iovlen > 0)
         {
             return;
         }
@@ -586,66 +729,72 @@ protected:
             return;
         }
         ring_data_t* data = ((ring_data_t*)sqe->user_data);
-        data->callback = [this](ring_data_t *data) { handle_read(data->res); };
-        if (cur_left < receive_buffer_size)
+        data->callback = [this, conn](ring_data_t *data) { handle_read(conn, data->res); };
+        if (conn->cur_left < receive_buffer_size)
         {
-            read_iov.iov_base = recv_buf;
-            read_iov.iov_len = receive_buffer_size;
+            conn->read_iov.iov_base = conn->recv_buf;
+            conn->read_iov.iov_len = receive_buffer_size;
         }
         else
         {
-            read_iov.iov_base = cur_buf;
-            read_iov.iov_len = cur_left;
+            conn->read_iov.iov_base = conn->cur_buf;
+            conn->read_iov.iov_len = conn->cur_left;
         }
-        read_msg.msg_iov = &read_iov;
-        read_msg.msg_iovlen = 1;
-        my_uring_prep_recvmsg(sqe, nbd_fd, &read_msg, 0);
+        conn->read_msg.msg_iov = &conn->read_iov;
+        conn->read_msg.msg_iovlen = 1;
+        my_uring_prep_recvmsg(sqe, conn->nbd_fd, &conn->read_msg, 0);
     }
 
-    void handle_read(int result)
+    void handle_read(nbd_conn_t *conn, int result)
     {
-        read_msg.msg_iovlen = 0;
+        conn->read_msg.msg_iovlen = 0;
+        if (conn->nbd_fd < 0)
+        {
+            // Connection is already closed
+            return;
+        }
         if (result < 0 && result != -EAGAIN)
         {
             fprintf(stderr, "Socket disconnected: %s\n", strerror(-result));
             exit(1);
         }
-        if (result == -EAGAIN || result < read_iov.iov_len)
+        if (result == -EAGAIN || result < conn->read_iov.iov_len)
         {
-            read_ready--;
+            conn->read_ready--;
         }
-        if (read_ready > 0)
+        if (conn->read_ready > 0)
         {
             ringloop->wakeup();
         }
-        void *b = recv_buf;
+        void *b = conn->recv_buf;
         while (result > 0)
         {
-            if (read_iov.iov_base == recv_buf)
+            if (conn->read_iov.iov_base == conn->recv_buf)
             {
-                int inc = result >= cur_left ? cur_left : result;
-                memcpy(cur_buf, b, inc);
-                cur_left -= inc;
+                int inc = result >= conn->cur_left ? conn->cur_left : result;
+                memcpy(conn->cur_buf, b, inc);
+                conn->cur_left -= inc;
                 result -= inc;
-                cur_buf += inc;
+                conn->cur_buf += inc;
                 b += inc;
             }
             else
             {
-                assert(result <= cur_left);
-                cur_left -= result;
+                assert(result <= conn->cur_left);
+                conn->cur_left -= result;
                 result = 0;
             }
-            if (cur_left <= 0)
+            if (conn->cur_left <= 0)
             {
-                handle_finished_read();
+                handle_finished_read(conn);
             }
         }
     }
 
-    void handle_finished_read()
+    void handle_finished_read(nbd_conn_t *conn)
     {
-        if (read_state == CL_READ_HDR)
+        nbd_request & cur_req = conn->cur_req;
+        if (conn->read_state == CL_READ_HDR)
         {
             int req_type = be32toh(cur_req.type);
             if (be32toh(cur_req.magic) != NBD_REQUEST_MAGIC ||
@@ -659,58 +808,67 @@ protected:
             printf("request %lx +%x %lx\n", be64toh(cur_req.from), be32toh(cur_req.len), handle);
 #endif
             void *buf = NULL;
+            uint64_t buf_len = 0;
             cluster_op_t *op = new cluster_op_t;
             if (req_type == NBD_CMD_READ || req_type == NBD_CMD_WRITE)
             {
                 op->opcode = req_type == NBD_CMD_READ ? OSD_OP_READ : OSD_OP_WRITE;
                 op->inode = inode ? inode : watch->cfg.num;
                 op->offset = be64toh(cur_req.from);
-                op->len = be32toh(cur_req.len);
-                buf = malloc_or_die(sizeof(nbd_reply) + op->len);
+                op->len = buf_len = be32toh(cur_req.len);
+                buf = buffer_pool.alloc_buffer(buf_len);
                 op->iov.push_back(buf + sizeof(nbd_reply), op->len);
             }
             else if (req_type == NBD_CMD_FLUSH)
             {
                 op->opcode = OSD_OP_SYNC;
-                buf = malloc_or_die(sizeof(nbd_reply));
+                buf = buffer_pool.alloc_buffer(0);
             }
-            op->callback = [this, buf, handle](cluster_op_t *op)
+            op->callback = [this, conn, buf, buf_len, handle](cluster_op_t *op)
             {
 #ifdef DEBUG
                 printf("reply %lx e=%d\n", handle, op->retval);
 #endif
+                if (conn->nbd_fd < 0)
+                {
+                    // Connection is already closed, nobody waits for the reply
+                    buffer_pool.free_buffer(buf, buf_len);
+                    delete op;
+                    return;
+                }
                 nbd_reply *reply = (nbd_reply*)buf;
                 reply->magic = htobe32(NBD_REPLY_MAGIC);
                 memcpy(reply->handle, &handle, 8);
                 reply->error = htobe32(op->retval < 0 ? -op->retval : 0);
-                auto & to_list = send_msg.msg_iovlen > 0 ? next_send_list : send_list;
+                auto & to_list = conn->send_msg.msg_iovlen > 0 ? conn->next_send_list : conn->send_list;
                 if (op->retval < 0 || op->opcode != OSD_OP_READ)
                     to_list.push_back({ .iov_base = buf, .iov_len = sizeof(nbd_reply) });
                 else
                     to_list.push_back({ .iov_base = buf, .iov_len = sizeof(nbd_reply) + op->len });
-                to_free.push_back(buf);
+                conn->to_free.push_back({ buf, buf_len });
                 delete op;
                 ringloop->wakeup();
             };
             if (req_type == NBD_CMD_WRITE)
             {
-                cur_op = op;
-                cur_buf = buf + sizeof(nbd_reply);
-                cur_left = op->len;
-                read_state = CL_READ_DATA;
+                conn->cur_op = op;
+                conn->cur_buf = buf + sizeof(nbd_reply);
+                conn->cur_left = op->len;
+                conn->read_state = CL_READ_DATA;
             }
             else
             {
-                cur_op = NULL;
-                cur_buf = &cur_req;
-                cur_left = sizeof(nbd_request);
-                read_state = CL_READ_HDR;
+                conn->cur_op = NULL;
+                conn->cur_buf = &cur_req;
+                conn->cur_left = sizeof(nbd_request);
+                conn->read_state = CL_READ_HDR;
                 cli->execute(op);
             }
         }
         else
         {
-            if (cur_op->opcode == OSD_OP_WRITE && watch->cfg.readonly)
+            cluster_op_t *cur_op = conn->cur_op;
+            if (cur_op->opcode == OSD_OP_WRITE && watch && watch->cfg.readonly)
             {
                 cur_op->retval = -EROFS;
                 std::function<void(cluster_op_t*)>(cur_op->callback)(cur_op);
@@ -719,10 +877,10 @@ protected:
             {
                 cli->execute(cur_op);
             }
-            cur_op = NULL;
-            cur_buf = &cur_req;
-            cur_left = sizeof(nbd_request);
-            read_state = CL_READ_HDR;
+            conn->cur_op = NULL;
+            conn->cur_buf = &cur_req;
+            conn->cur_left = sizeof(nbd_request);
+            conn->read_state = CL_READ_HDR;
         }
     }
 };
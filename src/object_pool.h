@@ -0,0 +1,110 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+// Maximum number of free items kept in each size class
+#define OBJECT_POOL_MAX_FREE 65536
+// Number of different allocation sizes per type (single objects and small arrays)
+#define OBJECT_POOL_SIZE_CLASSES 8
+
+struct object_pool_stats_t
+{
+    uint64_t allocs = 0, heap_allocs = 0;
+};
+
+// Thread-local free lists of memory for objects of type T, used from the class-specific
+// operator new/delete (see OBJECT_POOL_OPERATORS) so that types remain aggregates.
+// Every thread has its own lists, so there's no locking at all. Memory freed
+// in another thread is just put to that thread's list.
+template<class T> class object_pool_t
+{
+    struct size_class_t
+    {
+        size_t size;
+        std::vector<void*> items;
+    };
+
+    struct lists_t
+    {
+        size_class_t classes[OBJECT_POOL_SIZE_CLASSES];
+        int class_count = 0;
+        object_pool_stats_t stats;
+
+        ~lists_t()
+        {
+            for (int i = 0; i < class_count; i++)
+                for (void *ptr: classes[i].items)
+                    ::operator delete(ptr);
+        }
+    };
+
+    static inline lists_t & lists()
+    {
+        static thread_local lists_t l;
+        return l;
+    }
+
+    static inline size_class_t *find_class(lists_t & l, size_t size, bool create)
+    {
+        for (int i = 0; i < l.class_count; i++)
+        {
+            if (l.classes[i].size == size)
+                return &l.classes[i];
+        }
+        if (!create || l.class_count >= OBJECT_POOL_SIZE_CLASSES)
+            return NULL;
+        l.classes[l.class_count].size = size;
+        return &l.classes[l.class_count++];
+    }
+
+public:
+    static void* alloc(size_t size)
+    {
+        auto & l = lists();
+        l.stats.allocs++;
+        auto sc = find_class(l, size, false);
+        if (sc && sc->items.size() > 0)
+        {
+            void *ptr = sc->items.back();
+            sc->items.pop_back();
+            return ptr;
+        }
+        l.stats.heap_allocs++;
+        return ::operator new(size);
+    }
+
+    static void free(void *ptr, size_t size)
+    {
+        auto & l = lists();
+        auto sc = find_class(l, size, true);
+        if (sc && sc->items.size() < OBJECT_POOL_MAX_FREE)
+            sc->items.push_back(ptr);
+        else
+            ::operator delete(ptr);
+    }
+
+    static const object_pool_stats_t & stats()
+    {
+        return lists().stats;
+    }
+};
+
+#define OBJECT_POOL_OPERATORS(T) \
+    static void* operator new(size_t size) { return object_pool_t<T>::alloc(size); }\
+    static void* operator new[](size_t size) { return object_pool_t<T>::alloc(size); }\
+    static void operator delete(void *ptr, size_t size) { object_pool_t<T>::free(ptr, size); }\
+    static void operator delete[](void *ptr, size_t size) { object_pool_t<T>::free(ptr, size); }
+
+// Base for callback contexts. A callback captures only a pointer to the context instead of
+// all its arguments, so it's stored inline in std::function. Contexts of all derived types
+// are allocated from one pool, each size in its own size class
+struct pooled_callback_ctx_t
+{
+    OBJECT_POOL_OPERATORS(pooled_callback_ctx_t)
+};
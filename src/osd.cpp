@@ -46,6 +46,10 @@ osd_t::osd_t(const json11::Json & config, ring_loop_t *ringloop)
     // FIXME: Create Blockstore from on-disk superblock config and check it against the OSD cluster config
     auto bs_cfg = json_to_bs(this->config);
     this->bs = new blockstore_t(bs_cfg, ringloop, tfd);
+    if (fixed_buffer_count > 0)
+    {
+        ringloop->init_buffer_pool(fixed_buffer_count, bs_block_size);
+    }
     {
         // Autosync based on the number of unstable writes to prevent stalls due to insufficient journal space
         uint64_t max_autosync = bs->get_journal_size() / bs->get_block_size() / 2;
@@ -147,6 +151,18 @@ void osd_t::parse_config(const json11::Json & config)
     recovery_sync_batch = config["recovery_sync_batch"].uint64_value();
     if (recovery_sync_batch < 1 || recovery_sync_batch > MAX_RECOVERY_QUEUE)
         recovery_sync_batch = DEFAULT_RECOVERY_BATCH;
+    if (!config["peering_list_chunk"].is_null())
+    {
+        // Allow to set it to 0 to list PGs in one piece
+        peering_list_chunk = config["peering_list_chunk"].uint64_value();
+    }
+    fixed_buffer_count = config["fixed_buffer_count"].uint64_value();
+    qos_client.iops_limit = config["qos_client_iops"].uint64_value();
+    qos_client.bw_limit = config["qos_client_mbs"].uint64_value()*1024*1024;
+    qos_recovery.iops_limit = config["qos_recovery_iops"].uint64_value();
+    qos_recovery.bw_limit = config["qos_recovery_mbs"].uint64_value()*1024*1024;
+    qos_rebalance.iops_limit = config["qos_rebalance_iops"].uint64_value();
+    qos_rebalance.bw_limit = config["qos_rebalance_mbs"].uint64_value()*1024*1024;
     print_stats_interval = config["print_stats_interval"].uint64_value();
     if (!print_stats_interval)
         print_stats_interval = 3;
@@ -273,7 +289,8 @@ void osd_t::exec_op(osd_op_t *cur_op)
             cur_op->req.sec_rw.offset % bs_bitmap_granularity)) ||
         ((cur_op->req.hdr.opcode == OSD_OP_READ ||
             cur_op->req.hdr.opcode == OSD_OP_WRITE ||
-            cur_op->req.hdr.opcode == OSD_OP_DELETE) &&
+            cur_op->req.hdr.opcode == OSD_OP_DELETE ||
+            cur_op->req.hdr.opcode == OSD_OP_COPY) &&
             (cur_op->req.rw.len > OSD_RW_MAX ||
             cur_op->req.rw.len % bs_bitmap_granularity ||
             cur_op->req.rw.offset % bs_bitmap_granularity)))
@@ -299,6 +316,139 @@ void osd_t::exec_op(osd_op_t *cur_op)
         finish_op(cur_op, -EROFS);
         return;
     }
+    if (cur_op->op_type == OSD_OP_IN &&
+        (cur_op->req.hdr.opcode == OSD_OP_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_WRITE ||
+        cur_op->req.hdr.opcode == OSD_OP_DELETE ||
+        cur_op->req.hdr.opcode == OSD_OP_COPY) &&
+        inode_qos_delay(cur_op))
+    {
+        return;
+    }
+    exec_client_qos(cur_op);
+}
+
+// Per-inode QoS backstop: clients enforce inode limits themselves, so the queue is normally
+// empty, but a misbehaving or outdated client can't exceed the limit on any single primary OSD
+bool osd_t::inode_qos_delay(osd_op_t *cur_op)
+{
+    inode_t inode = cur_op->req.rw.inode;
+    auto cfg_it = st_cli.inode_config.find(inode);
+    bool limited = cfg_it != st_cli.inode_config.end() && cfg_it->second.qos.is_limited();
+    auto qos_it = inode_qos.find(inode);
+    if (qos_it == inode_qos.end())
+    {
+        if (!limited)
+            return false;
+        qos_it = inode_qos.emplace(inode, osd_inode_qos_t()).first;
+    }
+    else if (!limited && !qos_it->second.queue.size())
+    {
+        inode_qos.erase(qos_it);
+        return false;
+    }
+    auto & qos = qos_it->second;
+    (limited ? cfg_it->second.qos : inode_qos_config_t()).apply(qos.read, qos.write);
+    auto & bucket = cur_op->req.hdr.opcode == OSD_OP_READ ? qos.read : qos.write;
+    uint64_t bytes = cur_op->req.hdr.opcode == OSD_OP_DELETE ? 0 : cur_op->req.rw.len;
+    if (qos.queue.size() > 0 || !bucket.take(cur_op->tv_begin, bytes))
+    {
+        qos.queue.push_back(cur_op);
+        if (qos.timer_id < 0)
+        {
+            qos.timer_id = tfd->set_timer_us(bucket.wait_us(), false, [this, inode](int timer_id)
+            {
+                inode_qos[inode].timer_id = -1;
+                run_inode_qos_queue(inode);
+            });
+        }
+        return true;
+    }
+    return false;
+}
+
+void osd_t::run_inode_qos_queue(inode_t inode)
+{
+    auto qos_it = inode_qos.find(inode);
+    if (qos_it == inode_qos.end())
+    {
+        return;
+    }
+    auto & qos = qos_it->second;
+    auto cfg_it = st_cli.inode_config.find(inode);
+    (cfg_it != st_cli.inode_config.end() ? cfg_it->second.qos : inode_qos_config_t()).apply(qos.read, qos.write);
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    while (qos.queue.size() > 0)
+    {
+        osd_op_t *cur_op = qos.queue.front();
+        auto & bucket = cur_op->req.hdr.opcode == OSD_OP_READ ? qos.read : qos.write;
+        if (!bucket.take(now, cur_op->req.hdr.opcode == OSD_OP_DELETE ? 0 : cur_op->req.rw.len))
+        {
+            qos.timer_id = tfd->set_timer_us(bucket.wait_us(), false, [this, inode](int timer_id)
+            {
+                inode_qos[inode].timer_id = -1;
+                run_inode_qos_queue(inode);
+            });
+            return;
+        }
+        qos.queue.pop_front();
+        exec_client_qos(cur_op);
+    }
+    if (!qos.read.is_limited() && !qos.write.is_limited())
+    {
+        inode_qos.erase(qos_it);
+    }
+}
+
+void osd_t::exec_client_qos(osd_op_t *cur_op)
+{
+    if (cur_op->op_type == OSD_OP_IN && qos_client.is_limited() &&
+        (cur_op->req.hdr.opcode == OSD_OP_READ ||
+        cur_op->req.hdr.opcode == OSD_OP_WRITE ||
+        cur_op->req.hdr.opcode == OSD_OP_DELETE ||
+        cur_op->req.hdr.opcode == OSD_OP_COPY))
+    {
+        // Client QoS: queue the operation if the bucket is empty, preserving the order
+        if (qos_client_queue.size() > 0 || !qos_client.take(cur_op->tv_begin, cur_op->req.rw.len))
+        {
+            qos_client_queue.push_back(cur_op);
+            if (qos_client_timer_id < 0)
+            {
+                qos_client_timer_id = tfd->set_timer_us(qos_client.wait_us(), false, [this](int timer_id)
+                {
+                    qos_client_timer_id = -1;
+                    run_client_qos_queue();
+                });
+            }
+            return;
+        }
+    }
+    dispatch_op(cur_op);
+}
+
+void osd_t::run_client_qos_queue()
+{
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    while (qos_client_queue.size() > 0 && qos_client.take(now, qos_client_queue.front()->req.rw.len))
+    {
+        osd_op_t *cur_op = qos_client_queue.front();
+        qos_client_queue.pop_front();
+        dispatch_op(cur_op);
+    }
+    if (qos_client_queue.size() > 0 && qos_client_timer_id < 0)
+    {
+        qos_client_timer_id = tfd->set_timer_us(qos_client.wait_us(), false, [this](int timer_id)
+        {
+            qos_client_timer_id = -1;
+            run_client_qos_queue();
+        });
+    }
+}
+
+void osd_t::dispatch_op(osd_op_t *cur_op)
+{
     if (cur_op->req.hdr.opcode == OSD_OP_TEST_SYNC_STAB_ALL)
     {
         exec_sync_stab_all(cur_op);
@@ -323,6 +473,10 @@ void osd_t::exec_op(osd_op_t *cur_op)
     {
         continue_primary_del(cur_op);
     }
+    else if (cur_op->req.hdr.opcode == OSD_OP_COPY)
+    {
+        continue_primary_copy(cur_op);
+    }
     else
     {
         exec_secondary(cur_op);
@@ -343,19 +497,29 @@ void osd_t::print_stats()
     {
         if (msgr.stats.op_stat_count[i] != prev_stats.op_stat_count[i] && i != OSD_OP_PING)
         {
-            uint64_t avg = (msgr.stats.op_stat_sum[i] - prev_stats.op_stat_sum[i])/(msgr.stats.op_stat_count[i] - prev_stats.op_stat_count[i]);
+            uint64_t count = msgr.stats.op_stat_count[i] - prev_stats.op_stat_count[i];
+            uint64_t avg = (msgr.stats.op_stat_sum[i] - prev_stats.op_stat_sum[i])/count;
             uint64_t bw = (msgr.stats.op_stat_bytes[i] - prev_stats.op_stat_bytes[i]) / print_stats_interval;
+            // 99th percentile, rounded up to the histogram bucket boundary
+            uint64_t p99 = 0, seen = 0;
+            for (int b = 0; b < OSD_LAT_BUCKETS; b++)
+            {
+                seen += msgr.stats.op_stat_lat_hist[i][b] - prev_stats.op_stat_lat_hist[i][b];
+                prev_stats.op_stat_lat_hist[i][b] = msgr.stats.op_stat_lat_hist[i][b];
+                if (!p99 && seen*100 >= count*99)
+                    p99 = 1ul << b;
+            }
             if (msgr.stats.op_stat_bytes[i] != 0)
             {
                 printf(
-                    "[OSD %lu] avg latency for op %d (%s): %lu us, B/W: %.2f %s\n", osd_num, i, osd_op_names[i], avg,
+                    "[OSD %lu] avg latency for op %d (%s): %lu us, p99 < %lu us, B/W: %.2f %s\n", osd_num, i, osd_op_names[i], avg, p99,
                     (bw > 1024*1024*1024 ? bw/1024.0/1024/1024 : (bw > 1024*1024 ? bw/1024.0/1024 : bw/1024.0)),
                     (bw > 1024*1024*1024 ? "GB/s" : (bw > 1024*1024 ? "MB/s" : "KB/s"))
                 );
             }
             else
             {
-                printf("[OSD %lu] avg latency for op %d (%s): %lu us\n", osd_num, i, osd_op_names[i], avg);
+                printf("[OSD %lu] avg latency for op %d (%s): %lu us, p99 < %lu us\n", osd_num, i, osd_op_names[i], avg, p99);
             }
             prev_stats.op_stat_count[i] = msgr.stats.op_stat_count[i];
             prev_stats.op_stat_sum[i] = msgr.stats.op_stat_sum[i];
@@ -387,6 +551,33 @@ void osd_t::print_stats()
             recovery_stat_bytes[1][i] = recovery_stat_bytes[0][i];
         }
     }
+    {
+        // Operation structures should come from the pools, without malloc(), once the OSD warms up.
+        // Other per-operation allocations (op_data, data buffers, large iovecs) aren't counted here
+        object_pool_stats_t pool_stats = object_pool_t<osd_op_t>::stats();
+        pool_stats.allocs += object_pool_t<blockstore_op_t>::stats().allocs;
+        pool_stats.heap_allocs += object_pool_t<blockstore_op_t>::stats().heap_allocs;
+        pool_stats.allocs += object_pool_t<pooled_callback_ctx_t>::stats().allocs;
+        pool_stats.heap_allocs += object_pool_t<pooled_callback_ctx_t>::stats().heap_allocs;
+        if (pool_stats.heap_allocs != prev_pool_stats.heap_allocs)
+        {
+            printf(
+                "[OSD %lu] op pools: %lu of %lu allocations used malloc\n", osd_num,
+                pool_stats.heap_allocs - prev_pool_stats.heap_allocs, pool_stats.allocs - prev_pool_stats.allocs
+            );
+        }
+        prev_pool_stats = pool_stats;
+    }
+    if (ringloop->stats.submits != prev_ring_stats.submits)
+    {
+        uint64_t submits = ringloop->stats.submits - prev_ring_stats.submits;
+        printf(
+            "[OSD %lu] io_uring: %.2f submits per loop, %.2f SQEs per submit\n", osd_num,
+            submits * 1.0 / (ringloop->stats.loops - prev_ring_stats.loops),
+            (ringloop->stats.sqes - prev_ring_stats.sqes) * 1.0 / submits
+        );
+        prev_ring_stats = ringloop->stats;
+    }
     if (incomplete_objects > 0)
     {
         printf("[OSD %lu] %lu object(s) incomplete\n", osd_num, incomplete_objects);
@@ -454,10 +645,11 @@ void osd_t::print_slow()
                 else if (op->req.hdr.opcode == OSD_OP_SEC_LIST)
                 {
                     bufprintf(
-                        " inode=%lx-%lx pg=%u/%u, stripe=%lu",
+                        " inode=%lx-%lx pg=%u/%u, stripe=%lu, from=%lx, limit=%lu",
                         op->req.sec_list.min_inode, op->req.sec_list.max_inode,
                         op->req.sec_list.list_pg, op->req.sec_list.pg_count,
-                        op->req.sec_list.pg_stripe_size
+                        op->req.sec_list.pg_stripe_size, op->req.sec_list.min_stripe,
+                        op->req.sec_list.stable_limit
                     );
                 }
                 else if (op->req.hdr.opcode == OSD_OP_READ || op->req.hdr.opcode == OSD_OP_WRITE ||
@@ -21,8 +21,10 @@
 #include "timerfd_manager.h"
 #include "epoll_manager.h"
 #include "osd_peering_pg.h"
+#include "osd_recovery.h"
 #include "messenger.h"
 #include "etcd_state_client.h"
+#include "osd_qos.h"
 
 #define OSD_LOADING_PGS 0x01
 #define OSD_PEERING_PGS 0x04
@@ -39,6 +41,7 @@
 #define MAX_RECOVERY_QUEUE 2048
 #define DEFAULT_RECOVERY_QUEUE 4
 #define DEFAULT_RECOVERY_BATCH 16
+#define DEFAULT_PEERING_LIST_CHUNK 65536
 
 //#define OSD_STUB
 
@@ -113,6 +116,11 @@ class osd_t
     int autosync_writes = DEFAULT_AUTOSYNC_WRITES;
     int recovery_queue_depth = DEFAULT_RECOVERY_QUEUE;
     int recovery_sync_batch = DEFAULT_RECOVERY_BATCH;
+    int peering_list_chunk = DEFAULT_PEERING_LIST_CHUNK;
+    // QoS token buckets for client, recovery (degraded) and rebalance (misplaced) operations
+    osd_qos_bucket_t qos_client, qos_recovery, qos_rebalance;
+    // Number of block_size data buffers registered in io_uring for fixed reads/writes
+    int fixed_buffer_count = 0;
     int log_level = 0;
 
     // cluster state
@@ -138,6 +146,12 @@ class osd_t
     uint64_t misplaced_objects = 0, degraded_objects = 0, incomplete_objects = 0;
     int peering_state = 0;
     std::map<object_id, osd_recovery_op_t> recovery_ops;
+    // active PGs with degraded or misplaced objects, updated when PG states change
+    osd_recovery_queue_t recovery_degraded_pgs, recovery_misplaced_pgs;
+    int recovery_qos_timer_id = -1;
+    std::deque<osd_op_t*> qos_client_queue;
+    int qos_client_timer_id = -1;
+    std::map<inode_t, osd_inode_qos_t> inode_qos;
     int recovery_done = 0;
     osd_op_t *autosync_op = NULL;
 
@@ -164,6 +178,8 @@ class osd_t
 
     // op statistics
     osd_op_stats_t prev_stats;
+    ring_loop_stats_t prev_ring_stats = { 0 };
+    object_pool_stats_t prev_pool_stats;
     std::map<uint64_t, inode_stats_t> inode_stats;
     const char* recovery_stat_names[2] = { "degraded", "misplaced" };
     uint64_t recovery_stat_count[2][2] = { 0 };
@@ -202,7 +218,8 @@ class osd_t
     void repeer_pgs(osd_num_t osd_num);
     void start_pg_peering(pg_t & pg);
     void submit_sync_and_list_subop(osd_num_t role_osd, pg_peering_state_t *ps);
-    void submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps);
+    void submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps, object_id min_oid = { 0 });
+    void handle_list_chunk(osd_num_t role_osd, pg_peering_state_t *ps, obj_ver_id *buf, uint64_t total_count, uint64_t stable_count, object_id next_oid);
     void discard_list_subop(osd_op_t *list_op);
     bool stop_pg(pg_t & pg);
     void reset_pg(pg_t & pg);
@@ -212,13 +229,20 @@ class osd_t
     void submit_pg_flush_ops(pg_t & pg);
     void handle_flush_op(bool rollback, pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t *fb, osd_num_t peer_osd, int retval);
     void submit_flush_op(pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t *fb, bool rollback, osd_num_t peer_osd, int count, obj_ver_id *data);
-    bool pick_next_recovery(osd_recovery_op_t &op);
+    bool pick_next_recovery(osd_recovery_op_t &op, pg_t **pick_pg);
+    bool pick_recovery_object(pg_t & pg, bool degraded, osd_recovery_op_t &op);
+    void update_recovery_queue(pg_t & pg);
     void submit_recovery_op(osd_recovery_op_t *op);
     bool continue_recovery();
     pg_osd_set_state_t* change_osd_set(pg_osd_set_state_t *st, pg_t *pg);
 
     // op execution
     void exec_op(osd_op_t *cur_op);
+    bool inode_qos_delay(osd_op_t *cur_op);
+    void run_inode_qos_queue(inode_t inode);
+    void exec_client_qos(osd_op_t *cur_op);
+    void dispatch_op(osd_op_t *cur_op);
+    void run_client_qos_queue();
     void finish_op(osd_op_t *cur_op, int retval);
 
     // secondary ops
@@ -235,6 +259,9 @@ class osd_t
     void cancel_primary_write(osd_op_t *cur_op);
     void continue_primary_sync(osd_op_t *cur_op);
     void continue_primary_del(osd_op_t *cur_op);
+    void continue_primary_copy(osd_op_t *cur_op);
+    bool submit_copy_write(osd_op_t *cur_op);
+    void submit_copy_sync(osd_op_t *cur_op);
     bool check_write_queue(osd_op_t *cur_op, pg_t & pg);
     void remove_object_from_state(object_id & oid, pg_osd_set_state_t *object_state, pg_t &pg);
     void free_object_state(pg_t & pg, pg_osd_set_state_t **object_state);
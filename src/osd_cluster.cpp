@@ -678,6 +678,10 @@ void osd_t::apply_pg_config()
                 {
                     use_jerasure(pg.pg_size, pg.pg_data_size, true);
                 }
+                else if (pg.scheme == POOL_SCHEME_EC)
+                {
+                    use_ec(pg.pg_size, pg.pg_data_size, true);
+                }
                 this->pg_state_dirty.insert({ .pool_id = pool_id, .pg_num = pg_num });
                 pg.print_state();
                 if (pg_cfg.cur_primary == this->osd_num)
@@ -892,6 +896,10 @@ void osd_t::report_pg_states()
                         {
                             use_jerasure(pg_it->second.pg_size, pg_it->second.pg_data_size, false);
                         }
+                        else if (pg_it->second.scheme == POOL_SCHEME_EC)
+                        {
+                            use_ec(pg_it->second.pg_size, pg_it->second.pg_data_size, false);
+                        }
                         this->pgs.erase(pg_it);
                     }
                     else if (pg_it->second.state & PG_PEERED)
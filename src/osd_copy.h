@@ -0,0 +1,97 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+// Helpers for chained reads and OSD_OP_COPY, separated from osd_t to be testable
+
+#include <errno.h>
+#include "object_id.h"
+#include "etcd_state_client.h"
+
+// Walk the layer chain of <inode> inside the pool <pool_id>. The walk stops at the first parent
+// from another pool and, if <bottom> isn't 0, after <bottom>. Fills <chain> if it's not NULL.
+// Returns the number of layers including <inode> itself and sets <*last> to the last one.
+inline int osd_find_layer_chain(std::map<inode_t, inode_config_t> & inode_config, inode_t inode,
+    pool_id_t pool_id, inode_t bottom, inode_t *chain, inode_t *last)
+{
+    int size = 1;
+    if (chain)
+        chain[0] = inode;
+    *last = inode;
+    auto inode_it = inode_config.find(inode);
+    while (inode_it != inode_config.end() && inode_it->second.parent_id &&
+        INODE_POOL(inode_it->second.parent_id) == pool_id &&
+        // Check for loops
+        inode_it->second.parent_id != inode &&
+        inode_it->first != bottom)
+    {
+        *last = inode_it->second.parent_id;
+        if (chain)
+            chain[size] = *last;
+        size++;
+        inode_it = inode_config.find(*last);
+    }
+    return size;
+}
+
+// Check if OSD_OP_COPY can copy the chain found by osd_find_layer_chain() ending with <last>.
+// Returns 0, -EXDEV if the next layer to copy is in another pool or -EINVAL if <bottom>
+// isn't a parent of the copied inode
+inline int osd_check_copy_chain(std::map<inode_t, inode_config_t> & inode_config, inode_t last, inode_t bottom)
+{
+    if (bottom && last == bottom)
+        return 0;
+    auto inode_it = inode_config.find(last);
+    if (inode_it != inode_config.end() && inode_it->second.parent_id &&
+        INODE_POOL(inode_it->second.parent_id) != INODE_POOL(last))
+    {
+        // Parents from other pools can't be copied locally
+        return -EXDEV;
+    }
+    return bottom ? -EINVAL : 0;
+}
+
+// Leave only the parts of parent layer bitmaps (layers 1..chain_size-1, <layer_size> bytes each)
+// which are missing in the object itself (layer 0). Returns true if anything is left in
+// the range [start, end) of bitmap bits
+inline bool osd_mask_copy_bitmaps(uint8_t *bitmaps, int chain_size, int layer_size, int start, int end)
+{
+    bool found = false;
+    for (int chain_pos = 1; chain_pos < chain_size; chain_pos++)
+    {
+        uint8_t *part_bitmap = bitmaps + chain_pos*layer_size;
+        for (int i = 0; i < layer_size; i++)
+        {
+            part_bitmap[i] &= ~bitmaps[i];
+        }
+        for (int cur = start; cur < end && !found; cur++)
+        {
+            found = (part_bitmap[cur >> 3] >> (cur & 7)) & 1;
+        }
+    }
+    return found;
+}
+
+// Find the next range of set bits in [*pos, end), returns false if there are none.
+// The range is [*start, *pos) after the call
+inline bool osd_next_copy_range(const uint8_t *bitmap, int *pos, int end, int *start)
+{
+    int cur = *pos;
+    while (cur < end && !((bitmap[cur >> 3] >> (cur & 7)) & 1))
+    {
+        cur++;
+    }
+    if (cur >= end)
+    {
+        *pos = end;
+        return false;
+    }
+    *start = cur;
+    while (cur < end && ((bitmap[cur >> 3] >> (cur & 7)) & 1))
+    {
+        cur++;
+    }
+    *pos = cur;
+    return true;
+}
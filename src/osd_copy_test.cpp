@@ -0,0 +1,103 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "osd_copy.h"
+
+#define INODE(pool, num) (((inode_t)(pool) << (64-POOL_ID_BITS)) | (num))
+
+static void add_layer(std::map<inode_t, inode_config_t> & cfg, inode_t num, inode_t parent_id)
+{
+    cfg[num] = (inode_config_t){ .num = num, .name = "", .size = 0, .parent_id = parent_id };
+}
+
+void test_chain()
+{
+    printf("test_chain\n");
+    // 1/1 <- 1/2 <- 1/3 <- 1/4, 2/1 <- 1/5
+    std::map<inode_t, inode_config_t> cfg;
+    add_layer(cfg, INODE(1, 1), 0);
+    add_layer(cfg, INODE(1, 2), INODE(1, 1));
+    add_layer(cfg, INODE(1, 3), INODE(1, 2));
+    add_layer(cfg, INODE(1, 4), INODE(1, 3));
+    add_layer(cfg, INODE(2, 1), 0);
+    add_layer(cfg, INODE(1, 5), INODE(2, 1));
+    inode_t chain[8], last = 0;
+    // Chained read: all parents
+    assert(osd_find_layer_chain(cfg, INODE(1, 4), 1, 0, chain, &last) == 4);
+    assert(chain[0] == INODE(1, 4) && chain[1] == INODE(1, 3) && chain[2] == INODE(1, 2) && chain[3] == INODE(1, 1));
+    assert(last == INODE(1, 1));
+    assert(osd_check_copy_chain(cfg, last, 0) == 0);
+    // Copy down to 1/3 must not touch 1/2 and 1/1
+    assert(osd_find_layer_chain(cfg, INODE(1, 4), 1, INODE(1, 3), chain, &last) == 2);
+    assert(chain[0] == INODE(1, 4) && chain[1] == INODE(1, 3));
+    assert(osd_check_copy_chain(cfg, last, INODE(1, 3)) == 0);
+    // Copy down to 1/2, counting without filling the chain
+    assert(osd_find_layer_chain(cfg, INODE(1, 4), 1, INODE(1, 2), NULL, &last) == 3);
+    assert(last == INODE(1, 2) && osd_check_copy_chain(cfg, last, INODE(1, 2)) == 0);
+    // Bottom layer which isn't a parent
+    assert(osd_find_layer_chain(cfg, INODE(1, 2), 1, INODE(1, 4), chain, &last) == 2);
+    assert(osd_check_copy_chain(cfg, last, INODE(1, 4)) == -EINVAL);
+    // Parent from another pool
+    assert(osd_find_layer_chain(cfg, INODE(1, 5), 1, 0, chain, &last) == 1);
+    assert(last == INODE(1, 5));
+    assert(osd_check_copy_chain(cfg, last, 0) == -EXDEV);
+    assert(osd_check_copy_chain(cfg, last, INODE(2, 1)) == -EXDEV);
+    // No parents
+    assert(osd_find_layer_chain(cfg, INODE(1, 1), 1, 0, chain, &last) == 1);
+    assert(osd_check_copy_chain(cfg, last, 0) == 0);
+    // Loops
+    cfg[INODE(1, 1)].parent_id = INODE(1, 4);
+    assert(osd_find_layer_chain(cfg, INODE(1, 4), 1, 0, chain, &last) == 4);
+    assert(last == INODE(1, 1));
+    printf("OK\n");
+}
+
+void test_bitmaps()
+{
+    printf("test_bitmaps\n");
+    // 3 layers, 2 bytes of bitmap each
+    uint8_t bitmaps[6] = {
+        0x0F, 0x00, // object itself
+        0x3C, 0x01, // parent
+        0x81, 0x80, // grandparent
+    };
+    assert(osd_mask_copy_bitmaps(bitmaps, 3, 2, 0, 16));
+    assert(bitmaps[0] == 0x0F && bitmaps[1] == 0x00);
+    assert(bitmaps[2] == 0x30 && bitmaps[3] == 0x01);
+    assert(bitmaps[4] == 0x80 && bitmaps[5] == 0x80);
+    // Nothing left in the range [0, 4)
+    uint8_t bitmaps2[4] = { 0x0F, 0x00, 0x03, 0xF0 };
+    assert(!osd_mask_copy_bitmaps(bitmaps2, 2, 2, 0, 4));
+    assert(bitmaps2[2] == 0x00 && bitmaps2[3] == 0xF0);
+    assert(osd_mask_copy_bitmaps(bitmaps2, 2, 2, 0, 16));
+    printf("OK\n");
+}
+
+void test_ranges()
+{
+    printf("test_ranges\n");
+    // bits 1-2, 7-8, 15
+    uint8_t bitmap[2] = { 0x86, 0x81 };
+    int pos = 0, start = -1;
+    assert(osd_next_copy_range(bitmap, &pos, 16, &start) && start == 1 && pos == 3);
+    assert(osd_next_copy_range(bitmap, &pos, 16, &start) && start == 7 && pos == 9);
+    assert(osd_next_copy_range(bitmap, &pos, 16, &start) && start == 15 && pos == 16);
+    assert(!osd_next_copy_range(bitmap, &pos, 16, &start) && pos == 16);
+    // The range is limited by <end>
+    pos = 0;
+    assert(osd_next_copy_range(bitmap, &pos, 8, &start) && start == 1 && pos == 3);
+    assert(osd_next_copy_range(bitmap, &pos, 8, &start) && start == 7 && pos == 8);
+    assert(!osd_next_copy_range(bitmap, &pos, 8, &start));
+    printf("OK\n");
+}
+
+int main(int narg, char *args[])
+{
+    test_chain();
+    test_bitmaps();
+    test_ranges();
+    return 0;
+}
@@ -5,6 +5,15 @@
 
 #define FLUSH_BATCH 512
 
+struct osd_flush_ctx_t: public pooled_callback_ctx_t
+{
+    pool_id_t pool_id;
+    pg_num_t pg_num;
+    pg_flush_batch_t *fb;
+    osd_num_t peer_osd;
+    osd_op_t *op;
+};
+
 void osd_t::submit_pg_flush_ops(pg_t & pg)
 {
     pg_flush_batch_t *fb = new pg_flush_batch_t();
@@ -166,16 +175,24 @@ void osd_t::submit_flush_op(pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t
     // Copy buffer so it gets freed along with the operation
     op->buf = malloc_or_die(sizeof(obj_ver_id) * count);
     memcpy(op->buf, data, sizeof(obj_ver_id) * count);
+    osd_flush_ctx_t *ctx = new osd_flush_ctx_t();
+    ctx->pool_id = pool_id;
+    ctx->pg_num = pg_num;
+    ctx->fb = fb;
+    ctx->peer_osd = peer_osd;
+    ctx->op = op;
     if (peer_osd == this->osd_num)
     {
         // local
         clock_gettime(CLOCK_REALTIME, &op->tv_begin);
         op->bs_op = new blockstore_op_t((blockstore_op_t){
             .opcode = (uint64_t)(rollback ? BS_OP_ROLLBACK : BS_OP_STABLE),
-            .callback = [this, op, pool_id, pg_num, fb](blockstore_op_t *bs_op)
+            .callback = [this, ctx](blockstore_op_t *bs_op)
             {
+                osd_op_t *op = ctx->op;
                 add_bs_subop_stats(op);
-                handle_flush_op(bs_op->opcode == BS_OP_ROLLBACK, pool_id, pg_num, fb, this->osd_num, bs_op->retval);
+                handle_flush_op(bs_op->opcode == BS_OP_ROLLBACK, ctx->pool_id, ctx->pg_num, ctx->fb, this->osd_num, bs_op->retval);
+                delete ctx;
                 delete op->bs_op;
                 op->bs_op = NULL;
                 delete op;
@@ -202,52 +219,67 @@ void osd_t::submit_flush_op(pool_id_t pool_id, pg_num_t pg_num, pg_flush_batch_t
                 .len = count * sizeof(obj_ver_id),
             },
         };
-        op->callback = [this, pool_id, pg_num, fb, peer_osd](osd_op_t *op)
+        op->callback = [this, ctx](osd_op_t *op)
         {
-            handle_flush_op(op->req.hdr.opcode == OSD_OP_SEC_ROLLBACK, pool_id, pg_num, fb, peer_osd, op->reply.hdr.retval);
+            handle_flush_op(op->req.hdr.opcode == OSD_OP_SEC_ROLLBACK, ctx->pool_id, ctx->pg_num, ctx->fb, ctx->peer_osd, op->reply.hdr.retval);
+            delete ctx;
             delete op;
         };
         msgr.outbox_push(op);
     }
 }
 
-bool osd_t::pick_next_recovery(osd_recovery_op_t &op)
+// Pick the next object of the PG after its recovery cursor, skipping objects already being recovered
+bool osd_t::pick_recovery_object(pg_t & pg, bool degraded, osd_recovery_op_t &op)
 {
-    if (!no_recovery)
+    if (!osd_next_recovery_object(degraded ? pg.degraded_objects : pg.misplaced_objects,
+        pg.recovery_cursor, recovery_ops, &op.oid))
     {
-        for (auto pg_it = pgs.begin(); pg_it != pgs.end(); pg_it++)
-        {
-            if ((pg_it->second.state & (PG_ACTIVE | PG_HAS_DEGRADED)) == (PG_ACTIVE | PG_HAS_DEGRADED))
-            {
-                for (auto obj_it = pg_it->second.degraded_objects.begin(); obj_it != pg_it->second.degraded_objects.end(); obj_it++)
-                {
-                    if (recovery_ops.find(obj_it->first) == recovery_ops.end())
-                    {
-                        op.degraded = true;
-                        op.oid = obj_it->first;
-                        return true;
-                    }
-                }
-            }
-        }
+        return false;
     }
-    if (!no_rebalance)
+    op.degraded = degraded;
+    return true;
+}
+
+// Add the PG to recovery queues or remove it from them after a change of its state
+void osd_t::update_recovery_queue(pg_t & pg)
+{
+    pool_pg_num_t pg_id = { .pool_id = pg.pool_id, .pg_num = pg.pg_num };
+    if ((pg.state & (PG_ACTIVE | PG_HAS_DEGRADED)) == (PG_ACTIVE | PG_HAS_DEGRADED))
+        recovery_degraded_pgs.set(pg_id, osd_min_degraded_copies(pg));
+    else
+        recovery_degraded_pgs.remove(pg_id);
+    // Don't try to "recover" misplaced objects if "recovery" would make them degraded
+    if ((pg.state & (PG_ACTIVE | PG_DEGRADED | PG_HAS_MISPLACED)) == (PG_ACTIVE | PG_HAS_MISPLACED))
+        recovery_misplaced_pgs.set(pg_id, 0);
+    else
+        recovery_misplaced_pgs.remove(pg_id);
+}
+
+// Degraded objects go first, starting with PGs where they have the least number of copies left.
+// PGs with the same priority are processed round-robin, one object from each PG at a time.
+// Each PG remembers its position, so objects are never rescanned from the beginning.
+bool osd_t::pick_next_recovery(osd_recovery_op_t &op, pg_t **pick_pg)
+{
+    for (int degraded = 1; degraded >= 0; degraded--)
     {
-        for (auto pg_it = pgs.begin(); pg_it != pgs.end(); pg_it++)
+        if (degraded ? no_recovery : no_rebalance)
         {
-            // Don't try to "recover" misplaced objects if "recovery" would make them degraded
-            if ((pg_it->second.state & (PG_ACTIVE | PG_DEGRADED | PG_HAS_MISPLACED)) == (PG_ACTIVE | PG_HAS_MISPLACED))
-            {
-                for (auto obj_it = pg_it->second.misplaced_objects.begin(); obj_it != pg_it->second.misplaced_objects.end(); obj_it++)
-                {
-                    if (recovery_ops.find(obj_it->first) == recovery_ops.end())
-                    {
-                        op.degraded = false;
-                        op.oid = obj_it->first;
-                        return true;
-                    }
-                }
-            }
+            continue;
+        }
+        auto & queue = degraded ? recovery_degraded_pgs : recovery_misplaced_pgs;
+        bool found = queue.pick([&](pool_pg_num_t pg_id)
+        {
+            auto pg_it = pgs.find(pg_id);
+            // Skip PGs where all objects are already being recovered
+            if (pg_it == pgs.end() || !pick_recovery_object(pg_it->second, degraded, op))
+                return false;
+            *pick_pg = &pg_it->second;
+            return true;
+        });
+        if (found)
+        {
+            return true;
         }
     }
     return false;
@@ -315,16 +347,37 @@ void osd_t::submit_recovery_op(osd_recovery_op_t *op)
 // Just trigger write requests for degraded objects. They'll be recovered during writing
 bool osd_t::continue_recovery()
 {
+    if (recovery_qos_timer_id >= 0)
+    {
+        // Recovery is throttled, don't pick objects on every event loop iteration
+        // until the bucket refills and the timer wakes the loop up
+        return true;
+    }
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
     while (recovery_ops.size() < recovery_queue_depth)
     {
         osd_recovery_op_t op;
-        if (pick_next_recovery(op))
+        pg_t *pg = NULL;
+        if (!pick_next_recovery(op, &pg))
         {
-            recovery_ops[op.oid] = op;
-            submit_recovery_op(&recovery_ops[op.oid]);
-        }
-        else
             return false;
+        }
+        auto & bucket = op.degraded ? qos_recovery : qos_rebalance;
+        if (!bucket.take(now, bs_block_size))
+        {
+            // Don't move the cursor, the same object will be picked when the bucket refills
+            recovery_qos_timer_id = tfd->set_timer_us(bucket.wait_us(), false, [this](int timer_id)
+            {
+                recovery_qos_timer_id = -1;
+                ringloop->wakeup();
+            });
+            return true;
+        }
+        pg->recovery_cursor = op.oid;
+        (op.degraded ? recovery_degraded_pgs : recovery_misplaced_pgs).last_pg = { .pool_id = pg->pool_id, .pg_num = pg->pg_num };
+        recovery_ops[op.oid] = op;
+        submit_recovery_op(&recovery_ops[op.oid]);
     }
     return true;
 }
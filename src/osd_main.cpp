@@ -19,6 +19,19 @@ static void handle_sigint(int sig)
     exit(0);
 }
 
+static ring_loop_t *create_ringloop(json11::Json::object & config)
+{
+    int flags = 0;
+    if (config["io_sqpoll"] == "true" || config["io_sqpoll"] == "1" || config["io_sqpoll"] == "yes")
+        flags |= RINGLOOP_SQPOLL;
+    if (config["io_batch_submit"] == "true" || config["io_batch_submit"] == "1" || config["io_batch_submit"] == "yes")
+        flags |= RINGLOOP_BATCH_SUBMIT;
+    return new ring_loop_t(
+        512, flags, config["io_sqpoll_idle"].uint64_value(),
+        config["io_sqpoll_cpu"].is_null() ? -1 : config["io_sqpoll_cpu"].uint64_value()
+    );
+}
+
 int main(int narg, char *args[])
 {
     setvbuf(stdout, NULL, _IONBF, 0);
@@ -40,7 +53,7 @@ int main(int narg, char *args[])
     }
     signal(SIGINT, handle_sigint);
     signal(SIGTERM, handle_sigint);
-    ring_loop_t *ringloop = new ring_loop_t(512);
+    ring_loop_t *ringloop = create_ringloop(config);
     osd = new osd_t(config, ringloop);
     while (1)
     {
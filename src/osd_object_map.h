@@ -0,0 +1,253 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+// Compact map of non-clean PG objects: object_id => pg_osd_set_state_t*
+//
+// A PG usually has very few distinct object states, and objects of the same state
+// usually go one after another - for example, when an OSD dies, all objects of its PGs
+// become degraded in the same way. And objects of the same inode in one PG are
+// placed with a constant step (pg_count * pg_stripe_size) when pg_stripe_size isn't
+// larger than the PG block size, or one after another inside a PG stripe otherwise.
+//
+// So objects are stored as runs of <count> objects of the same inode and state with
+// stripes <start>, <start+step>, <start+2*step>... Each run takes ~40 bytes, so a fully
+// degraded PG takes a few bytes instead of 24+ bytes per object.
+//
+// Runs never overlap: a run never contains the start of another run in its span.
+//
+// The interface mimics the subset of btree_map<object_id, pg_osd_set_state_t*> used by the OSD.
+// Iterators return entries by value, so they can't be used to modify entries in place.
+
+#include "cpp-btree/btree_map.h"
+
+#include "object_id.h"
+
+struct pg_osd_set_state_t;
+
+struct pg_object_run_t
+{
+    // distance between stripes of consecutive objects in the run, undefined if count == 1
+    uint64_t step;
+    uint64_t count;
+    pg_osd_set_state_t *state;
+};
+
+class pg_object_map_t
+{
+public:
+    typedef btree::btree_map<object_id, pg_object_run_t> run_map_t;
+    typedef std::pair<object_id, pg_osd_set_state_t*> value_type;
+
+    class iterator
+    {
+        friend class pg_object_map_t;
+        run_map_t *runs = NULL;
+        run_map_t::iterator run_it;
+        uint64_t pos = 0;
+        value_type cur;
+
+        iterator(run_map_t *runs, run_map_t::iterator run_it, uint64_t pos):
+            runs(runs), run_it(run_it), pos(pos)
+        {
+            load();
+        }
+
+        void load()
+        {
+            if (run_it != runs->end())
+            {
+                cur.first = {
+                    .inode = run_it->first.inode,
+                    .stripe = run_it->first.stripe + pos*run_it->second.step,
+                };
+                cur.second = run_it->second.state;
+            }
+        }
+    public:
+        iterator() {}
+        value_type & operator*() { return cur; }
+        value_type* operator->() { return &cur; }
+        iterator & operator++()
+        {
+            pos++;
+            if (pos >= run_it->second.count)
+            {
+                run_it++;
+                pos = 0;
+            }
+            load();
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            iterator prev = *this;
+            ++(*this);
+            return prev;
+        }
+        bool operator==(const iterator & other) const
+        {
+            return run_it == other.run_it && (run_it == runs->end() || pos == other.pos);
+        }
+        bool operator!=(const iterator & other) const
+        {
+            return !(*this == other);
+        }
+    };
+
+    iterator begin()
+    {
+        return iterator(&runs, runs.begin(), 0);
+    }
+
+    iterator end()
+    {
+        return iterator(&runs, runs.end(), 0);
+    }
+
+    iterator find(const object_id & oid)
+    {
+        uint64_t pos = 0;
+        auto run_it = find_run(oid, &pos);
+        return iterator(&runs, run_it, pos);
+    }
+
+    // First object strictly after <oid>
+    iterator upper_bound(const object_id & oid)
+    {
+        auto run_it = runs.upper_bound(oid);
+        if (run_it != runs.begin())
+        {
+            auto prev_it = std::prev(run_it);
+            if (prev_it->first.inode == oid.inode && prev_it->second.count > 1)
+            {
+                uint64_t pos = (oid.stripe - prev_it->first.stripe) / prev_it->second.step + 1;
+                if (pos < prev_it->second.count)
+                    return iterator(&runs, prev_it, pos);
+            }
+        }
+        return iterator(&runs, run_it, 0);
+    }
+
+    void insert(const object_id & oid, pg_osd_set_state_t *state)
+    {
+        auto found = find(oid);
+        if (found != end())
+        {
+            if (found->second == state)
+                return;
+            erase(oid);
+        }
+        auto run_it = runs.upper_bound(oid);
+        if (run_it != runs.begin())
+        {
+            auto prev_it = std::prev(run_it);
+            auto & prev = prev_it->second;
+            if (prev_it->first.inode == oid.inode)
+            {
+                uint64_t last = prev_it->first.stripe + (prev.count-1)*prev.step;
+                if (prev.count > 1 && last > oid.stripe)
+                {
+                    // <oid> is inside the span of the previous run, split it
+                    uint64_t split = (oid.stripe - prev_it->first.stripe) / prev.step + 1;
+                    pg_object_run_t right = { .step = prev.step, .count = prev.count-split, .state = prev.state };
+                    object_id right_oid = { .inode = oid.inode, .stripe = prev_it->first.stripe + split*prev.step };
+                    prev.count = split;
+                    runs[right_oid] = right;
+                }
+                else if (prev.state == state && (prev.count == 1 || oid.stripe == last + prev.step))
+                {
+                    // Extend the previous run
+                    if (prev.count == 1)
+                        prev.step = oid.stripe - prev_it->first.stripe;
+                    prev.count++;
+                    count++;
+                    return;
+                }
+            }
+        }
+        runs[oid] = (pg_object_run_t){ .step = 0, .count = 1, .state = state };
+        count++;
+    }
+
+    void erase(const object_id & oid)
+    {
+        uint64_t pos = 0;
+        auto run_it = find_run(oid, &pos);
+        if (run_it == runs.end())
+        {
+            return;
+        }
+        count--;
+        pg_object_run_t run = run_it->second;
+        if (run.count == 1)
+        {
+            runs.erase(run_it);
+        }
+        else if (pos == run.count-1)
+        {
+            run_it->second.count--;
+        }
+        else if (pos == 0)
+        {
+            runs.erase(run_it);
+            run.count--;
+            runs[(object_id){ .inode = oid.inode, .stripe = oid.stripe + run.step }] = run;
+        }
+        else
+        {
+            // Split the run in two
+            run_it->second.count = pos;
+            run.count -= pos+1;
+            runs[(object_id){ .inode = oid.inode, .stripe = oid.stripe + run.step }] = run;
+        }
+    }
+
+    void clear()
+    {
+        runs.clear();
+        count = 0;
+    }
+
+    uint64_t size()
+    {
+        return count;
+    }
+
+    uint64_t run_count()
+    {
+        return runs.size();
+    }
+
+protected:
+    run_map_t runs;
+    uint64_t count = 0;
+
+    run_map_t::iterator find_run(const object_id & oid, uint64_t *pos)
+    {
+        auto run_it = runs.upper_bound(oid);
+        if (run_it == runs.begin())
+        {
+            return runs.end();
+        }
+        run_it--;
+        if (run_it->first.inode != oid.inode)
+        {
+            return runs.end();
+        }
+        uint64_t diff = oid.stripe - run_it->first.stripe;
+        if (diff == 0)
+        {
+            *pos = 0;
+            return run_it;
+        }
+        auto & run = run_it->second;
+        if (run.count == 1 || (diff % run.step) || diff / run.step >= run.count)
+        {
+            return runs.end();
+        }
+        *pos = diff / run.step;
+        return run_it;
+    }
+};
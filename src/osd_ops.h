@@ -29,7 +29,8 @@
 #define OSD_OP_DELETE               14
 #define OSD_OP_PING                 15
 #define OSD_OP_SEC_READ_BMP         16
-#define OSD_OP_MAX                  16
+#define OSD_OP_COPY                 17
+#define OSD_OP_MAX                  17
 // Alignment & limit for read/write operations
 #ifndef MEM_ALIGNMENT
 #define MEM_ALIGNMENT               512
@@ -167,6 +168,10 @@ struct __attribute__((__packed__)) osd_op_sec_list_t
     uint64_t pg_stripe_size;
     // inode range (used to select pools)
     uint64_t min_inode, max_inode;
+    // stripe to start listing from, i.e. listing starts from min_inode:min_stripe
+    uint64_t min_stripe;
+    // max number of clean objects in the reply, or 0 to list all objects
+    uint64_t stable_limit;
 };
 
 struct __attribute__((__packed__)) osd_reply_sec_list_t
@@ -175,9 +180,13 @@ struct __attribute__((__packed__)) osd_reply_sec_list_t
     // stable object version count. header.retval = total object version count
     // FIXME: maybe change to the number of bytes in the reply...
     uint64_t stable_count;
+    // the key to continue listing from, or 0:0 if the listing is complete
+    object_id next_oid;
 };
 
 // read or write to the primary OSD (must be within individual stripe)
+// also used for OSD_OP_COPY which copies data of parent layers from the same pool
+// down to copy_from into the object, meta_revision is required for it
 struct __attribute__((__packed__)) osd_op_rw_t
 {
     osd_op_header_t header;
@@ -194,6 +203,8 @@ struct __attribute__((__packed__)) osd_op_rw_t
     // object version for atomic "CAS" (compare-and-set) writes
     // writes and deletes fail with -EINTR if object version differs from (version-1)
     uint64_t version;
+    // for OSD_OP_COPY: the lowest parent layer to copy, 0 means all parents from the same pool
+    uint64_t copy_from;
 };
 
 struct __attribute__((__packed__)) osd_reply_rw_t
@@ -263,6 +263,7 @@ void osd_t::start_pg_peering(pg_t & pg)
                 {
                     free(it->second.buf);
                 }
+                pg.peering_state->discard_list(it->first);
                 pg.peering_state->list_results.erase(it++);
             }
             else
@@ -367,8 +368,12 @@ void osd_t::submit_sync_and_list_subop(osd_num_t role_osd, pg_peering_state_t *p
     }
 }
 
-void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
+void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps, object_id min_oid)
 {
+    if (!min_oid.inode && !min_oid.stripe)
+    {
+        min_oid.inode = ((uint64_t)ps->pool_id << (64 - POOL_ID_BITS));
+    }
     if (role_osd == this->osd_num)
     {
         // Self
@@ -378,11 +383,15 @@ void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
         clock_gettime(CLOCK_REALTIME, &op->tv_begin);
         op->bs_op = new blockstore_op_t();
         op->bs_op->opcode = BS_OP_LIST;
-        op->bs_op->oid.stripe = st_cli.pool_config[ps->pool_id].pg_stripe_size;
-        op->bs_op->oid.inode = ((uint64_t)ps->pool_id << (64 - POOL_ID_BITS));
-        op->bs_op->version = ((uint64_t)(ps->pool_id+1) << (64 - POOL_ID_BITS)) - 1;
-        op->bs_op->len = pg_counts[ps->pool_id];
-        op->bs_op->offset = ps->pg_num-1;
+        op->bs_op->pg_alignment = st_cli.pool_config[ps->pool_id].pg_stripe_size;
+        op->bs_op->min_oid = min_oid;
+        op->bs_op->max_oid = {
+            .inode = ((uint64_t)(ps->pool_id+1) << (64 - POOL_ID_BITS)) - 1,
+            .stripe = UINT64_MAX,
+        };
+        op->bs_op->pg_count = pg_counts[ps->pool_id];
+        op->bs_op->pg_number = ps->pg_num-1;
+        op->bs_op->list_stable_limit = peering_list_chunk;
         op->bs_op->callback = [this, ps, op, role_osd](blockstore_op_t *bs_op)
         {
             if (op->bs_op->retval < 0)
@@ -390,16 +399,7 @@ void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
                 throw std::runtime_error("local OP_LIST failed");
             }
             add_bs_subop_stats(op);
-            printf(
-                "[PG %u/%u] Got object list from OSD %lu (local): %d object versions (%lu of them stable)\n",
-                ps->pool_id, ps->pg_num, role_osd, bs_op->retval, bs_op->version
-            );
-            ps->list_results[role_osd] = {
-                .buf = (obj_ver_id*)op->bs_op->buf,
-                .total_count = (uint64_t)op->bs_op->retval,
-                .stable_count = op->bs_op->version,
-            };
-            ps->list_ops.erase(role_osd);
+            handle_list_chunk(role_osd, ps, (obj_ver_id*)op->bs_op->buf, op->bs_op->retval, op->bs_op->version, op->bs_op->min_oid);
             delete op->bs_op;
             op->bs_op = NULL;
             delete op;
@@ -423,8 +423,10 @@ void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
                 .list_pg = ps->pg_num,
                 .pg_count = pg_counts[ps->pool_id],
                 .pg_stripe_size = st_cli.pool_config[ps->pool_id].pg_stripe_size,
-                .min_inode = ((uint64_t)(ps->pool_id) << (64 - POOL_ID_BITS)),
+                .min_inode = min_oid.inode,
                 .max_inode = ((uint64_t)(ps->pool_id+1) << (64 - POOL_ID_BITS)) - 1,
+                .min_stripe = min_oid.stripe,
+                .stable_limit = (uint64_t)peering_list_chunk,
             },
         };
         op->callback = [this, ps, role_osd](osd_op_t *op)
@@ -438,18 +440,9 @@ void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
                 msgr.stop_client(fail_fd);
                 return;
             }
-            printf(
-                "[PG %u/%u] Got object list from OSD %lu: %ld object versions (%lu of them stable)\n",
-                ps->pool_id, ps->pg_num, role_osd, op->reply.hdr.retval, op->reply.sec_list.stable_count
-            );
-            ps->list_results[role_osd] = {
-                .buf = (obj_ver_id*)op->buf,
-                .total_count = (uint64_t)op->reply.hdr.retval,
-                .stable_count = op->reply.sec_list.stable_count,
-            };
+            handle_list_chunk(role_osd, ps, (obj_ver_id*)op->buf, op->reply.hdr.retval, op->reply.sec_list.stable_count, op->reply.sec_list.next_oid);
             // set op->buf to NULL so it doesn't get freed
             op->buf = NULL;
-            ps->list_ops.erase(role_osd);
             delete op;
         };
         msgr.outbox_push(op);
@@ -457,6 +450,31 @@ void osd_t::submit_list_subop(osd_num_t role_osd, pg_peering_state_t *ps)
     }
 }
 
+void osd_t::handle_list_chunk(osd_num_t role_osd, pg_peering_state_t *ps, obj_ver_id *buf, uint64_t total_count, uint64_t stable_count, object_id next_oid)
+{
+    // Append the chunk to the PG object list right away, so only one chunk buffer is kept at a time
+    ps->add_list_chunk(role_osd, buf, total_count, stable_count);
+    if (buf)
+    {
+        free(buf);
+    }
+    auto & res = ps->list_results[role_osd];
+    res.total_count += total_count;
+    res.stable_count += stable_count;
+    ps->list_ops.erase(role_osd);
+    if (next_oid.inode || next_oid.stripe)
+    {
+        // Request the next chunk
+        submit_list_subop(role_osd, ps, next_oid);
+        return;
+    }
+    printf(
+        "[PG %u/%u] Got object list from OSD %lu%s: %lu object versions (%lu of them stable)\n",
+        ps->pool_id, ps->pg_num, role_osd, role_osd == this->osd_num ? " (local)" : "",
+        res.total_count, res.stable_count
+    );
+}
+
 void osd_t::discard_list_subop(osd_op_t *list_op)
 {
     if (list_op->peer_fd == 0)
@@ -531,6 +549,7 @@ void osd_t::finish_stop_pg(pg_t & pg)
 void osd_t::report_pg_state(pg_t & pg)
 {
     pg.print_state();
+    update_recovery_queue(pg);
     this->pg_state_dirty.insert({ .pool_id = pg.pool_id, .pg_num = pg.pg_num });
     if (pg.state == PG_ACTIVE && (pg.target_history.size() > 0 || pg.all_peers.size() > pg.target_set.size()))
     {
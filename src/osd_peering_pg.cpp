@@ -4,29 +4,6 @@
 #include <unordered_map>
 #include "osd_peering_pg.h"
 
-struct obj_ver_role
-{
-    object_id oid;
-    uint64_t version;
-    uint64_t osd_num;
-    bool is_stable;
-};
-
-inline bool operator < (const obj_ver_role & a, const obj_ver_role & b)
-{
-    // ORDER BY inode ASC, stripe & ~STRIPE_MASK ASC, version DESC, role ASC, osd_num ASC
-    return a.oid.inode < b.oid.inode || a.oid.inode == b.oid.inode && (
-        (a.oid.stripe & ~STRIPE_MASK) < (b.oid.stripe & ~STRIPE_MASK) ||
-        (a.oid.stripe & ~STRIPE_MASK) == (b.oid.stripe & ~STRIPE_MASK) && (
-            a.version > b.version ||
-            a.version == b.version && (
-                a.oid.stripe < b.oid.stripe ||
-                a.oid.stripe == b.oid.stripe && a.osd_num < b.osd_num
-            )
-        )
-    );
-}
-
 struct obj_piece_ver_t
 {
     uint64_t max_ver = 0;
@@ -34,10 +11,17 @@ struct obj_piece_ver_t
     uint64_t max_target = 0;
 };
 
+struct pg_list_cursor_t
+{
+    obj_ver_role *cur, *end;
+    const std::pair<uint64_t, uint64_t> *seg, *seg_end;
+};
+
 struct pg_obj_state_check_t
 {
     pg_t *pg;
     bool replicated = false;
+    // versions of the current object
     std::vector<obj_ver_role> list;
     int list_pos;
     int obj_start = 0, obj_end = 0, ver_start = 0, ver_end = 0;
@@ -50,32 +34,92 @@ struct pg_obj_state_check_t
     pg_osd_set_t osd_set;
     int log_level;
 
-    void walk();
+    void walk(std::vector<obj_ver_role> & all, std::vector<pg_list_run_t> & runs);
     void start_object();
     void handle_version();
     void finish_object();
 };
 
-void pg_obj_state_check_t::walk()
+// Walk over the k-way merge of sorted runs of <all>, object by object
+void pg_obj_state_check_t::walk(std::vector<obj_ver_role> & all, std::vector<pg_list_run_t> & runs)
 {
     pg->clean_count = 0;
     pg->total_count = 0;
     pg->state = 0;
-    for (list_pos = 0; list_pos < list.size(); list_pos++)
+    uint64_t run_total = 0;
+    for (auto & run: runs)
     {
-        if (oid.inode != list[list_pos].oid.inode ||
-            oid.stripe != (list[list_pos].oid.stripe & ~STRIPE_MASK))
+        for (auto & seg: run.segments)
+        {
+            run_total += seg.second-seg.first;
+        }
+    }
+    std::vector<pg_list_run_t> all_run;
+    if (run_total != all.size())
+    {
+        // Runs are unknown, just sort the list
+        std::sort(all.begin(), all.end());
+        all_run.push_back((pg_list_run_t){ .osd_num = 0, .segments = { { 0, all.size() } } });
+    }
+    auto cmp = [](const pg_list_cursor_t & a, const pg_list_cursor_t & b)
+    {
+        return *b.cur < *a.cur;
+    };
+    std::vector<pg_list_cursor_t> heap;
+    for (auto & run: (all_run.size() ? all_run : runs))
+    {
+        if (run.segments.size() && run.segments[0].second > run.segments[0].first)
+        {
+            heap.push_back((pg_list_cursor_t){
+                .cur = all.data() + run.segments[0].first,
+                .end = all.data() + run.segments[0].second,
+                .seg = run.segments.data(),
+                .seg_end = run.segments.data() + run.segments.size(),
+            });
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), cmp);
+    while (heap.size())
+    {
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        auto & c = heap.back();
+        if (oid.inode != c.cur->oid.inode ||
+            oid.stripe != (c.cur->oid.stripe & ~STRIPE_MASK))
         {
             if (oid.inode != 0)
             {
+                list_pos = list.size();
                 finish_object();
             }
+            list.clear();
+            list.push_back(*c.cur);
+            list_pos = 0;
             start_object();
         }
+        else
+        {
+            list.push_back(*c.cur);
+            list_pos = list.size()-1;
+        }
         handle_version();
+        c.cur++;
+        if (c.cur >= c.end)
+        {
+            // Next segment of the same run
+            c.seg++;
+            if (c.seg >= c.seg_end)
+            {
+                heap.pop_back();
+                continue;
+            }
+            c.cur = all.data() + c.seg->first;
+            c.end = all.data() + c.seg->second;
+        }
+        std::push_heap(heap.begin(), heap.end(), cmp);
     }
     if (oid.inode != 0)
     {
+        list_pos = list.size();
         finish_object();
     }
     if (pg->state & PG_HAS_INVALID)
@@ -383,15 +427,123 @@ void pg_obj_state_check_t::finish_object()
         }
         if (state & OBJ_INCOMPLETE)
         {
-            pg->incomplete_objects[oid] = &it->second;
+            pg->incomplete_objects.insert(oid, &it->second);
         }
         else if (state & OBJ_DEGRADED)
         {
-            pg->degraded_objects[oid] = &it->second;
+            pg->degraded_objects.insert(oid, &it->second);
         }
         else
         {
-            pg->misplaced_objects[oid] = &it->second;
+            pg->misplaced_objects.insert(oid, &it->second);
+        }
+    }
+}
+
+void pg_peering_state_t::add_list_chunk(osd_num_t osd_num, obj_ver_id *buf, uint64_t total_count, uint64_t stable_count)
+{
+    uint64_t start = list.size();
+    list.resize(start + total_count);
+    for (uint64_t i = 0; i < total_count; i++)
+    {
+        list[start+i] = {
+            .oid = buf[i].oid,
+            .version = buf[i].version,
+            .osd_num = osd_num,
+            .is_stable = i < stable_count,
+        };
+    }
+    add_list_run(osd_num, start, start+stable_count);
+    add_list_run(osd_num, start+stable_count, start+total_count);
+}
+
+void pg_peering_state_t::add_list_run(osd_num_t osd_num, uint64_t begin, uint64_t end)
+{
+    // Stable and unstable parts of the listing are sorted by object ID, but not by version
+    // and, in case of EC, role. So sort versions of each object separately first
+    for (uint64_t i = begin; i < end; )
+    {
+        uint64_t j = i+1;
+        while (j < end && list[j].oid.inode == list[i].oid.inode &&
+            (list[j].oid.stripe & ~STRIPE_MASK) == (list[i].oid.stripe & ~STRIPE_MASK))
+        {
+            j++;
+        }
+        if (j > i+1)
+        {
+            std::sort(list.begin()+i, list.begin()+j);
+        }
+        i = j;
+    }
+    // Then split the range into sorted segments and append each of them to a run of the same OSD
+    while (begin < end)
+    {
+        uint64_t seg_end = begin+1;
+        while (seg_end < end && !(list[seg_end] < list[seg_end-1]))
+        {
+            seg_end++;
+        }
+        pg_list_run_t *run = NULL;
+        for (auto & r: list_runs)
+        {
+            if (r.osd_num == osd_num && !(list[begin] < list[r.segments.back().second-1]))
+            {
+                run = &r;
+                break;
+            }
+        }
+        if (!run)
+        {
+            list_runs.push_back((pg_list_run_t){ .osd_num = osd_num });
+            run = &list_runs.back();
+        }
+        if (run->segments.size() && run->segments.back().second == begin)
+            run->segments.back().second = seg_end;
+        else
+            run->segments.push_back({ begin, seg_end });
+        begin = seg_end;
+    }
+}
+
+void pg_peering_state_t::discard_list(osd_num_t osd_num)
+{
+    list.erase(std::remove_if(list.begin(), list.end(), [osd_num](const obj_ver_role & ov)
+    {
+        return ov.osd_num == osd_num;
+    }), list.end());
+    // Shift segments of other runs by the number of removed entries before them
+    std::vector<std::pair<uint64_t, uint64_t>> removed;
+    for (auto & run: list_runs)
+    {
+        if (run.osd_num == osd_num)
+        {
+            removed.insert(removed.end(), run.segments.begin(), run.segments.end());
+        }
+    }
+    if (!removed.size())
+    {
+        return;
+    }
+    list_runs.erase(std::remove_if(list_runs.begin(), list_runs.end(), [osd_num](const pg_list_run_t & run)
+    {
+        return run.osd_num == osd_num;
+    }), list_runs.end());
+    std::sort(removed.begin(), removed.end());
+    // removed[i].second becomes the number of entries removed up to the end of removed[i]
+    uint64_t total = 0;
+    for (auto & seg: removed)
+    {
+        total += seg.second-seg.first;
+        seg.second = total;
+    }
+    for (auto & run: list_runs)
+    {
+        for (auto & seg: run.segments)
+        {
+            auto it = std::upper_bound(removed.begin(), removed.end(), std::make_pair(seg.first, UINT64_MAX));
+            uint64_t shift = it == removed.begin() ? 0 : std::prev(it)->second;
+            seg.first -= shift;
+            seg.second -= shift;
         }
     }
 }
@@ -399,42 +551,36 @@ void pg_obj_state_check_t::finish_object()
 // FIXME: Write at least some tests for this function
 void pg_t::calc_object_states(int log_level)
 {
-    // Copy all object lists into one array
+    // Move all object lists into one array
     pg_obj_state_check_t st;
     st.log_level = log_level;
     st.pg = this;
     st.replicated = (this->scheme == POOL_SCHEME_REPLICATED);
     auto ps = peering_state;
-    epoch = 0;
     for (auto it: ps->list_results)
     {
-        auto nstab = it.second.stable_count;
-        auto n = it.second.total_count;
-        auto osd_num = it.first;
-        uint64_t start = st.list.size();
-        st.list.resize(start + n);
-        obj_ver_id *ov = it.second.buf;
-        for (uint64_t i = 0; i < n; i++, ov++)
+        if (it.second.buf)
         {
-            if ((ov->version >> (64-PG_EPOCH_BITS)) > epoch)
-            {
-                epoch = (ov->version >> (64-PG_EPOCH_BITS));
-            }
-            st.list[start+i] = {
-                .oid = ov->oid,
-                .version = ov->version,
-                .osd_num = osd_num,
-                .is_stable = i < nstab,
-            };
+            ps->add_list_chunk(it.first, it.second.buf, it.second.total_count, it.second.stable_count);
+            free(it.second.buf);
+            it.second.buf = NULL;
         }
-        free(it.second.buf);
-        it.second.buf = NULL;
     }
     ps->list_results.clear();
-    // Sort
-    std::sort(st.list.begin(), st.list.end());
-    // Walk over it and check object states
-    st.walk();
+    std::vector<obj_ver_role> all;
+    std::vector<pg_list_run_t> runs;
+    all.swap(ps->list);
+    runs.swap(ps->list_runs);
+    epoch = 0;
+    for (auto & ov: all)
+    {
+        if ((ov.version >> (64-PG_EPOCH_BITS)) > epoch)
+        {
+            epoch = (ov.version >> (64-PG_EPOCH_BITS));
+        }
+    }
+    // Merge lists from all OSDs and check object states
+    st.walk(all, runs);
     if (this->state & (PG_DEGRADED|PG_LEFT_ON_DEAD))
     {
         assert(epoch != ((1ul << PG_EPOCH_BITS)-1));
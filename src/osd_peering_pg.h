@@ -1,6 +1,8 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+#pragma once
+
 #include <map>
 #include <vector>
 #include <algorithm>
@@ -8,6 +10,7 @@
 #include "cpp-btree/btree_map.h"
 
 #include "object_id.h"
+#include "osd_object_map.h"
 #include "osd_ops.h"
 #include "pg_states.h"
 
@@ -35,8 +38,39 @@ struct pg_osd_set_state_t
 struct pg_list_result_t
 {
     obj_ver_id *buf = NULL;
-    uint64_t total_count;
-    uint64_t stable_count;
+    uint64_t total_count = 0;
+    uint64_t stable_count = 0;
+};
+
+struct obj_ver_role
+{
+    object_id oid;
+    uint64_t version;
+    uint64_t osd_num;
+    bool is_stable;
+};
+
+inline bool operator < (const obj_ver_role & a, const obj_ver_role & b)
+{
+    // ORDER BY inode ASC, stripe & ~STRIPE_MASK ASC, version DESC, role ASC, osd_num ASC
+    return a.oid.inode < b.oid.inode || a.oid.inode == b.oid.inode && (
+        (a.oid.stripe & ~STRIPE_MASK) < (b.oid.stripe & ~STRIPE_MASK) ||
+        (a.oid.stripe & ~STRIPE_MASK) == (b.oid.stripe & ~STRIPE_MASK) && (
+            a.version > b.version ||
+            a.version == b.version && (
+                a.oid.stripe < b.oid.stripe ||
+                a.oid.stripe == b.oid.stripe && a.osd_num < b.osd_num
+            )
+        )
+    );
+}
+
+// Sorted sequence of object versions from one OSD. Chunks of different OSDs are
+// interleaved in the list, so one run consists of several segments
+struct pg_list_run_t
+{
+    osd_num_t osd_num;
+    std::vector<std::pair<uint64_t, uint64_t>> segments;
 };
 
 struct osd_op_t;
@@ -45,9 +79,18 @@ struct pg_peering_state_t
 {
     // osd_num -> list result
     std::map<osd_num_t, osd_op_t*> list_ops;
+    // osd_num -> list result. buf is only set if the list wasn't added to <list> with add_list_chunk()
     std::map<osd_num_t, pg_list_result_t> list_results;
+    // object versions from all OSDs, appended chunk by chunk during listing
+    std::vector<obj_ver_role> list;
+    // sorted runs of <list>, merged by calc_object_states() instead of sorting the whole list
+    std::vector<pg_list_run_t> list_runs;
     pool_id_t pool_id = 0;
     pg_num_t pg_num = 0;
+
+    void add_list_chunk(osd_num_t osd_num, obj_ver_id *buf, uint64_t total_count, uint64_t stable_count);
+    void add_list_run(osd_num_t osd_num, uint64_t begin, uint64_t end);
+    void discard_list(osd_num_t osd_num);
 };
 
 struct obj_piece_id_t
@@ -103,10 +146,11 @@ struct pg_t
     pg_osd_set_t cur_loc_set;
     // moved object map. by default, each object is considered to reside on cur_set.
     // this map stores all objects that differ.
-    // it may consume up to ~ (raw storage / object size) * 24 bytes in the worst case scenario
-    // which is up to ~192 MB per 1 TB in the worst case scenario
+    // objects are stored as runs of the same state (see osd_object_map.h), so it usually takes
+    // a few KB per PG even when all objects are degraded. the worst case is when almost every
+    // other object is in a different state: ~ (raw storage / object size) * 40 bytes
     std::map<pg_osd_set_t, pg_osd_set_state_t> state_dict;
-    btree::btree_map<object_id, pg_osd_set_state_t*> incomplete_objects, misplaced_objects, degraded_objects;
+    pg_object_map_t incomplete_objects, misplaced_objects, degraded_objects;
     std::map<obj_piece_id_t, flush_action_t> flush_actions;
     std::vector<obj_ver_osd_t> copies_to_delete_after_sync;
     btree::btree_map<object_id, uint64_t> ver_override;
@@ -114,6 +158,8 @@ struct pg_t
     pg_flush_batch_t *flush_batch = NULL;
 
     int inflight = 0; // including write_queue
+    // last object picked for recovery, the next one is searched after it
+    object_id recovery_cursor = { 0 };
     std::multimap<object_id, osd_op_t*> write_queue;
 
     void calc_object_states(int log_level);
@@ -3,8 +3,12 @@
 
 #define _LARGEFILE64_SOURCE
 
+#include <assert.h>
+#include <time.h>
+#include <stdlib.h>
 #include "malloc_or_die.h"
 #include "osd_peering_pg.h"
+#include "test_timing.h"
 #define STRIPE_SHIFT 12
 
 /**
@@ -20,39 +24,188 @@
  *    v1=1s,2s,6s -> misplaced
  * 2) ...
  */
-int main(int argc, char *argv[])
+
+static pg_t make_replicated_pg(uint64_t osd_count)
 {
     pg_t pg = {
         .state = PG_PEERING,
+        .scheme = POOL_SCHEME_REPLICATED,
+        .pg_cursize = osd_count,
+        .pg_size = osd_count,
+        .pg_minsize = 1,
+        .pg_data_size = 1,
         .pg_num = 1,
-        .target_set = { 1, 2, 3 },
-        .cur_set = { 1, 2, 3 },
         .peering_state = new pg_peering_state_t(),
     };
-    for (uint64_t osd_num = 1; osd_num <= 3; osd_num++)
+    for (uint64_t osd_num = 1; osd_num <= osd_count; osd_num++)
+    {
+        pg.target_set.push_back(osd_num);
+        pg.cur_set.push_back(osd_num);
+    }
+    return pg;
+}
+
+// Every OSD has <count> stable objects, except that the last OSD misses each 1000th object.
+// OSD 1 also has unstable newer versions of the last 10 objects.
+// Chunks of <chunk> objects are added like during peering, interleaved between OSDs.
+static obj_ver_id* make_chunk(uint64_t osd_num, uint64_t osd_count, uint64_t count,
+    uint64_t from, uint64_t to, uint64_t *total_count, uint64_t *stable_count)
+{
+    obj_ver_id *buf = (obj_ver_id*)malloc_or_die(sizeof(obj_ver_id) * (to-from+10));
+    uint64_t n = 0;
+    for (uint64_t i = from; i < to; i++)
+    {
+        if (osd_num == osd_count && !(i % 1000))
+            continue;
+        buf[n++] = { .oid = { .inode = 1, .stripe = i << STRIPE_SHIFT }, .version = 1 };
+    }
+    *stable_count = n;
+    if (osd_num == 1)
+    {
+        for (uint64_t i = (from < count-10 ? count-10 : from); i < to; i++)
+            buf[n++] = { .oid = { .inode = 1, .stripe = i << STRIPE_SHIFT }, .version = 2 };
+    }
+    *total_count = n;
+    return buf;
+}
+
+static void fill_pg(pg_t & pg, uint64_t osd_count, uint64_t count, uint64_t chunk)
+{
+    for (uint64_t from = 0; from < count; from += chunk)
     {
-        pg_list_result_t r = {
-            .buf = (obj_ver_id*)malloc_or_die(sizeof(obj_ver_id) * 1024*1024*8),
-            .total_count = 1024*1024*8,
-            .stable_count = (uint64_t)(1024*1024*8 - (osd_num == 1 ? 10 : 0)),
-        };
-        for (uint64_t i = 0; i < r.total_count; i++)
+        uint64_t to = from+chunk > count ? count : from+chunk;
+        for (uint64_t osd_num = 1; osd_num <= osd_count; osd_num++)
         {
-            r.buf[i] = {
-                .oid = {
-                    .inode = 1,
-                    .stripe = (i << STRIPE_SHIFT) | (osd_num-1),
-                },
-                .version = (uint64_t)(osd_num == 1 && i >= r.total_count - 10 ? 2 : 1),
-            };
+            uint64_t total_count, stable_count;
+            obj_ver_id *buf = make_chunk(osd_num, osd_count, count, from, to, &total_count, &stable_count);
+            pg.peering_state->add_list_chunk(osd_num, buf, total_count, stable_count);
+            free(buf);
         }
+    }
+}
+
+static void check_states(pg_t & pg, uint64_t count, bool degraded)
+{
+    uint64_t degraded_count = degraded ? (count+999)/1000 : 0;
+    printf("total=%lu clean=%lu degraded=%lu flush=%lu\n", pg.total_count, pg.clean_count,
+        pg.degraded_objects.size(), pg.flush_actions.size());
+    assert(pg.total_count == count);
+    assert(pg.clean_count == count - degraded_count);
+    assert(pg.degraded_objects.size() == degraded_count);
+    assert(pg.flush_actions.size() == 10);
+    assert(pg.state & PG_HAS_UNCLEAN);
+    for (auto & fa: pg.flush_actions)
+    {
+        assert(fa.first.osd_num == 1 && fa.second.rollback && fa.second.rollback_to == 1);
+    }
+}
+
+void test_merge()
+{
+    // Chunked lists
+    pg_t pg = make_replicated_pg(3);
+    fill_pg(pg, 3, 100000, 4096);
+    pg.calc_object_states(0);
+    check_states(pg, 100000, true);
+    delete pg.peering_state;
+    // Discarded list of a disconnected OSD
+    pg = make_replicated_pg(3);
+    fill_pg(pg, 3, 100000, 4096);
+    pg.peering_state->discard_list(3);
+    uint64_t total_count, stable_count;
+    obj_ver_id *buf = make_chunk(3, 4, 100000, 0, 100000, &total_count, &stable_count);
+    pg.peering_state->add_list_chunk(3, buf, total_count, stable_count);
+    free(buf);
+    pg.calc_object_states(0);
+    check_states(pg, 100000, false);
+    delete pg.peering_state;
+    // Whole lists in list_results
+    pg = make_replicated_pg(3);
+    for (uint64_t osd_num = 1; osd_num <= 3; osd_num++)
+    {
+        pg_list_result_t r;
+        r.buf = make_chunk(osd_num, 3, 100000, 0, 100000, &r.total_count, &r.stable_count);
         pg.peering_state->list_results[osd_num] = r;
     }
     pg.calc_object_states(0);
-    printf("deviation variants=%ld clean=%lu\n", pg.state_dict.size(), pg.clean_count);
-    for (auto it: pg.state_dict)
+    check_states(pg, 100000, true);
+    delete pg.peering_state;
+    printf("[ok] object list merge test\n");
+}
+
+// Compare pg_object_map_t with a plain std::map under random inserts and erases
+void test_object_map()
+{
+    pg_osd_set_state_t states[3];
+    pg_object_map_t objmap;
+    std::map<object_id, pg_osd_set_state_t*> ref;
+    srand(1);
+    // Sequential fill, like in calc_object_states(): every 4th stripe, one state
+    for (uint64_t i = 0; i < 10000; i++)
     {
-        printf("dev: state=%lx\n", it.second.state);
+        object_id oid = { .inode = 1 + i/5000, .stripe = (i % 5000) * 4 << STRIPE_SHIFT };
+        objmap.insert(oid, &states[0]);
+        ref[oid] = &states[0];
     }
+    assert(objmap.size() == 10000);
+    assert(objmap.run_count() == 2);
+    for (int i = 0; i < 100000; i++)
+    {
+        object_id oid = { .inode = 1 + (uint64_t)rand() % 2, .stripe = ((uint64_t)rand() % 30000) << STRIPE_SHIFT };
+        if (rand() % 2)
+        {
+            auto st = &states[rand() % 3];
+            objmap.insert(oid, st);
+            ref[oid] = st;
+        }
+        else
+        {
+            objmap.erase(oid);
+            ref.erase(oid);
+        }
+        if (!(i % 1000))
+        {
+            // Full comparison
+            assert(objmap.size() == ref.size());
+            auto it = objmap.begin();
+            for (auto & p: ref)
+            {
+                assert(it != objmap.end() && it->first == p.first && it->second == p.second);
+                it++;
+            }
+            assert(it == objmap.end());
+        }
+        auto it = objmap.find(oid);
+        auto ref_it = ref.find(oid);
+        assert((it == objmap.end()) == (ref_it == ref.end()));
+        assert(it == objmap.end() || it->second == ref_it->second);
+        it = objmap.upper_bound(oid);
+        ref_it = ref.upper_bound(oid);
+        assert((it == objmap.end()) == (ref_it == ref.end()));
+        assert(it == objmap.end() || it->first == ref_it->first);
+    }
+    printf("[ok] compact object map test (%lu objects in %lu runs)\n", objmap.size(), objmap.run_count());
+}
+
+void bench(uint64_t osd_count, uint64_t count)
+{
+    pg_t pg = make_replicated_pg(osd_count);
+    fill_pg(pg, osd_count, count, 65536);
+    timespec tv_begin;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    pg.calc_object_states(0);
+    double t = elapsed_since(tv_begin);
+    check_states(pg, count, true);
+    printf("calc_object_states with %lu OSDs and %lu objects: %.3f s, %.2f M versions/s\n",
+        osd_count, count, t, count*osd_count/t/1000000);
+    delete pg.peering_state;
+}
+
+int main(int argc, char *argv[])
+{
+    test_merge();
+    test_object_map();
+    bench(3, 1024*1024*8);
+    bench(6, 1024*1024*4);
     return 0;
 }
@@ -2,6 +2,7 @@
 // License: VNPL-1.1 (see README.md for details)
 
 #include "osd_primary.h"
+#include "osd_copy.h"
 #include "allocator.h"
 
 // read: read directly or read paired stripe(s), reconstruct, return
@@ -54,11 +55,13 @@ bool osd_t::prepare_primary_rw(osd_op_t *cur_op)
     }
     int stripe_count = (pool_cfg.scheme == POOL_SCHEME_REPLICATED ? 1 : pg_it->second.pg_size);
     int chain_size = 0;
-    if (cur_op->req.hdr.opcode == OSD_OP_READ && cur_op->req.rw.meta_revision > 0)
+    if (cur_op->req.hdr.opcode == OSD_OP_READ && cur_op->req.rw.meta_revision > 0 ||
+        cur_op->req.hdr.opcode == OSD_OP_COPY)
     {
         // Chained read
         auto inode_it = st_cli.inode_config.find(cur_op->req.rw.inode);
-        if (inode_it->second.mod_revision != cur_op->req.rw.meta_revision)
+        if (inode_it == st_cli.inode_config.end() ||
+            inode_it->second.mod_revision != cur_op->req.rw.meta_revision)
         {
             // Client view of the metadata differs from OSD's view
             // Operation can't be completed correctly, client should retry later
@@ -66,18 +69,23 @@ bool osd_t::prepare_primary_rw(osd_op_t *cur_op)
             return false;
         }
         // Find parents from the same pool. Optimized reads only work within pools
-        while (inode_it != st_cli.inode_config.end() && inode_it->second.parent_id &&
-            INODE_POOL(inode_it->second.parent_id) == pg_it->second.pool_id &&
-            // Check for loops
-            inode_it->second.parent_id != cur_op->req.rw.inode)
+        // Copy only copies layers down to copy_from
+        inode_t last = 0;
+        chain_size = osd_find_layer_chain(st_cli.inode_config, cur_op->req.rw.inode, pg_it->second.pool_id,
+            cur_op->req.hdr.opcode == OSD_OP_COPY ? cur_op->req.rw.copy_from : 0, NULL, &last);
+        if (cur_op->req.hdr.opcode == OSD_OP_COPY)
         {
-            chain_size++;
-            inode_it = st_cli.inode_config.find(inode_it->second.parent_id);
+            int r = osd_check_copy_chain(st_cli.inode_config, last, cur_op->req.rw.copy_from);
+            if (r != 0)
+            {
+                finish_op(cur_op, r);
+                return false;
+            }
         }
-        if (chain_size)
+        if (chain_size == 1)
         {
-            // Add the original inode
-            chain_size++;
+            // No parents
+            chain_size = 0;
         }
     }
     osd_primary_op_data_t *op_data = (osd_primary_op_data_t*)calloc_or_die(
@@ -122,17 +130,9 @@ bool osd_t::prepare_primary_rw(osd_op_t *cur_op)
         op_data->missing_flags = (uint8_t*)data_buf;
         data_buf += chain_size * (pool_cfg.scheme == POOL_SCHEME_REPLICATED ? 0 : pg_it->second.pg_size);
         // Copy chain
-        int chain_num = 0;
-        op_data->read_chain[chain_num++] = cur_op->req.rw.inode;
-        auto inode_it = st_cli.inode_config.find(cur_op->req.rw.inode);
-        while (inode_it != st_cli.inode_config.end() && inode_it->second.parent_id &&
-            INODE_POOL(inode_it->second.parent_id) == pg_it->second.pool_id &&
-            // Check for loops
-            inode_it->second.parent_id != cur_op->req.rw.inode)
-        {
-            op_data->read_chain[chain_num++] = inode_it->second.parent_id;
-            inode_it = st_cli.inode_config.find(inode_it->second.parent_id);
-        }
+        inode_t last = 0;
+        osd_find_layer_chain(st_cli.inode_config, cur_op->req.rw.inode, pg_it->second.pool_id,
+            cur_op->req.hdr.opcode == OSD_OP_COPY ? cur_op->req.rw.copy_from : 0, op_data->read_chain, &last);
     }
     pg_it->second.inflight++;
     return true;
@@ -241,6 +241,10 @@ resume_2:
         {
             reconstruct_stripes_jerasure(stripes, op_data->pg_size, op_data->pg_data_size, clean_entry_bitmap_size);
         }
+        else if (op_data->scheme == POOL_SCHEME_EC)
+        {
+            reconstruct_stripes_ec(stripes, op_data->pg_size, op_data->pg_data_size, clean_entry_bitmap_size);
+        }
         cur_op->iov.push_back(op_data->stripes[0].bmp_buf, cur_op->reply.rw.bitmap_len);
         for (int role = 0; role < op_data->pg_size; role++)
         {
@@ -306,8 +310,14 @@ void osd_t::free_object_state(pg_t & pg, pg_osd_set_state_t **object_state)
 {
     if (*object_state && !(--(*object_state)->object_count))
     {
+        bool degraded = (*object_state)->state & OBJ_DEGRADED;
         pg.state_dict.erase((*object_state)->osd_set);
         *object_state = NULL;
+        if (degraded)
+        {
+            // Recovery priority of the PG depends on its degraded object states
+            update_recovery_queue(pg);
+        }
     }
 }
 
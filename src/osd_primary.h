@@ -23,6 +23,8 @@ struct osd_primary_op_data_t
     object_id oid;
     uint64_t target_ver;
     uint64_t fact_ver = 0;
+    // for copy: bitmap position to continue writing from
+    int copy_pos = 0;
     uint64_t scheme = 0;
     int n_subops = 0, done = 0, errors = 0, epipe = 0;
     int degraded = 0, pg_size, pg_data_size;
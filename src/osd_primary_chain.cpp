@@ -111,6 +111,10 @@ resume_1:
                         {
                             reconstruct_stripes_jerasure(local_stripes, pg.pg_size, pg.pg_data_size, clean_entry_bitmap_size);
                         }
+                        else if (pg.scheme == POOL_SCHEME_EC)
+                        {
+                            reconstruct_stripes_ec(local_stripes, pg.pg_size, pg.pg_data_size, clean_entry_bitmap_size);
+                        }
                         break;
                     }
                 }
@@ -198,6 +202,14 @@ int osd_t::collect_bitmap_requests(osd_op_t *cur_op, pg_t & pg, std::vector<bitm
     return 0;
 }
 
+struct osd_bitmap_subop_ctx_t: public pooled_callback_ctx_t
+{
+    osd_op_t *cur_op;
+    std::vector<bitmap_request_t> *bitmap_requests;
+    // range of bitmap requests sent in the subop
+    int prev, i;
+};
+
 int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg)
 {
     osd_primary_op_data_t *op_data = cur_op->op_data;
@@ -261,8 +273,17 @@ int osd_t::submit_bitmap_subops(osd_op_t *cur_op, pg_t & pg)
                     ov->oid = (*bitmap_requests)[j].oid;
                     ov->version = (*bitmap_requests)[j].version;
                 }
-                subop->callback = [cur_op, bitmap_requests, prev, i, this](osd_op_t *subop)
+                osd_bitmap_subop_ctx_t *ctx = new osd_bitmap_subop_ctx_t();
+                ctx->cur_op = cur_op;
+                ctx->bitmap_requests = bitmap_requests;
+                ctx->prev = prev;
+                ctx->i = i;
+                subop->callback = [this, ctx](osd_op_t *subop)
                 {
+                    osd_op_t *cur_op = ctx->cur_op;
+                    auto bitmap_requests = ctx->bitmap_requests;
+                    int prev = ctx->prev, i = ctx->i;
+                    delete ctx;
                     int requested_count = subop->req.sec_read_bmp.len / sizeof(obj_ver_id);
                     if (subop->reply.hdr.retval == requested_count * (8 + clean_entry_bitmap_size))
                     {
@@ -492,6 +513,10 @@ void osd_t::send_chained_read_results(pg_t & pg, osd_op_t *cur_op)
             {
                 reconstruct_stripes_jerasure(stripes, pg.pg_size, pg.pg_data_size, clean_entry_bitmap_size);
             }
+            else if (op_data->scheme == POOL_SCHEME_EC)
+            {
+                reconstruct_stripes_ec(stripes, pg.pg_size, pg.pg_data_size, clean_entry_bitmap_size);
+            }
         }
     }
     // Send bitmap
@@ -0,0 +1,184 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include "osd_primary.h"
+#include "osd_copy.h"
+#include "allocator.h"
+
+// copy: merge data of parent layers into the object without sending it to the client
+//
+// 1) read bitmaps of the layer chain down to copy_from (only parents from the same pool are supported)
+// 2) read parent data which is missing in the object itself, like a chained read does
+// 3) write it into the object with CAS, range by range, so the operation fails
+//    with -EINTR if the object is modified concurrently and can be simply retried
+// 4) sync, so clients don't have to remember copies for replaying them
+void osd_t::continue_primary_copy(osd_op_t *cur_op)
+{
+    if (!cur_op->op_data && !prepare_primary_rw(cur_op))
+    {
+        return;
+    }
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    auto & pg = pgs.at({ .pool_id = INODE_POOL(op_data->oid.inode), .pg_num = op_data->pg_num });
+    if (op_data->st == 1)      goto resume_1;
+    else if (op_data->st == 2) goto resume_2;
+    else if (op_data->st == 3) goto resume_3;
+    else if (op_data->st == 4) goto resume_4;
+    else if (op_data->st == 5) goto resume_5;
+    else if (op_data->st == 6) goto resume_6;
+    if (!op_data->chain_size)
+    {
+        // No parents, nothing to copy
+        finish_op(cur_op, cur_op->req.rw.len);
+        return;
+    }
+resume_1:
+resume_2:
+    // Read bitmaps of all layers
+    if (read_bitmaps(cur_op, pg, 1) != 0)
+        return;
+    // Remember the version of the object for CAS
+    op_data->target_ver = cur_op->reply.rw.version;
+    {
+        // Only copy parts missing in the object itself
+        int stripe_count = (pg.scheme == POOL_SCHEME_REPLICATED ? 1 : pg.pg_size);
+        int layer_size = stripe_count * clean_entry_bitmap_size;
+        uint8_t *own_bitmap = (uint8_t*)op_data->snapshot_bitmaps;
+        int start = (cur_op->req.rw.offset - op_data->oid.stripe) / bs_bitmap_granularity;
+        int end = start + cur_op->req.rw.len/bs_bitmap_granularity;
+        if (!osd_mask_copy_bitmaps(own_bitmap, op_data->chain_size, layer_size, start, end))
+        {
+            cur_op->reply.rw.version = op_data->target_ver;
+            finish_op(cur_op, cur_op->req.rw.len);
+            return;
+        }
+        memset(own_bitmap, 0, layer_size);
+        op_data->copy_pos = start;
+    }
+    // Read parent data
+    if (submit_chained_read_requests(pg, cur_op) != 0)
+        return;
+    if (op_data->n_subops > 0)
+    {
+        // Wait for reads
+        op_data->st = 3;
+resume_3:
+        return;
+    }
+resume_4:
+    if (op_data->errors > 0)
+    {
+        free(op_data->chain_reads);
+        op_data->chain_reads = NULL;
+        finish_op(cur_op, op_data->epipe > 0 ? -EPIPE : -EIO);
+        return;
+    }
+    send_chained_read_results(pg, cur_op);
+    {
+        // Gather the result into a single buffer to write it
+        void *buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.rw.len);
+        uint64_t pos = 0;
+        for (int i = 1; i < cur_op->iov.count; i++)
+        {
+            memcpy(buf + pos, cur_op->iov.buf[i].iov_base, cur_op->iov.buf[i].iov_len);
+            pos += cur_op->iov.buf[i].iov_len;
+        }
+        cur_op->iov.reset();
+        cur_op->reply.rw.bitmap_len = 0;
+        cur_op->free_buf();
+        cur_op->buf = buf;
+    }
+resume_5:
+    if (cur_op->reply.hdr.retval < 0)
+    {
+        finish_op(cur_op, cur_op->reply.hdr.retval);
+        return;
+    }
+    // Write next range
+    if (submit_copy_write(cur_op))
+    {
+        return;
+    }
+    if (immediate_commit != IMMEDIATE_ALL)
+    {
+        submit_copy_sync(cur_op);
+        return;
+resume_6:
+        if (cur_op->reply.hdr.retval < 0)
+        {
+            finish_op(cur_op, cur_op->reply.hdr.retval);
+            return;
+        }
+    }
+    cur_op->reply.rw.version = op_data->target_ver;
+    finish_op(cur_op, cur_op->req.rw.len);
+}
+
+void osd_t::submit_copy_sync(osd_op_t *cur_op)
+{
+    osd_op_t *sync_op = new osd_op_t();
+    sync_op->op_type = OSD_OP_OUT;
+    sync_op->req = (osd_any_op_t){
+        .sync = {
+            .header = {
+                .magic = SECONDARY_OSD_OP_MAGIC,
+                .id = 1,
+                .opcode = OSD_OP_SYNC,
+            },
+        },
+    };
+    sync_op->callback = [this, cur_op](osd_op_t *sync_op)
+    {
+        if (sync_op->reply.hdr.retval < 0)
+            cur_op->reply.hdr.retval = sync_op->reply.hdr.retval;
+        delete sync_op;
+        continue_primary_copy(cur_op);
+    };
+    cur_op->op_data->st = 6;
+    exec_op(sync_op);
+}
+
+// Submit a write of the next copied range, returns false if everything is already written
+bool osd_t::submit_copy_write(osd_op_t *cur_op)
+{
+    osd_primary_op_data_t *op_data = cur_op->op_data;
+    uint8_t *bitmap = (uint8_t*)op_data->stripes[0].bmp_buf;
+    int req_start = (cur_op->req.rw.offset - op_data->oid.stripe) / bs_bitmap_granularity;
+    int end = req_start + cur_op->req.rw.len/bs_bitmap_granularity;
+    int start = 0;
+    if (!osd_next_copy_range(bitmap, &op_data->copy_pos, end, &start))
+    {
+        return false;
+    }
+    int cur = op_data->copy_pos;
+    osd_op_t *op = new osd_op_t();
+    op->op_type = OSD_OP_OUT;
+    op->req = (osd_any_op_t){
+        .rw = {
+            .header = {
+                .magic = SECONDARY_OSD_OP_MAGIC,
+                .id = 1,
+                .opcode = OSD_OP_WRITE,
+            },
+            .inode = cur_op->req.rw.inode,
+            .offset = op_data->oid.stripe + (uint64_t)start*bs_bitmap_granularity,
+            .len = (uint32_t)((cur-start)*bs_bitmap_granularity),
+            .version = op_data->target_ver+1,
+        },
+    };
+    // Data is owned by cur_op
+    op->buf = cur_op->buf + (start-req_start)*bs_bitmap_granularity;
+    op->callback = [this, cur_op](osd_op_t *op)
+    {
+        if (op->reply.hdr.retval == op->req.rw.len)
+            cur_op->op_data->target_ver = op->reply.rw.version;
+        else
+            cur_op->reply.hdr.retval = op->reply.hdr.retval < 0 ? op->reply.hdr.retval : -EIO;
+        op->buf = NULL;
+        delete op;
+        continue_primary_copy(cur_op);
+    };
+    op_data->st = 5;
+    exec_op(op);
+    return true;
+}
@@ -368,6 +368,10 @@ void osd_t::handle_primary_subop(osd_op_t *subop, osd_op_t *cur_op)
         {
             continue_primary_del(cur_op);
         }
+        else if (cur_op->req.hdr.opcode == OSD_OP_COPY)
+        {
+            continue_primary_copy(cur_op);
+        }
         else
         {
             throw std::runtime_error("BUG: unknown opcode");
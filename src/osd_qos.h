@@ -0,0 +1,100 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <deque>
+
+// Token bucket limiting iops and bandwidth of one traffic class (client, recovery, rebalance)
+// or of one inode. Zero limits mean "unlimited". Buckets hold at most iops_burst/bw_burst
+// tokens, or 1/10 second worth of tokens by default, so that the limited traffic is spread
+// evenly. Bandwidth may go into debt to let large operations pass.
+struct osd_qos_bucket_t
+{
+    uint64_t iops_limit = 0, bw_limit = 0;
+    uint64_t iops_burst = 0, bw_burst = 0;
+    double iops_tokens = 0, bw_tokens = 0;
+    timespec last = { 0 };
+
+    inline bool is_limited()
+    {
+        return iops_limit || bw_limit;
+    }
+
+    void refill(const timespec & now)
+    {
+        double elapsed = last.tv_sec ? (now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec)/1000000000.0 : 1;
+        last = now;
+        if (elapsed <= 0)
+            return;
+        double iops_max = iops_burst ? iops_burst : iops_limit / 10.0 + 1;
+        double bw_max = bw_burst ? bw_burst : bw_limit / 10.0;
+        iops_tokens += iops_limit * elapsed;
+        if (iops_tokens > iops_max)
+            iops_tokens = iops_max;
+        bw_tokens += bw_limit * elapsed;
+        if (bw_tokens > bw_max)
+            bw_tokens = bw_max;
+    }
+
+    bool take(const timespec & now, uint64_t bytes)
+    {
+        if (!is_limited())
+            return true;
+        refill(now);
+        if (iops_limit && iops_tokens < 1 || bw_limit && bw_tokens <= 0)
+            return false;
+        iops_tokens -= 1;
+        bw_tokens -= bytes;
+        return true;
+    }
+
+    // Time until the next take() can succeed
+    uint64_t wait_us()
+    {
+        double wait = 0;
+        if (iops_limit && iops_tokens < 1)
+            wait = (1 - iops_tokens) / iops_limit;
+        if (bw_limit && bw_tokens <= 0 && (1 - bw_tokens) / bw_limit > wait)
+            wait = (1 - bw_tokens) / bw_limit;
+        return (uint64_t)(wait*1000000) + 1;
+    }
+};
+
+// Per-inode QoS limits, zero means "unlimited". Burst is the token bucket capacity
+// (1/10 second worth of the limit by default)
+struct inode_qos_config_t
+{
+    uint64_t read_iops = 0, write_iops = 0;
+    uint64_t read_bw = 0, write_bw = 0;
+    uint64_t burst_iops = 0, burst_bw = 0;
+
+    inline bool is_limited() const
+    {
+        return read_iops || write_iops || read_bw || write_bw;
+    }
+
+    void apply(osd_qos_bucket_t & read, osd_qos_bucket_t & write) const
+    {
+        read.iops_limit = read_iops;
+        read.bw_limit = read_bw;
+        read.iops_burst = burst_iops;
+        read.bw_burst = burst_bw;
+        write.iops_limit = write_iops;
+        write.bw_limit = write_bw;
+        write.iops_burst = burst_iops;
+        write.bw_burst = burst_bw;
+    }
+};
+
+struct osd_op_t;
+
+// Per-inode QoS state of the primary OSD, a backstop for clients not enforcing inode limits
+struct osd_inode_qos_t
+{
+    osd_qos_bucket_t read, write;
+    std::deque<osd_op_t*> queue;
+    int timer_id = -1;
+};
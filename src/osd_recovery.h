@@ -0,0 +1,120 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+// Recovery order helpers, separated from osd_t to be testable
+
+#include <set>
+#include "osd_peering_pg.h"
+#include "osd_id.h"
+
+// Minimum number of available copies (or EC chunks) of degraded objects in the PG
+inline uint64_t osd_min_degraded_copies(pg_t & pg)
+{
+    uint64_t min_copies = UINT64_MAX;
+    for (auto & st_pair: pg.state_dict)
+    {
+        auto & st = st_pair.second;
+        if (!(st.state & OBJ_DEGRADED) || !st.object_count)
+        {
+            continue;
+        }
+        uint64_t copies = 0, roles = 0;
+        for (auto & loc: st.osd_set)
+        {
+            if (!loc.outdated)
+            {
+                copies++;
+                roles |= (1ul << (loc.role & 63));
+            }
+        }
+        if (pg.scheme != POOL_SCHEME_REPLICATED)
+        {
+            copies = __builtin_popcountll(roles);
+        }
+        if (copies < min_copies)
+        {
+            min_copies = copies;
+        }
+    }
+    return min_copies;
+}
+
+// Find the next object after <cursor>, wrapping around once and skipping objects present in <busy>
+template<class B> inline bool osd_next_recovery_object(pg_object_map_t & objects, object_id cursor, B & busy, object_id *oid)
+{
+    auto obj_it = objects.upper_bound(cursor);
+    for (uint64_t left = objects.size(); left > 0; left--, obj_it++)
+    {
+        if (obj_it == objects.end())
+        {
+            obj_it = objects.begin();
+        }
+        if (busy.find(obj_it->first) == busy.end())
+        {
+            *oid = obj_it->first;
+            return true;
+        }
+    }
+    return false;
+}
+
+// PGs with objects to recover, updated when PG states change. PGs with lower priority
+// values go first, PGs with the same priority are processed round-robin after <last_pg>
+struct osd_recovery_queue_t
+{
+    std::set<std::pair<uint64_t, pool_pg_num_t>> queue;
+    std::map<pool_pg_num_t, uint64_t> priorities;
+    pool_pg_num_t last_pg = { 0 };
+
+    void set(pool_pg_num_t pg_id, uint64_t priority)
+    {
+        auto prio_it = priorities.find(pg_id);
+        if (prio_it != priorities.end())
+        {
+            if (prio_it->second == priority)
+                return;
+            queue.erase({ prio_it->second, pg_id });
+            prio_it->second = priority;
+        }
+        else
+            priorities[pg_id] = priority;
+        queue.insert({ priority, pg_id });
+    }
+
+    void remove(pool_pg_num_t pg_id)
+    {
+        auto prio_it = priorities.find(pg_id);
+        if (prio_it != priorities.end())
+        {
+            queue.erase({ prio_it->second, pg_id });
+            priorities.erase(prio_it);
+        }
+    }
+
+    // Call <try_pg> for PGs in the recovery order until it returns true. Doesn't change the queue
+    template<class F> bool pick(F try_pg)
+    {
+        auto prio_begin = queue.begin();
+        while (prio_begin != queue.end())
+        {
+            uint64_t priority = prio_begin->first;
+            auto prio_end = queue.upper_bound({ priority, (pool_pg_num_t){ .pool_id = UINT32_MAX, .pg_num = UINT32_MAX } });
+            auto start = queue.upper_bound({ priority, last_pg });
+            if (start == prio_end)
+                start = prio_begin;
+            auto it = start;
+            do
+            {
+                if (try_pg(it->second))
+                    return true;
+                it++;
+                if (it == prio_end)
+                    it = prio_begin;
+            } while (it != start);
+            prio_begin = prio_end;
+        }
+        return false;
+    }
+};
@@ -0,0 +1,168 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include <set>
+#include <vector>
+#include "osd_recovery.h"
+
+#define PG(pool, num) ((pool_pg_num_t){ .pool_id = pool, .pg_num = num })
+
+static std::vector<pool_pg_num_t> pick_order(osd_recovery_queue_t & queue, int count)
+{
+    std::vector<pool_pg_num_t> order;
+    for (int i = 0; i < count; i++)
+    {
+        assert(queue.pick([&](pool_pg_num_t pg_id)
+        {
+            order.push_back(pg_id);
+            return true;
+        }));
+        queue.last_pg = order.back();
+    }
+    return order;
+}
+
+static bool same_pg(pool_pg_num_t a, pool_pg_num_t b)
+{
+    return a.pool_id == b.pool_id && a.pg_num == b.pg_num;
+}
+
+void test_cursor()
+{
+    printf("test_cursor\n");
+    pg_osd_set_state_t st;
+    pg_object_map_t objects;
+    for (uint64_t i = 0; i < 4; i++)
+    {
+        objects.insert((object_id){ .inode = 1, .stripe = i*0x20000 }, &st);
+    }
+    std::set<object_id> busy;
+    object_id oid = { 0 };
+    // Start after the cursor
+    assert(osd_next_recovery_object(objects, (object_id){ .inode = 1, .stripe = 0x20000 }, busy, &oid));
+    assert(oid.inode == 1 && oid.stripe == 0x40000);
+    // Skip busy objects and wrap around
+    busy.insert((object_id){ .inode = 1, .stripe = 0x60000 });
+    assert(osd_next_recovery_object(objects, (object_id){ .inode = 1, .stripe = 0x40000 }, busy, &oid));
+    assert(oid.inode == 1 && oid.stripe == 0);
+    // The cursor after all objects
+    assert(osd_next_recovery_object(objects, (object_id){ .inode = 2, .stripe = 0 }, busy, &oid));
+    assert(oid.inode == 1 && oid.stripe == 0);
+    // All objects are busy
+    for (uint64_t i = 0; i < 4; i++)
+    {
+        busy.insert((object_id){ .inode = 1, .stripe = i*0x20000 });
+    }
+    assert(!osd_next_recovery_object(objects, (object_id){ .inode = 1, .stripe = 0 }, busy, &oid));
+    printf("OK\n");
+}
+
+void test_round_robin()
+{
+    printf("test_round_robin\n");
+    osd_recovery_queue_t queue;
+    queue.set(PG(1, 3), 0);
+    queue.set(PG(1, 1), 0);
+    queue.set(PG(2, 1), 0);
+    auto order = pick_order(queue, 4);
+    assert(same_pg(order[0], PG(1, 1)) && same_pg(order[1], PG(1, 3)) &&
+        same_pg(order[2], PG(2, 1)) && same_pg(order[3], PG(1, 1)));
+    // Removed PGs are skipped, new ones are picked in their turn
+    queue.remove(PG(1, 3));
+    queue.set(PG(1, 2), 0);
+    order = pick_order(queue, 3);
+    assert(same_pg(order[0], PG(1, 2)) && same_pg(order[1], PG(2, 1)) && same_pg(order[2], PG(1, 1)));
+    // PGs which can't give an object are skipped
+    std::vector<pool_pg_num_t> tried;
+    assert(queue.pick([&](pool_pg_num_t pg_id)
+    {
+        tried.push_back(pg_id);
+        return same_pg(pg_id, PG(2, 1));
+    }));
+    assert(tried.size() == 2 && same_pg(tried[0], PG(1, 2)) && same_pg(tried[1], PG(2, 1)));
+    tried.clear();
+    assert(!queue.pick([&](pool_pg_num_t pg_id)
+    {
+        tried.push_back(pg_id);
+        return false;
+    }));
+    assert(tried.size() == 3);
+    printf("OK\n");
+}
+
+void test_priority()
+{
+    printf("test_priority\n");
+    osd_recovery_queue_t queue;
+    queue.set(PG(1, 1), 2);
+    queue.set(PG(1, 2), 1);
+    queue.set(PG(1, 3), 1);
+    queue.set(PG(1, 4), UINT64_MAX);
+    // PGs with the lowest priority value go first, round-robin
+    auto order = pick_order(queue, 3);
+    assert(same_pg(order[0], PG(1, 2)) && same_pg(order[1], PG(1, 3)) && same_pg(order[2], PG(1, 2)));
+    // Lower priority PGs are only picked when higher priority ones can't give anything
+    std::vector<pool_pg_num_t> tried;
+    assert(queue.pick([&](pool_pg_num_t pg_id)
+    {
+        tried.push_back(pg_id);
+        return pg_id.pg_num == 4;
+    }));
+    assert(tried.size() == 4 && same_pg(tried[0], PG(1, 3)) && same_pg(tried[1], PG(1, 2)) &&
+        same_pg(tried[2], PG(1, 1)) && same_pg(tried[3], PG(1, 4)));
+    // Priority changes move PGs between groups
+    queue.set(PG(1, 1), 0);
+    order = pick_order(queue, 2);
+    assert(same_pg(order[0], PG(1, 1)) && same_pg(order[1], PG(1, 1)));
+    queue.remove(PG(1, 1));
+    order = pick_order(queue, 1);
+    assert(same_pg(order[0], PG(1, 2)));
+    printf("OK\n");
+}
+
+void test_degraded_copies()
+{
+    printf("test_degraded_copies\n");
+    pg_t pg;
+    pg.scheme = POOL_SCHEME_REPLICATED;
+    pg_osd_set_t one_left = {
+        { .role = 0, .osd_num = 1, .outdated = false },
+        { .role = 0, .osd_num = 2, .outdated = true },
+        { .role = 0, .osd_num = 3, .outdated = true },
+    };
+    pg_osd_set_t two_left = {
+        { .role = 0, .osd_num = 1, .outdated = false },
+        { .role = 0, .osd_num = 2, .outdated = false },
+    };
+    assert(osd_min_degraded_copies(pg) == UINT64_MAX);
+    pg.state_dict[two_left] = { .osd_set = two_left, .state = OBJ_DEGRADED, .object_count = 10 };
+    assert(osd_min_degraded_copies(pg) == 2);
+    // States without objects are ignored
+    pg.state_dict[one_left] = { .osd_set = one_left, .state = OBJ_DEGRADED, .object_count = 0 };
+    assert(osd_min_degraded_copies(pg) == 2);
+    pg.state_dict[one_left].object_count = 1;
+    assert(osd_min_degraded_copies(pg) == 1);
+    // EC pools count distinct chunks
+    pg.scheme = POOL_SCHEME_EC;
+    pg.state_dict.clear();
+    pg_osd_set_t ec_set = {
+        { .role = 0, .osd_num = 1, .outdated = false },
+        { .role = 0, .osd_num = 4, .outdated = false },
+        { .role = 1, .osd_num = 2, .outdated = false },
+        { .role = 2, .osd_num = 3, .outdated = true },
+    };
+    pg.state_dict[ec_set] = { .osd_set = ec_set, .state = OBJ_DEGRADED, .object_count = 1 };
+    assert(osd_min_degraded_copies(pg) == 2);
+    printf("OK\n");
+}
+
+int main(int narg, char *args[])
+{
+    test_cursor();
+    test_round_robin();
+    test_priority();
+    test_degraded_copies();
+    return 0;
+}
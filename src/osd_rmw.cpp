@@ -7,8 +7,10 @@
 #include <jerasure/reed_sol.h>
 #include <jerasure.h>
 #include <map>
+#include <vector>
 #include "allocator.h"
 #include "xor.h"
+#include "gf256.h"
 #include "osd_rmw.h"
 #include "malloc_or_die.h"
 
@@ -84,44 +86,26 @@ void split_stripes(uint64_t pg_minsize, uint32_t bs_block_size, uint32_t start,
 
 void reconstruct_stripes_xor(osd_rmw_stripe_t *stripes, int pg_size, uint32_t bitmap_size)
 {
+    const void *data_ptrs[pg_size];
+    const void *bmp_ptrs[pg_size];
     for (int role = 0; role < pg_size; role++)
     {
         if (stripes[role].read_end != 0 && stripes[role].missing)
         {
-            // Reconstruct missing stripe (XOR k+1)
-            int prev = -2;
+            // Reconstruct missing stripe (XOR k+1) in one pass
+            int n = 0;
             for (int other = 0; other < pg_size; other++)
             {
                 if (other != role)
                 {
-                    if (prev == -2)
-                    {
-                        prev = other;
-                    }
-                    else if (prev >= 0)
-                    {
-                        assert(stripes[role].read_start >= stripes[prev].read_start &&
-                            stripes[role].read_start >= stripes[other].read_start);
-                        memxor(
-                            stripes[prev].read_buf + (stripes[role].read_start - stripes[prev].read_start),
-                            stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start),
-                            stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start
-                        );
-                        memxor(stripes[prev].bmp_buf, stripes[other].bmp_buf, stripes[role].bmp_buf, bitmap_size);
-                        prev = -1;
-                    }
-                    else
-                    {
-                        assert(stripes[role].read_start >= stripes[other].read_start);
-                        memxor(
-                            stripes[role].read_buf,
-                            stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start),
-                            stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start
-                        );
-                        memxor(stripes[role].bmp_buf, stripes[other].bmp_buf, stripes[role].bmp_buf, bitmap_size);
-                    }
+                    assert(stripes[role].read_start >= stripes[other].read_start);
+                    data_ptrs[n] = stripes[other].read_buf + (stripes[role].read_start - stripes[other].read_start);
+                    bmp_ptrs[n] = stripes[other].bmp_buf;
+                    n++;
                 }
             }
+            memxor_n(data_ptrs, n, stripes[role].read_buf, stripes[role].read_end - stripes[role].read_start);
+            memxor_n(bmp_ptrs, n, stripes[role].bmp_buf, bitmap_size);
         }
     }
 }
@@ -136,12 +120,10 @@ inline bool operator < (const reed_sol_erased_t &a, const reed_sol_erased_t &b)
 {
     for (int i = 0; i < a.size && i < b.size; i++)
     {
-        if (a.data[i] < b.data[i])
-            return -1;
-        else if (a.data[i] > b.data[i])
-            return 1;
+        if (a.data[i] != b.data[i])
+            return a.data[i] < b.data[i];
     }
-    return 0;
+    return a.size < b.size;
 }
 
 struct reed_sol_matrix_t
@@ -279,6 +261,229 @@ void reconstruct_stripes_jerasure(osd_rmw_stripe_t *stripes, int pg_size, int pg
     }
 }
 
+// Built-in Reed-Solomon coder (pool scheme "ec")
+
+struct ec_erased_t
+{
+    uint64_t mask[4] = { 0 };
+};
+
+inline bool operator < (const ec_erased_t &a, const ec_erased_t &b)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (a.mask[i] != b.mask[i])
+            return a.mask[i] < b.mask[i];
+    }
+    return false;
+}
+
+struct ec_decoding_t
+{
+    // Roles of the chunks used to restore data (first pg_minsize alive chunks)
+    std::vector<int> ids;
+    // Multiplication tables for each data chunk, pg_minsize*pg_minsize*GF256_TABLE_SIZE bytes
+    std::vector<uint8_t> tables;
+};
+
+struct ec_matrix_t
+{
+    int refs = 0;
+    // Full pg_size*pg_minsize generator matrix, the upper part is the identity matrix
+    std::vector<uint8_t> data;
+    // Multiplication tables for each parity chunk, (pg_size-pg_minsize)*pg_minsize*GF256_TABLE_SIZE bytes
+    std::vector<uint8_t> tables;
+    std::map<ec_erased_t, ec_decoding_t> decodings;
+};
+
+static thread_local std::map<uint64_t, ec_matrix_t> ec_matrices;
+
+// Systematic Reed-Solomon-Vandermonde generator matrix, derived from the extended
+// Vandermonde matrix by elementary column operations, so any pg_minsize rows stay
+// linearly independent. The first parity row consists of ones, i.e. the first parity
+// chunk is a simple XOR of all data chunks
+static std::vector<uint8_t> ec_generator_matrix(int pg_size, int pg_minsize)
+{
+    const int k = pg_minsize;
+    std::vector<uint8_t> m(pg_size*k);
+    // Extended Vandermonde matrix: rows are (1, x, x^2, ...) for x = 0..pg_size-2, and (0, ..., 0, 1)
+    for (int i = 0; i < pg_size-1; i++)
+    {
+        uint8_t v = 1;
+        for (int j = 0; j < k; j++)
+        {
+            m[i*k+j] = v;
+            v = gf256_mul(v, i);
+        }
+    }
+    m[(pg_size-1)*k + k-1] = 1;
+    // Transform the upper k*k part into the identity matrix using column operations
+    for (int i = 1; i < k; i++)
+    {
+        int j = i;
+        while (j < pg_size && !m[j*k+i])
+            j++;
+        assert(j < pg_size);
+        if (j != i)
+        {
+            for (int c = 0; c < k; c++)
+            {
+                uint8_t t = m[i*k+c];
+                m[i*k+c] = m[j*k+c];
+                m[j*k+c] = t;
+            }
+        }
+        if (m[i*k+i] != 1)
+        {
+            uint8_t inv = gf256_inv(m[i*k+i]);
+            for (int r = 0; r < pg_size; r++)
+                m[r*k+i] = gf256_mul(m[r*k+i], inv);
+        }
+        for (int c = 0; c < k; c++)
+        {
+            uint8_t f = m[i*k+c];
+            if (c != i && f)
+            {
+                for (int r = 0; r < pg_size; r++)
+                    m[r*k+c] ^= gf256_mul(f, m[r*k+i]);
+            }
+        }
+    }
+    // Make the first parity row consist of ones
+    for (int c = 0; c < k; c++)
+    {
+        if (m[k*k+c] != 1)
+        {
+            uint8_t inv = gf256_inv(m[k*k+c]);
+            for (int r = k; r < pg_size; r++)
+                m[r*k+c] = gf256_mul(m[r*k+c], inv);
+        }
+    }
+    // And the first column of other parity rows
+    for (int r = k+1; r < pg_size; r++)
+    {
+        if (m[r*k] != 1)
+        {
+            uint8_t inv = gf256_inv(m[r*k]);
+            for (int c = 0; c < k; c++)
+                m[r*k+c] = gf256_mul(m[r*k+c], inv);
+        }
+    }
+    return m;
+}
+
+void use_ec(int pg_size, int pg_minsize, bool use)
+{
+    uint64_t key = (uint64_t)pg_size | ((uint64_t)pg_minsize) << 32;
+    auto rs_it = ec_matrices.find(key);
+    if (rs_it == ec_matrices.end())
+    {
+        if (!use)
+        {
+            return;
+        }
+        if (pg_size > 256 || pg_minsize < 1 || pg_minsize >= pg_size)
+        {
+            throw std::runtime_error("invalid EC pg_size/pg_minsize");
+        }
+        ec_matrix_t & matrix = ec_matrices[key];
+        matrix.data = ec_generator_matrix(pg_size, pg_minsize);
+        matrix.tables.resize((pg_size-pg_minsize)*pg_minsize*GF256_TABLE_SIZE);
+        gf256_init_tables(matrix.data.data() + pg_minsize*pg_minsize, (pg_size-pg_minsize)*pg_minsize, matrix.tables.data());
+        rs_it = ec_matrices.find(key);
+    }
+    rs_it->second.refs += (!use ? -1 : 1);
+    if (rs_it->second.refs <= 0)
+    {
+        ec_matrices.erase(rs_it);
+    }
+}
+
+static ec_matrix_t* get_ec_matrix(int pg_size, int pg_minsize)
+{
+    uint64_t key = (uint64_t)pg_size | ((uint64_t)pg_minsize) << 32;
+    auto rs_it = ec_matrices.find(key);
+    if (rs_it == ec_matrices.end())
+    {
+        throw std::runtime_error("EC matrix not initialized");
+    }
+    return &rs_it->second;
+}
+
+// Decoding matrices are cached by the set of unavailable chunks, so the matrix
+// is inverted only once for each combination of failed OSDs
+static ec_decoding_t* get_ec_decoding(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize)
+{
+    int edd = 0;
+    ec_erased_t erased;
+    for (int i = 0; i < pg_size; i++)
+        if (stripes[i].read_end == 0 || stripes[i].missing)
+            erased.mask[i/64] |= (1ul << (i % 64));
+    for (int i = 0; i < pg_minsize; i++)
+        if (stripes[i].read_end != 0 && stripes[i].missing)
+            edd++;
+    if (edd == 0)
+        return NULL;
+    ec_matrix_t *matrix = get_ec_matrix(pg_size, pg_minsize);
+    auto dec_it = matrix->decodings.find(erased);
+    if (dec_it != matrix->decodings.end())
+    {
+        return &dec_it->second;
+    }
+    ec_decoding_t dec;
+    for (int i = 0; i < pg_size && dec.ids.size() < pg_minsize; i++)
+        if (!(erased.mask[i/64] & (1ul << (i % 64))))
+            dec.ids.push_back(i);
+    if (dec.ids.size() < pg_minsize)
+    {
+        throw std::runtime_error("not enough chunks to reconstruct EC stripe");
+    }
+    uint8_t m[pg_minsize*pg_minsize];
+    for (int i = 0; i < pg_minsize; i++)
+        memcpy(m + i*pg_minsize, matrix->data.data() + dec.ids[i]*pg_minsize, pg_minsize);
+    if (!gf256_invert_matrix(m, pg_minsize))
+    {
+        throw std::runtime_error("EC decoding matrix is singular");
+    }
+    dec.tables.resize(pg_minsize*pg_minsize*GF256_TABLE_SIZE);
+    gf256_init_tables(m, pg_minsize*pg_minsize, dec.tables.data());
+    return &(matrix->decodings[erased] = std::move(dec));
+}
+
+void reconstruct_stripes_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize, uint32_t bitmap_size)
+{
+    ec_decoding_t *dec = get_ec_decoding(stripes, pg_size, pg_minsize);
+    if (!dec)
+    {
+        return;
+    }
+    const void *data_ptrs[pg_minsize];
+    for (int role = 0; role < pg_minsize; role++)
+    {
+        if (stripes[role].read_end != 0 && stripes[role].missing)
+        {
+            const uint8_t *tables = dec->tables.data() + role*pg_minsize*GF256_TABLE_SIZE;
+            if (stripes[role].read_end > stripes[role].read_start)
+            {
+                for (int i = 0; i < pg_minsize; i++)
+                {
+                    auto & other = stripes[dec->ids[i]];
+                    assert(other.read_start <= stripes[role].read_start);
+                    assert(other.read_end >= stripes[role].read_end);
+                    data_ptrs[i] = (uint8_t*)other.read_buf + (stripes[role].read_start - other.read_start);
+                }
+                gf256_dotprod(tables, data_ptrs, pg_minsize, stripes[role].read_buf,
+                    stripes[role].read_end - stripes[role].read_start);
+            }
+            for (int i = 0; i < pg_minsize; i++)
+            {
+                data_ptrs[i] = stripes[dec->ids[i]].bmp_buf;
+            }
+            gf256_dotprod(tables, data_ptrs, pg_minsize, stripes[role].bmp_buf, bitmap_size);
+        }
+    }
+}
+
 int extend_missing_stripes(osd_rmw_stripe_t *stripes, osd_num_t *osd_set, int pg_minsize, int pg_size)
 {
     for (int role = 0; role < pg_minsize; role++)
@@ -507,38 +712,6 @@ static void get_old_new_buffers(osd_rmw_stripe_t & stripe, uint32_t wr_start, ui
     }
 }
 
-static void xor_multiple_buffers(buf_len_t *xor1, int n1, buf_len_t *xor2, int n2, void *dest, uint32_t len)
-{
-    assert(n1 > 0 && n2 > 0);
-    int i1 = 0, i2 = 0;
-    uint32_t start1 = 0, start2 = 0, end1 = xor1[0].len, end2 = xor2[0].len;
-    uint32_t pos = 0;
-    while (pos < len)
-    {
-        // We know for sure that ranges overlap
-        uint32_t end = std::min(end1, end2);
-        memxor(xor1[i1].buf + pos-start1, xor2[i2].buf + pos-start2, dest+pos, end-pos);
-        pos = end;
-        if (pos >= end1)
-        {
-            i1++;
-            if (i1 >= n1)
-            {
-                assert(pos >= end2);
-                return;
-            }
-            start1 = end1;
-            end1 += xor1[i1].len;
-        }
-        if (pos >= end2)
-        {
-            i2++;
-            start2 = end2;
-            end2 += xor2[i2].len;
-        }
-    }
-}
-
 static void calc_rmw_parity_copy_mod(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
     uint64_t *read_osd_set, uint64_t *write_osd_set, uint32_t chunk_size, uint32_t bitmap_granularity,
     uint32_t &start, uint32_t &end)
@@ -647,45 +820,57 @@ void calc_rmw_parity_xor(osd_rmw_stripe_t *stripes, int pg_size, uint64_t *read_
     calc_rmw_parity_copy_mod(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, bitmap_granularity, start, end);
     if (write_osd_set[pg_minsize] != 0 && end != 0)
     {
-        // Calculate new parity (XOR k+1)
-        int parity = pg_minsize, prev = -2;
-        for (int other = 0; other < pg_minsize; other++)
+        // Calculate new parity (XOR k+1) in one pass over all data chunks
+        int parity = pg_minsize;
+        buf_len_t bufs[pg_minsize][3];
+        int nbuf[pg_minsize] = { 0 }, curbuf[pg_minsize] = { 0 };
+        uint32_t positions[pg_minsize];
+        const void *data_ptrs[pg_minsize];
+        for (int i = 0; i < pg_minsize; i++)
         {
-            if (prev == -2)
+            get_old_new_buffers(stripes[i], start, end, bufs[i], nbuf[i]);
+            positions[i] = start;
+        }
+        uint32_t pos = start;
+        while (pos < end)
+        {
+            uint32_t next_end = end;
+            for (int i = 0; i < pg_minsize; i++)
             {
-                prev = other;
+                assert(curbuf[i] < nbuf[i]);
+                assert(bufs[i][curbuf[i]].buf);
+                data_ptrs[i] = bufs[i][curbuf[i]].buf + pos-positions[i];
+                uint32_t this_end = bufs[i][curbuf[i]].len + positions[i];
+                if (next_end > this_end)
+                    next_end = this_end;
             }
-            else
+            assert(next_end > pos);
+            for (int i = 0; i < pg_minsize; i++)
             {
-                int n1 = 0, n2 = 0;
-                buf_len_t xor1[3], xor2[3];
-                if (prev == -1)
-                {
-                    xor1[n1++] = { .buf = stripes[parity].write_buf, .len = end-start };
-                    memxor(stripes[parity].bmp_buf, stripes[other].bmp_buf, stripes[parity].bmp_buf, bitmap_size);
-                }
-                else
+                uint32_t this_end = bufs[i][curbuf[i]].len + positions[i];
+                if (next_end >= this_end)
                 {
-                    memxor(stripes[prev].bmp_buf, stripes[other].bmp_buf, stripes[parity].bmp_buf, bitmap_size);
-                    get_old_new_buffers(stripes[prev], start, end, xor1, n1);
-                    prev = -1;
+                    positions[i] += bufs[i][curbuf[i]].len;
+                    curbuf[i]++;
                 }
-                get_old_new_buffers(stripes[other], start, end, xor2, n2);
-                xor_multiple_buffers(xor1, n1, xor2, n2, stripes[parity].write_buf, end-start);
             }
+            memxor_n(data_ptrs, pg_minsize, stripes[parity].write_buf + pos-start, next_end-pos);
+            pos = next_end;
+        }
+        for (int i = 0; i < pg_minsize; i++)
+        {
+            data_ptrs[i] = stripes[i].bmp_buf;
         }
+        memxor_n(data_ptrs, pg_minsize, stripes[parity].bmp_buf, bitmap_size);
     }
     calc_rmw_parity_copy_parity(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, start, end);
 }
 
-void calc_rmw_parity_jerasure(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
-    uint64_t *read_osd_set, uint64_t *write_osd_set, uint32_t chunk_size, uint32_t bitmap_size)
+// Calculate all parity chunks in one pass over contiguous pieces of old and new data
+// with <encode>(data_ptrs, len), data_ptrs contains pg_size pointers
+template<typename F> static void calc_rmw_parity_coding(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
+    uint64_t *write_osd_set, uint32_t bitmap_size, uint32_t start, uint32_t end, F encode)
 {
-    uint32_t bitmap_granularity = bitmap_size > 0 ? chunk_size / bitmap_size / 8 : 0;
-    reed_sol_matrix_t *matrix = get_jerasure_matrix(pg_size, pg_minsize);
-    reconstruct_stripes_jerasure(stripes, pg_size, pg_minsize, bitmap_size);
-    uint32_t start = 0, end = 0;
-    calc_rmw_parity_copy_mod(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, bitmap_granularity, start, end);
     if (end != 0)
     {
         int i;
@@ -734,21 +919,51 @@ void calc_rmw_parity_jerasure(osd_rmw_stripe_t *stripes, int pg_size, int pg_min
                         curbuf[i]++;
                     }
                 }
-                jerasure_matrix_encode(
-                    pg_minsize, pg_size-pg_minsize, OSD_JERASURE_W, matrix->data,
-                    (char**)data_ptrs, (char**)data_ptrs+pg_minsize, next_end-pos
-                );
+                encode(data_ptrs, next_end-pos);
                 pos = next_end;
             }
             for (int i = 0; i < pg_size; i++)
             {
                 data_ptrs[i] = stripes[i].bmp_buf;
             }
-            jerasure_matrix_encode(
-                pg_minsize, pg_size-pg_minsize, OSD_JERASURE_W, matrix->data,
-                (char**)data_ptrs, (char**)data_ptrs+pg_minsize, bitmap_size
-            );
+            encode(data_ptrs, bitmap_size);
         }
     }
+}
+
+void calc_rmw_parity_jerasure(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
+    uint64_t *read_osd_set, uint64_t *write_osd_set, uint32_t chunk_size, uint32_t bitmap_size)
+{
+    uint32_t bitmap_granularity = bitmap_size > 0 ? chunk_size / bitmap_size / 8 : 0;
+    reed_sol_matrix_t *matrix = get_jerasure_matrix(pg_size, pg_minsize);
+    reconstruct_stripes_jerasure(stripes, pg_size, pg_minsize, bitmap_size);
+    uint32_t start = 0, end = 0;
+    calc_rmw_parity_copy_mod(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, bitmap_granularity, start, end);
+    calc_rmw_parity_coding(stripes, pg_size, pg_minsize, write_osd_set, bitmap_size, start, end, [&](void **data_ptrs, uint32_t len)
+    {
+        jerasure_matrix_encode(
+            pg_minsize, pg_size-pg_minsize, OSD_JERASURE_W, matrix->data,
+            (char**)data_ptrs, (char**)data_ptrs+pg_minsize, len
+        );
+    });
+    calc_rmw_parity_copy_parity(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, start, end);
+}
+
+void calc_rmw_parity_ec(osd_rmw_stripe_t *stripes, int pg_size, int pg_minsize,
+    uint64_t *read_osd_set, uint64_t *write_osd_set, uint32_t chunk_size, uint32_t bitmap_size)
+{
+    uint32_t bitmap_granularity = bitmap_size > 0 ? chunk_size / bitmap_size / 8 : 0;
+    ec_matrix_t *matrix = get_ec_matrix(pg_size, pg_minsize);
+    reconstruct_stripes_ec(stripes, pg_size, pg_minsize, bitmap_size);
+    uint32_t start = 0, end = 0;
+    calc_rmw_parity_copy_mod(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, bitmap_granularity, start, end);
+    calc_rmw_parity_coding(stripes, pg_size, pg_minsize, write_osd_set, bitmap_size, start, end, [&](void **data_ptrs, uint32_t len)
+    {
+        for (int i = pg_minsize; i < pg_size; i++)
+        {
+            gf256_dotprod(matrix->tables.data() + (i-pg_minsize)*pg_minsize*GF256_TABLE_SIZE,
+                (const void**)data_ptrs, pg_minsize, data_ptrs[i], len);
+        }
+    });
     calc_rmw_parity_copy_parity(stripes, pg_size, pg_minsize, read_osd_set, write_osd_set, chunk_size, start, end);
 }
@@ -20,6 +20,7 @@ void test11();
 void test12();
 void test13();
 void test14();
+void test15();
 
 int main(int narg, char *args[])
 {
@@ -47,6 +48,8 @@ int main(int narg, char *args[])
     test13();
     // Test 14
     test14();
+    // Test 15
+    test15();
     // End
     printf("all ok\n");
     return 0;
@@ -802,3 +805,90 @@ void test14()
     free(write_buf);
     use_jerasure(3, 2, false);
 }
+
+/***
+
+15. built-in EC 4+2 test
+   calc_rmw(offset=0, len=4*4K, osd_set=[1,2,3,4,5,6], write_set=[1,2,3,4,5,6])
+   then calc_rmw_parity_ec(), check that the first parity chunk is XOR of data chunks,
+   then simulate reads with every combination of 2 missing OSDs and check all data chunks
+
+***/
+
+void test15()
+{
+    const int bmp = 4, chunk = 4096;
+    use_ec(6, 4, true);
+    osd_num_t osd_set[6] = { 1, 2, 3, 4, 5, 6 };
+    osd_rmw_stripe_t stripes[6] = { 0 };
+    uint32_t bitmaps[6] = { 0 };
+    // Test 15.0
+    uint8_t *write_buf = (uint8_t*)malloc_or_die(4*chunk);
+    for (int i = 0; i < 4*chunk; i++)
+        write_buf[i] = rand();
+    split_stripes(4, chunk, 0, 4*chunk, stripes);
+    for (int i = 0; i < 4; i++)
+        assert(stripes[i].req_start == 0 && stripes[i].req_end == chunk);
+    // Test 15.1
+    void *rmw_buf = calc_rmw(write_buf, stripes, osd_set, 6, 4, 6, osd_set, chunk, bmp);
+    assert(rmw_buf);
+    for (int i = 0; i < 6; i++)
+    {
+        stripes[i].bmp_buf = bitmaps+i;
+        assert(stripes[i].read_end == 0);
+        assert(stripes[i].write_start == 0 && stripes[i].write_end == chunk);
+    }
+    assert(stripes[4].write_buf == rmw_buf);
+    assert(stripes[5].write_buf == rmw_buf+chunk);
+    // Test 15.2 - encode
+    calc_rmw_parity_ec(stripes, 6, 4, osd_set, osd_set, chunk, bmp);
+    for (int i = 0; i < 4; i++)
+        assert(bitmaps[i] == 0xffffffff);
+    assert(bitmaps[4] == 0); // 4 equal data bitmaps XORed
+    for (int j = 0; j < chunk; j++)
+    {
+        uint8_t x = write_buf[j] ^ write_buf[chunk+j] ^ write_buf[2*chunk+j] ^ write_buf[3*chunk+j];
+        assert(((uint8_t*)rmw_buf)[j] == x);
+    }
+    // Test 15.3 - decode with any 2 chunks missing
+    for (int a = 0; a < 6; a++)
+    {
+        for (int b = a+1; b < 6; b++)
+        {
+            osd_num_t read_osd_set[6] = { 1, 2, 3, 4, 5, 6 };
+            read_osd_set[a] = read_osd_set[b] = 0;
+            memset(stripes, 0, sizeof(stripes));
+            split_stripes(4, chunk, 0, 4*chunk, stripes);
+            for (int role = 0; role < 6; role++)
+            {
+                stripes[role].read_start = stripes[role].req_start;
+                stripes[role].read_end = stripes[role].req_end;
+            }
+            assert(extend_missing_stripes(stripes, read_osd_set, 4, 6) == 0);
+            void *read_buf = alloc_read_buffer(stripes, 6, 0);
+            assert(read_buf);
+            uint32_t read_bitmaps[6] = { 0 };
+            for (int role = 0; role < 6; role++)
+            {
+                stripes[role].bmp_buf = read_bitmaps+role;
+                if (stripes[role].read_end != 0 && !stripes[role].missing)
+                {
+                    assert(stripes[role].read_start == 0 && stripes[role].read_end == chunk);
+                    memcpy(stripes[role].read_buf, role < 4 ? write_buf+role*chunk : rmw_buf+(role-4)*chunk, chunk);
+                    read_bitmaps[role] = bitmaps[role];
+                }
+            }
+            reconstruct_stripes_ec(stripes, 6, 4, bmp);
+            for (int role = 0; role < 4; role++)
+            {
+                assert(memcmp(stripes[role].read_buf, write_buf+role*chunk, chunk) == 0);
+                assert(read_bitmaps[role] == 0xffffffff);
+            }
+            free(read_buf);
+        }
+    }
+    // Huh done
+    free(rmw_buf);
+    free(write_buf);
+    use_ec(6, 4, false);
+}
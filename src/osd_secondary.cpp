@@ -35,6 +35,7 @@ void osd_t::secondary_op_callback(osd_op_t *op)
             op->iov.push_back(op->buf, op->bs_op->retval * sizeof(obj_ver_id));
         }
         op->reply.sec_list.stable_count = op->bs_op->version;
+        op->reply.sec_list.next_oid = op->bs_op->min_oid;
     }
     int retval = op->bs_op->retval;
     delete op->bs_op;
@@ -57,7 +58,7 @@ void osd_t::exec_secondary(osd_op_t *cur_op)
                 bs->read_bitmap(ov[i].oid, ov[i].version, cur_buf + sizeof(uint64_t), (uint64_t*)cur_buf);
                 cur_buf += (8 + clean_entry_bitmap_size);
             }
-            free(cur_op->buf);
+            cur_op->free_buf();
             cur_op->buf = reply_buf;
         }
         finish_op(cur_op, n * (8 + clean_entry_bitmap_size));
@@ -86,7 +87,7 @@ void osd_t::exec_secondary(osd_op_t *cur_op)
             else
                 cur_op->bitmap = &cur_op->bmp_data;
             if (cur_op->req.sec_rw.len > 0)
-                cur_op->buf = memalign_or_die(MEM_ALIGNMENT, cur_op->req.sec_rw.len);
+                cur_op->alloc_buf(ringloop, cur_op->req.sec_rw.len);
         }
         cur_op->bs_op->oid = cur_op->req.sec_rw.oid;
         cur_op->bs_op->version = cur_op->req.sec_rw.version;
@@ -125,11 +126,21 @@ void osd_t::exec_secondary(osd_op_t *cur_op)
             secondary_op_callback(cur_op);
             return;
         }
-        cur_op->bs_op->oid.stripe = cur_op->req.sec_list.pg_stripe_size;
-        cur_op->bs_op->len = cur_op->req.sec_list.pg_count;
-        cur_op->bs_op->offset = cur_op->req.sec_list.list_pg - 1;
-        cur_op->bs_op->oid.inode = cur_op->req.sec_list.min_inode;
-        cur_op->bs_op->version = cur_op->req.sec_list.max_inode;
+        cur_op->bs_op->pg_alignment = cur_op->req.sec_list.pg_stripe_size;
+        cur_op->bs_op->pg_count = cur_op->req.sec_list.pg_count;
+        cur_op->bs_op->pg_number = cur_op->req.sec_list.list_pg - 1;
+        cur_op->bs_op->min_oid = {
+            .inode = cur_op->req.sec_list.min_inode,
+            .stripe = cur_op->req.sec_list.min_stripe,
+        };
+        if (cur_op->req.sec_list.max_inode)
+        {
+            cur_op->bs_op->max_oid = {
+                .inode = cur_op->req.sec_list.max_inode,
+                .stripe = UINT64_MAX,
+            };
+        }
+        cur_op->bs_op->list_stable_limit = cur_op->req.sec_list.stable_limit;
 #ifdef OSD_STUB
         cur_op->bs_op->retval = 0;
         cur_op->bs_op->buf = NULL;
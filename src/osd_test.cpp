@@ -214,6 +214,8 @@ uint64_t test_read(int connect_fd, uint64_t inode, uint64_t stripe, uint64_t ver
     op.sec_list.list_pg = 1;
     op.sec_list.pg_count = 1;
     op.sec_list.pg_stripe_size = 4*1024*1024;
+    op.sec_list.min_stripe = 0;
+    op.sec_list.stable_limit = 0;
     write_blocking(connect_fd, op.buf, OSD_PACKET_SIZE);
     r = read_blocking(connect_fd, reply.buf, OSD_PACKET_SIZE);
     if (reply.hdr.retval < 0 || !check_reply(r, op, reply, reply.hdr.retval))
@@ -357,6 +359,8 @@ void test_list_stab(int connect_fd)
     op.hdr.id = 1;
     op.hdr.opcode = OSD_OP_SEC_LIST;
     op.sec_list.pg_count = 0;
+    op.sec_list.min_stripe = 0;
+    op.sec_list.stable_limit = 0;
     assert(write_blocking(connect_fd, op.buf, OSD_PACKET_SIZE) == OSD_PACKET_SIZE);
     int r = read_blocking(connect_fd, reply.buf, OSD_PACKET_SIZE);
     assert(check_reply(r, op, reply, -1));
@@ -3,13 +3,41 @@
 
 #include <stdlib.h>
 
+#include <algorithm>
 #include <stdexcept>
 
+#include "malloc_or_die.h"
 #include "ringloop.h"
 
-ring_loop_t::ring_loop_t(int qd)
+// Kernel limit for a single registered buffer
+#define MAX_FIXED_BUFFER_LEN (1024*1024*1024)
+#define POOL_ALIGNMENT 4096
+// Size of the sparse registered buffer table
+#define FIXED_BUFFER_SLOTS 64
+
+ring_loop_t::ring_loop_t(int qd, int flags, unsigned sqpoll_idle_ms, int sqpoll_cpu)
 {
-    int ret = io_uring_queue_init(qd, &ring, 0);
+    io_uring_params params = { 0 };
+    if (flags & RINGLOOP_SQPOLL)
+    {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll_idle_ms ? sqpoll_idle_ms : 1000;
+        if (sqpoll_cpu >= 0)
+        {
+            params.flags |= IORING_SETUP_SQ_AFF;
+            params.sq_thread_cpu = sqpoll_cpu;
+        }
+    }
+    batch_submit = (flags & RINGLOOP_BATCH_SUBMIT) != 0;
+    if (flags & RINGLOOP_SQE128)
+    {
+#ifdef IORING_SETUP_SQE128
+        params.flags |= IORING_SETUP_SQE128;
+#else
+        throw std::runtime_error("io_uring_queue_init: 128-byte SQEs are not supported by liburing headers");
+#endif
+    }
+    int ret = io_uring_queue_init_params(qd, &ring, &params);
     if (ret < 0)
     {
         throw std::runtime_error(std::string("io_uring_queue_init: ") + strerror(-ret));
@@ -33,6 +61,158 @@ ring_loop_t::~ring_loop_t()
     free(free_ring_data);
     free(ring_datas);
     io_uring_queue_exit(&ring);
+    if (buffer_pool)
+        free(buffer_pool);
+}
+
+bool ring_loop_t::update_fixed_buffers()
+{
+    io_uring_unregister_buffers(&ring);
+    if (!fixed_bufs.size())
+        return true;
+    return io_uring_register_buffers(&ring, fixed_bufs.data(), fixed_bufs.size()) >= 0;
+}
+
+bool ring_loop_t::update_fixed_slots(int from, int to)
+{
+    return io_uring_register_buffers_update_tag(&ring, from, fixed_bufs.data()+from, NULL, to-from) >= 0;
+}
+
+void ring_loop_t::update_fixed_index()
+{
+    fixed_by_addr.clear();
+    for (int i = 0; i < fixed_bufs.size(); i++)
+    {
+        if (fixed_bufs[i].iov_base)
+            fixed_by_addr.push_back({ (uint8_t*)fixed_bufs[i].iov_base, i });
+    }
+    std::sort(fixed_by_addr.begin(), fixed_by_addr.end());
+}
+
+bool ring_loop_t::register_buffer(void *buf, size_t len)
+{
+    if (!fixed_table)
+    {
+        // Prefer a sparse table (Linux 5.19+) so that changes only update their own slots
+        fixed_table = io_uring_register_buffers_sparse(&ring, FIXED_BUFFER_SLOTS) >= 0 ? 1 : -1;
+        if (fixed_table > 0)
+            fixed_bufs.resize(FIXED_BUFFER_SLOTS, (iovec){ 0 });
+    }
+    // Large buffers are registered in parts. I/O crossing their boundaries just isn't fixed
+    std::vector<iovec> parts;
+    for (size_t pos = 0; pos < len; pos += MAX_FIXED_BUFFER_LEN)
+    {
+        parts.push_back((iovec){
+            .iov_base = (uint8_t*)buf + pos,
+            .iov_len = len-pos < MAX_FIXED_BUFFER_LEN ? len-pos : MAX_FIXED_BUFFER_LEN,
+        });
+    }
+    if (fixed_table < 0)
+    {
+        int prev_count = fixed_bufs.size();
+        fixed_bufs.insert(fixed_bufs.end(), parts.begin(), parts.end());
+        if (!update_fixed_buffers())
+        {
+            printf("Warning: failed to register %lu byte buffer in io_uring, check RLIMIT_MEMLOCK\n", len);
+            fixed_bufs.resize(prev_count);
+            update_fixed_buffers();
+            return false;
+        }
+        update_fixed_index();
+        return true;
+    }
+    // Parts of one buffer take consecutive free slots
+    int from = 0;
+    while (from + parts.size() <= fixed_bufs.size())
+    {
+        int free_count = 0;
+        while (free_count < parts.size() && !fixed_bufs[from+free_count].iov_base)
+            free_count++;
+        if (free_count == parts.size())
+            break;
+        from += free_count+1;
+    }
+    if (from + parts.size() > fixed_bufs.size())
+    {
+        printf("Warning: failed to register %lu byte buffer in io_uring, no free slots\n", len);
+        return false;
+    }
+    std::copy(parts.begin(), parts.end(), fixed_bufs.begin()+from);
+    if (!update_fixed_slots(from, from+parts.size()))
+    {
+        printf("Warning: failed to register %lu byte buffer in io_uring, check RLIMIT_MEMLOCK\n", len);
+        for (int i = 0; i < parts.size(); i++)
+            fixed_bufs[from+i] = (iovec){ 0 };
+        return false;
+    }
+    update_fixed_index();
+    return true;
+}
+
+void ring_loop_t::unregister_buffer(void *buf)
+{
+    for (int i = 0; i < fixed_bufs.size(); i++)
+    {
+        if (fixed_bufs[i].iov_base == buf)
+        {
+            // Also remove the following parts of the same buffer
+            int j = i+1;
+            while (j < fixed_bufs.size() && fixed_bufs[j].iov_base == (uint8_t*)fixed_bufs[j-1].iov_base + fixed_bufs[j-1].iov_len &&
+                fixed_bufs[j-1].iov_len == MAX_FIXED_BUFFER_LEN)
+            {
+                j++;
+            }
+            if (fixed_table > 0)
+            {
+                for (int k = i; k < j; k++)
+                    fixed_bufs[k] = (iovec){ 0 };
+                update_fixed_slots(i, j);
+            }
+            else
+            {
+                fixed_bufs.erase(fixed_bufs.begin()+i, fixed_bufs.begin()+j);
+                update_fixed_buffers();
+            }
+            update_fixed_index();
+            return;
+        }
+    }
+}
+
+void ring_loop_t::init_buffer_pool(unsigned count, size_t chunk_size)
+{
+    assert(!buffer_pool);
+    if (!count || !chunk_size)
+        return;
+    chunk_size = (chunk_size + POOL_ALIGNMENT-1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+    buffer_pool_chunk = chunk_size;
+    buffer_pool_size = count*chunk_size;
+    buffer_pool = (uint8_t*)memalign_or_die(POOL_ALIGNMENT, buffer_pool_size);
+    free_pool_chunks.reserve(count);
+    for (unsigned i = count; i > 0; i--)
+    {
+        free_pool_chunks.push_back(buffer_pool + (i-1)*chunk_size);
+    }
+    register_buffer(buffer_pool, buffer_pool_size);
+}
+
+void* ring_loop_t::alloc_buffer(size_t len)
+{
+    if (len <= buffer_pool_chunk && free_pool_chunks.size() > 0)
+    {
+        void *buf = free_pool_chunks.back();
+        free_pool_chunks.pop_back();
+        return buf;
+    }
+    return memalign_or_die(POOL_ALIGNMENT, len);
+}
+
+void ring_loop_t::free_buffer(void *buf)
+{
+    if ((uint8_t*)buf >= buffer_pool && (uint8_t*)buf < buffer_pool+buffer_pool_size)
+        free_pool_chunks.push_back(buf);
+    else
+        free(buf);
 }
 
 void ring_loop_t::register_consumer(ring_consumer_t *consumer)
@@ -58,9 +238,27 @@ void ring_loop_t::unregister_consumer(ring_consumer_t *consumer)
     }
 }
 
+int ring_loop_t::do_submit()
+{
+    // Don't make a syscall when there's nothing to submit
+    if (!io_uring_sq_ready(&ring))
+    {
+        return 0;
+    }
+    int ret = io_uring_submit(&ring);
+    stats.submits++;
+    if (ret > 0)
+    {
+        stats.sqes += ret;
+    }
+    return ret;
+}
+
 void ring_loop_t::loop()
 {
     struct io_uring_cqe *cqe;
+    stats.loops++;
+    in_loop = true;
     while (!io_uring_peek_cqe(&ring, &cqe))
     {
         struct ring_data_t *d = (struct ring_data_t*)cqe->user_data;
@@ -96,6 +294,16 @@ void ring_loop_t::loop()
             consumers[i]->loop();
         }
     } while (loop_again);
+    in_loop = false;
+    if (submit_wanted)
+    {
+        submit_wanted = false;
+        int ret = do_submit();
+        if (ret < 0)
+        {
+            throw std::runtime_error(std::string("io_uring_submit: ") + strerror(-ret));
+        }
+    }
 }
 
 unsigned ring_loop_t::save()
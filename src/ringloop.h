@@ -12,6 +12,7 @@
 #include <liburing.h>
 
 #include <string>
+#include <algorithm>
 #include <functional>
 #include <vector>
 
@@ -120,6 +121,19 @@ struct ring_consumer_t
     std::function<void(void)> loop;
 };
 
+// Use a kernel thread polling the submission queue (IORING_SETUP_SQPOLL, Linux 5.11+)
+#define RINGLOOP_SQPOLL 1
+// Defer submit() calls made by consumers until all of them run, then submit once
+#define RINGLOOP_BATCH_SUBMIT 2
+// Use 128-byte SQEs, required by some IORING_OP_URING_CMD users like ublk (Linux 5.19+).
+// get_sqe() only clears the first 64 bytes of such SQEs
+#define RINGLOOP_SQE128 4
+
+struct ring_loop_stats_t
+{
+    uint64_t loops, submits, sqes;
+};
+
 class ring_loop_t
 {
     std::vector<std::pair<int,std::function<void()>>> get_sqe_queue;
@@ -129,13 +143,71 @@ class ring_loop_t
     int wait_sqe_id;
     unsigned free_ring_data_ptr;
     bool loop_again;
+    bool batch_submit = false, in_loop = false, submit_wanted = false;
     struct io_uring ring;
+    // Buffers registered in io_uring, I/O to/from them uses READ_FIXED/WRITE_FIXED.
+    // With a sparse table (fixed_table > 0) free slots have iov_base == NULL, otherwise
+    // (fixed_table < 0, old kernels) the whole table is re-registered on every change
+    std::vector<iovec> fixed_bufs;
+    // Occupied slots of fixed_bufs sorted by address, for the lookup in prep_readv/prep_writev
+    std::vector<std::pair<uint8_t*, int>> fixed_by_addr;
+    int fixed_table = 0;
+    // Pool of registered equal-size buffers for operation data
+    uint8_t *buffer_pool = NULL;
+    size_t buffer_pool_size = 0, buffer_pool_chunk = 0;
+    std::vector<void*> free_pool_chunks;
+    bool update_fixed_buffers();
+    bool update_fixed_slots(int from, int to);
+    void update_fixed_index();
+    int do_submit();
 public:
-    ring_loop_t(int qd);
+    ring_loop_stats_t stats = { 0 };
+
+    ring_loop_t(int qd, int flags = 0, unsigned sqpoll_idle_ms = 0, int sqpoll_cpu = -1);
     ~ring_loop_t();
     void register_consumer(ring_consumer_t *consumer);
     void unregister_consumer(ring_consumer_t *consumer);
 
+    // Register a long-living buffer for fixed I/O. Returns false if the kernel refuses it
+    // (for example, because of RLIMIT_MEMLOCK), I/O to it then just isn't fixed
+    bool register_buffer(void *buf, size_t len);
+    // Must be called before freeing a registered buffer
+    void unregister_buffer(void *buf);
+    // Allocate <count> registered buffers of <chunk_size> bytes for alloc_buffer()
+    void init_buffer_pool(unsigned count, size_t chunk_size);
+    // Take a buffer from the pool or allocate it with memalign() if it doesn't fit or the pool is empty
+    void* alloc_buffer(size_t len);
+    void free_buffer(void *buf);
+
+    inline int find_fixed_buffer(const void *buf, size_t len)
+    {
+        // Registered parts never overlap, so only the last one starting before <buf> may contain it
+        auto it = std::upper_bound(fixed_by_addr.begin(), fixed_by_addr.end(), (uint8_t*)buf,
+            [](uint8_t *addr, const std::pair<uint8_t*, int> & slot) { return addr < slot.first; });
+        if (it == fixed_by_addr.begin())
+            return -1;
+        it--;
+        auto & iov = fixed_bufs[it->second];
+        return (uint8_t*)buf+len <= (uint8_t*)iov.iov_base+iov.iov_len ? it->second : -1;
+    }
+    // readv/writev which are transparently converted to READ_FIXED/WRITE_FIXED for registered buffers
+    inline void prep_readv(struct io_uring_sqe *sqe, int fd, const struct iovec *iovecs, unsigned nr_vecs, off_t offset)
+    {
+        int buf_index;
+        if (nr_vecs == 1 && (buf_index = find_fixed_buffer(iovecs[0].iov_base, iovecs[0].iov_len)) >= 0)
+            my_uring_prep_read_fixed(sqe, fd, iovecs[0].iov_base, iovecs[0].iov_len, offset, buf_index);
+        else
+            my_uring_prep_readv(sqe, fd, iovecs, nr_vecs, offset);
+    }
+    inline void prep_writev(struct io_uring_sqe *sqe, int fd, const struct iovec *iovecs, unsigned nr_vecs, off_t offset)
+    {
+        int buf_index;
+        if (nr_vecs == 1 && (buf_index = find_fixed_buffer(iovecs[0].iov_base, iovecs[0].iov_len)) >= 0)
+            my_uring_prep_write_fixed(sqe, fd, iovecs[0].iov_base, iovecs[0].iov_len, offset, buf_index);
+        else
+            my_uring_prep_writev(sqe, fd, iovecs, nr_vecs, offset);
+    }
+
     inline struct io_uring_sqe* get_sqe()
     {
         if (free_ring_data_ptr == 0)
@@ -165,7 +237,12 @@ public:
     }
     inline int submit()
     {
-        return io_uring_submit(&ring);
+        if (batch_submit && in_loop)
+        {
+            submit_wanted = true;
+            return 0;
+        }
+        return do_submit();
     }
     inline int wait()
     {
@@ -1,9 +1,14 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+// Check the allocator and measure its throughput
+// Usage: test_allocator [benchmark_blocks]
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include "allocator.h"
+#include "test_timing.h"
 
 void alloc_all(int size)
 {
@@ -39,10 +44,136 @@ void alloc_all(int size)
     delete a;
 }
 
+void alloc_hint(int size)
+{
+    allocator *a = new allocator(size);
+    // Occupy every 3rd block
+    for (int i = 0; i < size; i += 3)
+        a->set(i, true);
+    for (int i = 0; i < size; i++)
+    {
+        uint64_t x = a->find_free(i);
+        uint64_t expected = i % 3 ? i : (i+1 < size ? i+1 : 1);
+        if (x != expected)
+        {
+            printf("find_free(%d) returned %lu instead of %lu (%d)\n", i, x, expected, size);
+            exit(1);
+        }
+    }
+    // Free a 5-block extent and find it
+    for (int i = 0; i < size; i++)
+        a->set(i, true);
+    if (a->find_free_n(2, 0) != UINT64_MAX)
+    {
+        printf("extent found in a full allocator (%d)\n", size);
+        exit(1);
+    }
+    uint64_t ext = size/2;
+    for (int i = 0; i < 5 && ext+i < size; i++)
+        a->set(ext+i, false);
+    a->set(1, false);
+    a->set(3, false);
+    a->set(4, false);
+    uint64_t x = a->find_free_n(5, 0);
+    if (x != ext)
+    {
+        printf("find_free_n(5) returned %lx instead of %lx (%d)\n", x, ext, size);
+        exit(1);
+    }
+    x = a->find_free_n(5, ext+1);
+    if (x != ext)
+    {
+        printf("find_free_n(5) with wraparound returned %lx instead of %lx (%d)\n", x, ext, size);
+        exit(1);
+    }
+    x = a->find_free_n(2, ext+3);
+    if (x != ext+3)
+    {
+        printf("find_free_n(2) returned %lx instead of %lx (%d)\n", x, ext+3, size);
+        exit(1);
+    }
+    x = a->find_free_n(2, 0);
+    if (x != 3)
+    {
+        printf("find_free_n(2) returned %lx instead of 3 (%d)\n", x, size);
+        exit(1);
+    }
+    if (a->find_free_n(6, 0) != UINT64_MAX)
+    {
+        printf("too long extent found (%d)\n", size);
+        exit(1);
+    }
+    if (a->get_free_count() != 8)
+    {
+        printf("incorrect free block count: %lu instead of 8 (%d)\n", a->get_free_count(), size);
+        exit(1);
+    }
+    delete a;
+}
+
+void bench(uint64_t size)
+{
+    timespec tv_begin;
+    allocator *a = new allocator(size);
+    // Fill 90% sequentially
+    uint64_t fill = size / 10 * 9;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint64_t i = 0; i < fill; i++)
+        a->set(a->find_free(), true);
+    double t = elapsed_since(tv_begin);
+    printf("sequential fill of %lu blocks: %.2f M/s\n", fill, fill/t/1000000);
+    // Free and allocate random blocks
+    uint64_t n = 10000000;
+    uint64_t hint = 0;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        a->set(((uint64_t)rand() * RAND_MAX + rand()) % size, false);
+        hint = a->find_free(hint+1);
+        a->set(hint, true);
+    }
+    t = elapsed_since(tv_begin);
+    printf("random free + allocation with hint: %.2f M/s\n", n/t/1000000);
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint64_t i = 0; i < n; i++)
+    {
+        a->set(((uint64_t)rand() * RAND_MAX + rand()) % size, false);
+        a->set(a->find_free(), true);
+    }
+    t = elapsed_since(tv_begin);
+    printf("random free + allocation without hint: %.2f M/s\n", n/t/1000000);
+    // Free everything in 16-block extents and allocate them again
+    for (uint64_t i = 0; i < size; i++)
+        a->set(i, (i % 64) >= 16);
+    n = size/64;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    hint = 0;
+    for (uint64_t i = 0; i < n; i++)
+    {
+        hint = a->find_free_n(16, hint);
+        for (int j = 0; j < 16; j++)
+            a->set(hint+j, true);
+    }
+    t = elapsed_since(tv_begin);
+    printf("16-block extent allocation: %.2f M/s\n", n/t/1000000);
+    delete a;
+}
+
 int main(int narg, char *args[])
 {
     alloc_all(8192);
     alloc_all(8062);
     alloc_all(4096);
+    alloc_all(64*64*64+1);
+    alloc_all(50);
+    alloc_hint(20);
+    alloc_hint(64);
+    alloc_hint(65);
+    alloc_hint(4097);
+    alloc_hint(262145);
+    if (narg > 1)
+    {
+        bench(strtoull(args[1], NULL, 10));
+    }
     return 0;
 }
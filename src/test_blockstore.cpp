@@ -1,12 +1,139 @@
 // Copyright (c) Vitaliy Filippov, 2019+
 // License: VNPL-1.1 (see README.md for details)
 
+// Usage: test_blockstore
+//        test_blockstore bench_dirty_db [objects]
+//        test_blockstore bench_dirty_list [entries] [pg_count]
+
 #include <malloc.h>
-#include "blockstore.h"
+#include "blockstore_impl.h"
 #include "epoll_manager.h"
+#include "test_timing.h"
+
+// Measure dirty_db insert and lookup throughput with random 4K writes, 4 versions per object
+template<class T> void bench_dirty_map(const char *name, std::vector<object_id> & oids)
+{
+    const int versions = 4;
+    uint64_t objects = oids.size();
+    timespec tv_begin;
+    T dirty_db;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (int v = 1; v <= versions; v++)
+    {
+        for (uint64_t i = 0; i < objects; i++)
+        {
+            dirty_db.emplace((obj_ver_id){ .oid = oids[i], .version = (uint64_t)v }, (dirty_entry){
+                .state = (BS_ST_SMALL_WRITE | BS_ST_SYNCED),
+                .flags = 0,
+                .location = i << 12,
+                .offset = 0,
+                .len = 4096,
+                .journal_sector = 0,
+                .bitmap = NULL,
+            });
+        }
+    }
+    double t = elapsed_since(tv_begin);
+    printf("%s insert: %.2f M/s (%lu entries)\n", name, objects*versions/t/1000000, dirty_db.size());
+    // Same lookup as in dequeue_read(): find the last version and walk back through all versions
+    uint64_t found = 0;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint64_t i = 0; i < objects; i++)
+    {
+        object_id & oid = oids[rand() % objects];
+        auto dirty_it = dirty_db.upper_bound((obj_ver_id){ .oid = oid, .version = UINT64_MAX });
+        while (dirty_it != dirty_db.begin())
+        {
+            dirty_it--;
+            if (dirty_it->first.oid != oid)
+                break;
+            found += dirty_it->second.len;
+        }
+    }
+    t = elapsed_since(tv_begin);
+    printf("%s lookup: %.2f M/s (%lu bytes found)\n", name, objects/t/1000000, found);
+    // Erase all versions of each object like the flusher does
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint64_t i = 0; i < objects; i++)
+    {
+        auto dirty_start = dirty_db.lower_bound((obj_ver_id){ .oid = oids[i], .version = 0 });
+        auto dirty_end = dirty_db.upper_bound((obj_ver_id){ .oid = oids[i], .version = UINT64_MAX });
+        dirty_db.erase(dirty_start, dirty_end);
+    }
+    t = elapsed_since(tv_begin);
+    printf("%s erase: %.2f M/s objects\n", name, objects/t/1000000);
+}
+
+void bench_dirty_db(uint64_t objects)
+{
+    std::vector<object_id> oids;
+    for (uint64_t i = 0; i < objects; i++)
+    {
+        oids.push_back((object_id){ .inode = 1 + (uint64_t)rand() % 16, .stripe = ((uint64_t)rand() * RAND_MAX + rand()) << 17 });
+    }
+    bench_dirty_map<blockstore_dirty_db_t>("btree_map", oids);
+    // std::map is the previous dirty_db implementation, for comparison
+    bench_dirty_map<std::map<obj_ver_id, dirty_entry>>("std::map", oids);
+}
+
+// Compare listing of one PG from a single dirty_db filtered by PG with listing of a per-PG dirty_db
+void bench_dirty_list(uint64_t entries, uint32_t pg_count)
+{
+    const uint64_t pg_stripe_size = 4*1024*1024;
+    uint64_t pool_start = (uint64_t)1 << (64-POOL_ID_BITS);
+    blockstore_dirty_db_t dirty_db;
+    std::map<uint32_t, blockstore_dirty_db_t> pg_dirty_db;
+    for (uint64_t i = 0; i < entries; i++)
+    {
+        obj_ver_id ov = {
+            .oid = { .inode = pool_start | (1 + (uint64_t)rand() % 16), .stripe = ((uint64_t)rand() * RAND_MAX + rand()) << 17 },
+            .version = 1,
+        };
+        dirty_entry de = { .state = (BS_ST_SMALL_WRITE | BS_ST_SYNCED), .len = 4096 };
+        dirty_db.emplace(ov, de);
+        pg_dirty_db[(ov.oid.stripe / pg_stripe_size) % pg_count].emplace(ov, de);
+    }
+    obj_ver_id min_ov = { .oid = { .inode = pool_start }, .version = 0 };
+    obj_ver_id max_ov = { .oid = { .inode = 2*pool_start-1, .stripe = UINT64_MAX }, .version = UINT64_MAX };
+    uint64_t found = 0;
+    timespec tv_begin;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint32_t pg = 0; pg < pg_count; pg++)
+    {
+        auto dirty_end = dirty_db.upper_bound(max_ov);
+        for (auto dirty_it = dirty_db.lower_bound(min_ov); dirty_it != dirty_end; dirty_it++)
+        {
+            if ((dirty_it->first.oid.stripe / pg_stripe_size) % pg_count == pg)
+                found++;
+        }
+    }
+    double t = elapsed_since(tv_begin);
+    printf("single dirty_db: %.3f ms per PG (%lu entries found)\n", t*1000/pg_count, found);
+    found = 0;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    for (uint32_t pg = 0; pg < pg_count; pg++)
+    {
+        auto & shard = pg_dirty_db[pg];
+        auto dirty_end = shard.upper_bound(max_ov);
+        for (auto dirty_it = shard.lower_bound(min_ov); dirty_it != dirty_end; dirty_it++)
+            found++;
+    }
+    t = elapsed_since(tv_begin);
+    printf("per-PG dirty_db: %.3f ms per PG (%lu entries found)\n", t*1000/pg_count, found);
+}
 
 int main(int narg, char *args[])
 {
+    if (narg > 1 && !strcmp(args[1], "bench_dirty_db"))
+    {
+        bench_dirty_db(narg > 2 ? strtoull(args[2], NULL, 10) : 1000000);
+        return 0;
+    }
+    if (narg > 1 && !strcmp(args[1], "bench_dirty_list"))
+    {
+        bench_dirty_list(narg > 2 ? strtoull(args[2], NULL, 10) : 65536, narg > 3 ? strtoul(args[3], NULL, 10) : 256);
+        return 0;
+    }
     blockstore_config_t config;
     config["meta_device"] = "./test_meta.bin";
     config["journal_device"] = "./test_journal.bin";
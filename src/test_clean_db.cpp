@@ -0,0 +1,143 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#define BLOCKSTORE_COMPACT_CLEAN_DB
+
+#include <assert.h>
+#include <stdio.h>
+#include "blockstore_impl.h"
+
+#define META_BLOCK_SIZE 4096
+#define ENTRY_SIZE 32
+#define BLOCK_ORDER 17
+
+// Metadata area with 1024 entries, version of the entry N is N+1000
+static uint8_t* make_meta(clean_db_meta_t & meta)
+{
+    uint8_t *buf = (uint8_t*)calloc(1024/(META_BLOCK_SIZE/ENTRY_SIZE), META_BLOCK_SIZE);
+    meta.buffer = buf;
+    meta.meta_block_size = META_BLOCK_SIZE;
+    meta.clean_entry_size = ENTRY_SIZE;
+    meta.block_order = BLOCK_ORDER;
+    for (uint64_t block = 0; block < 1024; block++)
+    {
+        clean_disk_entry *e = (clean_disk_entry*)(buf + block*ENTRY_SIZE);
+        e->version = block+1000;
+    }
+    return buf;
+}
+
+static void set_block(blockstore_clean_db_t & db, inode_t inode, uint64_t stripe, uint64_t block)
+{
+    db[(object_id){ .inode = inode, .stripe = stripe }] = (clean_entry){
+        .version = block+1000,
+        .location = block << BLOCK_ORDER,
+    };
+}
+
+static void check_entry(blockstore_clean_db_t::iterator it, inode_t inode, uint64_t stripe, uint64_t block)
+{
+    assert(it->first.inode == inode && it->first.stripe == stripe);
+    assert(it->second.location == block << BLOCK_ORDER);
+    assert(it->second.version == block+1000);
+}
+
+void test_iterate()
+{
+    printf("test_iterate\n");
+    clean_db_meta_t meta;
+    uint8_t *buf = make_meta(meta);
+    blockstore_clean_db_t db;
+    db.meta = &meta;
+    assert(db.begin() == db.end());
+    set_block(db, 2, 0x20000, 5);
+    set_block(db, 1, 0x40000, 3);
+    set_block(db, 1, 0x0, 1);
+    set_block(db, 3, 0x0, 7);
+    assert(db.size() == 4);
+    // Overwriting only changes the location
+    set_block(db, 1, 0x0, 2);
+    assert(db.size() == 4);
+    auto it = db.begin();
+    check_entry(it++, 1, 0x0, 2);
+    check_entry(it++, 1, 0x40000, 3);
+    check_entry(it++, 2, 0x20000, 5);
+    check_entry(it++, 3, 0x0, 7);
+    assert(it == db.end());
+    check_entry(db.find((object_id){ .inode = 2, .stripe = 0x20000 }), 2, 0x20000, 5);
+    assert(db.find((object_id){ .inode = 2, .stripe = 0 }) == db.end());
+    assert(db.find((object_id){ .inode = 4, .stripe = 0 }) == db.end());
+    // The version is always taken from the metadata area
+    ((clean_disk_entry*)(buf + 5*ENTRY_SIZE))->version = 1;
+    assert(db.find((object_id){ .inode = 2, .stripe = 0x20000 })->second.version == 1);
+    free(buf);
+    printf("OK\n");
+}
+
+void test_bounds()
+{
+    printf("test_bounds\n");
+    clean_db_meta_t meta;
+    uint8_t *buf = make_meta(meta);
+    blockstore_clean_db_t db;
+    db.meta = &meta;
+    set_block(db, 1, 0x0, 1);
+    set_block(db, 1, 0x40000, 3);
+    set_block(db, 3, 0x20000, 7);
+    // Exact matches
+    check_entry(db.lower_bound((object_id){ .inode = 1, .stripe = 0x40000 }), 1, 0x40000, 3);
+    check_entry(db.upper_bound((object_id){ .inode = 1, .stripe = 0x0 }), 1, 0x40000, 3);
+    // Between stripes of one inode
+    check_entry(db.lower_bound((object_id){ .inode = 1, .stripe = 0x20000 }), 1, 0x40000, 3);
+    check_entry(db.upper_bound((object_id){ .inode = 1, .stripe = 0x20000 }), 1, 0x40000, 3);
+    // After the last stripe of an inode: move to the next inode
+    check_entry(db.lower_bound((object_id){ .inode = 1, .stripe = 0x60000 }), 3, 0x20000, 7);
+    check_entry(db.upper_bound((object_id){ .inode = 1, .stripe = 0x40000 }), 3, 0x20000, 7);
+    // Missing inode
+    check_entry(db.lower_bound((object_id){ .inode = 2, .stripe = 0x60000 }), 3, 0x20000, 7);
+    check_entry(db.upper_bound((object_id){ .inode = 2, .stripe = 0 }), 3, 0x20000, 7);
+    check_entry(db.lower_bound((object_id){ .inode = 0, .stripe = UINT64_MAX }), 1, 0x0, 1);
+    // After everything
+    assert(db.lower_bound((object_id){ .inode = 3, .stripe = 0x20001 }) == db.end());
+    assert(db.upper_bound((object_id){ .inode = 3, .stripe = 0x20000 }) == db.end());
+    assert(db.lower_bound((object_id){ .inode = 4, .stripe = 0 }) == db.end());
+    free(buf);
+    printf("OK\n");
+}
+
+void test_erase()
+{
+    printf("test_erase\n");
+    clean_db_meta_t meta;
+    uint8_t *buf = make_meta(meta);
+    blockstore_clean_db_t db;
+    db.meta = &meta;
+    set_block(db, 1, 0x0, 1);
+    set_block(db, 1, 0x20000, 2);
+    set_block(db, 2, 0x0, 3);
+    set_block(db, 3, 0x0, 4);
+    db.erase(db.find((object_id){ .inode = 1, .stripe = 0x20000 }));
+    assert(db.size() == 3);
+    assert(db.find((object_id){ .inode = 1, .stripe = 0x20000 }) == db.end());
+    // Erasing the last stripe of an inode removes the inode
+    db.erase(db.find((object_id){ .inode = 2, .stripe = 0x0 }));
+    assert(db.size() == 2);
+    auto it = db.begin();
+    check_entry(it++, 1, 0x0, 1);
+    check_entry(it++, 3, 0x0, 4);
+    assert(it == db.end());
+    check_entry(db.lower_bound((object_id){ .inode = 2, .stripe = 0 }), 3, 0x0, 4);
+    db.erase(db.begin());
+    db.erase(db.begin());
+    assert(db.size() == 0 && db.begin() == db.end());
+    free(buf);
+    printf("OK\n");
+}
+
+int main(int narg, char *args[])
+{
+    test_iterate();
+    test_bounds();
+    test_erase();
+    return 0;
+}
@@ -47,11 +47,11 @@ void configure_single_pg_pool(cluster_client_t *cli)
     cli->st_cli.on_change_hook(changes);
 }
 
-int *test_write(cluster_client_t *cli, uint64_t offset, uint64_t len, uint8_t c, std::function<void()> cb = NULL)
+int *test_write(cluster_client_t *cli, uint64_t offset, uint64_t len, uint8_t c, std::function<void()> cb = NULL, bool complete_now = false)
 {
     printf("Post write %lx+%lx\n", offset, len);
     int *r = new int;
-    *r = -1;
+    *r = complete_now ? -2 : -1;
     cluster_op_t *op = new cluster_op_t();
     op->opcode = OSD_OP_WRITE;
     op->inode = 0x1000000000001;
@@ -75,6 +75,57 @@ int *test_write(cluster_client_t *cli, uint64_t offset, uint64_t len, uint8_t c,
     return r;
 }
 
+int *test_read(cluster_client_t *cli, uint64_t offset, uint64_t len, std::function<void(cluster_op_t*)> check, bool complete_now = false)
+{
+    printf("Post read %lx+%lx\n", offset, len);
+    int *r = new int;
+    *r = complete_now ? -2 : -1;
+    cluster_op_t *op = new cluster_op_t();
+    op->opcode = OSD_OP_READ;
+    op->inode = 0x1000000000001;
+    op->offset = offset;
+    op->len = len;
+    op->iov.push_back(malloc_or_die(len), len);
+    memset(op->iov.buf[0].iov_base, 0, len);
+    op->callback = [r, check](cluster_op_t *op)
+    {
+        if (*r == -1)
+            printf("Error: Not allowed to complete yet\n");
+        assert(*r != -1);
+        *r = op->retval == op->len ? 1 : 0;
+        printf("Done read %lx+%lx r=%d\n", op->offset, op->len, op->retval);
+        check(op);
+        free(op->iov.buf[0].iov_base);
+        delete op;
+    };
+    cli->execute(op);
+    return r;
+}
+
+void check_bytes(cluster_op_t *op, uint64_t offset, uint64_t len, uint8_t c)
+{
+    for (uint64_t i = 0; i < len; i++)
+    {
+        assert(((uint8_t*)op->iov.buf[0].iov_base)[offset-op->offset+i] == c);
+    }
+}
+
+// Check bytes of an OSD operation by their offset in the request
+void check_iov_bytes(osd_op_t *op, uint64_t offset, uint64_t len, uint8_t c)
+{
+    assert(op);
+    uint64_t pos = 0;
+    for (int i = 0; i < op->iov.count; i++)
+    {
+        for (uint64_t j = 0; j < op->iov.buf[i].iov_len; j++, pos++)
+        {
+            if (pos >= offset && pos < offset+len)
+                assert(((uint8_t*)op->iov.buf[i].iov_base)[j] == c);
+        }
+    }
+    assert(pos >= offset+len);
+}
+
 int *test_sync(cluster_client_t *cli)
 {
     printf("Post sync\n");
@@ -399,9 +450,179 @@ void test2()
     printf("[ok] copy_write test\n");
 }
 
+void test_writeback()
+{
+    json11::Json config = json11::Json::object {
+        { "client_enable_writeback", true },
+        { "client_max_buffered_bytes", 0x4000 },
+    };
+    timerfd_manager_t *tfd = new timerfd_manager_t([](int fd, bool wr, std::function<void(int, int)> callback){});
+    cluster_client_t *cli = new cluster_client_t(NULL, tfd, config);
+
+    configure_single_pg_pool(cli);
+    pretend_connected(cli, 1);
+    cli->continue_ops(true);
+
+    // Writes complete without OSD round trips
+    check_completed(test_write(cli, 0, 0x1000, 0x55, NULL, true));
+    check_completed(test_write(cli, 0x1000, 0x1000, 0x56, NULL, true));
+    check_op_count(cli, 1, 0);
+
+    // Fully cached read is served from memory and returns a bitmap
+    check_completed(test_read(cli, 0, 0x2000, [](cluster_op_t *op)
+    {
+        check_bytes(op, 0, 0x1000, 0x55);
+        check_bytes(op, 0x1000, 0x1000, 0x56);
+        assert(op->bitmap_buf && *(uint8_t*)op->bitmap_buf == 0x3);
+    }, true));
+    check_op_count(cli, 1, 0);
+
+    // Partially cached read goes to the OSD, cached data is put over the result
+    int *r1 = test_read(cli, 0x1000, 0x2000, [](cluster_op_t *op)
+    {
+        check_bytes(op, 0x1000, 0x1000, 0x56);
+        check_bytes(op, 0x2000, 0x1000, 0);
+    });
+    check_op_count(cli, 1, 1);
+    can_complete(r1);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_READ, 0x1000, 0x2000), 0);
+    check_completed(r1);
+
+    // SYNC flushes adjacent buffers with one write
+    int *r2 = test_sync(cli);
+    check_op_count(cli, 1, 1);
+    // Writes are buffered during the flush
+    check_completed(test_write(cli, 0, 0x1000, 0x57, NULL, true));
+    check_completed(test_read(cli, 0, 0x2000, [](cluster_op_t *op)
+    {
+        check_bytes(op, 0, 0x1000, 0x57);
+        check_bytes(op, 0x1000, 0x1000, 0x56);
+    }, true));
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_WRITE, 0, 0x2000), 0);
+    check_op_count(cli, 1, 1);
+    can_complete(r2);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_SYNC, 0, 0), 0);
+    check_completed(r2);
+
+    // The next SYNC only flushes the new write
+    r2 = test_sync(cli);
+    check_op_count(cli, 1, 1);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_WRITE, 0, 0x1000), 0);
+    can_complete(r2);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_SYNC, 0, 0), 0);
+    check_completed(r2);
+    check_op_count(cli, 1, 0);
+
+    // Overwrites of buffered data don't take more cache space, so 0x3000 bytes
+    // are below the 0x4000 limit and nothing is flushed
+    check_completed(test_write(cli, 0, 0x2000, 0x58, NULL, true));
+    check_completed(test_write(cli, 0x1000, 0x2000, 0x59, NULL, true));
+    check_op_count(cli, 1, 0);
+
+    // Failed flush is reported to the SYNC, but the data stays in the cache
+    r2 = test_sync(cli);
+    check_op_count(cli, 1, 1);
+    check_completed(test_write(cli, 0x2000, 0x1000, 0x5a, NULL, true));
+    can_complete(r2);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_WRITE, 0, 0x3000), -ENOSPC);
+    assert(*r2 == 0);
+    delete r2;
+    pretend_connected(cli, 1);
+    cli->continue_ops(true);
+    // Unsynced writes are replayed after reconnecting as usual
+    check_op_count(cli, 1, 1);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_WRITE, 0, 0x3000), 0);
+    check_op_count(cli, 1, 0);
+    check_completed(test_read(cli, 0, 0x3000, [](cluster_op_t *op)
+    {
+        check_bytes(op, 0, 0x1000, 0x58);
+        check_bytes(op, 0x1000, 0x1000, 0x59);
+        check_bytes(op, 0x2000, 0x1000, 0x5a);
+    }, true));
+
+    // The failed data is written again with the next flush
+    check_completed(test_write(cli, 0x3000, 0x1000, 0x5b, NULL, true));
+    check_op_count(cli, 1, 1);
+    osd_op_t *retry = find_op(cli, 1, OSD_OP_WRITE, 0, 0x4000);
+    check_iov_bytes(retry, 0, 0x1000, 0x58);
+    check_iov_bytes(retry, 0x1000, 0x1000, 0x59);
+    check_iov_bytes(retry, 0x2000, 0x1000, 0x5a);
+    check_iov_bytes(retry, 0x3000, 0x1000, 0x5b);
+    pretend_op_completed(cli, retry, 0);
+    check_op_count(cli, 1, 0);
+
+    delete cli;
+    delete tfd;
+    printf("[ok] write-back cache test\n");
+}
+
+void test_copy()
+{
+    json11::Json config = json11::Json::object { { "client_max_dirty_ops", 1024 } };
+    timerfd_manager_t *tfd = new timerfd_manager_t([](int fd, bool wr, std::function<void(int, int)> callback){});
+    cluster_client_t *cli = new cluster_client_t(NULL, tfd, config);
+
+    configure_single_pg_pool(cli);
+    pretend_connected(cli, 1);
+    cli->continue_ops(true);
+
+    // COPY is sliced by objects like a write, but without data
+    int *r = new int;
+    *r = -1;
+    cluster_op_t *op = new cluster_op_t();
+    op->opcode = OSD_OP_COPY;
+    op->inode = 0x1000000000001;
+    op->offset = 0x1000;
+    op->len = 0x20000;
+    op->callback = [r](cluster_op_t *op)
+    {
+        assert(*r != -1);
+        *r = op->retval;
+        delete op;
+    };
+    cli->execute(op);
+    check_op_count(cli, 1, 2);
+    osd_op_t *part = find_op(cli, 1, OSD_OP_COPY, 0x1000, 0x1f000);
+    assert(part && part->iov.count == 0);
+    pretend_op_completed(cli, part, 0);
+    can_complete(r);
+    // -EXDEV means that the OSD can't copy it and isn't a reason to drop the connection
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_COPY, 0x20000, 0x1000), -EXDEV);
+    assert(*r == -EXDEV);
+    delete r;
+    check_op_count(cli, 1, 0);
+
+    // Older OSDs reject the unknown opcode with -EINVAL, the connection is kept too
+    r = new int;
+    *r = -1;
+    op = new cluster_op_t();
+    op->opcode = OSD_OP_COPY;
+    op->inode = 0x1000000000001;
+    op->offset = 0;
+    op->len = 0x1000;
+    op->callback = [r](cluster_op_t *op)
+    {
+        assert(*r != -1);
+        *r = op->retval;
+        delete op;
+    };
+    cli->execute(op);
+    can_complete(r);
+    pretend_op_completed(cli, find_op(cli, 1, OSD_OP_COPY, 0, 0x1000), -EINVAL);
+    assert(*r == -EINVAL);
+    delete r;
+    check_op_count(cli, 1, 0);
+
+    delete cli;
+    delete tfd;
+    printf("[ok] copy test\n");
+}
+
 int main(int narg, char *args[])
 {
     test1();
     test2();
+    test_writeback();
+    test_copy();
     return 0;
 }
@@ -0,0 +1,29 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#include <assert.h>
+#include <stdio.h>
+#include "blockstore_impl.h"
+
+void test_meta_batch_ready()
+{
+    printf("test_meta_batch_ready\n");
+    // The only active flusher writes its batch even if there are idle flushers
+    // and objects in the queue which can't be flushed yet
+    assert(flusher_meta_batch_ready(false, 1, 1, 10));
+    // Another active flusher may join the batch
+    assert(!flusher_meta_batch_ready(false, 1, 2, 10));
+    // ...unless it already waits for a batch or fsync
+    assert(flusher_meta_batch_ready(false, 2, 2, 10));
+    // Nothing more to flush
+    assert(flusher_meta_batch_ready(false, 1, 2, 0));
+    // No metadata fsyncs: write immediately
+    assert(flusher_meta_batch_ready(true, 1, 4, 10));
+    printf("OK\n");
+}
+
+int main(int narg, char *args[])
+{
+    test_meta_batch_ready();
+    return 0;
+}
@@ -0,0 +1,14 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+
+#pragma once
+
+#include <time.h>
+
+// Seconds elapsed since <tv_begin>, for benchmarks in tests
+static inline double elapsed_since(timespec & tv_begin)
+{
+    timespec tv_end;
+    clock_gettime(CLOCK_REALTIME, &tv_end);
+    return (tv_end.tv_sec - tv_begin.tv_sec) + (tv_end.tv_nsec - tv_begin.tv_nsec) / 1000000000.0;
+}
@@ -0,0 +1,173 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+// Check all XOR and GF(2^8) dot product kernels supported by the CPU against the generic ones and measure their speed
+// Usage: test_xor [chunk_size]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <time.h>
+#include <functional>
+#include "xor.h"
+#include "gf256.h"
+
+#define MAX_SOURCES 8
+
+// memxor_n and GF(2^8) dot product kernels, with the dot product coefficients bound
+struct test_kernel_t
+{
+    const char *name;
+    std::function<void(const void **srcs, int n, void *dst, unsigned len)> fn;
+    // XOR kernels may write the result in place of the first source
+    bool in_place;
+};
+
+static void check_kernel(const test_kernel_t & kernel, const test_kernel_t & generic, uint8_t **bufs, uint8_t *res, uint8_t *expected)
+{
+    for (int n = 1; n <= MAX_SOURCES; n++)
+    {
+        for (unsigned len = 0; len < 1100; len += 1 + len/8)
+        {
+            for (unsigned offset = 0; offset < 64; offset += 7)
+            {
+                const void *srcs[MAX_SOURCES];
+                for (int i = 0; i < n; i++)
+                    srcs[i] = bufs[i] + offset + i;
+                generic.fn(srcs, n, expected, len);
+                memset(res, 0xcc, len+1);
+                kernel.fn(srcs, n, res, len);
+                if (memcmp(res, expected, len) != 0 || res[len] != 0xcc)
+                {
+                    printf("%s: mismatch with n=%d len=%u offset=%u\n", kernel.name, n, len, offset);
+                    exit(1);
+                }
+                if (!kernel.in_place)
+                    continue;
+                // Result in place of the first source
+                memcpy(res, srcs[0], len);
+                srcs[0] = res;
+                kernel.fn(srcs, n, res, len);
+                if (memcmp(res, expected, len) != 0)
+                {
+                    printf("%s: in-place mismatch with n=%d len=%u offset=%u\n", kernel.name, n, len, offset);
+                    exit(1);
+                }
+            }
+        }
+    }
+}
+
+static double bench_kernel(const test_kernel_t & kernel, uint8_t **bufs, int n, uint8_t *res, unsigned len)
+{
+    timespec tv_begin, tv_end;
+    const void *srcs[MAX_SOURCES];
+    for (int i = 0; i < n; i++)
+        srcs[i] = bufs[i];
+    uint64_t bytes = 0;
+    double elapsed = 0;
+    clock_gettime(CLOCK_REALTIME, &tv_begin);
+    while (elapsed < 0.2)
+    {
+        for (int i = 0; i < 20; i++)
+            kernel.fn(srcs, n, res, len);
+        bytes += (uint64_t)20*n*len;
+        clock_gettime(CLOCK_REALTIME, &tv_end);
+        elapsed = (tv_end.tv_sec - tv_begin.tv_sec) + (tv_end.tv_nsec - tv_begin.tv_nsec) / 1000000000.0;
+    }
+    return bytes / elapsed / 1024 / 1024 / 1024;
+}
+
+static void check_gf256(uint8_t *coefs, uint8_t *tables, uint8_t **bufs, uint8_t *res)
+{
+    // Check field arithmetic
+    for (int a = 1; a < 256; a++)
+    {
+        if (gf256_mul(a, gf256_inv(a)) != 1)
+        {
+            printf("gf256_inv(%d) is incorrect\n", a);
+            exit(1);
+        }
+    }
+    // Check the generic kernel itself, other kernels are compared with it
+    auto kernels = gf256_get_kernels();
+    const void *srcs[MAX_SOURCES];
+    for (int i = 0; i < MAX_SOURCES; i++)
+        srcs[i] = bufs[i];
+    kernels[kernels.size()-1].fn(tables, srcs, MAX_SOURCES, res, 256);
+    for (int j = 0; j < 256; j++)
+    {
+        uint8_t v = 0;
+        for (int i = 0; i < MAX_SOURCES; i++)
+            v ^= gf256_mul(coefs[i], bufs[i][j]);
+        if (res[j] != v)
+        {
+            printf("gf256 generic: incorrect result\n");
+            exit(1);
+        }
+    }
+}
+
+static void test_kernels(std::vector<test_kernel_t> & kernels, const char *what, uint8_t **bufs, uint8_t *res, uint8_t *expected, unsigned chunk_size)
+{
+    auto & generic = kernels[kernels.size()-1];
+    for (auto & kernel: kernels)
+    {
+        check_kernel(kernel, generic, bufs, res, expected);
+    }
+    printf("%s: %u byte chunks, GB/s of source data (selected kernel: %s)\n", what, chunk_size, kernels[0].name);
+    for (auto & kernel: kernels)
+    {
+        printf("%-8s", kernel.name);
+        for (int n = 2; n <= MAX_SOURCES; n *= 2)
+        {
+            printf("  n=%d: %6.2f", n, bench_kernel(kernel, bufs, n, res, chunk_size));
+        }
+        printf("\n");
+    }
+}
+
+int main(int narg, char *args[])
+{
+    unsigned chunk_size = narg > 1 ? atoi(args[1]) : 128*1024;
+    if (chunk_size < 2048)
+        chunk_size = 2048;
+    uint8_t *bufs[MAX_SOURCES];
+    for (int i = 0; i < MAX_SOURCES; i++)
+    {
+        bufs[i] = (uint8_t*)memalign(4096, chunk_size);
+        for (unsigned j = 0; j < chunk_size; j++)
+            bufs[i][j] = rand();
+    }
+    uint8_t *res = (uint8_t*)memalign(4096, chunk_size);
+    uint8_t *expected = (uint8_t*)memalign(4096, chunk_size);
+    std::vector<test_kernel_t> kernels;
+    for (auto & kernel: memxor_get_kernels())
+    {
+        kernels.push_back((test_kernel_t){ .name = kernel.name, .fn = kernel.fn, .in_place = true });
+    }
+    test_kernels(kernels, "XOR", bufs, res, expected, chunk_size);
+    uint8_t coefs[MAX_SOURCES];
+    uint8_t tables[MAX_SOURCES*GF256_TABLE_SIZE];
+    for (int i = 0; i < MAX_SOURCES; i++)
+        coefs[i] = rand() | 1;
+    gf256_init_tables(coefs, MAX_SOURCES, tables);
+    check_gf256(coefs, tables, bufs, res);
+    kernels.clear();
+    for (auto & kernel: gf256_get_kernels())
+    {
+        auto fn = kernel.fn;
+        kernels.push_back((test_kernel_t){
+            .name = kernel.name,
+            .fn = [fn, &tables](const void **srcs, int n, void *dst, unsigned len) { fn(tables, srcs, n, dst, len); },
+            .in_place = false,
+        });
+    }
+    test_kernels(kernels, "GF(2^8) dot product", bufs, res, expected, chunk_size);
+    for (int i = 0; i < MAX_SOURCES; i++)
+        free(bufs[i]);
+    free(res);
+    free(expected);
+    return 0;
+}
@@ -0,0 +1,722 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 (see README.md for details)
+// Userspace block device based on ublk (Linux 6.0+), a faster alternative to vitastor-nbd.
+// There's no socket between the kernel and the proxy: requests are fetched and completed
+// with io_uring commands, and the kernel copies data directly between bios and per-tag
+// buffers which are then sent to OSDs as is.
+
+#include <linux/ublk_cmd.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "epoll_manager.h"
+#include "cluster_client.h"
+
+#define UBLK_CONTROL_DEV "/dev/ublk-control"
+
+// Linux 6.4+ headers define ioctl-encoded commands, legacy ones may be disabled in the kernel
+#ifdef UBLK_U_CMD_ADD_DEV
+#define UBLK_CTRL_OP(op) UBLK_U_CMD_##op
+#define UBLK_IO_OP(op) UBLK_U_IO_##op
+#else
+#define UBLK_CTRL_OP(op) UBLK_CMD_##op
+#define UBLK_IO_OP(op) UBLK_IO_##op
+#endif
+
+// Size of the command area of a 128-byte SQE
+#define UBLK_SQE_CMD_SIZE 80
+
+const char *exe_name = NULL;
+
+struct ublk_io_cmd_t
+{
+    uint16_t tag;
+    uint32_t cmd_op;
+    int32_t result;
+};
+
+struct ublk_queue_t
+{
+    int q_id = 0;
+    // request descriptors shared with the kernel, indexed by tag
+    ublksrv_io_desc *io_descs = NULL;
+    size_t io_descs_size = 0;
+    // data buffers of all tags, queue_depth * max_io_size
+    void *bufs = NULL;
+    // number of tags waiting for requests or being handled, i.e. not aborted yet
+    int active = 0;
+    // FETCH and COMMIT_AND_FETCH commands not submitted yet because the ring was full
+    std::vector<ublk_io_cmd_t> pending;
+};
+
+static void ublk_prep_cmd(io_uring_sqe *sqe, int fd, uint32_t cmd_op, const void *cmd, size_t cmd_len)
+{
+    sqe->opcode = IORING_OP_URING_CMD;
+    sqe->fd = fd;
+    sqe->cmd_op = cmd_op;
+    memset(sqe->cmd, 0, UBLK_SQE_CMD_SIZE);
+    memcpy(sqe->cmd, cmd, cmd_len);
+}
+
+class ublk_proxy
+{
+protected:
+    std::string image_name;
+    uint64_t inode = 0;
+    uint64_t device_size = 0;
+    inode_watch_t *watch = NULL;
+
+    ring_loop_t *ringloop = NULL;
+    epoll_manager_t *epmgr = NULL;
+    cluster_client_t *cli = NULL;
+    ring_consumer_t consumer;
+
+    int ctrl_fd = -1, char_fd = -1;
+    uint32_t dev_id = -1;
+    int queue_count = 1, queue_depth = 128;
+    uint32_t max_io_size = 256*1024;
+    std::vector<ublk_queue_t*> queues;
+
+public:
+    static json11::Json::object parse_args(int narg, const char *args[])
+    {
+        json11::Json::object cfg;
+        int pos = 0;
+        for (int i = 1; i < narg; i++)
+        {
+            if (!strcmp(args[i], "-h") || !strcmp(args[i], "--help"))
+            {
+                help();
+            }
+            else if (args[i][0] == '-' && args[i][1] == '-')
+            {
+                const char *opt = args[i]+2;
+                cfg[opt] = !strcmp(opt, "json") || i == narg-1 ? "1" : args[++i];
+            }
+            else if (pos == 0)
+            {
+                cfg["command"] = args[i];
+                pos++;
+            }
+            else if (pos == 1 && (cfg["command"] == "map" || cfg["command"] == "unmap"))
+            {
+                int n = 0;
+                if (sscanf(args[i], "/dev/ublkb%d", &n) > 0)
+                    cfg["dev_num"] = n;
+                else
+                    cfg["dev_num"] = args[i];
+                pos++;
+            }
+        }
+        return cfg;
+    }
+
+    void exec(json11::Json cfg)
+    {
+        if (cfg["command"] == "map")
+        {
+            start(cfg);
+        }
+        else if (cfg["command"] == "unmap")
+        {
+            if (cfg["dev_num"].is_null())
+            {
+                fprintf(stderr, "device name or number is missing\n");
+                exit(1);
+            }
+            unmap(cfg["dev_num"].uint64_value());
+        }
+        else if (cfg["command"] == "ls" || cfg["command"] == "list" || cfg["command"] == "list-mapped")
+        {
+            auto mapped = list_mapped();
+            print_mapped(mapped, !cfg["json"].is_null());
+        }
+        else
+        {
+            help();
+        }
+    }
+
+    static void help()
+    {
+        printf(
+            "Vitastor ublk proxy\n"
+            "(c) Vitaliy Filippov, 2020-2021 (VNPL-1.1)\n\n"
+            "USAGE:\n"
+            "  %s map [--etcd_address <etcd_address>] (--image <image> | --pool <pool> --inode <inode> --size <size in bytes>)\n"
+            "      [--ublk_queues 1] [--ublk_queue_depth 128] [--ublk_max_io 262144]\n"
+            "  %s unmap /dev/ublkb0\n"
+            "  %s ls [--json]\n"
+            "\n"
+            "  --ublk_queues N       Number of kernel queues of the device\n"
+            "  --ublk_queue_depth N  Maximum number of requests in each queue\n"
+            "  --ublk_max_io N       Maximum request size in bytes, every request slot takes a buffer of this size\n"
+            "\n"
+            "Requires Linux 6.0+ with the ublk_drv module.\n",
+            exe_name, exe_name, exe_name
+        );
+        exit(0);
+    }
+
+    void unmap(int dev_num)
+    {
+        // Stopping the device aborts all requests of the serving process,
+        // and it then removes the device itself
+        open_control();
+        ringloop = new ring_loop_t(16, RINGLOOP_SQE128);
+        int r = ctrl_cmd(UBLK_CTRL_OP(STOP_DEV), dev_num, NULL, 0);
+        if (r < 0)
+        {
+            fprintf(stderr, "UBLK_CMD_STOP_DEV: %s\n", strerror(-r));
+            exit(1);
+        }
+        delete ringloop;
+        close(ctrl_fd);
+    }
+
+    void start(json11::Json cfg)
+    {
+        // Check options
+        if (cfg["image"].string_value() != "")
+        {
+            // Use image name
+            image_name = cfg["image"].string_value();
+            inode = 0;
+        }
+        else
+        {
+            // Use pool, inode number and size
+            if (!cfg["size"].uint64_value())
+            {
+                fprintf(stderr, "device size is missing\n");
+                exit(1);
+            }
+            device_size = cfg["size"].uint64_value();
+            inode = cfg["inode"].uint64_value();
+            uint64_t pool = cfg["pool"].uint64_value();
+            if (pool)
+            {
+                inode = (inode & ((1l << (64-POOL_ID_BITS)) - 1)) | (pool << (64-POOL_ID_BITS));
+            }
+            if (!(inode >> (64-POOL_ID_BITS)))
+            {
+                fprintf(stderr, "pool is missing\n");
+                exit(1);
+            }
+        }
+        if (!cfg["ublk_queues"].is_null())
+            queue_count = cfg["ublk_queues"].uint64_value();
+        if (!cfg["ublk_queue_depth"].is_null())
+            queue_depth = cfg["ublk_queue_depth"].uint64_value();
+        if (!cfg["ublk_max_io"].is_null())
+            max_io_size = cfg["ublk_max_io"].uint64_value();
+        if (queue_count < 1 || queue_count > 64 || queue_depth < 1 || queue_depth > UBLK_MAX_QUEUE_DEPTH ||
+            queue_count*queue_depth > 16384)
+        {
+            fprintf(stderr, "ublk_queues must be between 1 and 64, ublk_queue_depth between 1 and %d,"
+                " and there may be at most 16384 request slots in total\n", UBLK_MAX_QUEUE_DEPTH);
+            exit(1);
+        }
+        if (max_io_size < 4096 || (max_io_size % 4096))
+        {
+            fprintf(stderr, "ublk_max_io must be a multiple of 4096\n");
+            exit(1);
+        }
+        open_control();
+        // The process which fetches requests must also serve them, so daemonize before everything else
+        bool bg = cfg["foreground"].is_null();
+        int ready_fd = -1;
+        if (bg)
+        {
+            ready_fd = fork_daemon();
+        }
+        // Create client. Every request slot permanently occupies one SQE completion in the ring
+        ringloop = new ring_loop_t(512 + queue_count*queue_depth, RINGLOOP_SQE128);
+        epmgr = new epoll_manager_t(ringloop);
+        cli = new cluster_client_t(ringloop, epmgr->tfd, cfg);
+        if (!inode)
+        {
+            // Load image metadata
+            while (!cli->is_ready())
+            {
+                ringloop->loop();
+                if (cli->is_ready())
+                    break;
+                ringloop->wait();
+            }
+            watch = cli->st_cli.watch_inode(image_name);
+            device_size = watch->cfg.size;
+        }
+        consumer.loop = [this]()
+        {
+            for (auto q: queues)
+            {
+                submit_pending(q);
+            }
+            ringloop->submit();
+        };
+        ringloop->register_consumer(&consumer);
+        // Initialize ublk
+        add_device(cfg["dev_num"].is_null() ? -1 : cfg["dev_num"].uint64_value());
+        for (int i = 0; i < queue_count; i++)
+        {
+            init_queue(i);
+        }
+        ringloop->submit();
+        // START_DEV waits until all request slots are fetched, and the kernel
+        // may already read the device (partition table) before it returns
+        int r = ctrl_cmd(UBLK_CTRL_OP(START_DEV), dev_id, NULL, 0, getpid());
+        if (r < 0)
+        {
+            fprintf(stderr, "UBLK_CMD_START_DEV: %s\n", strerror(-r));
+            ctrl_cmd(UBLK_CTRL_OP(DEL_DEV), dev_id, NULL, 0);
+            exit(1);
+        }
+        std::string dev_name = "/dev/ublkb"+std::to_string(dev_id)+"\n";
+        if (ready_fd >= 0)
+        {
+            write(ready_fd, dev_name.c_str(), dev_name.size());
+            close(ready_fd);
+            finish_daemonize();
+        }
+        else
+        {
+            printf("%s", dev_name.c_str());
+        }
+        // Serve requests until the device is stopped
+        while (true)
+        {
+            int active = 0;
+            for (auto q: queues)
+                active += q->active;
+            if (!active)
+                break;
+            ringloop->loop();
+            ringloop->wait();
+        }
+        bool stop = false;
+        cluster_op_t *close_sync = new cluster_op_t;
+        close_sync->opcode = OSD_OP_SYNC;
+        close_sync->callback = [this, &stop](cluster_op_t *op)
+        {
+            stop = true;
+            delete op;
+        };
+        cli->execute(close_sync);
+        while (!stop)
+        {
+            ringloop->loop();
+            ringloop->wait();
+        }
+        for (auto q: queues)
+        {
+            munmap(q->io_descs, q->io_descs_size);
+            free(q->bufs);
+            delete q;
+        }
+        queues.clear();
+        close(char_fd);
+        r = ctrl_cmd(UBLK_CTRL_OP(DEL_DEV), dev_id, NULL, 0);
+        if (r < 0)
+        {
+            fprintf(stderr, "UBLK_CMD_DEL_DEV: %s\n", strerror(-r));
+        }
+        close(ctrl_fd);
+        ringloop->unregister_consumer(&consumer);
+        delete cli;
+        delete epmgr;
+        delete ringloop;
+    }
+
+    json11::Json::object list_mapped()
+    {
+        const char *self_filename = exe_name;
+        for (int i = 0; exe_name[i] != 0; i++)
+        {
+            if (exe_name[i] == '/')
+                self_filename = exe_name+i+1;
+        }
+        json11::Json::object mapped;
+        DIR *dir = opendir("/dev");
+        if (!dir)
+        {
+            perror("opendir /dev");
+            exit(1);
+        }
+        open_control();
+        ringloop = new ring_loop_t(16, RINGLOOP_SQE128);
+        dirent *ent;
+        while ((ent = readdir(dir)) != NULL)
+        {
+            int dev_num = 0;
+            char suffix = 0;
+            if (sscanf(ent->d_name, "ublkc%d%c", &dev_num, &suffix) != 1)
+                continue;
+            ublksrv_ctrl_dev_info info = { 0 };
+            if (ctrl_cmd(UBLK_CTRL_OP(GET_DEV_INFO), dev_num, &info, sizeof(info)) < 0 || info.ublksrv_pid <= 0)
+                continue;
+            char path[64] = { 0 };
+            sprintf(path, "/proc/%d/cmdline", info.ublksrv_pid);
+            std::string cmdline = read_file(path);
+            std::vector<const char*> argv;
+            int last = 0;
+            for (int i = 0; i < cmdline.size(); i++)
+            {
+                if (cmdline[i] == 0)
+                {
+                    argv.push_back(cmdline.c_str()+last);
+                    last = i+1;
+                }
+            }
+            if (argv.size() > 0)
+            {
+                const char *pid_filename = argv[0];
+                for (int i = 0; argv[0][i] != 0; i++)
+                {
+                    if (argv[0][i] == '/')
+                        pid_filename = argv[0]+i+1;
+                }
+                if (!strcmp(pid_filename, self_filename))
+                {
+                    json11::Json::object cfg = ublk_proxy::parse_args(argv.size(), argv.data());
+                    if (cfg["command"] == "map")
+                    {
+                        cfg.erase("command");
+                        cfg["pid"] = info.ublksrv_pid;
+                        mapped["/dev/ublkb"+std::to_string(dev_num)] = cfg;
+                    }
+                }
+            }
+        }
+        closedir(dir);
+        delete ringloop;
+        ringloop = NULL;
+        close(ctrl_fd);
+        return mapped;
+    }
+
+    void print_mapped(json11::Json mapped, bool json)
+    {
+        if (json)
+        {
+            printf("%s\n", mapped.dump().c_str());
+        }
+        else
+        {
+            for (auto & dev: mapped.object_items())
+            {
+                printf("%s\n", dev.first.c_str());
+                for (auto & k: dev.second.object_items())
+                {
+                    printf("%s: %s\n", k.first.c_str(), k.second.as_string().c_str());
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    std::string read_file(char *path)
+    {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                return "";
+            auto err = "open "+std::string(path);
+            perror(err.c_str());
+            exit(1);
+        }
+        std::string r;
+        while (true)
+        {
+            int l = r.size();
+            r.resize(l + 1024);
+            int rd = read(fd, (void*)(r.c_str() + l), 1024);
+            if (rd <= 0)
+            {
+                r.resize(l);
+                break;
+            }
+            r.resize(l + rd);
+        }
+        close(fd);
+        return r;
+    }
+
+protected:
+    void open_control()
+    {
+        if (access("/sys/module/ublk_drv", F_OK) != 0)
+        {
+            int r;
+            if ((r = system("modprobe ublk_drv")) != 0)
+            {
+                if (r < 0)
+                    perror("Failed to load ublk_drv kernel module");
+                else
+                    fprintf(stderr, "Failed to load ublk_drv kernel module\n");
+                exit(1);
+            }
+        }
+        ctrl_fd = open(UBLK_CONTROL_DEV, O_RDWR);
+        if (ctrl_fd < 0)
+        {
+            perror("open " UBLK_CONTROL_DEV);
+            exit(1);
+        }
+    }
+
+    // Fork and return the pipe to report the device name to the parent,
+    // which prints it and exits when the device is ready
+    int fork_daemon()
+    {
+        int ready_pipe[2];
+        if (pipe(ready_pipe) < 0)
+        {
+            perror("pipe");
+            exit(1);
+        }
+        if (fork())
+        {
+            close(ready_pipe[1]);
+            std::string name;
+            char buf[64];
+            int r;
+            while ((r = read(ready_pipe[0], buf, sizeof(buf))) > 0)
+            {
+                name.append(buf, r);
+            }
+            // Empty output means that the daemon failed and already printed an error
+            printf("%s", name.c_str());
+            exit(name == "" ? 1 : 0);
+        }
+        close(ready_pipe[0]);
+        setsid();
+        if (fork())
+            exit(0);
+        return ready_pipe[1];
+    }
+
+    void finish_daemonize()
+    {
+        chdir("/");
+        close(0);
+        close(1);
+        close(2);
+        open("/dev/null", O_RDONLY);
+        open("/dev/null", O_WRONLY);
+        open("/dev/null", O_WRONLY);
+    }
+
+    // Execute a control command and wait for the result
+    int ctrl_cmd(uint32_t cmd_op, uint32_t dev_id, void *addr, uint16_t len, uint64_t data0 = 0)
+    {
+        ublksrv_ctrl_cmd cmd = {
+            .dev_id = dev_id,
+            .queue_id = (uint16_t)-1,
+            .len = len,
+            .addr = (uint64_t)addr,
+            .data = { data0 },
+        };
+        io_uring_sqe *sqe = ringloop->get_sqe();
+        if (!sqe)
+        {
+            fprintf(stderr, "io_uring is full\n");
+            exit(1);
+        }
+        int res = 0;
+        bool done = false;
+        ring_data_t *data = ((ring_data_t*)sqe->user_data);
+        data->callback = [&](ring_data_t *data)
+        {
+            res = data->res;
+            done = true;
+        };
+        ublk_prep_cmd(sqe, ctrl_fd, cmd_op, &cmd, sizeof(cmd));
+        ringloop->submit();
+        while (!done)
+        {
+            ringloop->loop();
+            if (done)
+                break;
+            ringloop->wait();
+        }
+        return res;
+    }
+
+    void add_device(int64_t req_dev_id)
+    {
+        ublksrv_ctrl_dev_info info = {
+            .nr_hw_queues = (uint16_t)queue_count,
+            .queue_depth = (uint16_t)queue_depth,
+            .max_io_buf_bytes = max_io_size,
+            .dev_id = (uint32_t)req_dev_id,
+            .ublksrv_pid = getpid(),
+        };
+        int r = ctrl_cmd(UBLK_CTRL_OP(ADD_DEV), info.dev_id, &info, sizeof(info));
+        if (r < 0)
+        {
+            fprintf(stderr, "UBLK_CMD_ADD_DEV: %s\n", strerror(-r));
+            exit(1);
+        }
+        dev_id = info.dev_id;
+        ublk_params params = {
+            .len = sizeof(ublk_params),
+            .types = UBLK_PARAM_TYPE_BASIC,
+            .basic = {
+                // Flushes are required to make writes durable
+                .attrs = (uint32_t)(UBLK_ATTR_VOLATILE_CACHE | (watch && watch->cfg.readonly ? UBLK_ATTR_READ_ONLY : 0)),
+                .logical_bs_shift = 12,
+                .physical_bs_shift = 12,
+                .io_opt_shift = 12,
+                .io_min_shift = 12,
+                .max_sectors = max_io_size >> 9,
+                .dev_sectors = device_size >> 9,
+            },
+        };
+        r = ctrl_cmd(UBLK_CTRL_OP(SET_PARAMS), dev_id, &params, sizeof(params));
+        if (r < 0)
+        {
+            fprintf(stderr, "UBLK_CMD_SET_PARAMS: %s\n", strerror(-r));
+            ctrl_cmd(UBLK_CTRL_OP(DEL_DEV), dev_id, NULL, 0);
+            exit(1);
+        }
+        // The character device is created by udev, wait for it a bit
+        std::string char_path = "/dev/ublkc"+std::to_string(dev_id);
+        for (int i = 0; i < 100; i++)
+        {
+            char_fd = open(char_path.c_str(), O_RDWR);
+            if (char_fd >= 0 || errno != ENOENT)
+                break;
+            usleep(10000);
+        }
+        if (char_fd < 0)
+        {
+            perror(("open "+char_path).c_str());
+            ctrl_cmd(UBLK_CTRL_OP(DEL_DEV), dev_id, NULL, 0);
+            exit(1);
+        }
+    }
+
+    void init_queue(int q_id)
+    {
+        ublk_queue_t *q = new ublk_queue_t;
+        q->q_id = q_id;
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        q->io_descs_size = (queue_depth*sizeof(ublksrv_io_desc) + page_size-1) / page_size * page_size;
+        off_t desc_offset = UBLKSRV_CMD_BUF_OFFSET +
+            q_id * ((UBLK_MAX_QUEUE_DEPTH*sizeof(ublksrv_io_desc) + page_size-1) / page_size * page_size);
+        q->io_descs = (ublksrv_io_desc*)mmap(NULL, q->io_descs_size, PROT_READ, MAP_SHARED|MAP_POPULATE, char_fd, desc_offset);
+        if (q->io_descs == MAP_FAILED)
+        {
+            perror("mmap ublk request descriptors");
+            ctrl_cmd(UBLK_CTRL_OP(DEL_DEV), dev_id, NULL, 0);
+            exit(1);
+        }
+        q->bufs = memalign_or_die(MEM_ALIGNMENT, (uint64_t)queue_depth*max_io_size);
+        for (int tag = 0; tag < queue_depth; tag++)
+        {
+            q->pending.push_back((ublk_io_cmd_t){ .tag = (uint16_t)tag, .cmd_op = UBLK_IO_OP(FETCH_REQ) });
+        }
+        q->active = queue_depth;
+        queues.push_back(q);
+        submit_pending(q);
+    }
+
+    void submit_pending(ublk_queue_t *q)
+    {
+        int done = 0;
+        for (; done < q->pending.size(); done++)
+        {
+            io_uring_sqe *sqe = ringloop->get_sqe();
+            if (!sqe)
+            {
+                break;
+            }
+            auto & pc = q->pending[done];
+            ublksrv_io_cmd cmd = {
+                .q_id = (uint16_t)q->q_id,
+                .tag = pc.tag,
+                .result = pc.result,
+                .addr = (uint64_t)(q->bufs + (uint64_t)pc.tag*max_io_size),
+            };
+            ring_data_t *data = ((ring_data_t*)sqe->user_data);
+            int tag = pc.tag;
+            data->callback = [this, q, tag](ring_data_t *data) { handle_io_cmd(q, tag, data->res); };
+            ublk_prep_cmd(sqe, char_fd, pc.cmd_op, &cmd, sizeof(cmd));
+        }
+        if (done > 0)
+        {
+            q->pending.erase(q->pending.begin(), q->pending.begin()+done);
+        }
+    }
+
+    // FETCH or COMMIT_AND_FETCH completed: a new request arrived or the device is being stopped
+    void handle_io_cmd(ublk_queue_t *q, int tag, int res)
+    {
+        if (res != UBLK_IO_RES_OK)
+        {
+            if (res != UBLK_IO_RES_ABORT)
+            {
+                fprintf(stderr, "ublk queue %d tag %d failed: %s\n", q->q_id, tag, strerror(-res));
+            }
+            q->active--;
+            return;
+        }
+        const ublksrv_io_desc *iod = &q->io_descs[tag];
+        int ublk_op = ublksrv_get_op(iod);
+        if (ublk_op != UBLK_IO_OP_READ && ublk_op != UBLK_IO_OP_WRITE && ublk_op != UBLK_IO_OP_FLUSH)
+        {
+            commit(q, tag, -EOPNOTSUPP);
+            return;
+        }
+        if (ublk_op == UBLK_IO_OP_WRITE && watch && watch->cfg.readonly)
+        {
+            commit(q, tag, -EROFS);
+            return;
+        }
+        cluster_op_t *op = new cluster_op_t;
+        if (ublk_op == UBLK_IO_OP_FLUSH)
+        {
+            op->opcode = OSD_OP_SYNC;
+        }
+        else
+        {
+            op->opcode = ublk_op == UBLK_IO_OP_READ ? OSD_OP_READ : OSD_OP_WRITE;
+            op->inode = inode ? inode : watch->cfg.num;
+            op->offset = iod->start_sector << 9;
+            op->len = (uint64_t)iod->nr_sectors << 9;
+            // The kernel copies data to/from the buffer of the tag itself
+            op->iov.push_back(q->bufs + (uint64_t)tag*max_io_size, op->len);
+        }
+        op->callback = [this, q, tag](cluster_op_t *op)
+        {
+            int retval = op->retval;
+            delete op;
+            commit(q, tag, retval);
+        };
+        cli->execute(op);
+    }
+
+    void commit(ublk_queue_t *q, int tag, int result)
+    {
+        q->pending.push_back((ublk_io_cmd_t){
+            .tag = (uint16_t)tag,
+            .cmd_op = UBLK_IO_OP(COMMIT_AND_FETCH_REQ),
+            .result = result,
+        });
+        ringloop->wakeup();
+    }
+};
+
+int main(int narg, const char *args[])
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    setvbuf(stderr, NULL, _IONBF, 0);
+    exe_name = args[0];
+    ublk_proxy *p = new ublk_proxy();
+    p->exec(ublk_proxy::parse_args(narg, args));
+    return 0;
+}
@@ -0,0 +1,101 @@
+// Copyright (c) Vitaliy Filippov, 2019+
+// License: VNPL-1.1 or GNU GPL-2.0+ (see README.md for details)
+
+#include "xor.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XOR_X86
+#endif
+
+// XOR the remaining part of buffers starting with <pos>
+static inline void memxor_n_tail(const void **srcs, int n, void *dest, unsigned int pos, unsigned int len)
+{
+    for (; pos+8 <= len; pos += 8)
+    {
+        uint64_t v = *(uint64_t*)((uint8_t*)srcs[0] + pos);
+        for (int j = 1; j < n; j++)
+            v ^= *(uint64_t*)((uint8_t*)srcs[j] + pos);
+        *(uint64_t*)((uint8_t*)dest + pos) = v;
+    }
+    for (; pos < len; pos++)
+    {
+        uint8_t v = ((uint8_t*)srcs[0])[pos];
+        for (int j = 1; j < n; j++)
+            v ^= ((uint8_t*)srcs[j])[pos];
+        ((uint8_t*)dest)[pos] = v;
+    }
+}
+
+static void memxor_n_generic(const void **srcs, int n, void *dest, unsigned int len)
+{
+    memxor_n_tail(srcs, n, dest, 0, len);
+}
+
+#ifdef XOR_X86
+
+// Process 4 vectors at a time, reading each source only once
+#define MEMXOR_N_VECTOR(name, target_spec, vec_t, load, store, vxor)\
+__attribute__((target(target_spec))) static void name(const void **srcs, int n, void *dest, unsigned int len)\
+{\
+    const unsigned int sz = sizeof(vec_t);\
+    unsigned int pos = 0;\
+    for (; pos+4*sz <= len; pos += 4*sz)\
+    {\
+        const uint8_t *s = (const uint8_t*)srcs[0] + pos;\
+        vec_t v0 = load(s), v1 = load(s+sz), v2 = load(s+2*sz), v3 = load(s+3*sz);\
+        for (int j = 1; j < n; j++)\
+        {\
+            s = (const uint8_t*)srcs[j] + pos;\
+            v0 = vxor(v0, load(s));\
+            v1 = vxor(v1, load(s+sz));\
+            v2 = vxor(v2, load(s+2*sz));\
+            v3 = vxor(v3, load(s+3*sz));\
+        }\
+        uint8_t *d = (uint8_t*)dest + pos;\
+        store(d, v0);\
+        store(d+sz, v1);\
+        store(d+2*sz, v2);\
+        store(d+3*sz, v3);\
+    }\
+    memxor_n_tail(srcs, n, dest, pos, len);\
+}
+
+#define SSE2_LOAD(p) _mm_loadu_si128((const __m128i*)(p))
+#define SSE2_STORE(p, v) _mm_storeu_si128((__m128i*)(p), v)
+#define AVX2_LOAD(p) _mm256_loadu_si256((const __m256i*)(p))
+#define AVX2_STORE(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+#define AVX512_LOAD(p) _mm512_loadu_si512((const void*)(p))
+#define AVX512_STORE(p, v) _mm512_storeu_si512((void*)(p), v)
+
+MEMXOR_N_VECTOR(memxor_n_sse2, "sse2", __m128i, SSE2_LOAD, SSE2_STORE, _mm_xor_si128)
+MEMXOR_N_VECTOR(memxor_n_avx2, "avx2", __m256i, AVX2_LOAD, AVX2_STORE, _mm256_xor_si256)
+MEMXOR_N_VECTOR(memxor_n_avx512, "avx512f", __m512i, AVX512_LOAD, AVX512_STORE, _mm512_xor_si512)
+
+#endif
+
+std::vector<memxor_kernel_t> memxor_get_kernels()
+{
+    std::vector<memxor_kernel_t> kernels;
+#ifdef XOR_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        kernels.push_back({ .name = "avx512", .fn = memxor_n_avx512 });
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back({ .name = "avx2", .fn = memxor_n_avx2 });
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back({ .name = "sse2", .fn = memxor_n_sse2 });
+#endif
+    kernels.push_back({ .name = "generic", .fn = memxor_n_generic });
+    return kernels;
+}
+
+// Select the best kernel on the first call. It doesn't depend on static initialization order
+// and it's safe to race here because all threads select the same kernel
+static void memxor_n_select(const void **srcs, int n, void *dest, unsigned int len)
+{
+    memxor_n = memxor_get_kernels()[0].fn;
+    memxor_n(srcs, n, dest, len);
+}
+
+memxor_n_t memxor_n = memxor_n_select;
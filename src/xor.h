@@ -5,11 +5,25 @@
 
 #include <stdint.h>
 
+#include <vector>
+
+// XOR <n> source buffers into <dest> in one pass. <dest> may be one of the sources.
+// The implementation is selected at runtime depending on the CPU (AVX-512, AVX2, SSE2 or generic)
+typedef void (*memxor_n_t)(const void **srcs, int n, void *dest, unsigned int len);
+
+extern memxor_n_t memxor_n;
+
+struct memxor_kernel_t
+{
+    const char *name;
+    memxor_n_t fn;
+};
+
+// All kernels supported by the current CPU, the best one comes first
+std::vector<memxor_kernel_t> memxor_get_kernels();
+
 inline void memxor(const void *r1, const void *r2, void *res, unsigned int len)
 {
-    unsigned int i;
-    for (i = 0; i < len; ++i)
-    {
-        ((uint8_t*)res)[i] = ((uint8_t*)r1)[i] ^ ((uint8_t*)r2)[i];
-    }
+    const void *srcs[2] = { r1, r2 };
+    memxor_n(srcs, 2, res, len);
 }